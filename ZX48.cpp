@@ -35,7 +35,99 @@
    Set SPI_FREQUENCY to 39000000 for best performance.
 
    Games should be uploaded into SPIFFS as 48K .z80 snapshots (v1,v2,v3)
-   You can create such snapshots using ZXSPIN emulator
+   or as 128K .z80 snapshots (v2,v3). You can create such snapshots using ZXSPIN emulator
+
+   128K snapshots only keep three 16K banks in RAM, the rest are kept packed in heap,
+   so games with lots of data in all eight banks may not fit. The 128K editor ROM is not
+   included, put it into rom/rom128.h as rom128[] and define ZX_ROM128 to use it,
+   otherwise the 48K BASIC ROM is shown in both ROM slots
+
+   Define ZX_PAGED_RAM to keep the emulated RAM in 4K pages swapped to the free sketch
+   flash space instead, only ZX_PAGED_RAM_FRAMES pages are kept in heap. This fits 128K
+   snapshots of any size and lets you trade heap for speed. Page size can be set by
+   ZX_PAGED_RAM_SHIFT from 10 (1K) to 12 (4K). Do not use it with OTA updates running.
+   Pages are written back in turn to all sectors of the free space, 4K / page size pages
+   to a sector between erases, and at most one sector is erased every two frames unless
+   no clean page is left to drop. With 1M of free space that wears the flash out after
+   about 12 days of play at the erase limit, and after about 6 days (4K pages) to 24 days
+   (1K pages) for a game that writes a page back every frame; see zxvmem.hpp.
+
+   Define ZX_CONTENTION to emulate ULA memory and I/O contention, needed for exact timing
+   of multicolour and border effects. It costs some speed, without it the contention
+   callbacks compile to plain T-state counting.
+
+   The overlay in the top left corner shows the rendered frames per second and how busy
+   the emulator is, LFT+ACT hides it. Define ZX_TELEMETRY_SERIAL to send the frame time
+   counters over the serial port twice a second, see zxtelemetry.hpp for the format, and
+   read them with tools/zxtelemetry.py.
+
+   Define ZX_PROFILER to count executed instructions by 256 byte PC bucket and by opcode.
+   Send p over the serial port to get the profile, r to start it again, and read it with
+   tools/zxprof.py.
+
+   Define ZX_TRACE to keep the last ZX_TRACE_SIZE executed instructions with their bytes,
+   AF and frame T-state. Send t over the serial port to get them disassembled, LFT+DOWN
+   writes them to /trace.txt in SPIFFS, and so does a HALT with interrupts disabled,
+   the usual way a crashed game stops.
+
+   Define ZX_DEBUG for execution breakpoints and read/write watchpoints, driven by the
+   GDB remote protocol over the serial port, e.g. target remote /dev/ttyUSB0 from a gdb
+   built for z80. The single letter serial commands above still work alongside it, do
+   not use it with ZX_TELEMETRY_SERIAL.
+
+   Define ZX_SELFCHECK to check the Z80 flag table variant compiled in (see the
+   ZYMOSIS_FLAGS_IN_ options in zymosis.hpp) and time the core on one emulated second of
+   the ROM start-up before the file browser. The result is shown and sent over serial.
+   The host tests in tests/ run every flag variant through ZEXDOC/ZEXALL and the FUSE
+   test vectors, see tests/CMakeLists.txt.
+
+   Define ZX_FRAME_CHECK to keep a checksum of the picture the renderer sent to the LCD,
+   send f over the serial port to get it with the SPI transactions and bytes since the
+   last f. Turn the overlay off first, it is not part of the sum.
+   tests/render.cpp runs the renderer on the host with a model of the LCD and compares
+   the pictures of a few scenes in every display mode with tests/golden/frames.txt.
+
+   Define ZX_IDLE_SKIP to find the short loops games spin in while waiting for a key or
+   the next frame, and run them to the interrupt at once, see zxidle.hpp. With
+   ZX_CONTENTION only loops after the last contended line are skipped, and nothing is
+   skipped with ZX_PROFILER, ZX_TRACE or a ZX_DEBUG breakpoint set. The skips are counted
+   in the telemetry, and a game can turn it off in its .cfg file.
+
+   Define ZX_BLOCK_CACHE to keep runs of decoded Z80 instructions, so the core does not
+   fetch their opcode and operand bytes through the memory callbacks every time. Writes
+   and paging drop the blocks they touch. Send c over the serial port to get the hit and
+   miss counts. ZX_DEBUG read watchpoints do not see operands taken from the cache.
+
+   Define ZX_LAZY_FLAGS to let the Z80 core keep the operands of ADD, ADC, SUB, SBC, CP,
+   INC and DEC and work out the flags only when an instruction reads them, most results
+   are overwritten first. The operands are kept for the whole frame, only IN, OUT and the
+   end of the frame work them out. ZX_SELFCHECK compares it with the plain flag code. It is not
+   used with ZX_IDLE_SKIP or ZX_TRACE, which look at F before every instruction.
+
+   Define ZX_FUSION to run LD A,(HL)+INC HL, LD (DE),A+INC DE, the DEC BC+LD A,B+OR C+JR NZ
+   loop test and DJNZ $ delays as single steps of the Z80 core. Send u over the serial port
+   to get how often each one ran. It is not used with ZX_CONTENTION, ZX_DEBUG, ZX_PROFILER,
+   ZX_TRACE or ZX_IDLE_SKIP, which need to see every instruction.
+
+   Define ZX_IRAM_CORE to run the Z80 main loop, with the memory callbacks inlined into
+   it, and the row blend of the renderer from IRAM instead of through the 32K flash cache.
+   ED and IX/IY instructions are left in flash. IRAM is shared with sound_ISR and the
+   SDK, run tools/zxiram.py on the linker map of the build to see what each function
+   takes. The ZX_SELFCHECK policy bench is left out, each policy would need its own copy.
+
+   Scaled screen updates are spread over frames, ZX_RENDER_BUDGET sets the microseconds
+   a frame may spend drawing its oldest changed lines, 0 draws all of them at once.
+
+   Define ZX_SCANLINE to render attribute and border changes made while the beam is
+   drawing the frame on the lines they appear on, as multicolour and border effects need.
+   Up to ZX_SCANLINE_EVENTS mid-frame attribute writes are kept per frame, frames without
+   them render as usual.
+
+   LFT+ESC switches between the scaled screen, the screen stretched to the whole LCD
+   without the border and a 1:1 viewport. The viewport follows
+   the screen area the game draws to, or can be panned with RGT and the pad, RGT+ACT
+   makes it follow the game again. It uses the ST7735 vertical scrolling, set
+   LCD_ROW_OFFSET if your panel does not start at frame memory row 1.
 
    You can also put a 6912 byte screen with the exact same name to be displayed before game
 
@@ -47,19 +139,55 @@
 
    The order of characters is UP,DOWN,LEFT,RIGHT,ACT,ESC,LFT,RGT
    for example: QAOPM_0$
+   The layout may be followed by options separated by spaces, noidle turns ZX_IDLE_SKIP off
+   for the game, e.g. QAOPM_0$ noidle
 
    I.e. a game file set may look like:
 
    game.z80 - snapshot
    game.scr - splash screen in native ZX Spectrum format
+   game.pal - optional palette, 16 RRGGBB hex colours and the panel gamma, e.g. 2.2
 */
 
+#if defined(ZX_BLOCK_CACHE)
+#define ZYMOSIS_BLOCK_CACHE
+#endif
+
+//ZX_IRAM_CORE: the Z80 main loop with the memory callbacks inlined into it and the row blend
+//of the renderer run from IRAM, ED and IX/IY instructions stay in flash
+
+#if defined(ZX_IRAM_CORE)
+#define ZYMOSIS_HOT ICACHE_RAM_ATTR __attribute__((noinline))
+#define ZYMOSIS_COLD __attribute__((noinline))
+#define ZX_HOT ICACHE_RAM_ATTR __attribute__((noinline))
+#endif
+
 #include "zymosis.hpp"
 
+#if !defined(ZX_IRAM_CORE)
+#define ZX_HOT ZYMOSIS_INLINE
+#endif
+#include "zxbanks.hpp"
+#include "zxvmem.hpp"
+#include "zxcontention.hpp"
+#include "zxscanlog.hpp"
+#include "zxtelemetry.hpp"
+#include "zxprofiler.hpp"
+#include "zxdisasm.hpp"
+#include "zxtrace.hpp"
+#include "zxdebug.hpp"
+#include "zxframecheck.hpp"
+#include "zxidle.hpp"
+
 #include "glcdfont.c"
 #include "gfx/espboy.h"
 #include "gfx/keyboard.h"
 #include "rom/rom.h"
+#if defined(ZX_ROM128)
+#include "rom/rom128.h"
+#else
+#define rom128 rom
+#endif
 
 #define MCP23017address 0 // actually it's 0x20 but in <Adafruit_MCP23017.h> lib there is (x|0x20) :)
 #define MCP4725address 0x60
@@ -90,9 +218,41 @@ uint8_t keybModuleExist;
 
 uint16_t line_buffer[128];
 
+ZXTelemetry telemetry;
+
+#if defined(ZX_PROFILER)
+ZXProfiler profiler;
+#endif
+#if defined(ZX_TRACE)
+#ifndef ZX_TRACE_SIZE
+#define ZX_TRACE_SIZE 256 //instructions, a power of two, 12 bytes each
+#endif
+ZXTrace<ZX_TRACE_SIZE> trace;
+bool trace_saved = false; //the hang was already written, see trace_save()
+#endif
+#if defined(ZX_DEBUG)
+ZXDebugger debugger;
+#endif
+#if defined(ZX_FRAME_CHECK)
+ZXFrameCheck<128> frame_check;
+#endif
+#if defined(ZX_IDLE_SKIP)
+ZXIdleLoop idle;
+#endif
+bool overlay_enabled = true;
+bool overlay_damaged = false;	//the renderer drew over the overlay
+
 bool border_changed = false;
 
 uint8_t line_change[24]; //bit mask to updating each line
+uint8_t row_age[96];     //renders a dirty scaled row has been waiting for, up to 7
+uint16_t row_us = 200;   //running average of the time to draw a scaled row
+
+#ifndef ZX_RENDER_BUDGET
+#define ZX_RENDER_BUDGET 8000 //us for the scaled rows of a frame, 0 draws all dirty rows at once
+#endif
+uint8_t flash_rows[24];  //number of FLASH cells in each character row
+uint8_t flash_frame;     //FLASH swaps ink and paper every 16 frames
 char filename[32];
 
 uint8_t port_fe;  //keyboard, tape, sound, border
@@ -102,9 +262,152 @@ constexpr uint_fast32_t ZX_CLOCK_FREQ = 3500000;
 constexpr uint_fast32_t ZX_FRAME_RATE = 50;
 constexpr uint_fast32_t SAMPLE_RATE = 48000;   //more is better, but emulations gets slower
 constexpr uint_fast32_t MAX_FRAMESKIP = 8;
+constexpr uint_fast32_t ZX48_FRAME_TSTATES = 69888;
+constexpr uint_fast32_t ZX128_FRAME_TSTATES = 70908;
+constexpr uint_fast32_t ZX128_EXTRA_FRAME_HEAP = 48 * 1024;	//free heap needed to keep a 4th 128K bank resident
 
-#define RGB565Q(r,g,b)    ( ((((r)>>5)&0x1f)<<11) | ((((g)>>4)&0x3f)<<5) | (((b)>>5)&0x1f) )
+#define RGB565(r,g,b)     ( ((((r)>>3)&0x1f)<<11) | ((((g)>>2)&0x3f)<<5) | (((b)>>3)&0x1f) )
 inline uint16_t LHSWAP(uint16_t w) { return (w >> 8) | (w << 8); }
+inline uint32_t RGB565SPREAD(uint16_t c) { return (c | ((uint32_t)c << 16)) & 0x07E0F81F; } //5 guard bits above each channel
+
+#ifndef ZX_LCD_GAMMA
+#define ZX_LCD_GAMMA 2.2f
+#endif
+
+constexpr uint8_t zx_default_palette[16 * 3] PROGMEM = {
+	0, 0, 0,
+	0, 29, 200,
+	216, 36, 15,
+	213, 48, 201,
+	0, 199, 33,
+	0, 201, 203,
+	206, 202, 39,
+	203, 203, 203,
+	0, 0, 0,
+	0, 39, 251,
+	255, 48, 22,
+	255, 63, 252,
+	0, 249, 44,
+	0, 252, 254,
+	255, 253, 51,
+	255, 255, 255,
+};
+
+constexpr uint8_t nibble_bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+uint16_t zx_palette[16];		//RGB565, bright colours last
+uint16_t zx_blend[128 * 5];		//RGB565 by attribute bits 0..6, then by ink pixels out of 4
+
+//the 2x2 blends are mixed in linear light and encoded back with the panel gamma
+
+void palette_build(const uint8_t* rgb, float gamma)
+{
+	float lin[16][3];
+	float mix;
+	uint16_t attr;
+	uint8_t i, c, k, ink, pap;
+	uint8_t v[3];
+
+	for (i = 0; i < 16; ++i)
+	{
+		for (c = 0; c < 3; ++c) lin[i][c] = powf(rgb[i * 3 + c] / 255.0f, gamma);
+
+		zx_palette[i] = RGB565(rgb[i * 3 + 0], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+	}
+
+	for (attr = 0; attr < 128; ++attr)
+	{
+		ink = (attr & 7) + ((attr & 0x40) ? 8 : 0);
+		pap = ((attr >> 3) & 7) + ((attr & 0x40) ? 8 : 0);
+
+		zx_blend[attr * 5 + 0] = zx_palette[pap];
+		zx_blend[attr * 5 + 4] = zx_palette[ink];
+
+		for (k = 1; k < 4; ++k)
+		{
+			for (c = 0; c < 3; ++c)
+			{
+				mix = (lin[ink][c] * k + lin[pap][c] * (4 - k)) / 4;
+				v[c] = powf(mix, 1.0f / gamma) * 255.0f + 0.5f;
+			}
+
+			zx_blend[attr * 5 + k] = RGB565(v[0], v[1], v[2]);
+		}
+	}
+}
+
+#if defined(ZX_TRACE)
+void trace_save()
+{
+	fs::File f;
+
+	SPIFFS.begin();
+
+	f = SPIFFS.open("/trace.txt", "w");
+
+	if (f)
+	{
+		trace.dump(f);
+		f.close();
+	}
+
+	SPIFFS.end();
+}
+#endif
+
+//.pal is a plain text file with 16 RRGGBB hex colours in the ZX order, bright ones last,
+//optionally followed by the gamma of the panel, e.g. 2.2
+//the default palette is used when there is no such file, or with no filename
+
+void zx_load_palette(const char* filename)
+{
+	char buf[160];
+	uint8_t rgb[16 * 3];
+	char* tok;
+	uint32_t val;
+	float gamma;
+	uint8_t n;
+	size_t len;
+
+	memcpy_P(rgb, zx_default_palette, sizeof(rgb));
+	gamma = ZX_LCD_GAMMA;
+
+	fs::File f;
+
+	if (filename) f = SPIFFS.open(filename, "r");
+
+	if (f)
+	{
+		len = f.readBytes(buf, sizeof(buf) - 1);
+		f.close();
+
+		buf[len] = 0;
+		n = 0;
+
+		for (tok = strtok(buf, " ,\t\r\n"); tok; tok = strtok(nullptr, " ,\t\r\n"))
+		{
+			if (*tok == '#') ++tok;
+
+			if (strchr(tok, '.'))
+			{
+				gamma = atof(tok);
+			}
+			else if (n < 16 && strlen(tok) == 6)
+			{
+				val = strtoul(tok, nullptr, 16);
+
+				rgb[n * 3 + 0] = val >> 16;
+				rgb[n * 3 + 1] = val >> 8;
+				rgb[n * 3 + 2] = val;
+				++n;
+			}
+		}
+
+		if (gamma < 1.0f || gamma > 3.0f) gamma = ZX_LCD_GAMMA;
+	}
+
+	palette_build(rgb, gamma);
+}
 
 enum {
 	K_CS = 0, K_Z, K_X, K_C, K_V,
@@ -207,244 +510,1532 @@ enum {
 	EXT_Z80 = str_ext("z80").toUint32(),
 	EXT_SCR = str_ext("scr").toUint32(),
 	EXT_CFG = str_ext("cfg").toUint32(),
+	EXT_PAL = str_ext("pal").toUint32(),
 };
 
 constexpr size_t MEMORY_SIZE = 0xC000;
 uint8_t* memory; //49152 bytes
 
-class Z48_ESPBoy : protected zymosis::Z80CallBacks
+enum {
+	MACHINE_48K,
+	MACHINE_128K
+};
+
+uint8_t machine_type;
+uint_fast32_t frame_tstates;
+
+const uint8_t* rom_page;	//ROM at #0000
+uint8_t* ram_page[4];		//RAM at #4000, #8000, #c000, [0] is unused
+const uint8_t* screen;		//6912 bytes of the displayed screen
+
+ZXBankStore banks;			//128K RAM banks, the 48K memory block is used as resident frames
+uint8_t port_7ffd;			//128K paging
+uint8_t ram_bank;			//bank at #c000
+uint8_t slot_written;		//bit mask of 16K slots written to since the last paging
+bool paging_changed = false;
+bool bank_error = false;
+uint8_t screen_slots;		//bit mask of 16K slots the displayed screen is written through
+
+enum {
+	DISPLAY_SCALED,			//256x192 averaged 2x2 with the border around
+	DISPLAY_FILL,			//256x192 scaled 2:1 across and 3:2 down to the whole LCD
+	DISPLAY_CROP			//1:1 viewport below the status strip
+};
+
+#ifndef LCD_ROW_OFFSET
+#define LCD_ROW_OFFSET 1	//first visible row in the ST7735 frame memory, 1 for GREENTAB3
+#endif
+
+constexpr uint8_t LCD_MEMORY_ROWS = 162;
+constexpr uint8_t CROP_TOP = 10;						//status strip rows, never scrolled
+constexpr uint8_t CROP_LINES = 128 - CROP_TOP;			//screen lines shown in the viewport
+constexpr uint8_t CROP_COLS = 16;						//bytes of each screen line shown
+
+uint8_t display_mode = DISPLAY_SCALED;
+int16_t view_x;				//first shown byte of the line, 0..32-CROP_COLS
+int16_t view_y;				//first shown screen line, 0..192-CROP_LINES
+bool view_auto = true;		//viewport follows the screen writes
+uint8_t view_hot_line;		//last screen line and byte column written to
+uint8_t view_hot_col;
+uint8_t lcd_scroll_pos;
+
+uint8_t fill_line[128];		//first of the two source lines of each DISPLAY_FILL row
+uint8_t fill_weight[128];	//its weight out of 16, the next line gets the rest
+
+//box filter, row r covers source lines [r * 1.5, r * 1.5 + 1.5)
+
+void fill_init()
+{
+	uint16_t r, start, cover;
+
+	for (r = 0; r < 128; ++r)
+	{
+		start = r * 3; //in half lines
+		cover = (start / 2 + 1) * 2 - start;
+
+		fill_line[r] = start / 2;
+		fill_weight[r] = (cover * 32 + 3) / 6;
+	}
+}
+
+//the rows below the status strip are a ring of CROP_LINES lines, screen line ln is kept
+//in row ln % CROP_LINES and the hardware scroll start follows view_y, so a vertical pan
+//only pushes the newly exposed lines
+
+void lcd_scroll_area()
+{
+	uint16_t top, bottom;
+
+	top = LCD_ROW_OFFSET + CROP_TOP;
+	bottom = LCD_MEMORY_ROWS - top - CROP_LINES;
+
+	tft.writecommand(ST7735_VSCRDEF);
+	tft.writedata(top >> 8);
+	tft.writedata(top & 0xff);
+	tft.writedata(0);
+	tft.writedata(CROP_LINES);
+	tft.writedata(bottom >> 8);
+	tft.writedata(bottom & 0xff);
+}
+
+void lcd_scroll(uint8_t pos)
+{
+	uint16_t addr;
+
+	addr = LCD_ROW_OFFSET + CROP_TOP + pos;
+
+	tft.writecommand(ST7735_VSCRSADD);
+	tft.writedata(addr >> 8);
+	tft.writedata(addr & 0xff);
+
+	lcd_scroll_pos = pos;
+}
+
+void view_pan(int16_t x, int16_t y)
+{
+	int16_t ln;
+
+	if (x < 0) x = 0;
+	if (x > 32 - CROP_COLS) x = 32 - CROP_COLS;
+	if (y < 0) y = 0;
+	if (y > 192 - CROP_LINES) y = 192 - CROP_LINES;
+
+	if (x != view_x)
+	{
+		memset(line_change, 0xff, sizeof(line_change));
+	}
+	else
+	{
+		for (ln = y; ln < y + CROP_LINES; ++ln)
+		{
+			if (ln < view_y || ln >= view_y + CROP_LINES) line_change[ln / 8] |= 1 << (ln & 7);
+		}
+	}
+
+	view_x = x;
+	view_y = y;
+}
+
+//keeps the last written line in the middle half of the viewport, moving 4 lines a frame at most
+//a horizontal pan redraws everything, so it only happens when the column leaves the viewport
+
+void view_track()
+{
+	int16_t x, y;
+
+	x = view_x;
+	y = view_y;
+
+	if (view_hot_line < y + CROP_LINES / 4) y = view_hot_line - CROP_LINES / 4;
+	if (view_hot_line >= y + CROP_LINES * 3 / 4) y = view_hot_line - CROP_LINES * 3 / 4 + 1;
+
+	if (y < view_y - 4) y = view_y - 4;
+	if (y > view_y + 4) y = view_y + 4;
+
+	if (view_hot_col < x || view_hot_col >= x + CROP_COLS) x = view_hot_col - CROP_COLS / 2;
+
+	view_pan(x, y);
+}
+
+void display_set(uint8_t mode)
+{
+	display_mode = mode;
+
+	lcd_scroll(0);
+	tft.fillScreen(TFT_BLACK);
+
+	memset(line_change, 0xff, sizeof(line_change));
+	border_changed = true;
+}
+
+#if defined(ZX_PAGED_RAM)
+#ifndef ZX_PAGED_RAM_SHIFT
+#define ZX_PAGED_RAM_SHIFT 12
+#endif
+#ifndef ZX_PAGED_RAM_FRAMES
+#define ZX_PAGED_RAM_FRAMES (MEMORY_SIZE >> ZX_PAGED_RAM_SHIFT)
+#endif
+
+typedef ZXPagedRAM<ZX_PAGED_RAM_SHIFT> PagedRAM;
+
+PagedRAM vram;
+uint8_t* cpu_map[0x10000 >> ZX_PAGED_RAM_SHIFT];	//resident pages for reads, nullptr faults into vram
+uint8_t* cpu_wmap[0x10000 >> ZX_PAGED_RAM_SHIFT];	//resident dirty pages for writes
+uint32_t slot_base[4];								//paged RAM address of each 16K slot
+const uint8_t* vm_screen[2];						//wired screens of banks 5 and 7
+#endif
+
+#if defined(ZX_SCANLINE)
+#ifndef ZX_SCANLINE_EVENTS
+#define ZX_SCANLINE_EVENTS 512
+#endif
+
+ZXScanLog<ZX_SCANLINE_EVENTS, 64> scan_log;
+const ZXContentionTiming* scan_timing;
+uint16_t scan_first;		//frame line of the first display line
+uint8_t scan_attrs[768];	//attributes replayed line by line by the renderer
+#endif
+
+#if defined(ZX_CONTENTION)
+typedef ZXContention<true> ZXCallBacks;
+#else
+typedef ZXContention<false> ZXCallBacks;
+#endif
+
+//what the Z80 core emulates in this build: contention as configured, no M1 parity, paging,
+//breakpoints only for the debugger, exact MEMPTR and R. PC, T-states and AF stay in registers
+//unless a memory callback needs the T-state: contention and scanline attribute logging
+
+#if defined(ZX_CONTENTION) || defined(ZX_SCANLINE)
+#define ZX_CPU_RESIDENT false
+#else
+#define ZX_CPU_RESIDENT true
+#endif
+
+#if defined(ZX_LAZY_FLAGS) && !defined(ZX_IDLE_SKIP) && !defined(ZX_TRACE)
+#define ZX_CPU_LAZY_FLAGS true
+#else
+#define ZX_CPU_LAZY_FLAGS false
+#endif
+
+#if defined(ZX_FUSION) && !defined(ZX_CONTENTION) && !defined(ZX_DEBUG) && !defined(ZX_PROFILER) && !defined(ZX_TRACE) && !defined(ZX_IDLE_SKIP)
+#define ZX_CPU_FUSION true
+#else
+#define ZX_CPU_FUSION false
+#endif
+
+#if defined(ZX_DEBUG)
+typedef zymosis::Z80Policy<ZXCallBacks::enabled, false, true, true, true, true, ZX_CPU_RESIDENT, ZX_CPU_LAZY_FLAGS, ZX_CPU_FUSION> ZXPolicy;
+#else
+typedef zymosis::Z80Policy<ZXCallBacks::enabled, false, true, false, true, true, ZX_CPU_RESIDENT, ZX_CPU_LAZY_FLAGS, ZX_CPU_FUSION> ZXPolicy;
+#endif
+
+class Z48_ESPBoy;
+typedef zymosis::Z80Cpu<Z48_ESPBoy, ZXPolicy> ZXCpu;
+
+class Z48_ESPBoy : protected ZXCallBacks
 {
 protected:
+	//the beeper is summed by frame T-state as OUTs change it, a sample every ZX_CLOCK_FREQ / SAMPLE_RATE
+	uint_fast32_t beep_t = 0;		//frame T-state summed up to
+	uint_fast32_t beep_acc = 0;		//T-states of the sample being summed
+	uint_fast32_t beep_out = 0;		//its level times T-states
+#if defined(ZX_DEBUG)
+	uint_fast32_t debug_ticks = 0;		//frame T-state the debugger stopped the CPU at
+	bool debug_frame_open = false;		//the frame has to be finished before the next one
+#endif
+
 	Z48_ESPBoy()
 	{
 	}
 
 	ZYMOSIS_INLINE void reset()
 	{
+		set_machine(MACHINE_48K);
+
+#if !defined(ZX_PAGED_RAM)
 		memset(memory, 0, MEMORY_SIZE);
+#endif
 		memset(line_change, 0xff, sizeof(line_change));
+		flash_rebuild();
+
+#if defined(ZX_BLOCK_CACHE)
+		codeInvalidate(0x0000, 0x10000);
+#endif
 
 		key_matriz.reset();
 
 		port_fe = 0;
 		port_1f = 0;
+
+#if defined(ZX_TRACE)
+		trace.reset();
+		trace_saved = false;
+#endif
 	}
 
-	ZYMOSIS_INLINE void memWriteFn(uint16_t addr, uint8_t value, zymosis::Z80MemIOType mio)
+	void set_machine(uint8_t type)
 	{
-		uint16_t line;
+		machine_type = type;
+		port_7ffd = 0;
+		ram_bank = 0;
+		slot_written = 0;
+		paging_changed = false;
+		rom_page = rom;
+		screen_slots = 0x02;
+
+		setContention((type == MACHINE_128K) ? ZX128_CONTENTION : ZX48_CONTENTION, 0x02);
+
+#if defined(ZX_SCANLINE)
+		scan_timing = (type == MACHINE_128K) ? &ZX128_CONTENTION : &ZX48_CONTENTION;
+		scan_first = (scan_timing->start + 1) / scan_timing->line;
+		scan_log.begin(port_fe & 7);
+#endif
 
-		if (addr >= 0x4000)
+#if defined(ZX_PAGED_RAM)
+		vm_flush();
+
+		if (type == MACHINE_128K)
 		{
-			addr -= 0x4000;
-			if (addr < 0x1b00)
-			{
-				if (memory[addr] != value)
-				{
-					if (addr < 0x1800)
-					{
-						line = ((addr / 256) & 7) + ((addr / 32) & 7) * 8 + addr / 2048 * 64;
-						line_change[line / 8] |= (1 << (line & 7));
-					}
-					else
-					{
-						line_change[(addr - 0x1800) / 32] = 255;
-					}
-				}
-			}
+			if (!vram.clear(ZXBankStore::BANKS * ZXBankStore::BANK_SIZE)) bank_error = true;
 
-			memory[addr] = value;
-		}
-	}
+			vm_screen[0] = vram.wire(5 * ZXBankStore::BANK_SIZE, ZXBankStore::SCREEN_SIZE);
+			vm_screen[1] = vram.wire(7 * ZXBankStore::BANK_SIZE, ZXBankStore::SCREEN_SIZE);
 
-	ZYMOSIS_INLINE uint8_t memReadFn(uint16_t addr, zymosis::Z80MemIOType mio)
-	{
-		if (addr < 0x4000)
-		{
-			return pgm_read_byte(&rom[addr]);
+			slot_base[1] = 5 * ZXBankStore::BANK_SIZE;
+			slot_base[2] = 2 * ZXBankStore::BANK_SIZE;
+			slot_base[3] = 0 * ZXBankStore::BANK_SIZE;
+			screen = vm_screen[0];
+			frame_tstates = ZX128_FRAME_TSTATES;
 		}
 		else
 		{
-			return memory[addr - 0x4000];
-		}
-	}
+			if (!vram.clear(MEMORY_SIZE)) bank_error = true;
 
-	ZYMOSIS_INLINE uint8_t portInFn(uint16_t port, zymosis::Z80PIOType pio)
-	{
-		uint8_t val;
-		uint16_t off;
+			vm_screen[0] = vram.wire(0, ZXBankStore::SCREEN_SIZE);
+			vm_screen[1] = vm_screen[0];
 
-		val = 0xff;
+			slot_base[1] = 0x0000;
+			slot_base[2] = 0x4000;
+			slot_base[3] = 0x8000;
+			screen = vm_screen[0];
+			frame_tstates = ZX48_FRAME_TSTATES;
+		}
 
-		if (!(port & 0x01)) //port #fe
+		if (!screen) bank_error = true;
+#else
+		if (type == MACHINE_128K)
 		{
-			off = 0;
-
-			if (!(port & 0x0100)) off = 5 * 0;
-			if (!(port & 0x0200)) off = 5 * 1;
-			if (!(port & 0x0400)) off = 5 * 2;
-			if (!(port & 0x0800)) off = 5 * 3;
-			if (!(port & 0x1000)) off = 5 * 4;
-			if (!(port & 0x2000)) off = 5 * 5;
-			if (!(port & 0x4000)) off = 5 * 6;
-			if (!(port & 0x8000)) off = 5 * 7;
+			//banks are mapped by page128() once the snapshot pages are stored
 
-			if (key_matriz[off + 0]) val &= ~0x01;
-			if (key_matriz[off + 1]) val &= ~0x02;
-			if (key_matriz[off + 2]) val &= ~0x04;
-			if (key_matriz[off + 3]) val &= ~0x08;
-			if (key_matriz[off + 4]) val &= ~0x10;
+			banks.begin(memory, MEMORY_SIZE / ZXBankStore::BANK_SIZE, (ESP.getFreeHeap() >= ZX128_EXTRA_FRAME_HEAP) ? 1 : 0);
+			frame_tstates = ZX128_FRAME_TSTATES;
 		}
 		else
 		{
-			if ((port & 0xff) == 0x1f) val = port_1f;
+			banks.end();
+
+			ram_page[1] = &memory[0x0000];
+			ram_page[2] = &memory[0x4000];
+			ram_page[3] = &memory[0x8000];
+			screen = memory;
+			frame_tstates = ZX48_FRAME_TSTATES;
 		}
+#endif
+	}
 
-		return val;
+#if defined(ZX_PAGED_RAM)
+	void vm_flush()
+	{
+		memset(cpu_map, 0, sizeof(cpu_map));
+		memset(cpu_wmap, 0, sizeof(cpu_wmap));
 	}
 
-	ZYMOSIS_INLINE void portOutFn(uint16_t port, uint8_t value, zymosis::Z80PIOType pio)
+	//slow path of memory access, maps a page of the slot into cpu_map/cpu_wmap
+
+	uint8_t* vm_fault(uint16_t addr, bool write)
 	{
-		if (!(port & 0x01))
-		{
-			if ((port_fe & 7) != (value & 7)) border_changed = 1; //update border
+		uint32_t evictions = vram.evictions;
+		uint16_t idx = addr >> ZX_PAGED_RAM_SHIFT;
+		uint8_t* page;
 
-			port_fe = value;
+		page = vram.map((slot_base[addr >> 14] + (addr & 0x3fff)) >> ZX_PAGED_RAM_SHIFT, write);
+
+		if (vram.evictions != evictions) vm_flush(); //a cached frame may hold another page now
+
+		if (!page)
+		{
+			bank_error = true;
+			return vram.frame(0);
 		}
+
+		cpu_map[idx] = page;
+		if (write) cpu_wmap[idx] = page;
+
+		return page;
 	}
-public:
-	ZYMOSIS_INLINE void emulateFrame()
-	{
-		uint_fast32_t n, ticks, sacc, sout;
 
-		zymosis::Z80Cpu<Z48_ESPBoy>* zcpu = reinterpret_cast<zymosis::Z80Cpu<Z48_ESPBoy>*>(this);
+	//streams a .z80 memory block into paged RAM, so no 16K unpack buffer is needed
+
+	void load_block_vm(fs::File& f, int len, uint32_t vaddr, uint32_t size, uint8_t rle)
+	{
+		uint8_t buf[128];
+		uint8_t state, val;
+		int i, n, cnt;
+		uint32_t end = vaddr + size;
 
-		sacc = 0;
-		sout = 0;
-		ticks = zcpu->Z80_Interrupt();
+		state = 0;
+		cnt = 0;
 
-		while (ticks < (ZX_CLOCK_FREQ / ZX_FRAME_RATE))
+		while (len > 0 && vaddr < end)
 		{
-			n = zcpu->Z80_ExecuteTS(8);
+			n = f.readBytes((char*)buf, (len < (int)sizeof(buf)) ? len : sizeof(buf));
 
-			sacc += n;
+			if (n <= 0) break;
 
-			if (port_fe & 0x10) sout += 127 * n;
+			len -= n;
 
-			if (sacc >= (ZX_CLOCK_FREQ / SAMPLE_RATE))
+			for (i = 0; i < n && vaddr < end; ++i)
 			{
-				sound_buffer[sound_wr_ptr] = sout / sacc;
+				val = buf[i];
 
-				if (sound_wr_ptr != sound_rd_ptr)
+				if (!rle)
+				{
+					vram.poke(vaddr++, val);
+					continue;
+				}
+
+				switch (state)
+				{
+				case 0: //data
+					if (val == 0xed) state = 1; else vram.poke(vaddr++, val);
+					break;
+				case 1: //single 0xed, the next byte is never a block start
+					if (val == 0xed)
+					{
+						state = 2;
+					}
+					else
+					{
+						vram.poke(vaddr++, 0xed);
+						if (vaddr < end) vram.poke(vaddr++, val);
+						state = 0;
+					}
+					break;
+				case 2: //block length
+					cnt = val;
+					state = 3;
+					break;
+				case 3: //block value
+					while (cnt-- > 0 && vaddr < end) vram.poke(vaddr++, val);
+					state = 0;
+					break;
+				}
+			}
+		}
+
+		if (state == 1 && vaddr < end) vram.poke(vaddr, 0xed);
+
+		if (len > 0) f.seek(len, fs::SeekCur);
+	}
+#endif
+
+	//applies port #7ffd, banks 5 and 2 stay resident, the bank at #c000 is swapped in from the bank store
+
+	void page128()
+	{
+		uint8_t bank;
+#if !defined(ZX_PAGED_RAM)
+		uint8_t keep;
+		uint8_t* page;
+#endif
+		const uint8_t* scr;
+
+		paging_changed = false;
+
+#if defined(ZX_PAGED_RAM)
+		bank = port_7ffd & 7;
+		slot_base[3] = bank * ZXBankStore::BANK_SIZE;
+		ram_bank = bank;
+
+		memset(&cpu_map[0xc000 >> ZX_PAGED_RAM_SHIFT], 0, sizeof(cpu_map) / 4);
+		memset(&cpu_wmap[0xc000 >> ZX_PAGED_RAM_SHIFT], 0, sizeof(cpu_wmap) / 4);
+
+		rom_page = (port_7ffd & 0x10) ? rom : rom128;
+		scr = vm_screen[(port_7ffd & 0x08) ? 1 : 0];
+#else
+		if (slot_written & 0x08) banks.touch(ram_bank);
+
+		slot_written = 0;
+
+		bank = port_7ffd & 7;
+		keep = (1 << 5) | (1 << 2) | (1 << bank);
+
+		ram_page[1] = banks.acquire(5, keep);
+		ram_page[2] = banks.acquire(2, keep);
+
+		banks.touch(5);
+		banks.touch(2);
+
+		page = banks.acquire(bank, keep);
+
+		if (!page)
+		{
+			bank_error = true;
+			return;
+		}
+
+		ram_page[3] = page;
+		ram_bank = bank;
+
+		rom_page = (port_7ffd & 0x10) ? rom : rom128;
+
+		banks.setScreen((port_7ffd & 0x08) ? 7 : 5);
+		scr = banks.screen();
+
+		if (!scr)
+		{
+			bank_error = true;
+			return;
+		}
+#endif
+
+#if defined(ZX_BLOCK_CACHE)
+		codeInvalidate(0x0000, 0x4000);
+		codeInvalidate(0xc000, 0x4000);
+#endif
+
+		setContendedSlots(0x02 | ((ram_bank & 1) ? 0x08 : 0));
+
+		screen_slots = ((port_7ffd & 0x08) ? 0 : 0x02) | ((ram_bank == ((port_7ffd & 0x08) ? 7 : 5)) ? 0x08 : 0);
+
+		if (scr != screen)
+		{
+			screen = scr;
+			memset(line_change, 0xff, sizeof(line_change));
+			flash_rebuild();
+		}
+	}
+
+	//FLASH cells per character row of the displayed screen, kept up to date by memWriteFn;
+	//the renderer redraws whole rows, so a count per row is all it needs
+
+	void flash_rebuild()
+	{
+		uint16_t i;
+
+		memset(flash_rows, 0, sizeof(flash_rows));
+
+		for (i = 0; i < 768; ++i)
+		{
+			if (screen[6144 + i] & 0x80) ++flash_rows[i / 32];
+		}
+	}
+
+	//called when the FLASH bit of an attribute changes
+
+	ZYMOSIS_INLINE void flash_write(uint16_t addr, uint8_t value)
+	{
+		if (value & 0x80) ++flash_rows[addr / 32]; else --flash_rows[addr / 32];
+	}
+
+	ZYMOSIS_INLINE void pagerFn()
+	{
+		if (paging_changed) page128();
+	}
+
+#if defined(ZX_DEBUG)
+	ZYMOSIS_INLINE int checkBPFn()
+	{
+		return debugger.check(pc);
+	}
+#endif
+
+	ZYMOSIS_INLINE void memWriteFn(uint16_t addr, uint8_t value, zymosis::Z80MemIOType mio)
+	{
+		uint16_t line;
+		uint8_t slot;
+		uint8_t* ptr;
+
+#if defined(ZX_DEBUG)
+		if (mio == zymosis::Z80_MEMIO_DATA) debugger.watch(ZXDebugger::WRITE, addr);
+#endif
+#if defined(ZX_IDLE_SKIP)
+		idle.touch();
+#endif
+
+		if (addr >= 0x4000)
+		{
+#if defined(ZX_BLOCK_CACHE)
+			codeWritten(addr);
+#endif
+			slot = addr >> 14;
+#if defined(ZX_PAGED_RAM)
+			ptr = cpu_wmap[addr >> ZX_PAGED_RAM_SHIFT];
+			if (!ptr) ptr = vm_fault(addr, true);
+			ptr += addr & PagedRAM::PAGE_MASK;
+#else
+			ptr = &ram_page[slot][addr & 0x3fff];
+			slot_written |= 1 << slot;
+#endif
+			addr &= 0x3fff;
+
+			if ((screen_slots & (1 << slot)) && addr < 0x1b00)
+			{
+				if (*ptr != value)
+				{
+					if (addr < 0x1800)
+					{
+						line = ((addr / 256) & 7) + ((addr / 32) & 7) * 8 + addr / 2048 * 64;
+						line_change[line / 8] |= (1 << (line & 7));
+						view_hot_line = line;
+						view_hot_col = addr & 31;
+					}
+					else
+					{
+						line_change[(addr - 0x1800) / 32] = 255;
+						if ((*ptr ^ value) & 0x80) flash_write(addr - 0x1800, value);
+#if defined(ZX_SCANLINE)
+						scanAttr(addr - 0x1800, *ptr);
+#endif
+					}
+				}
+			}
+
+			*ptr = value;
+		}
+	}
+
+	ZYMOSIS_INLINE uint8_t memReadFn(uint16_t addr, zymosis::Z80MemIOType mio)
+	{
+#if defined(ZX_DEBUG)
+		if (mio == zymosis::Z80_MEMIO_DATA) debugger.watch(ZXDebugger::READ, addr);
+#endif
+		if (addr < 0x4000)
+		{
+			return pgm_read_byte(&rom_page[addr]);
+		}
+		else
+		{
+#if defined(ZX_PAGED_RAM)
+			uint8_t* ptr = cpu_map[addr >> ZX_PAGED_RAM_SHIFT];
+			if (!ptr) ptr = vm_fault(addr, false);
+			return ptr[addr & PagedRAM::PAGE_MASK];
+#else
+			return ram_page[addr >> 14][addr & 0x3fff];
+#endif
+		}
+	}
+
+	//LDIR/LDDR and CPIR/CPDR run in bulk when nothing needs to see each iteration, the
+	//core counts 21 T-states for every one, so the loop and its data must be uncontended;
+	//the core itself ends a bulk copy before it would write over the LDIR/LDDR opcode
+
+	ZYMOSIS_INLINE bool block_bulk(uint16_t addr, uint16_t addr2, uint16_t len)
+	{
+#if defined(ZX_PROFILER) || defined(ZX_TRACE)
+		return false;
+#else
+#if defined(ZX_DEBUG)
+		if (!debugger.idle()) return false;
+#endif
+		return !contended(pc, 2) && !contended(addr, len) && !contended(addr2, len);
+#endif
+	}
+
+	//bytes of the 16K slot or paged RAM page left from addr on in the copy direction
+
+	ZYMOSIS_INLINE uint16_t block_left(uint16_t addr, bool backward)
+	{
+#if defined(ZX_PAGED_RAM)
+		const uint16_t mask = PagedRAM::PAGE_MASK;
+#else
+		const uint16_t mask = 0x3fff;
+#endif
+		return backward ? (addr & mask) + 1 : mask + 1 - (addr & mask);
+	}
+
+	uint16_t blockCopyFn(uint16_t src, uint16_t dst, uint16_t count, bool backward)
+	{
+		uint16_t done, n, i, off, line, lo;
+		int16_t step;
+		uint8_t slot, value;
+		uint8_t* d;
+		const uint8_t* s;
+
+		//wrapping around #ffff and writes to the ROM are left to the core
+
+		if (backward)
+		{
+			if (src < count - 1 || dst < 0x4000 + count - 1) return 0;
+		}
+		else
+		{
+			if (src > 0xffff - (count - 1) || dst > 0xffff - (count - 1) || dst < 0x4000) return 0;
+		}
+
+		if (!block_bulk(backward ? src - (count - 1) : src, backward ? dst - (count - 1) : dst, count)) return 0;
+
+#if defined(ZX_IDLE_SKIP)
+		idle.touch();
+#endif
+
+		step = backward ? -1 : 1;
+		done = 0;
+
+		while (done < count)
+		{
+			n = count - done;
+			if (n > block_left(src, backward)) n = block_left(src, backward);
+			if (n > block_left(dst, backward)) n = block_left(dst, backward);
+
+			slot = dst >> 14;
+			off = dst & 0x3fff;
+
+#if defined(ZX_PAGED_RAM)
+			d = cpu_wmap[dst >> ZX_PAGED_RAM_SHIFT];
+			if (!d) d = vm_fault(dst, true);
+			d += dst & PagedRAM::PAGE_MASK;
+
+			s = nullptr;
+			if (src >= 0x4000)
+			{
+				s = cpu_map[src >> ZX_PAGED_RAM_SHIFT];
+				if (!s) s = vm_fault(src, false);
+				s += src & PagedRAM::PAGE_MASK;
+
+				//mapping the source may have evicted the destination
+				if (!cpu_wmap[dst >> ZX_PAGED_RAM_SHIFT]) break;
+			}
+#else
+			d = &ram_page[slot][off];
+			s = (src >= 0x4000) ? &ram_page[src >> 14][src & 0x3fff] : nullptr;
+			slot_written |= 1 << slot;
+#endif
+
+			lo = backward ? off - (n - 1) : off;
+
+			if ((screen_slots & (1 << slot)) && lo < 0x1b00)
+			{
+#if defined(ZX_SCANLINE)
+				//attribute writes are logged with their beam position, one at a time
+				if (lo + n > 0x1800) break;
+#endif
+				for (i = 0; i < n; ++i)
+				{
+					value = s ? *s : pgm_read_byte(&rom_page[src]);
+
+					if (off < 0x1b00 && *d != value)
+					{
+						if (off < 0x1800)
+						{
+							line = ((off / 256) & 7) + ((off / 32) & 7) * 8 + off / 2048 * 64;
+							line_change[line / 8] |= (1 << (line & 7));
+							view_hot_line = line;
+							view_hot_col = off & 31;
+						}
+						else
+						{
+							line_change[(off - 0x1800) / 32] = 255;
+							if ((*d ^ value) & 0x80) flash_write(off - 0x1800, value);
+						}
+					}
+
+					*d = value;
+					d += step;
+					if (s) s += step;
+					src += step;
+					off += step;
+				}
+			}
+			else if (s)
+			{
+				for (i = 0; i < n; ++i)
+				{
+					*d = *s;
+					d += step;
+					s += step;
+				}
+
+				src += n * step;
+			}
+			else
+			{
+				for (i = 0; i < n; ++i)
+				{
+					*d = pgm_read_byte(&rom_page[src]);
+					d += step;
+					src += step;
+				}
+			}
+
+			dst += n * step;
+			done += n;
+		}
+
+#if defined(ZX_BLOCK_CACHE)
+		if (done) codeInvalidate(backward ? dst + 1 : dst - done, done);
+#endif
+
+		return done;
+	}
+
+	uint16_t blockScanFn(uint16_t addr, uint16_t count, bool backward, uint8_t value)
+	{
+		uint16_t done;
+
+		if (backward ? addr < count - 1 : addr > 0xffff - (count - 1)) return 0;
+
+		if (!block_bulk(backward ? addr - (count - 1) : addr, backward ? addr - (count - 1) : addr, count)) return 0;
+
+		for (done = 0; done < count; ++done)
+		{
+			if (memReadFn(addr, zymosis::Z80_MEMIO_OTHER) == value) break;
+			addr += backward ? -1 : 1;
+		}
+
+		return done;
+	}
+
+	ZYMOSIS_INLINE uint8_t portInFn(uint16_t port, zymosis::Z80PIOType pio)
+	{
+		uint8_t val;
+		uint16_t off;
+
+		val = 0xff;
+
+		if (!(port & 0x01)) //port #fe
+		{
+			off = 0;
+
+			if (!(port & 0x0100)) off = 5 * 0;
+			if (!(port & 0x0200)) off = 5 * 1;
+			if (!(port & 0x0400)) off = 5 * 2;
+			if (!(port & 0x0800)) off = 5 * 3;
+			if (!(port & 0x1000)) off = 5 * 4;
+			if (!(port & 0x2000)) off = 5 * 5;
+			if (!(port & 0x4000)) off = 5 * 6;
+			if (!(port & 0x8000)) off = 5 * 7;
+
+			if (key_matriz[off + 0]) val &= ~0x01;
+			if (key_matriz[off + 1]) val &= ~0x02;
+			if (key_matriz[off + 2]) val &= ~0x04;
+			if (key_matriz[off + 3]) val &= ~0x08;
+			if (key_matriz[off + 4]) val &= ~0x10;
+		}
+		else
+		{
+			if ((port & 0xff) == 0x1f) val = port_1f;
+		}
+
+		return val;
+	}
+
+	ZYMOSIS_INLINE void portOutFn(uint16_t port, uint8_t value, zymosis::Z80PIOType pio)
+	{
+#if defined(ZX_IDLE_SKIP)
+		idle.touch();
+#endif
+
+		if (!(port & 0x01))
+		{
+			if ((port_fe ^ value) & 0x10) beeper(frame_base + tstates);
+
+			if ((port_fe & 7) != (value & 7))
+			{
+				border_changed = 1; //update border
+#if defined(ZX_SCANLINE)
+				scanBorder(value & 7);
+#endif
+			}
+
+			port_fe = value;
+		}
+
+		if (machine_type == MACHINE_128K && !(port & 0x8002) && !(port_7ffd & 0x20)) //port #7ffd, applied before the next opcode fetch
+		{
+			port_7ffd = value;
+			paging_changed = true;
+		}
+	}
+
+#if defined(ZX_SCANLINE)
+	//only writes during the display lines are logged, with the first line that shows them
+
+	ZYMOSIS_INLINE void scanAttr(uint16_t addr, uint8_t old)
+	{
+		uint32_t t;
+
+		t = frame_base + tstates - (scan_timing->start + 1);
+
+		if (t >= 191UL * scan_timing->line) return;
+
+		scan_log.attr(addr, ((t * scan_timing->line_mul) >> 24) + 1, old);
+	}
+
+	//colours set above the visible border are the colour the frame starts with
+
+	void scanBorder(uint8_t colour)
+	{
+		uint32_t line, first;
+
+		line = (uint32_t)(frame_base + tstates) / scan_timing->line;
+		first = scan_first;
+
+		if (line < first - 32)
+		{
+			scan_log.borderStart(colour);
+			return;
+		}
+
+		if (line < first + 192 + 32) scan_log.border(line, colour);
+	}
+#endif
+#if defined(ZX_PROFILER) || defined(ZX_TRACE) || defined(ZX_IDLE_SKIP)
+	ZYMOSIS_INLINE void profileFn(uint16_t pc)
+	{
+#if defined(ZX_PROFILER) || defined(ZX_TRACE)
+		auto peek = [this](uint16_t addr) { return memReadFn(addr, zymosis::Z80_MEMIO_OTHER); };
+#endif
+#if defined(ZX_IDLE_SKIP)
+		//contended loops do not repeat their timing, so they are only looked at after the display
+		if (frame_base + tstates >= contentionEnd())
+		{
+			idle.step(*this, pc, frame_base + tstates);
+
+#if !defined(ZX_PROFILER) && !defined(ZX_TRACE)
+			//the run ends after this instruction and emulateFrame() skips the passes of the loop
+#if defined(ZX_DEBUG)
+			if (idle.idle() && debugger.idle()) next_event_tstate = tstates;
+#else
+			if (idle.idle()) next_event_tstate = tstates;
+#endif
+#endif
+		}
+#endif
+
+#if defined(ZX_PROFILER)
+		profiler.sample(pc, peek);
+#endif
+#if defined(ZX_TRACE)
+		//a halted CPU runs its HALT over and over, only the first one is kept
+		if (!halted) trace.record(pc, af.w, frame_base + tstates, peek);
+#endif
+	}
+#endif
+public:
+#if defined(ZX_PROFILER)
+	void profileDump(Print& out)
+	{
+		profiler.dump(out, [this](uint16_t addr) { return memReadFn(addr, zymosis::Z80_MEMIO_OTHER); });
+	}
+#endif
+#if defined(ZX_DEBUG)
+	//registers in the GDB z80 order, see zxdebug.hpp
+
+	uint16_t debugReg(uint8_t n)
+	{
+		switch (n)
+		{
+		case 0: return af.w;
+		case 1: return bc.w;
+		case 2: return de.w;
+		case 3: return hl.w;
+		case 4: return sp.w;
+		case 5: return pc;
+		case 6: return ix.w;
+		case 7: return iy.w;
+		case 8: return afx.w;
+		case 9: return bcx.w;
+		case 10: return dex.w;
+		case 11: return hlx.w;
+		default: return (regI << 8) | regR;
+		}
+	}
+
+	void debugSetReg(uint8_t n, uint16_t value)
+	{
+		switch (n)
+		{
+		case 0: af.w = value; break;
+		case 1: bc.w = value; break;
+		case 2: de.w = value; break;
+		case 3: hl.w = value; break;
+		case 4: sp.w = value; break;
+		case 5: pc = value; halted = false; break;
+		case 6: ix.w = value; break;
+		case 7: iy.w = value; break;
+		case 8: afx.w = value; break;
+		case 9: bcx.w = value; break;
+		case 10: dex.w = value; break;
+		case 11: hlx.w = value; break;
+		default: regI = value >> 8; regR = value & 0xff; break;
+		}
+	}
+
+	uint8_t debugPeek(uint16_t addr)
+	{
+		return memReadFn(addr, zymosis::Z80_MEMIO_OTHER);
+	}
+
+	void debugPoke(uint16_t addr, uint8_t value)
+	{
+		memWriteFn(addr, value, zymosis::Z80_MEMIO_OTHER);
+	}
+#endif
+
+	//per frame work up to the interrupt, returns the T-states it took. C is the core built
+	//on this class, the emulator's own or one of the ZX_SELFCHECK bench policies
+
+	template<class C = ZXCpu>
+	ZYMOSIS_INLINE uint_fast32_t frameStart()
+	{
+		uint_fast32_t n;
+
+		C* zcpu = reinterpret_cast<C*>(this);
+
+#if defined(ZX_PAGED_RAM)
+		//drop cached page pointers once a frame, so page ages are refreshed on next access
+		vram.tick();
+		vm_flush();
+#endif
+
+#if defined(ZX_SCANLINE)
+		scan_log.begin(port_fe & 7);
+#endif
+
+		//only the character rows with FLASH cells are redrawn when the phase flips
+		if (!(++flash_frame & 15))
+		{
+			for (n = 0; n < 24; ++n)
+			{
+				if (flash_rows[n]) line_change[n] = 255;
+			}
+		}
+
+		frame_base = -tstates;
+		beep_t = 0;
+
+#if defined(ZX_IDLE_SKIP)
+		idle.reset();
+#endif
+
+		return zcpu->Z80_Interrupt();
+	}
+
+	ZYMOSIS_INLINE void sound_put(uint8_t value)
+	{
+		//ZX_SELFCHECK runs frames before sound_init()
+		if (!sound_buffer) return;
+
+		sound_buffer[sound_wr_ptr] = value;
+
+		if (sound_wr_ptr != sound_rd_ptr)
+		{
+			++sound_wr_ptr;
+
+			if (sound_wr_ptr >= SOUND_BUFFER_SIZE) sound_wr_ptr = 0;
+		}
+	}
+
+	//sums the beeper level from beep_t up to frame T-state t
+
+	ZYMOSIS_INLINE void beeper(uint_fast32_t t)
+	{
+		uint_fast32_t n;
+
+		while (beep_t < t)
+		{
+			n = (ZX_CLOCK_FREQ / SAMPLE_RATE) - beep_acc;
+			if (n > t - beep_t) n = t - beep_t;
+
+			beep_t += n;
+			beep_acc += n;
+			if (port_fe & 0x10) beep_out += 127 * n;
+
+			if (beep_acc >= (ZX_CLOCK_FREQ / SAMPLE_RATE))
+			{
+				sound_put(beep_out / beep_acc);
+
+				beep_acc = 0;
+				beep_out = 0;
+			}
+		}
+	}
+
+	//the core runs to the end of the frame in one go, it only comes back early for an idle
+	//loop to skip or a debugger stop
+
+	template<class C = ZXCpu>
+	ZYMOSIS_INLINE void emulateFrame()
+	{
+		uint_fast32_t ticks;
+#if defined(ZX_IDLE_SKIP) && !defined(ZX_PROFILER) && !defined(ZX_TRACE)
+		uint_fast32_t n;
+#endif
+
+		C* zcpu = reinterpret_cast<C*>(this);
+
+#if defined(ZX_DEBUG)
+		//a stopped CPU stays where it is, once resumed it goes on from there in the frame
+		if (debugger.stopped()) return;
+
+		ticks = debug_frame_open ? debug_ticks : frameStart<C>();
+		debug_frame_open = false;
+#else
+		ticks = frameStart<C>();
+#endif
+
+		while (ticks < frame_tstates)
+		{
+			frame_base = ticks;
+
+			ticks += zcpu->Z80_ExecuteTS(frame_tstates - ticks);
+
+#if defined(ZX_IDLE_SKIP) && !defined(ZX_PROFILER) && !defined(ZX_TRACE)
+#if defined(ZX_DEBUG)
+			n = debugger.idle() ? idle.skip(frame_tstates - ticks, regR) : 0;
+#else
+			n = idle.skip(frame_tstates - ticks, regR);
+#endif
+			//the loop does no OUT, the beeper level holds for the passes skipped
+			if (n)
+			{
+				++telemetry.idle_skips;
+				ticks += n;
+			}
+#endif
+
+#if defined(ZX_DEBUG)
+			if (debugger.stopped())
+			{
+				debug_ticks = ticks;
+				debug_frame_open = true;
+				return;
+			}
+#endif
+		}
+
+		beeper(ticks);
+
+#if defined(ZX_TRACE)
+		//nothing but NMI gets the CPU out of HALT with interrupts off
+		if (halted && !iff1 && !trace_saved)
+		{
+			trace_save();
+			trace_saved = true;
+		}
+#endif
+	}
+
+	//1:1 viewport, see lcd_scroll_area()
+
+	void renderCrop(uint8_t flash)
+	{
+		uint16_t ln, pptr, aptr, optr;
+		uint8_t ch, px, attr, bits, bright;
+		uint_fast16_t ink, pap;
+		const uint8_t* arow;
+#if defined(ZX_SCANLINE)
+		bool scan, redraw;
+
+		scan = scan_log.attrEvents() != 0;
+#endif
+
+		if (lcd_scroll_pos != view_y % CROP_LINES) lcd_scroll(view_y % CROP_LINES);
+
+		for (ln = view_y; ln < view_y + CROP_LINES; ++ln)
+		{
+			aptr = 6144 + ln / 8 * 32 + view_x;
+			arow = &screen[aptr];
+
+#if defined(ZX_SCANLINE)
+			redraw = false;
+
+			if (scan)
+			{
+				scan_log.advance(scan_attrs, ln);
+				arow = &scan_attrs[aptr - 6144];
+				redraw = memcmp(arow, &screen[aptr], CROP_COLS) != 0;
+			}
+#endif
+
+			if (!(line_change[ln / 8] & (1 << (ln & 7)))) continue;
+
+			line_change[ln / 8] &= ~(1 << (ln & 7));
+
+			pptr = (ln & 7) * 256 + ((ln / 8) & 7) * 32 + (ln / 64) * 2048 + view_x;
+			optr = 0;
+
+			for (ch = 0; ch < CROP_COLS; ++ch)
+			{
+				attr = arow[ch];
+				if (attr & flash) attr = (attr & 0x40) | ((attr & 7) << 3) | ((attr >> 3) & 7);
+				bright = (attr & 0x40) ? 8 : 0;
+				ink = zx_palette[(attr & 7) + bright];
+				pap = zx_palette[((attr >> 3) & 7) + bright];
+
+				bits = screen[pptr++];
+				px = 8;
+				while (px--)
+				{
+					line_buffer[optr++] = (bits & 0x80) ? ink : pap;
+					bits <<= 1;
+				}
+			}
+
+			tft.startWrite();
+			tft.setAddrWindow(0, CROP_TOP + ln % CROP_LINES, 128, 1);
+			tft.pushColors(line_buffer, 128, true);
+			tft.endWrite();
+#if defined(ZX_FRAME_CHECK)
+			frame_check.line(CROP_TOP + ln % CROP_LINES, line_buffer, 128);
+#endif
+
+			telemetry.spi_bytes += 128 * 2;
+			++telemetry.dirty_lines;
+
+#if defined(ZX_SCANLINE)
+			if (redraw) line_change[ln / 8] |= 1 << (ln & 7);
+#endif
+		}
+	}
+
+	//the two source lines of a row are blended in spread RGB565, so the weighted sum of four
+	//pixels fits in 32 bits, source lines shared by two rows are only cleared once both are done
+
+	void renderFill(uint8_t flash)
+	{
+		uint16_t pptr1, pptr2, optr;
+		uint8_t r, ch, px, la, lb, wa, wb, attr, bright, line1, line2;
+		uint32_t ink, pap, c;
+		uint32_t mixa[3], mixb[3];
+		const uint8_t* arow1;
+		const uint8_t* arow2;
+#if defined(ZX_SCANLINE)
+		uint8_t scan_row[32];
+		uint8_t redraw[24];
+		bool scan;
+
+		scan = scan_log.attrEvents() != 0;
+		memset(redraw, 0, sizeof(redraw));
+#endif
+
+		for (r = 0; r < 128; ++r)
+		{
+			la = fill_line[r];
+			lb = la + 1;
+			arow1 = &screen[6144 + la / 8 * 32];
+			arow2 = &screen[6144 + lb / 8 * 32];
+
+#if defined(ZX_SCANLINE)
+			if (scan)
+			{
+				scan_log.advance(scan_attrs, la);
+				memcpy(scan_row, &scan_attrs[la / 8 * 32], 32);
+				scan_log.advance(scan_attrs, lb);
+
+				if (memcmp(scan_row, arow1, 32)) redraw[la / 8] |= 1 << (la & 7);
+				if (memcmp(&scan_attrs[lb / 8 * 32], arow2, 32)) redraw[lb / 8] |= 1 << (lb & 7);
+
+				arow1 = scan_row;
+				arow2 = &scan_attrs[lb / 8 * 32];
+			}
+#endif
+
+			if (!(line_change[la / 8] & (1 << (la & 7))) && !(line_change[lb / 8] & (1 << (lb & 7)))) continue;
+
+			wa = fill_weight[r];
+			wb = 16 - wa;
+
+			pptr1 = (la & 7) * 256 + ((la / 8) & 7) * 32 + (la / 64) * 2048;
+			pptr2 = (lb & 7) * 256 + ((lb / 8) & 7) * 32 + (lb / 64) * 2048;
+			optr = 0;
+
+			for (ch = 0; ch < 32; ++ch)
+			{
+				attr = arow1[ch];
+				if (attr & flash) attr = (attr & 0x40) | ((attr & 7) << 3) | ((attr >> 3) & 7);
+				bright = (attr & 0x40) ? 8 : 0;
+				ink = RGB565SPREAD(zx_palette[(attr & 7) + bright]) * wa;
+				pap = RGB565SPREAD(zx_palette[((attr >> 3) & 7) + bright]) * wa;
+
+				mixa[0] = pap * 2;
+				mixa[1] = ink + pap;
+				mixa[2] = ink * 2;
+
+				attr = arow2[ch];
+				if (attr & flash) attr = (attr & 0x40) | ((attr & 7) << 3) | ((attr >> 3) & 7);
+				bright = (attr & 0x40) ? 8 : 0;
+				ink = RGB565SPREAD(zx_palette[(attr & 7) + bright]) * wb;
+				pap = RGB565SPREAD(zx_palette[((attr >> 3) & 7) + bright]) * wb;
+
+				mixb[0] = pap * 2;
+				mixb[1] = ink + pap;
+				mixb[2] = ink * 2;
+
+				line1 = screen[pptr1++];
+				line2 = screen[pptr2++];
+				px = 4;
+				while (px--)
+				{
+					c = mixa[(line1 >> 7) + ((line1 >> 6) & 1)] + mixb[(line2 >> 7) + ((line2 >> 6) & 1)];
+					c = (c >> 5) & 0x07E0F81F;
+
+					line_buffer[optr++] = c | (c >> 16);
+
+					line1 <<= 2;
+					line2 <<= 2;
+				}
+			}
+
+			tft.startWrite();
+			tft.setAddrWindow(0, r, 128, 1);
+			tft.pushColors(line_buffer, 128, true);
+			tft.endWrite();
+#if defined(ZX_FRAME_CHECK)
+			frame_check.line(r, line_buffer, 128);
+#endif
+
+			telemetry.spi_bytes += 128 * 2;
+			++telemetry.dirty_lines;
+
+			if (r < 8) overlay_damaged = true;
+		}
+
+		memset(line_change, 0, sizeof(line_change));
+
+#if defined(ZX_SCANLINE)
+		for (r = 0; r < 24; ++r) line_change[r] |= redraw[r];
+#endif
+	}
+
+	//one LCD row out of the two Spectrum lines from pptr1, the inner loop of renderFrame()
+
+	ZX_HOT void renderRow(const uint8_t* arow1, const uint8_t* arow2, uint16_t pptr1, uint8_t flash)
+	{
+		uint16_t ch, px, attr, optr, pptr2;
+		uint8_t line1, line2;
+		const uint16_t* mix;
+#if defined(ZX_SCANLINE)
+		const uint16_t* mix2;
+		uint_fast16_t col;
+#endif
+
+		pptr2 = pptr1 + 256;
+		optr = 0;
+
+		for (ch = 0; ch < 32; ++ch)
+		{
+			attr = arow1[ch];
+			if (attr & flash) attr = (attr & 0x40) | ((attr & 7) << 3) | ((attr >> 3) & 7);
+			mix = &zx_blend[(attr & 0x7f) * 5];
+
+			line1 = screen[pptr1++];
+			line2 = screen[pptr2++];
+			px = 4;
+
+#if defined(ZX_SCANLINE)
+			if (arow2[ch] != arow1[ch])
+			{
+				//each line is blended with its own attribute, then the two are averaged
+				attr = arow2[ch];
+				if (attr & flash) attr = (attr & 0x40) | ((attr & 7) << 3) | ((attr >> 3) & 7);
+				mix2 = &zx_blend[(attr & 0x7f) * 5];
+
+				while (px--)
 				{
-					++sound_wr_ptr;
+					col = ((mix[nibble_bits[line1 >> 6] * 2] & 0xf7de) >> 1) + ((mix2[nibble_bits[line2 >> 6] * 2] & 0xf7de) >> 1);
+					line_buffer[optr++] = col;
 
-					if (sound_wr_ptr >= SOUND_BUFFER_SIZE) sound_wr_ptr = 0;
+					line1 <<= 2;
+					line2 <<= 2;
 				}
 
-				sacc -= ZX_CLOCK_FREQ / SAMPLE_RATE;
-				sout = 0;
+				continue;
 			}
+#endif
+
+			while (px--)
+			{
+				line_buffer[optr++] = mix[nibble_bits[(line1 >> 6) | ((line2 & 0xC0) >> 4)]];
 
-			ticks += n;
+				line1 <<= 2;
+				line2 <<= 2;
+			}
 		}
 	}
 
 	ZYMOSIS_INLINE void renderFrame()
 	{
-		uint16_t ch, ln, px, row, aptr, optr, attr, pptr1, pptr2, bright;
-		uint_fast16_t ink, pap;
+		uint16_t ln, row, aptr, pptr1, budget, drawn;
 		uint_fast16_t col = 0;
-		uint8_t line1, line2;
+		uint8_t flash, age;
+		uint8_t hist[8];
+		uint32_t t;
+		const uint8_t* arow1;
+		const uint8_t* arow2;
+#if defined(ZX_SCANLINE)
+		uint8_t scan_row[32];
+		bool scan, redraw;
+#endif
+
+		flash = (flash_frame & 16) ? 0x80 : 0; //FLASH cells show ink and paper swapped
+
+#if defined(ZX_SCANLINE)
+		//replay the attribute writes from the start of frame state
+		scan = scan_log.attrEvents() != 0;
+
+		if (scan)
+		{
+			memcpy(scan_attrs, &screen[6144], sizeof(scan_attrs));
+			scan_log.rewind(scan_attrs);
+		}
+#endif
 
-		const uint_fast16_t palette[16] = {
-		  RGB565Q(0, 0, 0),
-		  RGB565Q(0, 29, 200),
-		  RGB565Q(216, 36, 15),
-		  RGB565Q(213, 48, 201),
-		  RGB565Q(0, 199, 33),
-		  RGB565Q(0, 201, 203),
-		  RGB565Q(206, 202, 39),
-		  RGB565Q(203, 203, 203),
-		  RGB565Q(0, 0, 0),
-		  RGB565Q(0, 39, 251),
-		  RGB565Q(255, 48, 22),
-		  RGB565Q(255, 63, 252),
-		  RGB565Q(0, 249, 44),
-		  RGB565Q(0, 252, 254),
-		  RGB565Q(255, 253, 51),
-		  RGB565Q(255, 255, 255),
-		};
+		if (display_mode == DISPLAY_CROP)
+		{
+			renderCrop(flash);
+			return;
+		}
 
+		if (display_mode == DISPLAY_FILL)
+		{
+			renderFill(flash);
+			return;
+		}
 
 		if (border_changed)
 		{
 			tft.startWrite();
 			border_changed = false;
 
-			col = LHSWAP(palette[port_fe & 7] << 2);
-			tft.setAddrWindow(0, 0, 128, 16);
-			tft.writeColor(col, 2048);
-			tft.setAddrWindow(0, 112, 128, 16);
-			tft.writeColor(col, 2048);
+#if defined(ZX_SCANLINE)
+			if (scan_log.borderEvents())
+			{
+				//each row shows the colour of its first frame line, redrawn next time in case the effect stops
+				border_changed = true;
+
+				for (row = 0; row < 16; ++row)
+				{
+					tft.setAddrWindow(0, row, 128, 1);
+					tft.writeColor(LHSWAP(zx_palette[scan_log.borderAt(scan_first - 32 + row * 2)]), 128);
+					tft.setAddrWindow(0, 112 + row, 128, 1);
+					tft.writeColor(LHSWAP(zx_palette[scan_log.borderAt(scan_first + 192 + row * 2)]), 128);
+#if defined(ZX_FRAME_CHECK)
+					frame_check.fill(row, 1, 128, zx_palette[scan_log.borderAt(scan_first - 32 + row * 2)]);
+					frame_check.fill(112 + row, 1, 128, zx_palette[scan_log.borderAt(scan_first + 192 + row * 2)]);
+#endif
+				}
+			}
+			else
+#endif
+			{
+				col = LHSWAP(zx_palette[port_fe & 7]);
+				tft.setAddrWindow(0, 0, 128, 16);
+				tft.writeColor(col, 2048);
+				tft.setAddrWindow(0, 112, 128, 16);
+				tft.writeColor(col, 2048);
+#if defined(ZX_FRAME_CHECK)
+				frame_check.fill(0, 16, 128, zx_palette[port_fe & 7]);
+				frame_check.fill(112, 16, 128, zx_palette[port_fe & 7]);
+#endif
+			}
 			tft.endWrite();
+
+			telemetry.spi_bytes += 2 * 2048 * 2;
+			overlay_damaged = true;
 		}
 
-		row = 16;
+		//the oldest dirty rows that fit in the budget are drawn, the rest wait for the next frame
+		//rows are still visited in order, so the scanline replay works the same
+
+		memset(hist, 0, sizeof(hist));
 
 		for (ln = 0; ln < 192; ln += 2)
 		{
-			if (!(line_change[ln / 8] & (3 << (ln & 7))))
+			if (line_change[ln / 8] & (3 << (ln & 7)))
 			{
-				++row;
-				continue;
+				if (row_age[ln / 2] < 7) ++row_age[ln / 2];
+				++hist[row_age[ln / 2]];
 			}
+		}
 
-			line_change[ln / 8] &= ~(3 << (ln & 7));
+		budget = ZX_RENDER_BUDGET ? ZX_RENDER_BUDGET / row_us : 96;
+		if (!budget) budget = 1;
 
-			pptr1 = (ln & 7) * 256 + ((ln / 8) & 7) * 32 + (ln / 64) * 2048;
-			pptr2 = pptr1 + 256;
+		age = 7;
+		while (age && hist[age] <= budget) budget -= hist[age--];
+
+		drawn = 0;
+		t = micros();
+
+		row = 16;
+
+		for (ln = 0; ln < 192; ln += 2)
+		{
 			aptr = 6144 + ln / 8 * 32;
-			optr = 0;
+			arow1 = &screen[aptr];
+			arow2 = arow1;
 
-			for (ch = 0; ch < 32; ++ch)
+#if defined(ZX_SCANLINE)
+			redraw = false;
+
+			if (scan)
 			{
-				attr = memory[aptr++];
-				bright = (attr & 0x40) ? 8 : 0;
-				ink = palette[(attr & 7) + bright];
-				pap = palette[((attr >> 3) & 7) + bright];
+				scan_log.advance(scan_attrs, ln);
+				memcpy(scan_row, &scan_attrs[aptr - 6144], 32);
+				scan_log.advance(scan_attrs, ln + 1);
 
-				line1 = memory[pptr1++];
-				line2 = memory[pptr2++];
-				px = 4;
-				while (px--)
-				{
-					switch ((line1 >> 6) | ((line2 & 0xC0) >> 4))
-					{
-					case 0x00: col = pap * 4; break;
-					case 0x01:
-					case 0x02:
-					case 0x04:
-					case 0x08: col = ink + pap * 3; break;
-					case 0x07:
-					case 0x0B:
-					case 0x0D:
-					case 0x0E: col = ink * 3 + pap; break;
-					case 0x0F: col = ink * 4; break;
-					default: col = ink * 2 + pap * 2;
-					}
+				arow1 = scan_row;
+				arow2 = &scan_attrs[aptr - 6144];
 
-					line_buffer[optr++] = col;
+				//lines that differ from the end of frame state are drawn again next time
+				redraw = memcmp(arow1, &screen[aptr], 32) || memcmp(arow2, &screen[aptr], 32);
+			}
+#endif
 
-					line1 <<= 2;
-					line2 <<= 2;
-				}
+			if (!(line_change[ln / 8] & (3 << (ln & 7))))
+			{
+				++row;
+				continue;
+			}
+
+			if (row_age[ln / 2] < age || (row_age[ln / 2] == age && !budget))
+			{
+				++row;
+				continue;
 			}
 
+			if (row_age[ln / 2] == age) --budget;
+
+			line_change[ln / 8] &= ~(3 << (ln & 7));
+			row_age[ln / 2] = 0;
+			++drawn;
+
+			pptr1 = (ln & 7) * 256 + ((ln / 8) & 7) * 32 + (ln / 64) * 2048;
+			renderRow(arow1, arow2, pptr1, flash);
+
 			tft.startWrite();
 			tft.setAddrWindow(0, row++, 128, 1);
 			tft.pushColors(line_buffer, 128, true);
 			tft.endWrite();
+#if defined(ZX_FRAME_CHECK)
+			frame_check.line(row - 1, line_buffer, 128);
+#endif
+
+			telemetry.spi_bytes += 128 * 2;
+			++telemetry.dirty_lines;
+
+#if defined(ZX_SCANLINE)
+			if (redraw) line_change[ln / 8] |= 3 << (ln & 7);
+#endif
+		}
+
+		if (drawn)
+		{
+			t = (micros() - t) / drawn;
+			row_us = (row_us * 3 + t + 3) / 4;
 		}
 	}
 
@@ -477,8 +2068,12 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 	uint8_t load_z80(const char* filename)
 	{
 		uint8_t header[30];
-		int sz, len, ptr;
-		uint8_t rle;
+		uint8_t ext[56];
+		int sz, len, ptr, hw;
+		uint8_t rle, bank;
+#if !defined(ZX_PAGED_RAM)
+		uint8_t* buf;
+#endif
 
 		fs::File f = SPIFFS.open(filename, "r");
 
@@ -537,24 +2132,35 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 
 		if (pc) //v1 format
 		{
+#if defined(ZX_PAGED_RAM)
+			load_block_vm(f, sz, 0, MEMORY_SIZE, rle);
+#else
 			f.readBytes((char*)memory, sz);
 
 			if (rle) unrle(memory, 16384 * 3);
+#endif
 		}
 		else  //v2 or v3 format, features an extra header
 		{
-			//read actual PC from the extra header, skip rest of the extra header
+			//read actual PC and hardware type from the extra header, skip rest of the extra header
 
-			f.readBytes((char*)header, 4);
-			sz -= 4;
+			f.readBytes((char*)ext, 2);
+			sz -= 2;
 
-			len = header[0] + header[1] * 256 + 2 - 4;
-			pc = header[2] + header[3] * 256;
+			len = ext[0] + ext[1] * 256;
+			ptr = (len < (int)sizeof(ext) - 2) ? len : sizeof(ext) - 2;
 
-			f.seek(len, fs::SeekCur);
+			memset(&ext[2], 0, sizeof(ext) - 2);
+			f.readBytes((char*)&ext[2], ptr);
+			f.seek(len - ptr, fs::SeekCur);
 			sz -= len;
 
-			//unpack 16K pages
+			pc = ext[2] + ext[3] * 256;
+			hw = ext[4];
+
+			if (len == 23 ? (hw == 3 || hw == 4) : (hw == 4 || hw == 5 || hw == 6 || hw == 12)) set_machine(MACHINE_128K);
+
+			//unpack 16K pages, 128K pages are stored packed as they are
 
 			while (sz > 0)
 			{
@@ -563,6 +2169,49 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 
 				len = header[0] + header[1] * 256;
 
+				if (machine_type == MACHINE_128K)
+				{
+					if (header[2] >= 3 && header[2] < 3 + ZXBankStore::BANKS)
+					{
+						bank = header[2] - 3;
+
+#if defined(ZX_PAGED_RAM)
+						if (len == 0xffff)
+						{
+							load_block_vm(f, ZXBankStore::BANK_SIZE, bank * ZXBankStore::BANK_SIZE, ZXBankStore::BANK_SIZE, 0);
+							len = ZXBankStore::BANK_SIZE;
+						}
+						else
+						{
+							load_block_vm(f, len, bank * ZXBankStore::BANK_SIZE, ZXBankStore::BANK_SIZE, 1);
+						}
+#else
+						//0xffff is an unpacked page, a packed one can be BANK_SIZE long as well
+
+						buf = banks.store(bank, (len == 0xffff) ? ZXBankStore::BANK_SIZE : len, len == 0xffff);
+
+						if (len == 0xffff) len = ZXBankStore::BANK_SIZE;
+
+						if (!buf)
+						{
+							bank_error = true;
+							break;
+						}
+
+						f.readBytes((char*)buf, len);
+#endif
+					}
+					else
+					{
+						if (len == 0xffff) len = ZXBankStore::BANK_SIZE;
+
+						f.seek(len, fs::SeekCur);
+					}
+
+					sz -= len;
+					continue;
+				}
+
 				switch (header[2])
 				{
 				case 4: ptr = 0x8000; break;
@@ -572,14 +2221,27 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 					ptr = 0;
 				}
 
+				if (len == 0xffff) //uncompressed page
+				{
+					len = 16384;
+					rle = 0;
+				}
+				else
+				{
+					rle = 1;
+				}
+
 				if (ptr)
 				{
 					ptr -= 0x4000;
-
+#if defined(ZX_PAGED_RAM)
+					load_block_vm(f, len, ptr, 16384, rle);
+#else
 					f.readBytes((char*)&memory[ptr], len);
-					sz -= len;
 
-					if (len < 0xffff) unrle(&memory[ptr], 16384);
+					if (rle) unrle(&memory[ptr], 16384);
+#endif
+					sz -= len;
 				}
 				else
 				{
@@ -587,10 +2249,28 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 					sz -= len;
 				}
 			}
+
+			if (machine_type == MACHINE_128K)
+			{
+				port_7ffd = ext[5];
+				page128();
+			}
 		}
 
 		f.close();
 
+#if defined(ZX_PAGED_RAM)
+		vm_flush();
+#endif
+
+		if (bank_error) return 0;
+
+		flash_rebuild();
+
+#if defined(ZX_BLOCK_CACHE)
+		codeInvalidate(0x0000, 0x10000);
+#endif
+
 		return 1;
 	}
 
@@ -600,16 +2280,55 @@ class Z48_ESPBoy : protected zymosis::Z80CallBacks
 
 		if (!f) return 0;
 
+#if defined(ZX_PAGED_RAM)
+		f.readBytes((char*)vm_screen[0], 6912);
+#else
 		f.readBytes((char*)memory, 6912);
+#endif
 		f.close();
 
 		memset(line_change, 0xff, sizeof(line_change));
+		flash_rebuild();
+
+#if defined(ZX_BLOCK_CACHE)
+		codeInvalidate(0x4000, 6912);
+#endif
 
 		return 1;
 	}
 };
 
-zymosis::Z80Cpu<Z48_ESPBoy> cpu;
+ZXCpu cpu;
+
+#if defined(ZX_BLOCK_CACHE)
+//ZXCACHE <hits> <bypasses> <misses> <evictions> <invalidations>, counted since start
+
+void cache_dump(Print& out)
+{
+	char buf[80];
+
+	snprintf(buf, sizeof(buf), "ZXCACHE %lu %lu %lu %lu %lu",
+		(unsigned long)cpu.cache_stats.hits, (unsigned long)cpu.cache_stats.bypasses, (unsigned long)cpu.cache_stats.misses,
+		(unsigned long)cpu.cache_stats.evictions, (unsigned long)cpu.cache_stats.invalidations);
+	out.println(buf);
+}
+#endif
+#if defined(ZX_FUSION)
+//ZXFUSE <ld a,(hl)+inc hl> <ld (de),a+inc de> <dec bc..jr nz> <djnz $ passes>, counted since start
+
+void fusion_dump(Print& out)
+{
+	char buf[80];
+
+	snprintf(buf, sizeof(buf), "ZXFUSE %lu %lu %lu %lu",
+		(unsigned long)cpu.fusion_stats.ldInc, (unsigned long)cpu.fusion_stats.stInc,
+		(unsigned long)cpu.fusion_stats.decJr, (unsigned long)cpu.fusion_stats.djnz);
+	out.println(buf);
+}
+#endif
+#if defined(ZX_DEBUG)
+ZXGdbStub<Z48_ESPBoy> gdb(cpu, debugger);
+#endif
 
 int check_key()
 {
@@ -991,6 +2710,9 @@ void file_browser(const char* path, const __FlashStringHelper* header, char* fna
 void ICACHE_RAM_ATTR sound_ISR()
 {
 	size_t gap;
+	uint32_t cycles;
+
+	cycles = ESP.getCycleCount();
 
 	sigmaDeltaWrite(0, sound_dac);
 
@@ -1003,10 +2725,144 @@ void ICACHE_RAM_ATTR sound_ISR()
 		++sound_rd_ptr;
 
 		if (sound_rd_ptr >= SOUND_BUFFER_SIZE) sound_rd_ptr = 0;
+
+		if (sound_rd_ptr == sound_wr_ptr) ++telemetry.audio_underruns;
+	}
+
+	telemetry.audio_cycles += ESP.getCycleCount() - cycles;
+}
+
+//rendered frames per second and the share of the time the emulator was busy
+
+void overlay_draw()
+{
+	const ZXTelemetryReport& r = telemetry.last;
+	char buf[16];
+	uint32_t fps, busy;
+
+	fps = r.window_us ? (r.renders * 1000000UL + r.window_us / 2) / r.window_us : 0;
+	busy = r.window_us ? (r.emulate_us + r.render_us + r.input_us + r.audio_us) / (r.window_us / 100) : 0;
+
+	snprintf(buf, sizeof(buf), "%2u %3u%%", (unsigned)fps, (unsigned)busy);
+	printFast(0, 0, buf, TFT_WHITE);
+}
+
+
+
+#if defined(ZX_SELFCHECK)
+#if !defined(ZX_IRAM_CORE)
+//emulated MHz * 100 of a core built with policy P, on a quarter second of the ROM start-up
+
+//frames are run by emulateFrame() as in the game, only the core policy differs
+
+template<class P>
+uint32_t zx_bench()
+{
+	typedef zymosis::Z80Cpu<Z48_ESPBoy, P> BenchCpu;
+	BenchCpu* bench;
+	uint32_t t, ts;
+
+	bench = new BenchCpu;
+	bench->Z80_Reset();
+
+	t = micros();
+	ts = 0;
+
+	while (ts < ZX_CLOCK_FREQ / 4)
+	{
+		bench->template emulateFrame<BenchCpu>();
+		ts += frame_tstates;
+		delay(0);
+	}
+
+	t = micros() - t;
+
+	delete bench;
+
+	return (uint64_t)ts * 100 / t;
+}
+
+//the full core, then without one feature at a time, then with none of them, and last
+//without contention but with resident registers, with lazy flags as well, and with fusion
+//as well but without breakpoints, which fusion skips
+
+void zx_bench_policies(char* first, char* last, size_t size)
+{
+	static const char names[11][8] = { "full", "-cont", "-m1", "-pager", "-bp", "-memptr", "-r", "none", "-c+res", "+lazy", "+fuse" };
+	uint32_t mhz[11];
+	char buf[32];
+	uint8_t i;
+
+	mhz[0] = zx_bench<zymosis::Z80FullPolicy>();
+	mhz[1] = zx_bench<zymosis::Z80Policy<false, true, true, true, true, true> >();
+	mhz[2] = zx_bench<zymosis::Z80Policy<true, false, true, true, true, true> >();
+	mhz[3] = zx_bench<zymosis::Z80Policy<true, true, false, true, true, true> >();
+	mhz[4] = zx_bench<zymosis::Z80Policy<true, true, true, false, true, true> >();
+	mhz[5] = zx_bench<zymosis::Z80Policy<true, true, true, true, false, true> >();
+	mhz[6] = zx_bench<zymosis::Z80Policy<true, true, true, true, true, false> >();
+	mhz[7] = zx_bench<zymosis::Z80Policy<false, false, false, false, false, false> >();
+	mhz[8] = zx_bench<zymosis::Z80Policy<false, true, true, true, true, true, true> >();
+	mhz[9] = zx_bench<zymosis::Z80Policy<false, true, true, true, true, true, true, true> >();
+	mhz[10] = zx_bench<zymosis::Z80Policy<false, true, true, false, true, true, true, true, true> >();
+
+	for (i = 0; i < 11; ++i)
+	{
+		snprintf(buf, sizeof(buf), "%-8s%lu.%02lu MHz", names[i], (unsigned long)mhz[i] / 100, (unsigned long)mhz[i] % 100);
+		Serial.println(buf);
+
+		if (i == 0) strncpy(first, buf, size);
+		if (i == 7) strncpy(last, buf, size);
 	}
 }
+#endif
+
+void zx_selfcheck()
+{
+	char buf[24];
+#if !defined(ZX_IRAM_CORE)
+	char full[32], none[32];
+#endif
+	uint32_t t, ts;
+	bool ok;
 
+	ok = cpu.Z80_SelfCheck();
 
+	cpu.Z80_Reset();
+
+	t = micros();
+	ts = 0;
+
+	while (ts < ZX_CLOCK_FREQ)
+	{
+		cpu.emulateFrame();
+		ts += frame_tstates;
+		delay(0);
+	}
+
+	t = micros() - t;
+	ts = (uint64_t)ts * 100 / t; //emulated MHz * 100
+
+	tft.fillScreen(TFT_BLACK);
+	printFast_P(4, 52, ok ? PSTR("Z80 flags ok") : PSTR("Z80 flags FAILED"), ok ? TFT_GREEN : TFT_RED);
+	snprintf(buf, sizeof(buf), "%lu.%02lu MHz", (unsigned long)ts / 100, (unsigned long)ts % 100);
+	printFast(4, 64, buf, TFT_WHITE);
+
+	Serial.println(ok ? "Z80 flags ok" : "Z80 flags FAILED");
+	Serial.println(buf);
+
+#if !defined(ZX_IRAM_CORE)
+	//every policy gets its own Z80_Execute(), they would not fit in IRAM together
+	zx_bench_policies(full, none, sizeof(full));
+	full[sizeof(full) - 1] = 0;
+	none[sizeof(none) - 1] = 0;
+
+	printFast(4, 80, full, TFT_WHITE);
+	printFast(4, 92, none, TFT_WHITE);
+#endif
+
+	wait_any_key(3 * 1000);
+}
+#endif
 
 void zx_setup() {
 
@@ -1041,6 +2897,14 @@ void zx_setup() {
 		tft.begin();
 		tft.setRotation(0);
 		tft.fillScreen(TFT_BLACK);
+		lcd_scroll_area();
+		lcd_scroll(0);
+		fill_init();
+
+#if defined(ZX_TELEMETRY_SERIAL) || defined(ZX_PROFILER) || defined(ZX_TRACE) || defined(ZX_DEBUG) || defined(ZX_FRAME_CHECK) || defined(ZX_SELFCHECK) || defined(ZX_BLOCK_CACHE) || defined(ZX_FUSION)
+		Serial.begin(115200);
+#endif
+		zx_load_palette(nullptr);
 
 		dac.setVoltage(4095, true);
 
@@ -1064,7 +2928,11 @@ void zx_setup() {
 		else keybModuleExist = 0;
 
 		//cpu = new zymosis::Z80Cpu<Z48_ESPBoy>;
+#if defined(ZX_PAGED_RAM)
+		vram.begin(ZX_PAGED_RAM_FRAMES);
+#else
 		memory = (uint8_t*)malloc(MEMORY_SIZE);
+#endif
 
 		//filesystem init
 		SPIFFS.begin();
@@ -1140,15 +3008,28 @@ uint8_t zx_layout_code(uint8_t c)
 
 void zx_load_layout(char* filename)
 {
-	char cfg[8];
+	char cfg[32];
+	size_t len;
+
+#if defined(ZX_IDLE_SKIP)
+	idle.enabled = true;
+#endif
 
 	fs::File f = SPIFFS.open(filename, "r");
 
 	if (!f) return;
 
-	f.readBytes(cfg, 8);
+	memset(cfg, 0, sizeof(cfg));
+	len = f.readBytes(cfg, sizeof(cfg) - 1);
 	f.close();
 
+	if (len < 8) return;
+
+	//options after the layout
+#if defined(ZX_IDLE_SKIP)
+	if (strstr(&cfg[8], "noidle")) idle.enabled = false;
+#endif
+
 	control_type = CONTROL_PAD_KEYBOARD;
 	control_pad_u = zx_layout_code(cfg[0]);
 	control_pad_d = zx_layout_code(cfg[1]);
@@ -1206,6 +3087,7 @@ void redrawOnscreen(uint8_t slX, uint8_t slY, uint8_t shf) {
 
 void keybOnscreen() {
 	uint8_t selX = 0, selY = 0, shifts = 0;
+	lcd_scroll(0);
 	redrawOnscreen(selX, selY, shifts);
 	while (1) {
 		check_key();
@@ -1234,9 +3116,11 @@ void keybOnscreen() {
 
 void zx_loop()
 {
-		uint32_t t_prev, t_new;
+		uint32_t t_prev, t_new, t;
 		uint8_t frames;
-		uint32_t avgt = 0;
+#if defined(ZX_PROFILER) || defined(ZX_TRACE) || defined(ZX_DEBUG) || defined(ZX_FRAME_CHECK) || defined(ZX_BLOCK_CACHE) || defined(ZX_FUSION)
+		int c;
+#endif
 
 		file_cursor = 0;
 
@@ -1250,6 +3134,10 @@ void zx_loop()
 		control_pad_lft = K_NULL;
 		control_pad_rgt = K_NULL;
 
+#if defined(ZX_SELFCHECK)
+		zx_selfcheck();
+#endif
+
 		if (espboy_logo_effect(0))
 		{
 			wait_any_key(1000);
@@ -1265,6 +3153,9 @@ void zx_loop()
 			change_ext(filename, EXT_CFG);
 			zx_load_layout(filename);
 
+			change_ext(filename, EXT_PAL);
+			zx_load_palette(filename);
+
 			change_ext(filename, EXT_SCR);
 			if (cpu.load_scr(filename))
 			{
@@ -1287,6 +3178,8 @@ void zx_loop()
 		t_prev = micros();
 		while (1)
 		{
+			t = micros();
+
 			key_matriz.reset();
 			check_key();
 
@@ -1296,6 +3189,57 @@ void zx_loop()
 			//check keyboard module
 			if (keybModuleExist) keybModule();
 
+			//LFT+ACT shows or hides the overlay
+			if ((pad_state & PAD_LFT) && (pad_state_t & PAD_ACT))
+			{
+				overlay_enabled = !overlay_enabled;
+				display_set(display_mode);
+				pad_state = 0;
+			}
+
+#if defined(ZX_TRACE)
+			//LFT+DOWN writes the trace
+			if ((pad_state & PAD_LFT) && (pad_state_t & PAD_DOWN))
+			{
+				trace_save();
+				pad_state = 0;
+			}
+
+#endif
+			//LFT+ESC switches the display mode
+			if ((pad_state & PAD_LFT) && (pad_state_t & PAD_ESC))
+			{
+				display_set((display_mode == DISPLAY_CROP) ? DISPLAY_SCALED : display_mode + 1);
+				pad_state = 0;
+			}
+
+			//RGT with the pad pans the 1:1 viewport, RGT+ACT makes it follow the game again
+			if (display_mode == DISPLAY_CROP)
+			{
+				if ((pad_state & PAD_RGT) && (pad_state & (PAD_UP | PAD_DOWN | PAD_LEFT | PAD_RIGHT | PAD_ACT)))
+				{
+					if (pad_state_t & PAD_ACT) view_auto = true;
+
+					if (pad_state & (PAD_UP | PAD_DOWN))
+					{
+						view_auto = false;
+						view_pan(view_x, view_y + ((pad_state & PAD_DOWN) ? 2 : -2));
+					}
+
+					if (pad_state_t & (PAD_LEFT | PAD_RIGHT))
+					{
+						view_auto = false;
+						view_pan(view_x + ((pad_state_t & PAD_RIGHT) ? 2 : -2), view_y);
+					}
+
+					pad_state = 0;
+				}
+				else if (view_auto)
+				{
+					view_track();
+				}
+			}
+
 			switch (control_type)
 			{
 			case CONTROL_PAD_KEYBOARD:
@@ -1323,26 +3267,89 @@ void zx_loop()
 			}
 
 			t_new = micros();
+			telemetry.input_us += t_new - t;
+
 			frames = ((t_new - t_prev) / (1000000 / ZX_FRAME_RATE));
 			if (frames < 1) frames = 1;
 			t_prev = t_new;
 
 			if (frames > MAX_FRAMESKIP) frames = MAX_FRAMESKIP;
 
+			telemetry.frames += frames;
+			telemetry.skipped += frames - 1;
+
 			while (frames--) cpu.emulateFrame();
 
-			uint32_t tp = t_prev; // micros();
+			t = micros();
+			telemetry.emulate_us += t - t_new;
+
+			//the bank store could not page a bank in even after dropping every packed copy
+			//it can rebuild, start over with the file browser
+
+			if (bank_error)
+			{
+				tft.fillScreen(TFT_BLACK);
+				printFast_P(24, 60, PSTR("Out of memory"), TFT_RED);
+
+				wait_any_key(0);
+				ESP.restart();
+			}
 
 			cpu.renderFrame();
 
-			uint32_t tt = micros() - tp;
-			uint32_t st = 1000000 / tt;
+			++telemetry.renders;
+
+			if (telemetry.tick(micros()))
+			{
+				overlay_damaged = true;
+#if defined(ZX_TELEMETRY_SERIAL)
+				telemetry.dump(Serial);
+#endif
+			}
+
+#if defined(ZX_PROFILER) || defined(ZX_TRACE) || defined(ZX_DEBUG) || defined(ZX_FRAME_CHECK) || defined(ZX_BLOCK_CACHE) || defined(ZX_FUSION)
+			//serial commands: p prints the profile, r starts it again, t prints the trace,
+			//f prints the frame checksum, c the block cache counts, u the fusion counts
+			while (Serial.available())
+			{
+				c = Serial.read();
+
+#if defined(ZX_DEBUG)
+				if (gdb.feed(c, Serial)) continue;
+#endif
+
+				switch (c)
+				{
+#if defined(ZX_PROFILER)
+				case 'p': cpu.profileDump(Serial); break;
+				case 'r': profiler.reset(); break;
+#endif
+#if defined(ZX_TRACE)
+				case 't': trace.dump(Serial); break;
+#endif
+#if defined(ZX_FRAME_CHECK)
+				case 'f': frame_check.dump(Serial); break;
+#endif
+#if defined(ZX_BLOCK_CACHE)
+				case 'c': cache_dump(Serial); break;
+#endif
+#if defined(ZX_FUSION)
+				case 'u': fusion_dump(Serial); break;
+#endif
+				}
+			}
+#endif
+#if defined(ZX_DEBUG)
+			gdb.poll(Serial);
+#endif
 
-			avgt = ((avgt * 19) + tt) / 20;
+			if (overlay_enabled && overlay_damaged)
+			{
+				overlay_draw();
+				overlay_damaged = false;
+			}
 
-			tft.fillRect(0, 0, 6 * 4, 10, TFT_BLACK);
-			//tft.drawString(String(avgt), 0, 10);
-			tft.drawString(String(st), 0, 0);
+			telemetry.render_us += micros() - t;
 
 			delay(0);
 		}
@@ -0,0 +1,219 @@
+/*
+ * 128K bank store: packing round trips, pages whose packed stream is exactly BANK_SIZE
+ * long, LRU paging however many acquires back, and bank switching against a plain copy
+ * of all eight banks with the heap limited, counting the mallocs dirty paging costs.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+/* the store allocates through these, so the test can run it out of heap */
+static size_t heap_used, heap_limit = (size_t)-1;
+static uint32_t heap_mallocs;
+static std::map<void*, size_t> heap_blocks;
+
+static void* test_malloc(size_t n)
+{
+	void* p;
+
+	if (heap_used + n > heap_limit) return nullptr;
+	p = malloc(n);
+	heap_blocks[p] = n;
+	heap_used += n;
+	++heap_mallocs;
+	return p;
+}
+
+static void test_free(void* p)
+{
+	if (!p) return;
+	heap_used -= heap_blocks[p];
+	heap_blocks.erase(p);
+	free(p);
+}
+
+#define malloc test_malloc
+#define free test_free
+#include "zxbanks.hpp"
+#undef malloc
+#undef free
+
+static const size_t BANK = ZXBankStore::BANK_SIZE;
+
+/* bank contents from noise to long runs, every fourth with ED bytes in it */
+static void fill(uint8_t* p, uint32_t kind)
+{
+	uint32_t i;
+
+	for (i = 0; i < BANK; ++i) {
+		uint32_t r = rand();
+		switch (kind % 4) {
+		case 0: p[i] = r; break;
+		case 1: p[i] = (r % 3 == 0) ? 0xed : r % 2; break;
+		case 2: p[i] = (i / 300) & 0xff; break;
+		default: p[i] = (r % 50 == 0) ? 0xed : 0; break;
+		}
+	}
+}
+
+static bool roundTrips()
+{
+	static uint8_t a[BANK], b[BANK], packed[BANK * 2];
+	uint32_t t;
+	size_t n;
+
+	for (t = 0; t < 400; ++t) {
+		fill(a, t);
+		n = ZXBankStore::pack(a, nullptr);
+		if (ZXBankStore::pack(a, packed) != n || ZXBankStore::pack(a, packed, n / 2) != n) { printf("banks: pack size differs, round %u\n", t); return false; }
+		ZXBankStore::pack(a, packed);
+		ZXBankStore::unpack(packed, n, false, b);
+		if (memcmp(a, b, BANK)) { printf("banks: round trip %u differs\n", t); return false; }
+	}
+	return true;
+}
+
+/* six zeros pack to 4 bytes, a pair of EDs to 4, the rest is literal: BANK_SIZE packed */
+static void exactBank(uint8_t* p)
+{
+	uint32_t i;
+
+	memset(p, 0, 6);
+	p[6] = p[7] = 0xed;
+	for (i = 8; i < BANK; ++i) p[i] = 1 + (i * 7 + (i >> 5)) % 0xe0;
+}
+
+static bool exactSize()
+{
+	static uint8_t a[BANK], packed[BANK];
+	ZXBankStore store;
+	static uint8_t frames[3 * BANK];
+	uint8_t* buf;
+	uint8_t* p;
+
+	exactBank(a);
+	if (ZXBankStore::pack(a, nullptr) != BANK) { puts("banks: test bank does not pack to BANK_SIZE"); return false; }
+	ZXBankStore::pack(a, packed);
+
+	/* from a snapshot, as a packed page */
+	store.begin(frames, 3, 0);
+	buf = store.store(3, BANK, false);
+	memcpy(buf, packed, BANK);
+	p = store.acquire(3, 1 << 3);
+	if (!p || memcmp(p, a, BANK)) { puts("banks: packed page of BANK_SIZE bytes read back as raw"); return false; }
+
+	/* paged out after a write, it is kept raw then */
+	store.touch(3);
+	store.acquire(0, 1 << 0);
+	store.acquire(1, 1 << 1);
+	store.acquire(2, 1 << 2);
+	p = store.acquire(3, 1 << 3);
+	if (!p || memcmp(p, a, BANK)) { puts("banks: written BANK_SIZE bank differs after paging"); return false; }
+
+	store.end();
+	return true;
+}
+
+/* the least recently used bank is paged out however many acquires ago it was used: */
+/* bank 0 is left alone while banks 1 and 2 are paged in turn, n times */
+static bool leastRecent()
+{
+	static uint8_t frames[3 * BANK];
+	ZXBankStore store;
+	uint8_t* first;
+	uint32_t n, k;
+
+	for (n = 0; n < 600; ++n) {
+		store.begin(frames, 3, 0);
+		first = store.acquire(0, 0);
+		store.acquire(1, 0);
+		store.acquire(2, 0);
+		for (k = 0; k < n; ++k) store.acquire(1 + k % 2, 0);
+		if (store.acquire(3, 0) != first) { printf("banks: bank 0 not paged out after %u acquires\n", n); return false; }
+		store.end();
+	}
+	return true;
+}
+
+/* page128() of ZX48.cpp: banks 5 and 2 stay in, a random bank at #c000 gets written; */
+/* slack is the heap left once the banks are loaded */
+static bool switching(size_t slack, uint32_t rounds, uint32_t& failures, uint32_t& mallocs)
+{
+	static uint8_t frames[3 * BANK];
+	std::vector<std::vector<uint8_t> > ref(8, std::vector<uint8_t>(BANK, 0));
+	ZXBankStore store;
+	uint32_t t, k;
+	uint8_t bank, keep;
+	uint8_t* p;
+	const uint8_t* s;
+
+	heap_limit = (size_t)-1;
+	store.begin(frames, 3, 0);
+	for (bank = 0; bank < 8; ++bank) {
+		fill(ref[bank].data(), 2 + bank % 2);
+		uint8_t* buf = store.store(bank, ZXBankStore::pack(ref[bank].data(), nullptr), false);
+		ZXBankStore::pack(ref[bank].data(), buf);
+	}
+
+	heap_limit = (slack == (size_t)-1) ? slack : heap_used + slack;
+	heap_mallocs = 0;
+	failures = 0;
+	srand(7);
+	for (t = 0; t < rounds; ++t) {
+		bank = rand() % 8;
+		keep = (1 << 5) | (1 << 2) | (1 << bank);
+		store.acquire(5, keep);
+		store.acquire(2, keep);
+		store.touch(5);
+		store.touch(2);
+
+		p = store.acquire(bank, keep);
+		if (!p) { ++failures; continue; }
+		if (memcmp(p, ref[bank].data(), BANK)) { printf("banks: bank %u differs, round %u\n", bank, t); return false; }
+
+		/* games write the variables of most banks they page in, the packed size stays about the same */
+		if (rand() % 4) {
+			store.touch(bank);
+			for (k = 0; k < 64; ++k) {
+				uint32_t at = BANK - 1 - rand() % 256;
+				p[at] = ref[bank][at] = rand();
+			}
+		}
+
+		store.setScreen((t & 64) ? 7 : 5);
+		s = store.screen();
+		if (s && memcmp(s, ref[(t & 64) ? 7 : 5].data(), ZXBankStore::SCREEN_SIZE)) { printf("banks: screen differs, round %u\n", t); return false; }
+	}
+	mallocs = heap_mallocs;
+
+	heap_limit = (size_t)-1;
+	store.end();
+	return true;
+}
+
+int main()
+{
+	uint32_t failures, mallocs;
+	bool ok = roundTrips() && exactSize() && leastRecent();
+
+	if (ok) ok = switching((size_t)-1, 20000, failures, mallocs);
+	if (ok) {
+		printf("banks: 20000 switches, %u mallocs\n", mallocs);
+		/* a malloc for every written bank paged out would be about 11000 */
+		if (mallocs > 1000) { puts("banks: dirty paging still allocates every time"); ok = false; }
+	}
+
+	/* 4000 bytes of heap left over the packed banks and the screen shadow, without */
+	/* dropping the copies it can rebuild the store fails here */
+	if (ok) ok = switching(4000, 20000, failures, mallocs);
+	if (ok) {
+		printf("banks: tight heap, %u failed switches, %u mallocs\n", failures, mallocs);
+		if (failures) ok = false;
+	}
+
+	puts(ok ? "banks: ok" : "banks: FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/*
+ * The frame loop of ZX48.cpp on the host: emulateFrame() runs a program that copies and
+ * scans with LDIR and CPIR, loops, sounds the beeper and waits in HALT for the interrupt,
+ * frame after frame. The core has to reach the bulk block callbacks from there, and the
+ * RAM, the beeper samples and every frame have to come out as a plain core stepping the
+ * same program (z80host.hpp) makes them.
+ *
+ * With ZX_FUSION the copy loop, the DEC BC loop tests and the DJNZ $ delays have to run
+ * fused on every pass.
+ *
+ * With ZX_LAZY_FLAGS the flags CPIR leaves are read through PUSH AF after a whole run of
+ * the core has kept them lazy.
+ *
+ * Each build (plain, ZX_IDLE_SKIP, ZX_FUSION, ZX_LAZY_FLAGS) is its own test.
+ */
+#include "ZX48.cpp"
+#include "z80host.hpp"
+
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define FRAME_STR(x) FRAME_STR2(x)
+#define FRAME_STR2(x) #x
+
+EspClass ESP;
+HardwareSerial Serial;
+fs::FS SPIFFS;
+TwoWire Wire;
+ESP8266WiFiClass WiFi;
+
+static const std::string build = FRAME_STR(FRAME_BUILD);
+static char dir[] = "/tmp/zxframeXXXXXX";
+
+static const uint32_t FRAMES = 10;
+static const uint32_t SOUND_FRAME = 5;	/* the frame the beeper samples are checked on */
+static const uint32_t COPY = 0x300;		/* bytes LDIR copies and CPIR scans */
+
+/* the program at #8000, IM 2 through the table at #7000 to EI, RET at #7171 */
+static std::vector<uint8_t> program()
+{
+	static const uint8_t code[] = {
+		0x21, 0x00, 0x90,			/* LD HL,#9000 */
+		0x11, 0x00, 0xa0,			/* LD DE,#A000 */
+		0x01, COPY & 0xff, COPY >> 8,	/* LD BC,COPY */
+		0xed, 0xb0,					/* LDIR */
+		0x21, 0x00, 0x90,			/* LD HL,#9000 */
+		0x01, COPY & 0xff, COPY >> 8,	/* LD BC,COPY */
+		0x3e, 0xff,					/* LD A,#FF, not in the data */
+		0xed, 0xb1,					/* CPIR */
+		0xf5, 0xe1,					/* PUSH AF, POP HL */
+		0x22, 0x02, 0xc0,			/* LD (#C002),HL */
+		0x21, 0x00, 0x90,			/* LD HL,#9000 */
+		0x11, 0x00, 0xb0,			/* LD DE,#B000 */
+		0x01, 0x80, 0x00,			/* LD BC,128 */
+		0x7e, 0x23, 0x12, 0x13,		/* LD A,(HL), INC HL, LD (DE),A, INC DE */
+		0x0b, 0x78, 0xb1, 0x20, 0xf7,	/* DEC BC, LD A,B, OR C, JR NZ */
+		0x06, 0x00, 0x10, 0xfe,		/* LD B,0, DJNZ $ */
+		0x3e, 0x10, 0xd3, 0xfe,		/* LD A,#10, OUT (#FE),A */
+		0x06, 0xc8, 0x10, 0xfe,		/* LD B,200, DJNZ $ */
+		0x01, 0xc8, 0x00,			/* LD BC,200 */
+		0x0b, 0x78, 0xb1, 0x20, 0xfb,	/* DEC BC, LD A,B, OR C, JR NZ */
+		0xaf, 0xd3, 0xfe,			/* XOR A, OUT (#FE),A */
+		0xed, 0x5f,					/* LD A,R */
+		0x32, 0x04, 0xc0,			/* LD (#C004),A */
+		0x2a, 0x00, 0xc0,			/* LD HL,(#C000) */
+		0x23,						/* INC HL */
+		0x22, 0x00, 0xc0,			/* LD (#C000),HL */
+		0x76,						/* HALT */
+	};
+	std::vector<uint8_t> ram(0xc000, 0);
+	uint32_t n;
+
+	std::copy(code, code + sizeof(code), ram.begin() + 0x4000);
+	ram[0x4000 + sizeof(code)] = 0x18;
+	ram[0x4000 + sizeof(code) + 1] = 0x100 - sizeof(code) - 2;
+
+	std::fill(ram.begin() + 0x3000, ram.begin() + 0x3101, 0x71);
+	ram[0x3171] = 0xfb;
+	ram[0x3172] = 0xc9;
+
+	for (n = 0; n < COPY; ++n) ram[0x5000 + n] = n % 251;
+	return ram;
+}
+
+/* a v1 .z80 snapshot of uncompressed RAM, as tests/render.cpp writes them */
+static std::vector<uint8_t> snapshot(const std::vector<uint8_t>& ram)
+{
+	std::vector<uint8_t> z80(30, 0);
+
+	z80[6] = 0x00;
+	z80[7] = 0x80;
+	z80[8] = 0x00;
+	z80[9] = 0xff;
+	z80[10] = 0x70;
+	z80[27] = 1;
+	z80[28] = 1;
+	z80[29] = 2;
+	z80.insert(z80.end(), ram.begin(), ram.end());
+	return z80;
+}
+
+/* the plain core stepping the same program, with the frames shaped as emulateFrame() shapes them */
+struct Reference {
+	z80host::HostCpu<z80host::PlainPolicy> cpu;
+	int32_t base;						/* frame T-state the run started at */
+	int32_t ticks;						/* T-states of the last frame */
+	std::vector<int32_t> edges;			/* frame T-states the beeper changed at in the last frame */
+	uint8_t level;
+
+	explicit Reference(const std::vector<uint8_t>& ram) : base(0), ticks(0), level(0)
+	{
+		std::copy(ram.begin(), ram.end(), cpu.mem + 0x4000);
+		cpu.rom = true;
+		cpu.af.w = cpu.bc.w = cpu.de.w = cpu.hl.w = 0;
+		cpu.afx.w = cpu.bcx.w = cpu.dex.w = cpu.hlx.w = 0;
+		cpu.ix.w = cpu.iy.w = 0;
+		cpu.sp.w = 0xff00;
+		cpu.pc = 0x8000;
+		cpu.regI = 0x70;
+		cpu.regR = 0;
+		cpu.im = 2;
+		cpu.iff1 = cpu.iff2 = 1;
+		/* as load_z80() leaves a snapshot with interrupts on, the first one waits an instruction */
+		cpu.prev_was_EIDDR = 1;
+		cpu.user = this;
+		cpu.portOut = [](z80host::HostCallBacks& cb, uint16_t port, uint8_t value) {
+			Reference* r = (Reference*)cb.user;
+
+			if (!(port & 0x01) && ((r->level ^ value) & 0x10)) r->edges.push_back(r->base + cb.tstates);
+			if (!(port & 0x01)) r->level = value;
+		};
+	}
+
+	void frame()
+	{
+		edges.clear();
+		cpu.tstates = 0;
+		ticks = cpu.Z80_Interrupt();
+		while (ticks < 69888) {
+			base = ticks;
+			ticks += cpu.Z80_ExecuteTS(69888 - ticks);
+		}
+	}
+
+	/* T-states of the frame the beeper was high for, it starts and ends the frame low */
+	int32_t high() const
+	{
+		int32_t t = 0;
+		size_t n;
+
+		for (n = 0; n + 1 < edges.size(); n += 2) t += edges[n + 1] - edges[n];
+		return t;
+	}
+};
+
+static bool ok = true;
+
+static void fail(const char* what, uint32_t f, long got, long expected)
+{
+	printf("frame %s: %s %ld after frame %u, expected %ld\n", build.c_str(), what, got, f, expected);
+	ok = false;
+}
+
+static uint8_t peek(uint16_t addr)
+{
+	return ram_page[addr >> 14][addr & 0x3fff];
+}
+
+/* the samples of one frame: as many as the frame has whole 72 T-state steps, give or take */
+/* the one the last frame left open, all high ones but the two at the edges of the tone */
+static void sound(uint32_t f, uint16_t from, const Reference& ref)
+{
+	const int32_t step = ZX_CLOCK_FREQ / SAMPLE_RATE;
+	uint32_t count, full = 0, part = 0;
+	uint16_t n;
+
+	count = (sound_wr_ptr + SOUND_BUFFER_SIZE - from) % SOUND_BUFFER_SIZE;
+	if (count != (uint32_t)(ref.ticks / step) && count != (uint32_t)(ref.ticks / step + 1)) fail("samples", f, count, ref.ticks / step);
+
+	for (n = from; n != sound_wr_ptr; n = (n + 1) % SOUND_BUFFER_SIZE) {
+		if (sound_buffer[n] == 127) ++full;
+		else if (sound_buffer[n]) ++part;
+	}
+	if (ref.edges.size() != 2) fail("beeper edges", f, ref.edges.size(), 2);
+	if (full != (uint32_t)(ref.high() / step) && full + 1 != (uint32_t)(ref.high() / step)) fail("high samples", f, full, ref.high() / step);
+	if (part > 2) fail("part high samples", f, part, 2);
+}
+
+int main()
+{
+	std::vector<uint8_t> ram = program();
+	std::vector<uint8_t> z80 = snapshot(ram);
+	Reference ref(ram);
+	uint32_t f, addr, copies, scans;
+	uint16_t from;
+	ZXCpu::Z80FusionStats fused;
+	FILE* file;
+
+	if (!mkdtemp(dir)) { puts("frame: no temporary directory"); return 1; }
+	SPIFFS.root(dir);
+
+	zx_setup();
+	sound_init();
+
+	file = fopen((std::string(dir) + "/frame.z80").c_str(), "wb");
+	if (!file) { puts("frame: cannot write the snapshot"); return 1; }
+	fwrite(z80.data(), 1, z80.size(), file);
+	fclose(file);
+
+	cpu.Z80_Reset();
+	if (!cpu.load_z80("/frame.z80")) { puts("frame: snapshot not loaded"); return 1; }
+	unlink((std::string(dir) + "/frame.z80").c_str());
+	rmdir(dir);
+
+	copies = cpu.block_stats.copies;
+	scans = cpu.block_stats.scans;
+	fused = cpu.fusion_stats;
+
+	for (f = 1; f <= FRAMES; ++f) {
+		/* the reader is one sample behind, so the frame can fill all the buffer but one */
+		from = sound_wr_ptr;
+		sound_rd_ptr = (from + SOUND_BUFFER_SIZE - 1) % SOUND_BUFFER_SIZE;
+
+		cpu.emulateFrame();
+		ref.frame();
+
+		if (f == SOUND_FRAME) sound(f, from, ref);
+
+		for (addr = 0x4000; addr < 0x10000; ++addr) {
+			if (peek(addr) != ref.cpu.mem[addr]) {
+				printf("frame %s: #%04x is %02x after frame %u, expected %02x\n", build.c_str(), addr, peek(addr), f, ref.cpu.mem[addr]);
+				ok = false;
+				break;
+			}
+		}
+		if (!ok) break;
+	}
+
+	if (peek(0xc000) != FRAMES) fail("passes", FRAMES, peek(0xc000), FRAMES);
+
+	/* the core runs the first and the last iteration of each, the rest go in bulk every frame */
+	if (cpu.block_stats.copies - copies != FRAMES * (COPY - 2)) fail("LDIR bulk iterations", FRAMES, cpu.block_stats.copies - copies, FRAMES * (COPY - 2));
+	if (cpu.block_stats.scans - scans != FRAMES * (COPY - 2)) fail("CPIR bulk iterations", FRAMES, cpu.block_stats.scans - scans, FRAMES * (COPY - 2));
+
+#if ZX_CPU_FUSION
+	/* every pass of the copy and wait loops, and all DJNZ $ passes but the first and last */
+	if (cpu.fusion_stats.ldInc - fused.ldInc != FRAMES * 128) fail("LD A,(HL) INC HL", FRAMES, cpu.fusion_stats.ldInc - fused.ldInc, FRAMES * 128);
+	if (cpu.fusion_stats.stInc - fused.stInc != FRAMES * 128) fail("LD (DE),A INC DE", FRAMES, cpu.fusion_stats.stInc - fused.stInc, FRAMES * 128);
+	if (cpu.fusion_stats.decJr - fused.decJr != FRAMES * (128 + 200)) fail("DEC BC loop tests", FRAMES, cpu.fusion_stats.decJr - fused.decJr, FRAMES * (128 + 200));
+	if (cpu.fusion_stats.djnz - fused.djnz != FRAMES * (254 + 198)) fail("DJNZ $ passes", FRAMES, cpu.fusion_stats.djnz - fused.djnz, FRAMES * (254 + 198));
+#endif
+
+#if defined(ZX_IDLE_SKIP)
+	/* the HALT is after the contended lines in every frame */
+	if (telemetry.idle_skips < FRAMES) fail("idle skips", FRAMES, telemetry.idle_skips, FRAMES);
+#endif
+
+	printf("frame %s: %s\n", build.c_str(), ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
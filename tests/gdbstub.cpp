@@ -0,0 +1,246 @@
+/*
+ * GDB remote stub of zxdebug.hpp on a host build of the core.
+ *
+ *   gdbstub                       scripted session, checks every reply
+ *   gdbstub serve [file [addr]]   talks the protocol on stdin/stdout until EOF, e.g.
+ *                                 (gdb) target remote | tests/build/gdbstub serve prog.bin
+ *
+ * The target side is what ZX48.cpp builds with ZX_DEBUG: the same policy, breakpoints
+ * checked from checkBPFn(), watchpoints on the data accesses.
+ */
+#include "host/arduino.h"
+#include "zxdebug.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/select.h>
+#include <unistd.h>
+
+using namespace zymosis;
+
+EspClass ESP;
+
+static ZXDebugger debugger;
+
+struct DebugCallBacks : public Z80CallBacks {
+	uint8_t mem[65536];
+
+	inline uint8_t memReadFn(uint16_t addr, Z80MemIOType mio)
+	{
+		if (mio == Z80_MEMIO_DATA) debugger.watch(ZXDebugger::READ, addr);
+		return mem[addr];
+	}
+
+	inline void memWriteFn(uint16_t addr, uint8_t value, Z80MemIOType mio)
+	{
+		if (mio == Z80_MEMIO_DATA) debugger.watch(ZXDebugger::WRITE, addr);
+		mem[addr] = value;
+	}
+
+	inline int checkBPFn() { return debugger.check(pc); }
+
+	uint16_t debugReg(uint8_t n)
+	{
+		uint16_t regs[12] = { af.w, bc.w, de.w, hl.w, sp.w, pc, ix.w, iy.w, afx.w, bcx.w, dex.w, hlx.w };
+		return n < 12 ? regs[n] : (regI << 8) | regR;
+	}
+
+	void debugSetReg(uint8_t n, uint16_t value)
+	{
+		uint16_t* regs[12] = { &af.w, &bc.w, &de.w, &hl.w, &sp.w, &pc, &ix.w, &iy.w, &afx.w, &bcx.w, &dex.w, &hlx.w };
+
+		if (n < 12) *regs[n] = value;
+		else { regI = value >> 8; regR = value & 0xff; }
+		if (n == 5) halted = false;
+	}
+
+	uint8_t debugPeek(uint16_t addr) { return mem[addr]; }
+	void debugPoke(uint16_t addr, uint8_t value) { mem[addr] = value; }
+};
+
+typedef Z80Cpu<DebugCallBacks, Z80Policy<false, false, true, true, true, true> > DebugCpu;
+
+static DebugCpu cpu;
+static ZXGdbStub<DebugCpu> gdb(cpu, debugger);
+
+struct StringPrint : public Print {
+	std::string text;
+	size_t write(uint8_t c) { text += (char)c; return 1; }
+};
+
+struct FilePrint : public Print {
+	FILE* f;
+	FilePrint(FILE* f) : f(f) {}
+	size_t write(uint8_t c) { return fputc(c, f) == EOF ? 0 : 1; }
+};
+
+/* runs frames until a stop, the way emulateFrame() keeps a stopped frame open */
+static void run(uint32_t frames)
+{
+	while (frames-- && !debugger.stopped()) cpu.Z80_ExecuteTS(69888);
+}
+
+static std::string framed(const std::string& data)
+{
+	char tail[4];
+	uint8_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < data.size(); ++i) sum += data[i];
+	snprintf(tail, sizeof(tail), "#%02x", sum);
+	return "$" + data + tail;
+}
+
+static bool failed;
+
+static void expect(const char* what, const std::string& got, const std::string& reply)
+{
+	if (got == reply) return;
+	printf("gdbstub: %s replied \"%s\", expected \"%s\"\n", what, got.c_str(), reply.c_str());
+	failed = true;
+}
+
+/* sends a packet, returns the ack and reply */
+static std::string packet(const std::string& data)
+{
+	StringPrint out;
+	std::string p = framed(data);
+	size_t i;
+
+	for (i = 0; i < p.size(); ++i) gdb.feed(p[i], out);
+	return out.text;
+}
+
+static void ask(const std::string& data, const std::string& reply)
+{
+	expect(data.c_str(), packet(data), "+" + framed(reply));
+}
+
+/* c or s, then the stop reply once the CPU stopped */
+static void go(const std::string& data, const std::string& stop, uint16_t pc)
+{
+	StringPrint out;
+
+	expect(data.c_str(), packet(data), "+");
+	run(10);
+	gdb.poll(out);
+	expect((data + " stop").c_str(), out.text, framed(stop));
+	if (cpu.pc != pc) {
+		printf("gdbstub: %s stopped at %04x, expected %04x\n", data.c_str(), cpu.pc, pc);
+		failed = true;
+	}
+}
+
+static int session()
+{
+	/* 0: LD HL,#8000  3: INC A  4: LD (HL),A  5: LD B,(HL)  6: JR 3 */
+	static const uint8_t prog[] = { 0x21, 0x00, 0x80, 0x3c, 0x77, 0x46, 0x18, 0xfb };
+	StringPrint out;
+
+	memcpy(cpu.mem, prog, sizeof(prog));
+	cpu.Z80_Reset();
+
+	ask("qSupported:multiprocess+", "PacketSize=100");
+	ask("qAttached", "1");
+	ask("?", "S02");
+	ask("m0,8", "2100803c774618fb");
+	ask("p5", "0000");
+
+	/* registers go little-endian, G writes them all back */
+	ask("G" "3412" "7856" "bc9a" "f0de" "00c0" "0000" "1111" "2222" "3333" "4444" "5555" "6666" "0000", "OK");
+	ask("g", "3412" "7856" "bc9a" "f0de" "00c0" "0000" "1111" "2222" "3333" "4444" "5555" "6666" "0000");
+	ask("P3=3412", "OK");
+	ask("p3", "3412");
+	ask("p0c", "0000");
+	ask("p0d", "E01");
+
+	ask("Z0,4,1", "OK");
+	go("c", "S05", 0x0004);
+	go("c", "S05", 0x0004);
+	go("s", "S05", 0x0005);
+	ask("z0,4,1", "OK");
+	ask("z0,4,1", "E01");
+
+	/* a watchpoint stops after the instruction that hit it */
+	ask("Z2,8000,1", "OK");
+	go("c", "T05watch:8000;", 0x0005);
+	ask("z2,8000,1", "OK");
+	ask("Z3,8000,1", "OK");
+	go("c", "T05rwatch:8000;", 0x0006);
+	ask("z3,8000,1", "OK");
+	ask("Z4,8000,1", "OK");
+	go("c", "T05watch:8000;", 0x0005);
+	ask("z4,8000,1", "OK");
+
+	ask("M9000,2:abcd", "OK");
+	ask("m9000,2", "abcd");
+	ask("M9000,2:ab", "E01");
+	ask("vCont?", "");
+
+	/* continue at an address, then Ctrl-C */
+	expect("c3", packet("c3"), "+");
+	run(2);
+	if (debugger.stopped()) { puts("gdbstub: stopped without a breakpoint"); failed = true; }
+	if (!gdb.feed(0x03, out)) { puts("gdbstub: Ctrl-C not taken"); failed = true; }
+	run(1);
+	gdb.poll(out);
+	expect("Ctrl-C", out.text, framed("S02"));
+
+	/* a bad checksum is refused, bytes outside packets are left to the serial commands */
+	out.text.clear();
+	for (const char* p = "$g#00"; *p; ++p) gdb.feed(*p, out);
+	expect("bad checksum", out.text, "-");
+	if (gdb.feed('x', out)) { puts("gdbstub: took a byte outside a packet"); failed = true; }
+
+	ask("D", "OK");
+	run(2);
+	if (debugger.stopped()) { puts("gdbstub: still stopped after D"); failed = true; }
+
+	puts(failed ? "gdbstub: FAILED" : "gdbstub: ok");
+	return failed ? 1 : 0;
+}
+
+/* the protocol on stdin/stdout: while the CPU runs a frame goes between the bytes */
+/* read, so a script piped in sees every stop before its next packet */
+static int serve(int argc, char** argv)
+{
+	FilePrint out(stdout);
+	uint16_t addr = 0;
+	FILE* f;
+
+	if (argc > 2) {
+		if (argc > 3) addr = strtoul(argv[3], nullptr, 0);
+		f = fopen(argv[2], "rb");
+		if (!f) { fprintf(stderr, "gdbstub: cannot open %s\n", argv[2]); return 1; }
+		if (!fread(cpu.mem + addr, 1, 65536 - addr, f)) fprintf(stderr, "gdbstub: %s is empty\n", argv[2]);
+		fclose(f);
+	}
+	cpu.Z80_Reset();
+	cpu.pc = addr;
+	debugger.halt();
+	debugger.report();
+
+	for (;;) {
+		fd_set set;
+		struct timeval none = { 0, 0 };
+		uint8_t c;
+
+		if (!debugger.stopped()) run(1);
+		gdb.poll(out);
+		fflush(stdout);
+
+		FD_ZERO(&set);
+		FD_SET(0, &set);
+		if (!debugger.stopped() && select(1, &set, nullptr, nullptr, &none) <= 0) continue;
+		if (read(0, &c, 1) != 1) return 0;
+		gdb.feed(c, out);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "serve")) return serve(argc, argv);
+	return session();
+}
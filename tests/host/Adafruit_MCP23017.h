@@ -0,0 +1,19 @@
+/*
+ * The ESPboy buttons and the keyboard module sit on MCP23017 port expanders, inputs have
+ * pull-ups, so a pin reads high while its button is up. Tests press buttons by clearing
+ * bits of gpio.
+ */
+#pragma once
+
+#include "arduino.h"
+
+struct Adafruit_MCP23017 {
+	uint16_t gpio = 0xffff;
+
+	void begin(uint8_t) {}
+	void pinMode(uint8_t, uint8_t) {}
+	void pullUp(uint8_t, uint8_t) {}
+	void digitalWrite(uint8_t, uint8_t) {}
+	uint8_t digitalRead(uint8_t pin) { return (gpio >> pin) & 1; }
+	uint16_t readGPIOAB() { return gpio; }
+};
@@ -0,0 +1,12 @@
+/* the sketch only turns the radio off */
+#pragma once
+
+#include "arduino.h"
+
+#define WIFI_OFF 0
+
+struct ESP8266WiFiClass {
+	bool mode(uint8_t) { return true; }
+};
+
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,101 @@
+/*
+ * SPIFFS on a directory of the host, set with SPIFFS.root() before the sketch opens
+ * anything. Names are absolute SPIFFS names like "/game.z80".
+ */
+#pragma once
+
+#include "arduino.h"
+
+#include <dirent.h>
+#include <memory>
+#include <string>
+
+namespace fs {
+
+enum SeekMode { SeekSet = SEEK_SET, SeekCur = SEEK_CUR, SeekEnd = SEEK_END };
+
+class File : public Print {
+	std::shared_ptr<FILE> f;
+	std::string path;
+
+public:
+	File() {}
+	File(FILE* f, const std::string& path) : f(f, fclose), path(path) {}
+
+	operator bool() const { return (bool)f; }
+	const char* name() const { return path.c_str(); }
+
+	size_t size()
+	{
+		long pos, end;
+
+		pos = ftell(f.get());
+		fseek(f.get(), 0, SEEK_END);
+		end = ftell(f.get());
+		fseek(f.get(), pos, SEEK_SET);
+		return end;
+	}
+
+	size_t readBytes(char* buf, size_t len) { return fread(buf, 1, len, f.get()); }
+	bool seek(uint32_t pos, SeekMode mode) { return fseek(f.get(), (long)(int32_t)pos, mode) == 0; }
+	size_t write(uint8_t c) { return fputc(c, f.get()) == EOF ? 0 : 1; }
+	using Print::write;
+	void close() { f.reset(); }
+};
+
+class Dir {
+	std::shared_ptr<DIR> d;
+	std::string dir, prefix, entry;
+
+public:
+	Dir() {}
+	Dir(DIR* d, const std::string& dir, const std::string& prefix) : d(d, closedir), dir(dir), prefix(prefix) {}
+
+	bool next()
+	{
+		struct dirent* e;
+
+		while (d && (e = readdir(d.get()))) {
+			if (e->d_name[0] == '.') continue;
+			entry = e->d_name;
+			return true;
+		}
+		return false;
+	}
+
+	File openFile(const char* mode)
+	{
+		FILE* f = fopen((dir + "/" + entry).c_str(), mode);
+		return f ? File(f, prefix + entry) : File();
+	}
+};
+
+class FS {
+	std::string base;
+
+public:
+	void root(const std::string& dir) { base = dir; }
+
+	bool begin() { return true; }
+	void end() {}
+
+	File open(const char* name, const char* mode)
+	{
+		FILE* f = fopen((base + name).c_str(), (*mode == 'r') ? "rb" : "wb");
+		return f ? File(f, name) : File();
+	}
+
+	Dir openDir(const char* name)
+	{
+		std::string prefix = name;
+
+		DIR* d = opendir((base + name).c_str());
+
+		if (prefix.empty() || prefix[prefix.size() - 1] != '/') prefix += '/';
+		return d ? Dir(d, base + name, prefix) : Dir();
+	}
+};
+
+}
+
+extern fs::FS SPIFFS;
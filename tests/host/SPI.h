@@ -0,0 +1,4 @@
+/* the LCD is the only SPI device, TFT_eSPI.h models it */
+#pragma once
+
+#include "arduino.h"
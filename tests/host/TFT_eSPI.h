@@ -0,0 +1,141 @@
+/*
+ * The ST7735 of the ESPboy the way TFT_eSPI drives it with the GREENTAB3 offsets: 162 rows
+ * of 128 pixels of frame memory, the panel shows rows 1 to 128, and the vertical scrolling
+ * set by VSCRDEF/VSCRSADD decides which memory row each panel line shows. Pixels are kept
+ * as the RGB565 the panel receives: fillRect() and pushColors() with swap take them as
+ * they are, writeColor() and pushImage() take them byte swapped, as the sketch sends them.
+ * Every byte takes 8 bits at the 26.67MHz SPI clock on the micros() clock.
+ */
+#pragma once
+
+#include "arduino.h"
+#include "FS.h"
+
+#define TFT_BLACK 0x0000
+#define TFT_WHITE 0xffff
+#define TFT_RED 0xf800
+#define TFT_GREEN 0x07e0
+#define TFT_YELLOW 0xffe0
+
+#define ST7735_VSCRDEF 0x33
+#define ST7735_VSCRSADD 0x37
+
+class TFT_eSPI {
+public:
+	static const int32_t COLUMNS = 128;
+	static const int32_t ROWS = 162;
+	static const int32_t ROW_START = 1;
+
+	uint16_t ram[ROWS][COLUMNS];
+
+	TFT_eSPI() { begin(); }
+
+	void begin()
+	{
+		memset(ram, 0, sizeof(ram));
+		tfa = 0;
+		vsa = ROWS;
+		ssa = 0;
+		command = 0;
+		args = 0;
+		setAddrWindow(0, 0, COLUMNS, ROWS - ROW_START);
+	}
+
+	void setRotation(uint8_t) {}
+	void startWrite() {}
+	void endWrite() {}
+
+	void setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h)
+	{
+		x0 = x;
+		x1 = x + w - 1;
+		y0 = y + ROW_START;
+		y1 = y + ROW_START + h - 1;
+		cx = x0;
+		cy = y0;
+		send(11 * 8);
+	}
+
+	void pushColors(uint16_t* data, uint32_t len, bool swap)
+	{
+		while (len--) pixel(swap ? *data++ : swapped(*data++));
+	}
+
+	void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t* data)
+	{
+		uint32_t n = w * h;
+
+		setAddrWindow(x, y, w, h);
+		while (n--) pixel(swapped(*data++));
+	}
+
+	void writeColor(uint16_t color, uint32_t len)
+	{
+		while (len--) pixel(swapped(color));
+	}
+
+	void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+	{
+		uint32_t n = w * h;
+
+		setAddrWindow(x, y, w, h);
+		while (n--) pixel(color);
+	}
+
+	void fillScreen(uint32_t color) { fillRect(0, 0, 128, 128, color); }
+
+	void writecommand(uint8_t c)
+	{
+		command = c;
+		args = 0;
+		send(8);
+	}
+
+	void writedata(uint8_t d)
+	{
+		if (args < sizeof(arg)) arg[args++] = d;
+		send(8);
+
+		if (command == ST7735_VSCRDEF && args == 6) {
+			tfa = (arg[0] << 8) | arg[1];
+			vsa = (arg[2] << 8) | arg[3];
+		}
+		if (command == ST7735_VSCRSADD && args == 2) ssa = (arg[0] << 8) | arg[1];
+	}
+
+	/* what the panel shows at x, y of 128x128 */
+	uint16_t panel(int32_t x, int32_t y) const
+	{
+		int32_t row = y + ROW_START;
+
+		if (vsa && row >= tfa && row < tfa + vsa) row = tfa + ((row - tfa + ssa - tfa) % vsa + vsa) % vsa;
+		return ram[row][x];
+	}
+
+private:
+	int32_t x0, x1, y0, y1, cx, cy;
+	int32_t tfa, vsa, ssa;
+	uint8_t command, args;
+	uint8_t arg[6];
+	uint64_t bits = 0;
+
+	static uint16_t swapped(uint16_t c) { return (c >> 8) | (c << 8); }
+
+	void send(uint32_t n)
+	{
+		uint32_t us = bits * 3 / 80;
+
+		bits += n;
+		hostMicros() += bits * 3 / 80 - us;
+	}
+
+	void pixel(uint16_t c)
+	{
+		if (cx >= 0 && cx < COLUMNS && cy >= 0 && cy < ROWS) ram[cy][cx] = c;
+		if (++cx > x1) {
+			cx = x0;
+			if (++cy > y1) cy = y0;
+		}
+		send(16);
+	}
+};
@@ -0,0 +1,137 @@
+/*
+ * The part of the ESP8266 Arduino core the host tests build against. The flash behaves
+ * like NOR flash: erasing sets a sector to #ff, writing can only clear bits, so a write
+ * back that skips its erase reads back wrong.
+ *
+ * micros() is a clock of its own that only moves when delay() is called or a stub
+ * device takes time, see TFT_eSPI.h, so frame timing is the same on every run.
+ */
+#pragma once
+
+#include "pgmspace.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <vector>
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+
+#define D3 0
+#define D4 2
+#define D8 15
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+
+#define F_CPU 160000000L
+
+#define TIM_DIV1 0
+#define TIM_EDGE 0
+#define TIM_LOOP 1
+
+#define strcasecmp_P strcasecmp
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+
+inline uint32_t& hostMicros()
+{
+	static uint32_t us;
+	return us;
+}
+
+inline uint32_t micros() { return hostMicros(); }
+inline uint32_t millis() { return hostMicros() / 1000; }
+inline void delay(uint32_t ms) { hostMicros() += ms * 1000; }
+inline void yield() {}
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline void timer1_attachInterrupt(void (*)()) {}
+inline void timer1_enable(uint8_t, uint8_t, uint8_t) {}
+inline void timer1_write(uint32_t) {}
+
+struct EspClass {
+	static const uint32_t SECTOR = 4096;
+
+	std::vector<uint8_t> flash;
+	std::vector<uint32_t> sectorErases;
+	uint32_t sketchSize, freeSpace;
+
+	EspClass() : flash(4 << 20, 0xff), sectorErases((4 << 20) / SECTOR, 0), sketchSize(400000), freeSpace(1 << 20) {}
+
+	uint32_t getSketchSize() { return sketchSize; }
+	uint32_t getFreeSketchSpace() { return freeSpace; }
+
+	bool flashEraseSector(uint32_t sector)
+	{
+		if ((sector + 1) * SECTOR > flash.size()) return false;
+		memset(&flash[sector * SECTOR], 0xff, SECTOR);
+		++sectorErases[sector];
+		return true;
+	}
+
+	bool flashWrite(uint32_t addr, uint32_t* data, size_t size)
+	{
+		const uint8_t* p = (const uint8_t*)data;
+		size_t i;
+
+		if ((addr & 3) || (size & 3) || addr + size > flash.size()) return false;
+		for (i = 0; i < size; ++i) flash[addr + i] &= p[i];
+		return true;
+	}
+
+	bool flashRead(uint32_t addr, uint32_t* data, size_t size)
+	{
+		if ((addr & 3) || (size & 3) || addr + size > flash.size()) return false;
+		memcpy(data, &flash[addr], size);
+		return true;
+	}
+
+	uint8_t getCpuFreqMHz() { return F_CPU / 1000000; }
+	uint32_t getCycleCount() { return micros() * getCpuFreqMHz(); }
+	uint32_t getFreeHeap() { return 40000; }
+
+	void restart()
+	{
+		fputs("ESP.restart()\n", stderr);
+		exit(1);
+	}
+};
+
+extern EspClass ESP;
+
+struct Print {
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+
+	size_t write(const uint8_t* data, size_t size)
+	{
+		size_t i;
+
+		for (i = 0; i < size; ++i) write(data[i]);
+		return size;
+	}
+
+	size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+	size_t println(const char* s) { return print(s) + print("\r\n"); }
+	size_t println() { return print("\r\n"); }
+};
+
+/* nothing ever arrives, what is sent goes to stdout */
+struct HardwareSerial : public Print {
+	void begin(uint32_t) {}
+	int available() { return 0; }
+	int read() { return -1; }
+	size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+	using Print::write;
+};
+
+extern HardwareSerial Serial;
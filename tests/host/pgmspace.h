@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for the ESP8266 pgmspace.h, PROGMEM data is plain memory on the host.
+ * The tests include it before zymosis.hpp, so the core is built the way the sketch
+ * builds it and not through its own fallbacks.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
@@ -0,0 +1,379 @@
+/*
+ * Golden frames of the renderer: ZX48.cpp built for the host against the stubs in host/,
+ * a few scenes run frame by frame the way zx_loop() runs them, and the picture on the
+ * modelled LCD hashed at given frames and compared with golden/frames.txt.
+ *
+ *   render check golden/frames.txt    compares, names every picture that differs
+ *   render update golden/frames.txt   writes the hashes of this build into the file
+ *   render ppm dir                    writes every picture as dir/<build>-<scene>-<shot>.ppm
+ *
+ * Each build (plain, a small ZX_RENDER_BUDGET, ZX_SCANLINE) has its own lines in the file.
+ * A change that is meant to change the picture is checked by looking at the PPM files
+ * before and after it, then the hashes are updated in the same commit.
+ */
+#include "ZX48.cpp"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#define RENDER_STR(x) RENDER_STR2(x)
+#define RENDER_STR2(x) #x
+
+EspClass ESP;
+HardwareSerial Serial;
+fs::FS SPIFFS;
+TwoWire Wire;
+ESP8266WiFiClass WiFi;
+
+static const std::string build = RENDER_STR(RENDER_BUILD);
+
+enum { CHECK, UPDATE, PPM };
+
+static int mode;
+static std::string target;
+static std::map<std::string, uint32_t> golden;
+static std::map<std::string, uint32_t> shots;
+static std::string scene;
+static uint32_t frames;
+static char dir[] = "/tmp/zxrenderXXXXXX";
+
+static uint32_t hash()
+{
+	uint32_t h = 2166136261u;
+	int32_t x, y;
+	uint16_t c;
+
+	for (y = 0; y < 128; ++y) {
+		for (x = 0; x < 128; ++x) {
+			c = tft.panel(x, y);
+			h = (h ^ (c & 0xff)) * 16777619u;
+			h = (h ^ (c >> 8)) * 16777619u;
+		}
+	}
+	return h;
+}
+
+static void ppm(const std::string& name)
+{
+	FILE* f = fopen((target + "/" + name + ".ppm").c_str(), "wb");
+	int32_t x, y;
+	uint16_t c;
+
+	if (!f) { printf("render: cannot write %s/%s.ppm\n", target.c_str(), name.c_str()); return; }
+	fprintf(f, "P6\n128 128\n255\n");
+	for (y = 0; y < 128; ++y) {
+		for (x = 0; x < 128; ++x) {
+			c = tft.panel(x, y);
+			fputc((c >> 11) * 255 / 31, f);
+			fputc(((c >> 5) & 63) * 255 / 63, f);
+			fputc((c & 31) * 255 / 31, f);
+		}
+	}
+	fclose(f);
+}
+
+static void shot(const char* name)
+{
+	std::string key = scene + "/" + name;
+
+	shots[key] = hash();
+	if (mode == PPM) ppm(build + "-" + scene + "-" + name);
+}
+
+/* one pass of the zx_loop() main loop with a single frame and no input */
+static void frame()
+{
+	if (display_mode == DISPLAY_CROP && view_auto) view_track();
+	cpu.emulateFrame();
+	cpu.renderFrame();
+	++frames;
+}
+
+static void run(uint32_t until)
+{
+	while (frames < until) frame();
+}
+
+static void begin(const char* name, uint8_t display, const char* snapshot)
+{
+	scene = name;
+	frames = 0;
+
+	/* the renderer state of a fresh start, so no scene depends on the one before */
+	flash_frame = 0;
+	memset(row_age, 0, sizeof(row_age));
+	row_us = 200;
+	view_x = 0;
+	view_y = 0;
+	view_auto = true;
+	display_set(display);
+
+	cpu.Z80_Reset();
+	if (snapshot && !cpu.load_z80(snapshot)) printf("render: %s not loaded\n", snapshot);
+	memset(line_change, 0xff, sizeof(line_change));
+}
+
+static void save(const char* name, const std::vector<uint8_t>& data)
+{
+	FILE* f = fopen((std::string(dir) + name).c_str(), "wb");
+
+	if (f) {
+		fwrite(data.data(), 1, data.size(), f);
+		fclose(f);
+	}
+}
+
+/* a v1 .z80 snapshot of uncompressed RAM */
+static std::vector<uint8_t> snapshot(const std::vector<uint8_t>& ram, uint16_t pc, uint8_t border, uint8_t i, uint8_t im, bool ei)
+{
+	std::vector<uint8_t> z80(30, 0);
+
+	z80[6] = pc & 0xff;
+	z80[7] = pc >> 8;
+	z80[8] = 0x00;
+	z80[9] = 0xff;
+	z80[10] = i;
+	z80[12] = border << 1;
+	z80[27] = ei;
+	z80[28] = ei;
+	z80[29] = im;
+	z80.insert(z80.end(), ram.begin(), ram.end());
+	return z80;
+}
+
+/* a screen with every attribute three times, FLASH and BRIGHT included, over random pixels */
+static void pattern(std::vector<uint8_t>& ram)
+{
+	uint32_t seed = 1, n;
+
+	for (n = 0; n < 6144; ++n) {
+		seed = seed * 1103515245 + 12345;
+		ram[n] = seed >> 16;
+	}
+	for (n = 0; n < 768; ++n) ram[6144 + n] = n;
+}
+
+/* LD BC,n then DEC BC, LD A,B, OR C, JR NZ: 26 T-states a pass */
+static void wait(std::vector<uint8_t>& code, uint16_t n)
+{
+	static const uint8_t loop[] = { 0x0b, 0x78, 0xb1, 0x20, 0xfb };
+
+	code.push_back(0x01);
+	code.push_back(n & 0xff);
+	code.push_back(n >> 8);
+	code.insert(code.end(), loop, loop + sizeof(loop));
+}
+
+/* LD HL,addr, LD A,attr, LD B,32 then LD (HL),A, INC HL, DJNZ */
+static void fillRow(std::vector<uint8_t>& code, uint16_t addr, uint8_t attr)
+{
+	const uint8_t fill[] = { 0x21, (uint8_t)(addr & 0xff), (uint8_t)(addr >> 8), 0x3e, attr, 0x06, 32, 0x77, 0x23, 0x10, 0xfc };
+
+	code.insert(code.end(), fill, fill + sizeof(fill));
+}
+
+static void border(std::vector<uint8_t>& code, uint8_t colour)
+{
+	const uint8_t out[] = { 0x3e, colour, 0xd3, 0xfe };
+
+	code.insert(code.end(), out, out + sizeof(out));
+}
+
+/* the 48K ROM starting up to the copyright message */
+static void boot()
+{
+	static const char* names[3] = { "boot-scaled", "boot-fill", "boot-crop" };
+	uint8_t display;
+
+	for (display = DISPLAY_SCALED; display <= DISPLAY_CROP; ++display) {
+		begin(names[display], display, nullptr);
+		run(40);
+		shot("40");
+		run(160);
+		shot("160");
+	}
+}
+
+/* a still screen loaded as the splash .scr, then as a snapshot that stops in DI, HALT */
+static void still()
+{
+	static const char* names[3] = { "still-scaled", "still-fill", "still-crop" };
+	std::vector<uint8_t> ram(0xc000, 0);
+	uint8_t display;
+
+	pattern(ram);
+	ram[0x4000] = 0xf3;
+	ram[0x4001] = 0x76;
+	save("/still.scr", std::vector<uint8_t>(ram.begin(), ram.begin() + 6912));
+	save("/still.z80", snapshot(ram, 0x8000, 2, 0x3f, 1, false));
+
+	for (display = DISPLAY_SCALED; display <= DISPLAY_CROP; ++display) {
+		begin(names[display], display, nullptr);
+		cpu.load_scr("/still.scr");
+		cpu.renderFrame();
+		shot("splash");
+
+		begin(names[display], display, "/still.z80");
+		run(1);
+		shot("1");
+		/* the FLASH phase flips on the 16th frame */
+		run(16);
+		shot("16");
+
+		if (display == DISPLAY_CROP) {
+			view_auto = false;
+			view_pan(0, 40);
+			frame();
+			shot("pan-down");
+			view_pan(16, 74);
+			frame();
+			shot("pan-right");
+			view_pan(16, 10);
+			frame();
+			shot("pan-up");
+		}
+	}
+}
+
+/* border and attribute changes at set points of the frame from an IM 2 loop: the border */
+/* goes blue, green in the top border, red in the bottom one, and a character row turns */
+/* red on yellow while the beam draws it and back to white below */
+static void beam()
+{
+	static const char* names[3] = { "beam-scaled", "beam-fill", "beam-crop" };
+	std::vector<uint8_t> ram(0xc000, 0);
+	std::vector<uint8_t> code;
+	uint8_t display;
+	size_t n;
+
+	pattern(ram);
+	for (n = 0; n < 768; ++n) ram[6144 + n] = 0x38;
+
+	code.push_back(0x76);
+	border(code, 1);
+	wait(code, 411);
+	border(code, 4);
+	wait(code, 713);
+	fillRow(code, 0x5900, 0x32);
+	wait(code, 680);
+	fillRow(code, 0x5900, 0x38);
+	wait(code, 396);
+	border(code, 2);
+	code.push_back(0x18);
+	code.push_back(0x100 - code.size() - 1);
+	std::copy(code.begin(), code.end(), ram.begin() + 0x4000);
+
+	/* the IM 2 table at #9000 points to EI, RET at #9191 */
+	std::fill(ram.begin() + 0x5000, ram.begin() + 0x5101, 0x91);
+	ram[0x5191] = 0xfb;
+	ram[0x5192] = 0xc9;
+
+	save("/beam.z80", snapshot(ram, 0x8000, 7, 0x90, 2, true));
+
+	for (display = DISPLAY_SCALED; display <= DISPLAY_CROP; ++display) {
+		begin(names[display], display, "/beam.z80");
+		run(2);
+		shot("2");
+		run(3);
+		shot("3");
+	}
+}
+
+static bool load(const char* file)
+{
+	FILE* f = fopen(file, "r");
+	char line[256], b[64], k[128];
+	unsigned h;
+
+	if (!f) { printf("render: cannot open %s\n", file); return false; }
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %127s %x", b, k, &h) == 3 && build == b) golden[k] = h;
+	}
+	fclose(f);
+	return true;
+}
+
+/* keeps the comments and the lines of other builds, puts ours in order of build name */
+static bool update(const char* file)
+{
+	std::vector<std::string> head, lines;
+	std::map<std::string, uint32_t>::const_iterator i;
+	FILE* f = fopen(file, "r");
+	char line[256], b[64], buf[256];
+	size_t n;
+
+	while (f && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n') { if (lines.empty()) head.push_back(line); continue; }
+		if (sscanf(line, "%63s", b) == 1 && build != b) lines.push_back(line);
+	}
+	if (f) fclose(f);
+
+	for (i = shots.begin(); i != shots.end(); ++i) {
+		snprintf(buf, sizeof(buf), "%s %s %08x\n", build.c_str(), i->first.c_str(), i->second);
+		lines.push_back(buf);
+	}
+	std::stable_sort(lines.begin(), lines.end(), [](const std::string& a, const std::string& b) {
+		return a.substr(0, a.find(' ')) < b.substr(0, b.find(' '));
+	});
+
+	f = fopen(file, "w");
+	if (!f) { printf("render: cannot write %s\n", file); return false; }
+	for (n = 0; n < head.size(); ++n) fputs(head[n].c_str(), f);
+	for (n = 0; n < lines.size(); ++n) fputs(lines[n].c_str(), f);
+	fclose(f);
+	printf("render: %u pictures of %s written to %s\n", (unsigned)shots.size(), build.c_str(), file);
+	return true;
+}
+
+static bool compare()
+{
+	std::map<std::string, uint32_t>::const_iterator i, g;
+	bool ok = true;
+
+	for (i = shots.begin(); i != shots.end(); ++i) {
+		g = golden.find(i->first);
+		if (g == golden.end()) { printf("render: %s %s has no golden hash\n", build.c_str(), i->first.c_str()); ok = false; }
+		else if (g->second != i->second) { printf("render: %s %s is %08x, expected %08x\n", build.c_str(), i->first.c_str(), i->second, g->second); ok = false; }
+	}
+	for (g = golden.begin(); g != golden.end(); ++g) {
+		if (!shots.count(g->first)) { printf("render: %s %s was not drawn\n", build.c_str(), g->first.c_str()); ok = false; }
+	}
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool ok;
+
+	if (argc < 3) { puts("usage: render check|update golden-file, render ppm dir"); return 2; }
+	if (!strcmp(argv[1], "update")) mode = UPDATE;
+	else if (!strcmp(argv[1], "ppm")) mode = PPM;
+	else mode = CHECK;
+	target = argv[2];
+
+	if (mode == CHECK && !load(argv[2])) return 1;
+	if (!mkdtemp(dir)) { puts("render: no temporary directory"); return 1; }
+	SPIFFS.root(dir);
+
+	zx_setup();
+	sound_init();
+	overlay_enabled = false;
+
+	boot();
+	still();
+	beam();
+
+	unlink((std::string(dir) + "/still.scr").c_str());
+	unlink((std::string(dir) + "/still.z80").c_str());
+	unlink((std::string(dir) + "/beam.z80").c_str());
+	rmdir(dir);
+
+	if (mode == UPDATE) return update(argv[2]) ? 0 : 1;
+	if (mode == PPM) { printf("render: %u pictures written to %s\n", (unsigned)shots.size(), target.c_str()); return 0; }
+
+	ok = compare();
+	printf("render %s: %s\n", build.c_str(), ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * ULA contention of zxcontention.hpp: the scanline constants, hand counted T-states of
+ * single instructions at the edges of the contended area, and random programs timed
+ * against the documented M-cycle patterns (pc:4, hl:3, IR:1 ...) and I/O rules.
+ */
+#include "host/pgmspace.h"
+#include "zxcontention.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace zymosis;
+
+struct TimingCallBacks : public ZXContention<true> {
+	uint8_t mem[65536];
+
+	inline uint8_t memReadFn(uint16_t addr, Z80MemIOType) { return mem[addr]; }
+	inline void memWriteFn(uint16_t addr, uint8_t value, Z80MemIOType) { mem[addr] = value; }
+	inline uint8_t portInFn(uint16_t port, Z80PIOType) { return 0xff; }
+	inline void portOutFn(uint16_t port, uint8_t value, Z80PIOType) {}
+};
+
+/* the policy ZX48.cpp builds with ZX_CONTENTION */
+struct TimingCpu : public Z80Cpu<TimingCallBacks, Z80Policy<true, false, true, false, true, true> > {
+	TimingCpu() { Z80_Reset(); }
+
+	/* runs one instruction starting at frame T-state t, returns its length */
+	int32_t step(int32_t t)
+	{
+		frame_base = t;
+		tstates = 0;
+		return Z80_ExecuteStep();
+	}
+};
+
+static TimingCpu cpu;
+
+/* the contention model written out plainly */
+struct Reference {
+	ZXContentionTiming timing;
+	uint8_t slots;
+	int32_t t;
+
+	uint32_t delay() const
+	{
+		static const uint8_t pattern[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+		int32_t d = t - timing.start;
+
+		/* the pattern starts again on every line, 228 is not a multiple of 8 */
+		if (d < 0 || d >= 192 * timing.line || d % timing.line >= 128) return 0;
+		return pattern[d % timing.line % 8];
+	}
+
+	bool contended(uint16_t addr) const { return slots & (1 << (addr >> 14)); }
+
+	void cycle(uint16_t addr, uint32_t n)
+	{
+		if (contended(addr)) t += delay();
+		t += n;
+	}
+
+	void cycles(uint16_t addr, uint32_t count)
+	{
+		while (count--) cycle(addr, 1);
+	}
+
+	/* N:1 C:3, N:4, C:1 C:3, C:1 C:1 C:1 C:1 */
+	void io(uint16_t port)
+	{
+		bool high = contended(port);
+
+		if (port & 1) {
+			if (high) cycles(port, 4); else t += 4;
+		} else {
+			if (high) cycle(port, 1); else t += 1;
+			t += delay();
+			t += 3;
+		}
+	}
+};
+
+static bool check(const char* what, int32_t got, int32_t expected)
+{
+	if (got == expected) return true;
+	printf("timing: %s took %d T-states, expected %d\n", what, got, expected);
+	return false;
+}
+
+static bool lineDivision(const ZXContentionTiming& timing)
+{
+	uint32_t t;
+
+	for (t = 0; t < 192UL * timing.line; ++t) {
+		if ((t * timing.line_mul) >> 24 != t / timing.line) { printf("timing: line of %u is wrong for %u T-state lines\n", t, timing.line); return false; }
+	}
+	return true;
+}
+
+/* counted by hand on the 48K timing */
+static bool counted()
+{
+	const int32_t s = ZX48_CONTENTION.start;
+	bool ok = true;
+
+	cpu.setContention(ZX48_CONTENTION, 0x02);
+	memset(cpu.mem, 0, sizeof(cpu.mem));
+
+	/* NOP at #4000: 6 T-states wait at the first contended cycle, none two later */
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 on the first contended cycle", cpu.step(s), 10);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 one T-state before it", cpu.step(s - 1), 4);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 on the 5th cycle", cpu.step(s + 4), 6);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 on the 7th cycle", cpu.step(s + 6), 4);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 in the right border", cpu.step(s + 128), 4);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 on the next line", cpu.step(s + 224), 10);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 on the last line", cpu.step(s + 191 * 224 + 1), 9);
+	cpu.pc = 0x4000; ok &= check("NOP at #4000 below the screen", cpu.step(s + 192 * 224), 4);
+	cpu.pc = 0x8000; ok &= check("NOP at #8000", cpu.step(s), 4);
+
+	/* LD A,(HL) at #8000, HL=#4000: 4 fetch, 6 wait, 3 read */
+	cpu.mem[0x8000] = 0x7e;
+	cpu.pc = 0x8000; cpu.hl.w = 0x4000; ok &= check("LD A,(HL) reading #4000", cpu.step(s - 4), 13);
+
+	/* OUT (#fe),A with A=0 at #8000: 4 fetch, 3 operand, N:1, 5 wait, C:3 */
+	cpu.mem[0x8000] = 0xd3; cpu.mem[0x8001] = 0xfe;
+	cpu.pc = 0x8000; cpu.af.a = 0x00; ok &= check("OUT (#fe),A to #00fe", cpu.step(s - 7), 16);
+	/* the same with A=#40: C:1 with 6 wait, C:3 on the 8th cycle without one */
+	cpu.pc = 0x8000; cpu.af.a = 0x40; ok &= check("OUT (#fe),A to #40fe", cpu.step(s - 7), 4 + 3 + (6 + 1) + (0 + 3));
+	/* OUT (#ff),A with A=#40, odd port in the contended area: four C:1 */
+	cpu.mem[0x8001] = 0xff;
+	cpu.pc = 0x8000; cpu.af.a = 0x40; ok &= check("OUT (#ff),A to #40ff", cpu.step(s - 7), 4 + 3 + (6 + 1) + (0 + 1) + (6 + 1) + (0 + 1));
+	/* IN A,(#ff) with A=#80, odd port outside: N:4 */
+	cpu.mem[0x8000] = 0xdb;
+	cpu.pc = 0x8000; cpu.af.a = 0x80; ok &= check("IN A,(#ff) from #80ff", cpu.step(s - 7), 11);
+
+	/* 128K: bank 7 at #c000 is contended, the area starts 26 T-states later */
+	cpu.setContention(ZX128_CONTENTION, 0x0a);
+	memset(cpu.mem, 0, sizeof(cpu.mem));
+	cpu.pc = 0xc000; ok &= check("128K NOP at #c000", cpu.step(ZX128_CONTENTION.start), 10);
+	cpu.pc = 0x4000; ok &= check("128K NOP at #4000 on the 48K start", cpu.step(ZX48_CONTENTION.start), 4);
+	cpu.pc = 0x4000; ok &= check("128K NOP at #4000 on the next line", cpu.step(ZX128_CONTENTION.start + 228), 10);
+
+	return ok;
+}
+
+/* instructions with the M-cycles the contention documents give for them */
+enum { I_NOP, I_LDAHL, I_LDHLA, I_LDAN, I_INCHL, I_OUT, I_IN, I_PUSH, I_INCMHL, I_LDI, I_JR, I_COUNT };
+
+static uint16_t emit(uint16_t pc, uint32_t kind)
+{
+	static const uint8_t code[I_COUNT][2] = { { 0x00 }, { 0x7e }, { 0x77 }, { 0x3e }, { 0x23 }, { 0xd3 }, { 0xdb }, { 0xc5 }, { 0x34 }, { 0xed, 0xa0 }, { 0x18, 0x00 } };
+	static const uint8_t size[I_COUNT] = { 1, 1, 1, 2, 1, 2, 2, 1, 1, 2, 2 };
+
+	cpu.mem[pc] = code[kind][0];
+	if (size[kind] > 1) cpu.mem[pc + 1] = (kind == I_LDAN || kind == I_OUT || kind == I_IN) ? rand() : code[kind][1];
+	return pc + size[kind];
+}
+
+static void expect(Reference& ref)
+{
+	uint16_t pc = cpu.pc, hl = cpu.hl.w, de = cpu.de.w, sp = cpu.sp.w, ir = cpu.regI << 8;
+	uint8_t n = cpu.mem[(uint16_t)(pc + 1)];
+
+	ref.cycle(pc, 4);
+	switch (cpu.mem[pc]) {
+	case 0x00: break;
+	case 0x7e: case 0x77: ref.cycle(hl, 3); break;
+	case 0x3e: ref.cycle(pc + 1, 3); break;
+	case 0x23: ref.cycles(ir, 2); break;
+	case 0xd3: case 0xdb: ref.cycle(pc + 1, 3); ref.io((cpu.af.a << 8) | n); break;
+	case 0xc5: ref.cycles(ir, 1); ref.cycle(sp - 1, 3); ref.cycle(sp - 2, 3); break;
+	case 0x34: ref.cycle(hl, 3); ref.cycles(hl, 1); ref.cycle(hl, 3); break;
+	case 0xed: ref.cycle(pc + 1, 4); ref.cycle(hl, 3); ref.cycle(de, 3); ref.cycles(de, 2); break;
+	case 0x18: ref.cycle(pc + 1, 3); ref.cycles(pc + 1, 5); break;
+	}
+}
+
+static bool programs(const ZXContentionTiming& timing, uint8_t slots)
+{
+	static const uint16_t areas[4] = { 0x4000, 0x8000, 0xc000, 0x6000 };
+	Reference ref = { timing, slots, 0 };
+	uint32_t round, i, count;
+	uint16_t pc;
+	int32_t start, got;
+	uint8_t op;
+
+	cpu.setContention(timing, slots);
+	srand(slots * 1000 + timing.line);
+
+	for (round = 0; round < 2000; ++round) {
+		memset(cpu.mem, 0, sizeof(cpu.mem));
+		cpu.Z80_Reset();
+		pc = areas[rand() % 4] + 0x1000;
+		count = 1 + rand() % 40;
+		cpu.pc = pc;
+		for (i = 0; i < count; ++i) pc = emit(pc, rand() % I_COUNT);
+		cpu.hl.w = areas[rand() % 4] + rand() % 0x800;
+		cpu.de.w = areas[rand() % 4] + rand() % 0x800;
+		cpu.sp.w = areas[rand() % 4] + 0xf00;
+		cpu.bc.w = 0x8000;
+		cpu.regI = areas[rand() % 4] >> 8;
+		cpu.af.a = rand();
+
+		/* start near the contended area, in it or on its last lines */
+		start = timing.start - 100 + rand() % 400;
+		if (rand() % 2) start = timing.start + rand() % (192 * timing.line + 200);
+
+		for (i = 0; i < count; ++i) {
+			ref.t = start;
+			expect(ref);
+			pc = cpu.pc;
+			op = cpu.mem[pc];
+			got = cpu.step(start);
+			if (got != ref.t - start) {
+				printf("timing: opcode %02x at %04x from T-state %d took %d, expected %d (slots %02x, %u T-state lines)\n",
+					op, pc, start, got, ref.t - start, slots, timing.line);
+				return false;
+			}
+			start += got;
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	bool ok = lineDivision(ZX48_CONTENTION) && lineDivision(ZX128_CONTENTION);
+
+	if (ok) ok = counted();
+	if (ok) ok = programs(ZX48_CONTENTION, 0x02);
+	if (ok) ok = programs(ZX128_CONTENTION, 0x02);
+	if (ok) ok = programs(ZX128_CONTENTION, 0x0a);
+
+	puts(ok ? "timing: ok" : "timing: FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*
+ * Flash paged RAM: contents against a plain copy of the paged space, the number of
+ * sector erases between two tick() calls and over the run, that every erased sector is
+ * filled with pages before the next erase, and how evenly the swap area wears.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "zxvmem.hpp"
+
+EspClass ESP;
+
+static const uint32_t SPACE = 0x20000;
+static const uint32_t SCREEN = 5 * 0x4000;
+
+/* a frame of a 128K game: 8K of code and variables it moves along every 100 frames, */
+/* one access in 100 anywhere in the banks and one in spread of those a write. With */
+/* thrash set there are more dirty misses than erases a frame, only the contents and */
+/* the count of forced erases are checked then */
+template<uint8_t SHIFT> static bool frames(const char* name, uint8_t count, uint32_t spread, uint32_t rounds, bool thrash)
+{
+	static ZXPagedRAM<SHIFT> vm;
+	std::vector<uint8_t> ref(SPACE, 0);
+	uint32_t first = ESP.getSketchSize() / EspClass::SECTOR;
+	uint32_t last = first + ESP.getFreeSketchSpace() / EspClass::SECTOR + 1;
+	uint32_t t, k, erases, forced, most, total, used, s;
+	uint8_t* screen;
+	uint8_t* p;
+
+	std::fill(ESP.sectorErases.begin(), ESP.sectorErases.end(), 0);
+	vm.begin(count);
+	if (!vm.clear(SPACE)) { printf("vmem %s: no swap area\n", name); return false; }
+	screen = vm.wire(SCREEN, 6912);
+	if (!screen) { printf("vmem %s: screen not wired\n", name); return false; }
+	vm.resetStats();
+
+	srand(11);
+	for (t = 0; t < rounds; ++t) {
+		erases = vm.erases;
+		forced = vm.forced;
+		for (k = 0; k < 3000; ++k) {
+			uint32_t r = rand();
+			bool hot = r % 100 != 0;
+			uint32_t addr = hot ? 0x8000 + (t / 100) * 0x1000 % 0x10000 + rand() % 0x2000 : rand() % SPACE;
+			bool write = hot ? (r >> 8) % 3 == 0 : (r >> 8) % spread == 0;
+			if (write) {
+				uint8_t v = rand();
+				vm.poke(addr, v);
+				ref[addr] = v;
+			} else {
+				p = vm.map(addr >> SHIFT, false);
+				if (!p) { printf("vmem %s: map failed, round %u\n", name, t); return false; }
+				if (p[addr & vm.PAGE_MASK] != ref[addr]) { printf("vmem %s: %05x differs, round %u\n", name, addr, t); return false; }
+			}
+		}
+		if (memcmp(screen, &ref[SCREEN], 6912)) { printf("vmem %s: wired screen differs, round %u\n", name, t); return false; }
+		if (vm.erases - erases > 1 + (vm.forced - forced)) { printf("vmem %s: %u erases in round %u\n", name, vm.erases - erases, t); return false; }
+		vm.tick();
+	}
+
+	/* the erases of the swap area spread over all of it */
+	most = total = used = 0;
+	for (s = first; s < last; ++s) {
+		total += ESP.sectorErases[s];
+		if (ESP.sectorErases[s]) ++used;
+		if (ESP.sectorErases[s] > most) most = ESP.sectorErases[s];
+	}
+	printf("vmem %s: %u rounds, %u misses, %u write backs, %u erases (%u forced) over %u sectors, at most %u on one\n",
+		name, rounds, vm.misses, vm.writebacks, vm.erases, vm.forced, used, most);
+	if (!thrash && vm.forced * 20 > rounds) { printf("vmem %s: erases are forced too often\n", name); return false; }
+	if (vm.erases - vm.forced > rounds / vm.ERASE_FRAMES + 1) { printf("vmem %s: more than one erase every %u frames\n", name, vm.ERASE_FRAMES); return false; }
+	if (vm.erases > vm.writebacks / vm.SLOTS + 1) { printf("vmem %s: sectors erased before their %u slots were written\n", name, vm.SLOTS); return false; }
+	if (used < 200 || most > total * 3 / 2 / used + 2) { printf("vmem %s: the swap area wears unevenly\n", name); return false; }
+
+	vm.end();
+	return true;
+}
+
+/* a swap area one sector larger than the space still works, one exactly the size does not */
+static bool tight()
+{
+	static ZXPagedRAM<12> vm;
+	std::vector<uint8_t> ref(SPACE, 0);
+	uint32_t free_space = ESP.freeSpace;
+	uint32_t t, addr;
+	uint8_t* p;
+	bool ok = true;
+
+	vm.begin(4);
+	ESP.freeSpace = SPACE;
+	if (vm.clear(SPACE)) { puts("vmem: swap area without a spare sector accepted"); ok = false; }
+	ESP.freeSpace = SPACE + EspClass::SECTOR;
+	if (ok && !vm.clear(SPACE)) { puts("vmem: swap area with a spare sector refused"); ok = false; }
+
+	srand(5);
+	for (t = 0; ok && t < 20000; ++t) {
+		addr = rand() % SPACE;
+		if (rand() % 2) {
+			vm.poke(addr, t);
+			ref[addr] = t;
+		} else {
+			p = vm.map(addr >> 12, false);
+			if (!p || p[addr & 0xfff] != ref[addr]) { printf("vmem: %05x differs in the tight swap area, access %u\n", addr, t); ok = false; }
+		}
+		if (t % 50 == 0) vm.tick();
+	}
+
+	ESP.freeSpace = free_space;
+	vm.end();
+	return ok;
+}
+
+int main()
+{
+	bool ok = tight();
+
+	if (ok) ok = frames<10>("1K", 20, 64, 5000, false);
+	if (ok) ok = frames<11>("2K", 12, 64, 5000, false);
+	if (ok) ok = frames<12>("4K", 8, 64, 5000, false);
+	if (ok) ok = frames<10>("1K thrashing", 20, 2, 2000, true);
+
+	puts(ok ? "vmem: ok" : "vmem: FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/*
+ * Z80 core on the host: flat 64K memory callbacks, the policies the tests run and
+ * helpers to compare and time CPUs.
+ */
+#pragma once
+
+#include "host/pgmspace.h"
+#include "zymosis.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace z80host {
+
+	using namespace zymosis;
+
+	/* the Z80Info fields and memory of one CPU, what two runs are compared by */
+	struct Z80Snapshot {
+		uint16_t af, bc, de, hl, afx, bcx, dex, hlx, ix, iy, sp, pc, memptr;
+		uint8_t i, r, im;
+		bool iff1, iff2, halted;
+		int32_t tstates;
+		uint8_t mem[65536];
+	};
+
+	inline uint32_t fnv(const void* data, size_t len, uint32_t h = 2166136261u)
+	{
+		const uint8_t* p = (const uint8_t*)data;
+		while (len--) h = (h ^ *p++) * 16777619u;
+		return h;
+	}
+
+	/* xorshift32, random programs come out the same on every host */
+	struct Random {
+		uint32_t s;
+
+		explicit Random(uint32_t seed) : s(seed * 2654435761u + 1) {}
+		uint32_t next() { s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+		uint32_t below(uint32_t n) { return next() % n; }
+		uint8_t byte() { return next() >> 24; }
+	};
+
+	/* 64K of RAM, or ROM below #4000 when rom is set. bulk turns the LDIR/LDDR and */
+	/* CPIR/CPDR callbacks on, they copy and scan byte by byte the way ZX48.cpp does */
+	struct HostCallBacks : public Z80CallBacks {
+		uint8_t mem[65536];
+		bool rom;
+		bool bulk;
+		uint32_t bulkCalls;
+		/* port #fe of the ROM bench, the port high byte for the FUSE tests otherwise */
+		uint8_t (*portIn)(HostCallBacks& cb, uint16_t port);
+		void (*portOut)(HostCallBacks& cb, uint16_t port, uint8_t value);
+		void* user;
+
+		HostCallBacks() : rom(false), bulk(false), bulkCalls(0), portIn(nullptr), portOut(nullptr), user(nullptr) { memset(mem, 0, sizeof(mem)); }
+
+		inline uint8_t memReadFn(uint16_t addr, Z80MemIOType) { return mem[addr]; }
+
+		inline void memWriteFn(uint16_t addr, uint8_t value, Z80MemIOType)
+		{
+			if (rom && addr < 0x4000) return;
+			mem[addr] = value;
+#if defined(ZYMOSIS_BLOCK_CACHE)
+			codeWritten(addr);
+#endif
+		}
+
+		inline uint8_t portInFn(uint16_t port, Z80PIOType) { return portIn ? portIn(*this, port) : port >> 8; }
+		inline void portOutFn(uint16_t port, uint8_t value, Z80PIOType) { if (portOut) portOut(*this, port, value); }
+
+		uint16_t blockCopyFn(uint16_t src, uint16_t dst, uint16_t count, bool backward)
+		{
+			uint16_t i;
+
+			if (!bulk) return 0;
+			++bulkCalls;
+			for (i = 0; i < count; ++i) {
+				memWriteFn(dst, mem[src], Z80_MEMIO_OTHER);
+				src += backward ? -1 : 1;
+				dst += backward ? -1 : 1;
+			}
+			return count;
+		}
+
+		uint16_t blockScanFn(uint16_t addr, uint16_t count, bool backward, uint8_t value)
+		{
+			uint16_t i;
+
+			if (!bulk) return 0;
+			++bulkCalls;
+			for (i = 0; i < count && mem[addr] != value; ++i) addr += backward ? -1 : 1;
+			return i;
+		}
+	};
+
+	/* the reference: every feature on, registers in Z80Info, flags worked out eagerly */
+	typedef Z80Policy<true, true, true, true, true, true> FullPolicy;
+	/* what ZX48.cpp builds by default, and with ZX_CPU_RESIDENT, ZX_CPU_LAZY_FLAGS, ZX_CPU_FUSION */
+	typedef Z80Policy<false, true, true, false, true, true> PlainPolicy;
+	typedef Z80Policy<false, true, true, false, true, true, true> ResidentPolicy;
+	typedef Z80Policy<false, true, true, false, true, true, true, true> LazyPolicy;
+	typedef Z80Policy<false, true, true, false, true, true, true, true, true> FusedPolicy;
+
+	template<class P> struct HostCpu : public Z80Cpu<HostCallBacks, P> {
+		static const uint32_t REGISTERS = 21;
+
+		HostCpu() { this->Z80_Reset(); }
+
+		void snapshot(Z80Snapshot& s) const
+		{
+			s.af = this->af.w; s.bc = this->bc.w; s.de = this->de.w; s.hl = this->hl.w;
+			s.afx = this->afx.w; s.bcx = this->bcx.w; s.dex = this->dex.w; s.hlx = this->hlx.w;
+			s.ix = this->ix.w; s.iy = this->iy.w; s.sp = this->sp.w; s.pc = this->pc; s.memptr = this->memptr.w;
+			s.i = this->regI; s.r = this->regR; s.im = this->im;
+			s.iff1 = this->iff1; s.iff2 = this->iff2; s.halted = this->halted;
+			s.tstates = this->tstates;
+			memcpy(s.mem, this->mem, sizeof(s.mem));
+		}
+
+		/* starts over from s, as Z80_Reset() leaves everything the snapshot does not hold */
+		void restore(const Z80Snapshot& s)
+		{
+			this->Z80_Reset();
+			this->af.w = s.af; this->bc.w = s.bc; this->de.w = s.de; this->hl.w = s.hl;
+			this->afx.w = s.afx; this->bcx.w = s.bcx; this->dex.w = s.dex; this->hlx.w = s.hlx;
+			this->ix.w = s.ix; this->iy.w = s.iy; this->sp.w = s.sp; this->pc = s.pc; this->memptr.w = s.memptr;
+			this->regI = s.i; this->regR = s.r; this->im = s.im;
+			this->iff1 = s.iff1; this->iff2 = s.iff2; this->halted = s.halted;
+			this->tstates = s.tstates;
+			memcpy(this->mem, s.mem, sizeof(s.mem));
+		}
+
+		/* the registers and state of the snapshot without the memory */
+		void registers(uint16_t r[REGISTERS]) const
+		{
+			uint16_t regs[REGISTERS] = { this->af.w, this->bc.w, this->de.w, this->hl.w, this->afx.w, this->bcx.w, this->dex.w, this->hlx.w,
+				this->ix.w, this->iy.w, this->sp.w, this->pc, this->memptr.w, this->regI, this->regR, this->im,
+				this->iff1, this->iff2, this->halted, (uint16_t)this->tstates, (uint16_t)(this->tstates >> 16) };
+			memcpy(r, regs, sizeof(regs));
+		}
+
+		/* hash of the registers and memory, equal on every build that emulates alike */
+		uint32_t digest(uint32_t h = 2166136261u) const
+		{
+			uint16_t r[REGISTERS];
+
+			registers(r);
+			return fnv(this->mem, sizeof(this->mem), fnv(r, sizeof(r), h));
+		}
+
+		/* cheaper than two snapshots, for comparing after every step */
+		template<class Q> bool matches(const HostCpu<Q>& other) const
+		{
+			uint16_t a[REGISTERS], b[REGISTERS];
+
+			registers(a);
+			other.registers(b);
+			return !memcmp(a, b, sizeof(a)) && !memcmp(this->mem, other.mem, sizeof(this->mem));
+		}
+	};
+
+	/* prints the first difference, returns true when there is none */
+	inline bool same(const char* what, const Z80Snapshot& a, const Z80Snapshot& b)
+	{
+		static const char* names[] = { "AF", "BC", "DE", "HL", "AF'", "BC'", "DE'", "HL'", "IX", "IY", "SP", "PC", "MEMPTR" };
+		const uint16_t* ra = &a.af;
+		const uint16_t* rb = &b.af;
+		uint32_t i;
+
+		for (i = 0; i < 13; ++i) {
+			if (ra[i] != rb[i]) { printf("%s: %s %04x, expected %04x\n", what, names[i], ra[i], rb[i]); return false; }
+		}
+		if (a.i != b.i || a.r != b.r || a.im != b.im) { printf("%s: I R IM %02x %02x %u, expected %02x %02x %u\n", what, a.i, a.r, a.im, b.i, b.r, b.im); return false; }
+		if (a.iff1 != b.iff1 || a.iff2 != b.iff2 || a.halted != b.halted) { printf("%s: IFF1 IFF2 halted %d %d %d, expected %d %d %d\n", what, a.iff1, a.iff2, a.halted, b.iff1, b.iff2, b.halted); return false; }
+		if (a.tstates != b.tstates) { printf("%s: t-states %d, expected %d\n", what, a.tstates, b.tstates); return false; }
+		for (i = 0; i < 65536; ++i) {
+			if (a.mem[i] != b.mem[i]) { printf("%s: memory %04x %02x, expected %02x\n", what, i, a.mem[i], b.mem[i]); return false; }
+		}
+		return true;
+	}
+
+	/* emulated MHz of a program run as ROM from 0, with the 48K ROM the same load */
+	/* ZX_SELFCHECK times on the device. Frames go as emulateFrame() in ZX48.cpp runs */
+	/* them: the interrupt, then the core to the end of the frame */
+	template<class P> double bench(const uint8_t* rom, size_t size, uint32_t frames, uint32_t& digest)
+	{
+		static HostCpu<P> cpu;
+		uint32_t f;
+		int32_t ticks;
+		int64_t ts = 0;
+		double s;
+
+		memset(cpu.mem, 0, sizeof(cpu.mem));
+		memcpy(cpu.mem, rom, size);
+		cpu.rom = true;
+		cpu.bulk = !P::contention;
+		cpu.portIn = [](HostCallBacks&, uint16_t) -> uint8_t { return 0xbf; };
+		cpu.Z80_Reset();
+
+		auto t0 = std::chrono::steady_clock::now();
+		for (f = 0; f < frames; ++f) {
+			cpu.tstates = 0;
+			ticks = cpu.Z80_Interrupt();
+			while (ticks < 69888) ticks += cpu.Z80_ExecuteTS(69888 - ticks);
+			ts += ticks;
+		}
+		s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		digest = fnv(cpu.mem, sizeof(cpu.mem));
+		return ts / s / 1e6;
+	}
+
+}
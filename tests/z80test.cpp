@@ -0,0 +1,837 @@
+/*
+ * Z80 core conformance runner, built once per flag table variant and dispatch mode
+ * (see CMakeLists.txt) and run against the policies of z80host.hpp:
+ *
+ *   z80test selfcheck                          Z80_SelfCheck() of every policy
+ *   z80test fuse tests.in tests.expected       the FUSE per-opcode vectors, with t-states
+ *   z80test zex zexdoc.com                     ZEXDOC/ZEXALL through a CP/M BDOS stub
+ *   z80test flags                              8-bit ALU, INC/DEC and DAA flags for every input
+ *   z80test diff [kind] [images]               random programs against the full policy
+ *   z80test bench [frames]                     MHz and MIPS of the 48K ROM start-up and of
+ *                                              a DAA/INC/DEC loop, the flag table workload
+ *
+ * A last argument names one policy (full, plain, resident, lazy, fused) to run only that.
+ * Exit status is 0 when everything passed, 1 on a failure and 77 when a test file is
+ * missing, which CTest reports as skipped.
+ */
+#include "z80host.hpp"
+#include "rom/rom.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace z80host;
+
+#define Z80TEST_SKIP 77
+
+#if defined(ZYMOSIS_COLD)
+static const char* variant = "cold";
+#elif defined(ZYMOSIS_BLOCK_CACHE)
+static const char* variant = "cache";
+#elif defined(ZYMOSIS_FLAGS_IN_STATIC)
+static const char* variant = "static";
+#elif defined(ZYMOSIS_FLAGS_IN_ARRAY)
+static const char* variant = "array";
+#elif defined(ZYMOSIS_FLAGS_IN_FUNCTION)
+static const char* variant = "function";
+#elif defined(ZYMOSIS_FLAGS_IN_FUNCTION3)
+static const char* variant = "function3";
+#elif defined(ZYMOSIS_FLAGS_IN_TABLES)
+static const char* variant = "tables";
+#else
+static const char* variant = "function2";
+#endif
+
+/* runs T::run<P>(name) for every policy, or the one named; returns the failures */
+template<class T> int eachPolicy(T& test, const char* only)
+{
+	int failed = 0;
+
+	if (!only || !strcmp(only, "full")) failed += !test.template run<FullPolicy>("full");
+	if (!only || !strcmp(only, "plain")) failed += !test.template run<PlainPolicy>("plain");
+	if (!only || !strcmp(only, "resident")) failed += !test.template run<ResidentPolicy>("resident");
+	if (!only || !strcmp(only, "lazy")) failed += !test.template run<LazyPolicy>("lazy");
+	if (!only || !strcmp(only, "fused")) failed += !test.template run<FusedPolicy>("fused");
+	return failed;
+}
+
+/******************************************************************************/
+/* selfcheck */
+
+struct SelfCheck {
+	template<class P> bool run(const char* name)
+	{
+		static HostCpu<P> cpu;
+		bool ok = cpu.Z80_SelfCheck();
+
+		printf("selfcheck %s %s: %s\n", variant, name, ok ? "ok" : "FAILED");
+		return ok;
+	}
+};
+
+/******************************************************************************/
+/* FUSE tests: tests.in gives the registers, the t-states to run and the memory, */
+/* tests.expected the state after it; the bus events listed there are not checked */
+
+struct FuseCase {
+	std::string name;
+	uint16_t reg[13]; /* AF BC DE HL AF' BC' DE' HL' IX IY SP PC MEMPTR */
+	uint32_t i, r, iff1, iff2, im, halted, tstates;
+	std::vector<std::pair<uint16_t, std::vector<uint8_t> > > mem;
+};
+
+static bool fuseLine(FILE* f, std::string& line)
+{
+	char buf[1024];
+
+	if (!fgets(buf, sizeof(buf), f)) return false;
+	line = buf;
+	while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) line.pop_back();
+	return true;
+}
+
+/* reads one case, expected says the file is tests.expected; false at the end */
+static bool fuseRead(FILE* f, FuseCase& c, bool expected)
+{
+	std::string line;
+	uint32_t addr, value;
+	int n, at;
+
+	do {
+		if (!fuseLine(f, line)) return false;
+	} while (line.empty());
+	c.name = line;
+	c.mem.clear();
+
+	/* bus events are indented */
+	do {
+		if (!fuseLine(f, line)) return false;
+	} while (expected && (line[0] == ' ' || line[0] == '\t'));
+
+	if (sscanf(line.c_str(), "%hx %hx %hx %hx %hx %hx %hx %hx %hx %hx %hx %hx %hx",
+		&c.reg[0], &c.reg[1], &c.reg[2], &c.reg[3], &c.reg[4], &c.reg[5], &c.reg[6],
+		&c.reg[7], &c.reg[8], &c.reg[9], &c.reg[10], &c.reg[11], &c.reg[12]) != 13) return false;
+	if (!fuseLine(f, line)) return false;
+	if (sscanf(line.c_str(), "%x %x %u %u %u %u %u", &c.i, &c.r, &c.iff1, &c.iff2, &c.im, &c.halted, &c.tstates) != 7) return false;
+
+	/* memory blocks: address, bytes, -1; tests.in ends the list with -1, tests.expected with a blank line */
+	while (fuseLine(f, line) && !line.empty()) {
+		const char* p = line.c_str();
+
+		if (sscanf(p, "%x%n", &addr, &at) != 1 || line.compare(0, 2, "-1") == 0) break;
+		c.mem.push_back(std::make_pair((uint16_t)addr, std::vector<uint8_t>()));
+		for (p += at; sscanf(p, "%x%n", &value, &n) == 1 && strncmp(p + strspn(p, " \t"), "-1", 2); p += n) {
+			c.mem.back().second.push_back(value);
+		}
+	}
+	return true;
+}
+
+/* memory as the FUSE test core starts it, before the case is loaded */
+static void fuseMemory(uint8_t* mem, const FuseCase& c)
+{
+	static const uint8_t fill[4] = { 0xde, 0xad, 0xbe, 0xef };
+	uint32_t i;
+
+	for (i = 0; i < 65536; ++i) mem[i] = fill[i & 3];
+	for (auto& block : c.mem) {
+		for (i = 0; i < block.second.size(); ++i) mem[(block.first + i) & 0xffff] = block.second[i];
+	}
+}
+
+struct FuseTests {
+	std::vector<FuseCase> in, expected;
+
+	template<class P> bool run(const char* name)
+	{
+		static HostCpu<P> cpu;
+		static Z80Snapshot got, want;
+		uint32_t k, failed = 0;
+		std::string what;
+
+		for (k = 0; k < in.size(); ++k) {
+			const FuseCase& c = in[k];
+			const FuseCase& e = expected[k];
+
+			cpu.Z80_Reset();
+			fuseMemory(cpu.mem, c);
+			cpu.bulk = !P::contention;
+			cpu.af.w = c.reg[0]; cpu.bc.w = c.reg[1]; cpu.de.w = c.reg[2]; cpu.hl.w = c.reg[3];
+			cpu.afx.w = c.reg[4]; cpu.bcx.w = c.reg[5]; cpu.dex.w = c.reg[6]; cpu.hlx.w = c.reg[7];
+			cpu.ix.w = c.reg[8]; cpu.iy.w = c.reg[9]; cpu.sp.w = c.reg[10]; cpu.pc = c.reg[11]; cpu.memptr.w = c.reg[12];
+			cpu.regI = c.i; cpu.regR = c.r; cpu.iff1 = c.iff1; cpu.iff2 = c.iff2; cpu.im = c.im; cpu.halted = c.halted;
+			cpu.Z80_ExecuteTS(c.tstates);
+			cpu.snapshot(got);
+
+			memcpy(&want.af, e.reg, sizeof(e.reg));
+			want.i = e.i; want.r = e.r; want.im = e.im;
+			want.iff1 = e.iff1; want.iff2 = e.iff2; want.halted = e.halted;
+			want.tstates = e.tstates;
+			fuseMemory(want.mem, c);
+			for (auto& block : e.mem) {
+				for (uint32_t i = 0; i < block.second.size(); ++i) want.mem[(block.first + i) & 0xffff] = block.second[i];
+			}
+
+			what = std::string("fuse ") + variant + " " + name + " " + c.name;
+			if (!same(what.c_str(), got, want)) ++failed;
+		}
+		printf("fuse %s %s: %u tests, %u failed\n", variant, name, (uint32_t)in.size(), failed);
+		return !failed;
+	}
+};
+
+static int fuseMain(const char* inName, const char* expectedName, const char* only)
+{
+	FuseTests tests;
+	FuseCase c;
+	FILE* in = fopen(inName, "r");
+	FILE* expected = fopen(expectedName, "r");
+	int failed;
+
+	if (!in || !expected) {
+		printf("fuse: %s or %s not found, skipped\n", inName, expectedName);
+		if (in) fclose(in);
+		if (expected) fclose(expected);
+		return Z80TEST_SKIP;
+	}
+	while (fuseRead(in, c, false)) tests.in.push_back(c);
+	while (fuseRead(expected, c, true)) tests.expected.push_back(c);
+	fclose(in);
+	fclose(expected);
+
+	if (tests.in.empty() || tests.in.size() != tests.expected.size()) {
+		printf("fuse: %u cases in, %u expected\n", (uint32_t)tests.in.size(), (uint32_t)tests.expected.size());
+		return 1;
+	}
+	for (uint32_t k = 0; k < tests.in.size(); ++k) {
+		if (tests.in[k].name != tests.expected[k].name) {
+			printf("fuse: case %s expected as %s\n", tests.in[k].name.c_str(), tests.expected[k].name.c_str());
+			return 1;
+		}
+	}
+
+	failed = eachPolicy(tests, only);
+	return failed ? 1 : 0;
+}
+
+/******************************************************************************/
+/* ZEXDOC/ZEXALL: the .COM runs at #0100, CALL 5 jumps to an OUT (0),A that stands */
+/* for the BDOS (C=2 prints E, C=9 the string at DE up to $), warm boot at 0 is a HALT */
+
+#define ZEX_BDOS 0xfe00
+
+struct ZexTests {
+	std::vector<uint8_t> com;
+	std::string out;
+
+	static void bdos(HostCallBacks& cb, uint16_t port, uint8_t)
+	{
+		ZexTests& t = *(ZexTests*)cb.user;
+		uint16_t a;
+
+		if (port & 0xff) return;
+		switch (cb.bc.c) {
+		case 2:
+			t.print(cb.de.e);
+			break;
+		case 9:
+			for (a = cb.de.w; cb.mem[a] != '$'; a = (a + 1) & 0xffff) t.print(cb.mem[a]);
+			break;
+		}
+	}
+
+	void print(char ch)
+	{
+		out += ch;
+		putchar(ch);
+		if (ch == '\n') fflush(stdout);
+	}
+
+	template<class P> bool run(const char* name)
+	{
+		static HostCpu<P> cpu;
+		static const uint8_t bdosCode[] = { 0xd3, 0x00, 0xc9 }; /* OUT (0),A; RET */
+		uint64_t ts = 0;
+		double s;
+
+		cpu.Z80_Reset();
+		memset(cpu.mem, 0, sizeof(cpu.mem));
+		memcpy(cpu.mem + 0x100, com.data(), com.size());
+		cpu.mem[0] = 0x76;
+		cpu.mem[5] = 0xc3;
+		cpu.mem[6] = ZEX_BDOS & 0xff;
+		cpu.mem[7] = ZEX_BDOS >> 8;
+		memcpy(cpu.mem + ZEX_BDOS, bdosCode, sizeof(bdosCode));
+		cpu.bulk = !P::contention;
+		cpu.portOut = bdos;
+		cpu.user = this;
+		cpu.sp.w = ZEX_BDOS;
+		cpu.pc = 0x100;
+		out.clear();
+
+		printf("zex %s %s\n", variant, name);
+		auto t0 = std::chrono::steady_clock::now();
+		while (!cpu.halted && ts < 100000000000ull) ts += cpu.Z80_ExecuteTS(1 << 24);
+		s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		bool ok = cpu.halted && out.find("ERROR") == std::string::npos;
+		printf("\nzex %s %s: %s, %.1f MHz\n", variant, name, ok ? "ok" : "FAILED", ts / s / 1e6);
+		return ok;
+	}
+};
+
+static int zexMain(const char* comName, const char* only)
+{
+	ZexTests tests;
+	FILE* f = fopen(comName, "rb");
+	int ch;
+
+	if (!f) {
+		printf("zex: %s not found, skipped\n", comName);
+		return Z80TEST_SKIP;
+	}
+	while ((ch = fgetc(f)) != EOF && tests.com.size() < ZEX_BDOS - 0x100) tests.com.push_back(ch);
+	fclose(f);
+
+	return eachPolicy(tests, only) ? 1 : 0;
+}
+
+/******************************************************************************/
+/* flags: every A, operand and carry of the 8-bit ALU against the textbook flag */
+/* formulas below. The carry comes from a CP and the result goes to a JP cc and */
+/* a PUSH AF in the same run, so the lazy policies work F out where the program */
+/* reads it rather than on the way out of Z80_Execute() */
+
+/* parity, sign, zero and bits 3/5 of an 8-bit result */
+static uint8_t flagsSZ53P(uint8_t r)
+{
+	uint8_t p = r ^ (r >> 4);
+
+	p ^= p >> 2;
+	p ^= p >> 1;
+	return (r & 0xa8) | (r ? 0 : Z80_FLAG_Z) | (p & 1 ? 0 : Z80_FLAG_PV);
+}
+
+/* A and F after the operation, c is 0 or 1 */
+typedef uint16_t (*FlagRef)(uint8_t a, uint8_t v, uint8_t c);
+
+static uint16_t flagsAdd(uint8_t a, uint8_t v, uint8_t c)
+{
+	uint32_t r = a + v + c;
+	uint8_t f = (flagsSZ53P(r) & ~Z80_FLAG_PV) | ((a ^ v ^ r) & Z80_FLAG_H);
+
+	if ((a ^ ~v) & (a ^ r) & 0x80) f |= Z80_FLAG_PV;
+	if (r > 0xff) f |= Z80_FLAG_C;
+	return ((r & 0xff) << 8) | f;
+}
+
+static uint16_t flagsSub(uint8_t a, uint8_t v, uint8_t c)
+{
+	int32_t r = a - v - c;
+	uint8_t f = (flagsSZ53P(r) & ~Z80_FLAG_PV) | ((a ^ v ^ r) & Z80_FLAG_H) | Z80_FLAG_N;
+
+	if ((a ^ v) & (a ^ r) & 0x80) f |= Z80_FLAG_PV;
+	if (r < 0) f |= Z80_FLAG_C;
+	return ((r & 0xff) << 8) | f;
+}
+
+static uint16_t flagsADD(uint8_t a, uint8_t v, uint8_t) { return flagsAdd(a, v, 0); }
+static uint16_t flagsADC(uint8_t a, uint8_t v, uint8_t c) { return flagsAdd(a, v, c); }
+static uint16_t flagsSUB(uint8_t a, uint8_t v, uint8_t) { return flagsSub(a, v, 0); }
+static uint16_t flagsSBC(uint8_t a, uint8_t v, uint8_t c) { return flagsSub(a, v, c); }
+
+/* A is kept, bits 3/5 come from the operand */
+static uint16_t flagsCP(uint8_t a, uint8_t v, uint8_t)
+{
+	return (a << 8) | (flagsSub(a, v, 0) & 0xff & ~Z80_FLAG_35) | (v & Z80_FLAG_35);
+}
+
+static uint16_t flagsAND(uint8_t a, uint8_t v, uint8_t) { return ((a & v) << 8) | flagsSZ53P(a & v) | Z80_FLAG_H; }
+static uint16_t flagsXOR(uint8_t a, uint8_t v, uint8_t) { return ((a ^ v) << 8) | flagsSZ53P(a ^ v); }
+static uint16_t flagsOR(uint8_t a, uint8_t v, uint8_t) { return ((a | v) << 8) | flagsSZ53P(a | v); }
+
+/* the carry is kept */
+static uint16_t flagsINC(uint8_t a, uint8_t, uint8_t c)
+{
+	uint8_t r = a + 1;
+	uint8_t f = (flagsSZ53P(r) & ~Z80_FLAG_PV) | c;
+
+	if ((a & 0x0f) == 0x0f) f |= Z80_FLAG_H;
+	if (a == 0x7f) f |= Z80_FLAG_PV;
+	return (r << 8) | f;
+}
+
+static uint16_t flagsDEC(uint8_t a, uint8_t, uint8_t c)
+{
+	uint8_t r = a - 1;
+	uint8_t f = (flagsSZ53P(r) & ~Z80_FLAG_PV) | Z80_FLAG_N | c;
+
+	if ((a & 0x0f) == 0) f |= Z80_FLAG_H;
+	if (a == 0x80) f |= Z80_FLAG_PV;
+	return (r << 8) | f;
+}
+
+/* f holds the C, H and N that DAA reads */
+static uint16_t flagsDAA(uint8_t a, uint8_t f)
+{
+	uint8_t lo = a & 0x0f, diff = 0, r, c = f & Z80_FLAG_C;
+	bool n = f & Z80_FLAG_N, h = f & Z80_FLAG_H;
+
+	if (h || lo > 9) diff = 0x06;
+	if (c || a > 0x99) { diff |= 0x60; c = Z80_FLAG_C; }
+	r = n ? a - diff : a + diff;
+	f = flagsSZ53P(r) | c | (n ? Z80_FLAG_N : 0);
+	if (n ? h && lo < 6 : lo > 9) f |= Z80_FLAG_H;
+	return (r << 8) | f;
+}
+
+struct FlagOp {
+	const char* name;
+	uint8_t opcode; /* on A and B, or on (HL) */
+	bool operand; /* false when B does not matter */
+	bool memory; /* works on (HL) instead of A */
+	FlagRef ref;
+};
+
+static const FlagOp flagOps[] = {
+	{ "ADD A,B", 0x80, true, false, flagsADD },
+	{ "ADC A,B", 0x88, true, false, flagsADC },
+	{ "SUB B", 0x90, true, false, flagsSUB },
+	{ "SBC A,B", 0x98, true, false, flagsSBC },
+	{ "AND B", 0xa0, true, false, flagsAND },
+	{ "XOR B", 0xa8, true, false, flagsXOR },
+	{ "OR B", 0xb0, true, false, flagsOR },
+	{ "CP B", 0xb8, true, false, flagsCP },
+	{ "INC A", 0x3c, false, false, flagsINC },
+	{ "DEC A", 0x3d, false, false, flagsDEC },
+	{ "INC (HL)", 0x34, false, true, flagsINC },
+	{ "DEC (HL)", 0x35, false, true, flagsDEC },
+};
+
+/* whether JP cc is taken with the flags f */
+static bool flagsTaken(uint8_t cc, uint8_t f)
+{
+	static const uint8_t bits[4] = { Z80_FLAG_Z, Z80_FLAG_C, Z80_FLAG_PV, Z80_FLAG_S };
+
+	return ((f & bits[cc >> 1]) != 0) == ((cc & 1) != 0);
+}
+
+struct FlagTests {
+	template<class P> bool run(const char* name)
+	{
+		static HostCpu<P> cpu;
+		/* #8000 LD A,E; CP D; LD A,C; op; JP cc,#9000; PUSH AF, and PUSH AF at #9000 */
+		static const uint8_t prog[] = { 0x7b, 0xba, 0x79, 0x00, 0xc2, 0x00, 0x90, 0xf5 };
+		/* #8100 POP AF; DAA; JP cc,#9000; PUSH AF */
+		static const uint8_t daa[] = { 0xf1, 0x27, 0xc2, 0x00, 0x90, 0xf5 };
+		uint32_t k, a, v, c, cases = 0, failed = 0;
+		uint16_t want, got, pushed, pc;
+		uint8_t cc, f, m;
+
+		for (k = 0; k < sizeof(flagOps) / sizeof(flagOps[0]); ++k) {
+			const FlagOp& op = flagOps[k];
+
+			cpu.Z80_Reset();
+			for (a = 0; a < sizeof(prog); ++a) cpu.memWriteFn(0x8000 + a, prog[a], Z80_MEMIO_OTHER);
+			cpu.memWriteFn(0x8003, op.opcode, Z80_MEMIO_OTHER);
+			cpu.memWriteFn(0x9000, 0xf5, Z80_MEMIO_OTHER);
+
+			for (a = 0; a < 256; ++a) {
+				for (v = 0; v < (op.operand ? 256u : 1u); ++v) {
+					for (c = 0; c < 2; ++c) {
+						cc = (a ^ v ^ c) & 7;
+						cpu.memWriteFn(0x8004, 0xc2 | (cc << 3), Z80_MEMIO_OTHER);
+						cpu.af.w = 0; cpu.bc.b = v; cpu.bc.c = a; cpu.de.d = c; cpu.de.e = 0; cpu.hl.w = 0xa000;
+						cpu.memWriteFn(0xa000, a, Z80_MEMIO_OTHER);
+						cpu.sp.w = 0xff00;
+						cpu.pc = 0x8000;
+						cpu.Z80_ExecuteTS(op.memory ? 34 : 27);
+
+						want = op.ref(a, v, c);
+						m = cpu.mem[0xa000];
+						pushed = cpu.mem[0xfefe] | (cpu.mem[0xfeff] << 8);
+						got = cpu.af.w;
+						pc = flagsTaken(cc, want) ? 0x9001 : 0x8008;
+						if (op.memory) {
+							m ^= (want >> 8) ^ a;
+							want = (a << 8) | (want & 0xff);
+						}
+						++cases;
+						if (got == want && pushed == want && cpu.pc == pc && cpu.sp.w == 0xfefe && m == a) continue;
+						if (++failed <= 10) {
+							printf("flags %s %s %s A=%02x B=%02x carry %u: AF %04x pushed %04x PC %04x (HL) %02x, expected AF %04x PC %04x\n",
+								variant, name, op.name, a, v, c, got, pushed, cpu.pc, cpu.mem[0xa000], want, pc);
+						}
+					}
+				}
+			}
+		}
+
+		/* DAA for every A and C, H and N, the other flags it must not keep set as well */
+		cpu.Z80_Reset();
+		for (k = 0; k < sizeof(daa); ++k) cpu.memWriteFn(0x8100 + k, daa[k], Z80_MEMIO_OTHER);
+		for (a = 0; a < 256; ++a) {
+			for (k = 0; k < 8; ++k) {
+				f = (k & 1 ? Z80_FLAG_C : 0) | (k & 2 ? Z80_FLAG_H : 0) | (k & 4 ? Z80_FLAG_N : 0);
+				f |= (a * 7 + k) & (Z80_FLAG_S | Z80_FLAG_Z | Z80_FLAG_35 | Z80_FLAG_PV);
+				cc = (a ^ k) & 7;
+				cpu.memWriteFn(0x8102, 0xc2 | (cc << 3), Z80_MEMIO_OTHER);
+				cpu.memWriteFn(0xfefc, f, Z80_MEMIO_OTHER);
+				cpu.memWriteFn(0xfefd, a, Z80_MEMIO_OTHER);
+				cpu.af.w = 0;
+				cpu.sp.w = 0xfefc;
+				cpu.pc = 0x8100;
+				cpu.Z80_ExecuteTS(25);
+
+				want = flagsDAA(a, f);
+				pushed = cpu.mem[0xfefc] | (cpu.mem[0xfefd] << 8);
+				got = cpu.af.w;
+				pc = flagsTaken(cc, want) ? 0x9001 : 0x8106;
+				++cases;
+				if (got == want && pushed == want && cpu.pc == pc && cpu.sp.w == 0xfefc) continue;
+				if (++failed <= 10) {
+					printf("flags %s %s DAA A=%02x F=%02x: AF %04x pushed %04x PC %04x, expected AF %04x PC %04x\n",
+						variant, name, a, f, got, pushed, cpu.pc, want, pc);
+				}
+			}
+		}
+		printf("flags %s %s: %u cases, %u failed\n", variant, name, cases, failed);
+		return !failed;
+	}
+};
+
+/******************************************************************************/
+/* diff: random programs run by the full policy, flags worked out eagerly and no block */
+/* callbacks, and by the policy under test, with the LDIR/LDDR and CPIR/CPDR callbacks */
+/* when it has no contention. Both get the same mix of single steps, Z80_ExecuteTS() */
+/* runs and interrupts and are compared after each; the digest of the reference runs */
+/* is the same for every variant */
+
+typedef HostCpu<FullPolicy> DiffCpu;
+
+/* fills the memory and sets what the program needs over the random registers */
+typedef void (*DiffProgram)(Random& rnd, DiffCpu& cpu);
+
+/* random bytes, with block copies that run into their own opcode planted */
+static void mixedProgram(Random& rnd, DiffCpu& cpu)
+{
+	uint8_t code[11];
+	uint32_t i, n;
+	uint16_t at, de;
+
+	for (i = 0; i < 65536; ++i) cpu.mem[i] = rnd.byte();
+	for (n = 0; n < 64; ++n) {
+		/* LD DE,nn; LD HL,nn; LD BC,n; LDIR or LDDR, DE up to 8 below or 3 above the ED */
+		at = rnd.next();
+		de = at + 1 + rnd.below(12);
+		code[0] = 0x11; code[1] = de & 0xff; code[2] = de >> 8;
+		code[3] = 0x21; code[4] = rnd.byte(); code[5] = rnd.byte();
+		code[6] = 0x01; code[7] = 1 + rnd.below(40); code[8] = 0;
+		code[9] = 0xed; code[10] = rnd.below(2) ? 0xb0 : 0xb8;
+		for (i = 0; i < sizeof(code); ++i) cpu.mem[(uint16_t)(at + i)] = code[i];
+	}
+}
+
+/* ALU operations that may leave F lazy, between instructions that read F or set it */
+/* another way: PUSH/POP AF, EX AF,AF', JR/JP/CALL/RET cc, DAA, SCF/CCF, rotates, */
+/* ADC/SBC HL, LD A,I/R, NEG and BIT */
+static void aluProgram(Random& rnd, DiffCpu& cpu)
+{
+	static const uint8_t readers[] = { 0xf5, 0xf1, 0x08, 0x27, 0x37, 0x3f, 0x07, 0x0f, 0x17, 0x1f, 0x20, 0x28, 0x30, 0x38,
+		0xc2, 0xca, 0xd2, 0xda, 0xe2, 0xea, 0xf2, 0xfa, 0xc0, 0xc8, 0xd0, 0xd8, 0xc4, 0xcc, 0xd4, 0xdc, 0xed, 0xcb };
+	static const uint8_t ed[] = { 0x42, 0x52, 0x62, 0x72, 0x4a, 0x5a, 0x6a, 0x7a, 0x57, 0x5f, 0x44 };
+	uint32_t i = 0;
+	uint8_t op;
+
+	while (i < 65536) {
+		if (rnd.below(2)) {
+			/* ALU A,r or n, INC/DEC r, LD A,n */
+			switch (rnd.below(4)) {
+			case 0: cpu.mem[i++] = 0x80 + rnd.below(64); break;
+			case 1: cpu.mem[i++] = 0xc6 + 8 * rnd.below(8); cpu.mem[i++ & 0xffff] = rnd.byte(); break;
+			case 2: cpu.mem[i++] = 0x04 + 8 * rnd.below(8) + rnd.below(2); break;
+			default: cpu.mem[i++] = 0x3e; cpu.mem[i++ & 0xffff] = rnd.byte(); break;
+			}
+			continue;
+		}
+		op = readers[rnd.below(sizeof(readers))];
+		cpu.mem[i++] = op;
+		if (op == 0xed) cpu.mem[i++ & 0xffff] = ed[rnd.below(sizeof(ed))];
+		else if (op == 0xcb) cpu.mem[i++ & 0xffff] = 0x40 + rnd.below(64);
+		/* short jumps keep the program in the mix, the others land anywhere in it */
+		else if ((op & 0xe7) == 0x20) cpu.mem[i++ & 0xffff] = rnd.below(16) - 8;
+		else if ((op & 0xc6) == 0xc2 || (op & 0xc7) == 0xc4) { cpu.mem[i++ & 0xffff] = rnd.byte(); cpu.mem[i++ & 0xffff] = rnd.byte(); }
+	}
+}
+
+/* IX/IY code: one to three DD/FD prefixes before main opcodes with (IX+d) operands, */
+/* DDCB d op and DD/FD ED, between unprefixed bytes for the HL forms */
+static void indexProgram(Random& rnd, DiffCpu& cpu)
+{
+	uint32_t i = 0, n, prefixes;
+
+	while (i < 65536) {
+		n = rnd.below(10);
+		if (n < 3) {
+			cpu.mem[i++] = rnd.byte();
+			continue;
+		}
+		prefixes = 1 + (rnd.below(4) == 0) + (rnd.below(8) == 0);
+		while (prefixes--) cpu.mem[i++ & 0xffff] = rnd.below(2) ? 0xdd : 0xfd;
+		if (n < 7) {
+			cpu.mem[i++ & 0xffff] = rnd.byte();
+		} else if (n < 9) {
+			cpu.mem[i++ & 0xffff] = 0xcb;
+			cpu.mem[i++ & 0xffff] = rnd.byte();
+			cpu.mem[i++ & 0xffff] = rnd.byte();
+		} else {
+			cpu.mem[i++ & 0xffff] = 0xed;
+			cpu.mem[i++ & 0xffff] = rnd.byte();
+		}
+		/* displacement and operand, or the next instruction */
+		cpu.mem[i++ & 0xffff] = rnd.byte();
+		cpu.mem[i++ & 0xffff] = rnd.byte();
+	}
+}
+
+/* the sequences the fusion policy runs as one: copy loops of LD A,(HL); INC HL; */
+/* LD (DE),A; INC DE; DEC BC; LD A,B; OR C; JR NZ, DJNZ $ after LD B,n, the pairs on */
+/* their own and broken off after their first instruction, between random bytes */
+static void fusionProgram(Random& rnd, DiffCpu& cpu)
+{
+	static const uint8_t copy[] = { 0x01, 0x00, 0x00, 0x21, 0x00, 0x00, 0x11, 0x00, 0x00, 0x7e, 0x23, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20, 0xf7 };
+	static const uint8_t djnz[] = { 0x06, 0x00, 0x10, 0xfe };
+	static const uint8_t pairs[][4] = { { 0x7e, 0x23 }, { 0x12, 0x13 }, { 0x0b, 0x78, 0xb1, 0x20 } };
+	uint8_t code[sizeof(copy)];
+	uint32_t i = 0, n, k;
+
+	while (i < 65536) {
+		n = rnd.below(8);
+		if (n == 0) {
+			memcpy(code, copy, sizeof(copy));
+			code[1] = 1 + rnd.below(40);
+			code[4] = rnd.byte(); code[5] = rnd.byte();
+			code[7] = rnd.byte(); code[8] = rnd.byte();
+			for (k = 0; k < sizeof(copy); ++k) cpu.mem[i++ & 0xffff] = code[k];
+		} else if (n == 1) {
+			for (k = 0; k < sizeof(djnz); ++k) cpu.mem[i++ & 0xffff] = k == 1 ? rnd.byte() : djnz[k];
+		} else if (n < 5) {
+			/* whole, or cut short by a random byte */
+			const uint8_t* pair = pairs[n - 2];
+			uint32_t len = n == 4 ? 4 : 2, cut = rnd.below(4) ? len : 1 + rnd.below(len - 1);
+
+			for (k = 0; k < cut; ++k) cpu.mem[i++ & 0xffff] = pair[k];
+			cpu.mem[i++ & 0xffff] = n == 4 && cut == len ? rnd.below(16) - 12 : rnd.byte();
+		} else {
+			cpu.mem[i++] = rnd.byte();
+		}
+	}
+}
+
+/* reference is the digest of the full policy over the default number of images, taken */
+/* from the core before the HL/IX/IY bodies were split and before fusion, so the full */
+/* policy is held to it */
+struct DiffKind {
+	const char* name;
+	DiffProgram program;
+	uint32_t images;
+	uint32_t reference;
+	bool fused; /* the fused policy must have run each of its sequences */
+};
+
+static const DiffKind diffKinds[] = {
+	{ "mixed", mixedProgram, 500, 0x4b23fc10, false },
+	{ "alu", aluProgram, 300, 0x344f0543, false },
+	{ "index", indexProgram, 300, 0x11f6b9a4, false },
+	{ "fusion", fusionProgram, 300, 0xd01d2596, true },
+};
+
+struct DiffTests {
+	const DiffKind* kind;
+	uint32_t images, actions;
+
+	template<class P> bool run(const char* name)
+	{
+		static DiffCpu ref;
+		static HostCpu<P> cpu;
+		static Z80Snapshot start, a, b;
+		uint32_t k, n, t, failed = 0, digest = 2166136261u;
+		typename HostCpu<P>::Z80FusionStats was = cpu.fusion_stats, &now = cpu.fusion_stats;
+		char what[96];
+
+		for (k = 0; k < images && failed < 10; ++k) {
+			Random rnd(k + 1);
+
+			ref.Z80_Reset();
+			ref.af.w = rnd.next(); ref.bc.w = rnd.next(); ref.de.w = rnd.next(); ref.hl.w = rnd.next();
+			ref.afx.w = rnd.next(); ref.bcx.w = rnd.next(); ref.dex.w = rnd.next(); ref.hlx.w = rnd.next();
+			ref.ix.w = rnd.next(); ref.iy.w = rnd.next(); ref.sp.w = rnd.next(); ref.pc = rnd.next(); ref.memptr.w = rnd.next();
+			ref.regI = rnd.byte(); ref.regR = rnd.byte(); ref.im = rnd.below(3);
+			ref.iff1 = ref.iff2 = rnd.below(2);
+			kind->program(rnd, ref);
+			ref.snapshot(start);
+			cpu.restore(start);
+			ref.bulk = false;
+			cpu.bulk = !P::contention;
+
+			for (n = 0; n < actions; ++n) {
+				t = rnd.below(16);
+				if (t < 10) {
+					ref.Z80_ExecuteStep();
+					cpu.Z80_ExecuteStep();
+				} else if (t < 15) {
+					t = 1 + rnd.below(400);
+					ref.Z80_ExecuteTS(t);
+					cpu.Z80_ExecuteTS(t);
+				} else {
+					ref.Z80_Interrupt();
+					cpu.Z80_Interrupt();
+				}
+				if (cpu.matches(ref)) continue;
+				ref.snapshot(a);
+				cpu.snapshot(b);
+				snprintf(what, sizeof(what), "diff %s %s %s image %u action %u", variant, kind->name, name, k, n);
+				same(what, b, a);
+				++failed;
+				break;
+			}
+			digest = ref.digest(digest);
+		}
+		printf("diff %s %s %s: %u images, %u failed, reference %08x\n", variant, kind->name, name, images, failed, digest);
+		if (P::fusion) {
+			printf("diff %s %s %s: fused %u LD A,(HL), %u LD (DE),A, %u DEC BC loops, %u DJNZ $ passes\n", variant, kind->name, name,
+				now.ldInc - was.ldInc, now.stInc - was.stInc, now.decJr - was.decJr, now.djnz - was.djnz);
+			if (kind->fused && (now.ldInc == was.ldInc || now.stInc == was.stInc || now.decJr == was.decJr || now.djnz == was.djnz)) return false;
+		}
+		if (!failed && images == kind->images && digest != kind->reference) {
+			printf("diff %s %s %s: reference %08x, expected %08x\n", variant, kind->name, name, digest, kind->reference);
+			return false;
+		}
+		return !failed;
+	}
+};
+
+static int diffMain(const char* kindName, uint32_t images, const char* only)
+{
+	DiffTests tests;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(diffKinds) / sizeof(diffKinds[0]); ++i) {
+		if (strcmp(kindName, diffKinds[i].name)) continue;
+		tests.kind = &diffKinds[i];
+		tests.images = images ? images : diffKinds[i].images;
+		tests.actions = 300;
+		return eachPolicy(tests, only) ? 1 : 0;
+	}
+	printf("diff: no program kind %s\n", kindName);
+	return 2;
+}
+
+/******************************************************************************/
+/* bench: MIPS are counted with the instructions of the full policy, fused */
+/* instructions skip profileFn */
+
+/* INC A; DAA; INC (HL); DEC B; ADD A,B; DAA; DEC (HL); INC C; SUB C; DAA; DEC A; JR, */
+/* what ZYMOSIS_FLAGS_IN_TABLES looks up against the arithmetic of the other variants */
+static const uint8_t daaLoop[] = { 0x21, 0x00, 0x80, 0x3c, 0x27, 0x34, 0x05, 0x80, 0x27, 0x35, 0x0c, 0x91, 0x27, 0x3d, 0x18, 0xf3 };
+
+struct Bench {
+	const char* load;
+	const uint8_t* image;
+	size_t size;
+	uint32_t frames;
+	uint32_t reference;
+	double instructions;
+
+	template<class P> bool run(const char* name)
+	{
+		uint32_t digest;
+		double mhz = bench<P>(image, size, frames, digest);
+
+		printf("bench %-10s %-4s %-9s %8.1f MHz %8.1f MIPS  mem %08x%s\n", variant, load, name, mhz,
+			mhz * instructions / (frames * 69888.0), digest, digest == reference ? "" : " DIFFERS");
+		return digest == reference;
+	}
+
+	/* counts the instructions once, stepping the reference */
+	void count()
+	{
+		static HostCpu<FullPolicy> ref;
+		uint64_t n = 0;
+		uint32_t f;
+
+		memset(ref.mem, 0, sizeof(ref.mem));
+		memcpy(ref.mem, image, size);
+		ref.rom = true;
+		ref.portIn = [](HostCallBacks&, uint16_t) -> uint8_t { return 0xbf; };
+		ref.Z80_Reset();
+		for (f = 0; f < frames; ++f) {
+			ref.tstates = 0;
+			ref.Z80_Interrupt();
+			while (ref.tstates < 69888) {
+				ref.Z80_ExecuteStep();
+				++n;
+			}
+		}
+		reference = fnv(ref.mem, sizeof(ref.mem));
+		instructions = (double)n;
+	}
+};
+
+static int benchMain(uint32_t frames, const char* only)
+{
+	Bench b;
+	int failed;
+
+	b.frames = frames;
+	b.load = "daa";
+	b.image = daaLoop;
+	b.size = sizeof(daaLoop);
+	b.count();
+	failed = eachPolicy(b, only);
+
+	b.load = "rom";
+	b.image = rom;
+	b.size = 0x4000;
+	b.count();
+	failed += eachPolicy(b, only);
+
+	/* the ZX_SELFCHECK rows: one feature removed at a time, then all of them. Without */
+	/* MEMPTR the undocumented flags of BIT n,(HL) differ, so those may end differently */
+	if (!only) {
+		b.run<Z80Policy<false, true, true, true, true, true> >("-cont");
+		b.run<Z80Policy<true, false, true, true, true, true> >("-m1");
+		b.run<Z80Policy<true, true, false, true, true, true> >("-pager");
+		b.run<Z80Policy<true, true, true, false, true, true> >("-bp");
+		b.run<Z80Policy<true, true, true, true, false, true> >("-memptr");
+		b.run<Z80Policy<true, true, true, true, true, false> >("-r");
+		b.run<Z80Policy<false, false, false, false, false, false> >("none");
+	}
+	return failed ? 1 : 0;
+}
+
+/******************************************************************************/
+
+int main(int argc, char** argv)
+{
+	std::string cmd = argc > 1 ? argv[1] : "";
+
+	setvbuf(stdout, nullptr, _IOLBF, 0);
+
+	if (cmd == "selfcheck") {
+		SelfCheck s;
+		return eachPolicy(s, argc > 2 ? argv[2] : nullptr) ? 1 : 0;
+	}
+	if (cmd == "fuse" && argc > 3) return fuseMain(argv[2], argv[3], argc > 4 ? argv[4] : nullptr);
+	if (cmd == "zex" && argc > 2) return zexMain(argv[2], argc > 3 ? argv[3] : nullptr);
+	if (cmd == "flags") {
+		FlagTests f;
+		return eachPolicy(f, argc > 2 ? argv[2] : nullptr) ? 1 : 0;
+	}
+	if (cmd == "diff") return diffMain(argc > 2 ? argv[2] : "mixed", argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? argv[4] : nullptr);
+	if (cmd == "bench") return benchMain(argc > 2 ? atoi(argv[2]) : 500, argc > 3 ? argv[3] : nullptr);
+
+	printf("usage: %s selfcheck | fuse tests.in tests.expected | zex file.com | flags [policy] | diff [kind] [images] [policy] | bench [frames] [policy]\n", argv[0]);
+	return 2;
+}
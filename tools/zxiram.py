@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Lists what a ZX48 build put in the ESP8266 IRAM.
+
+The ESP8266 core leaves a linker map next to the .elf in the build directory (turn on
+verbose compile output in the Arduino IDE to see where). Build with ZX_IRAM_CORE and run
+
+    zxiram.py ESPBoy_ZX48HPP.ino.map
+    zxiram.py --limit 32768 ESPBoy_ZX48HPP.ino.map      (exit status 1 when over)
+
+The report lists the functions in IRAM by size with the object they come from, the total
+per object, and the IRAM left. Z80_Execute(), renderRow() and sound_ISR() come from
+ZX48.cpp.o, the rest is the core and the SDK.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+IRAM_START = 0x40100000
+
+HEX = r"0x[0-9a-fA-F]+"
+INPUT = re.compile(r"^ (\.\S+)(?:\s+(%s)\s+(%s)\s+(.*))?$" % (HEX, HEX))
+WRAPPED = re.compile(r"^\s+(%s)\s+(%s)\s+(.*)$" % (HEX, HEX))
+SYMBOL = re.compile(r"^\s+(%s)\s+([A-Za-z_.$][^\s=]*)\s*$" % HEX)
+
+
+def parse(lines, size):
+    """Returns [address, length, section, object, symbol] of the input sections in IRAM."""
+    found = []
+    pending = None
+    last = None
+
+    for line in lines:
+        line = line.rstrip("\n")
+
+        if pending is not None:
+            m = WRAPPED.match(line)
+            section, pending = pending, None
+            if m:
+                last = found_add(found, section, m.group(1), m.group(2), m.group(3), size)
+                continue
+
+        m = INPUT.match(line)
+        if m:
+            if m.group(2) is None:
+                pending = m.group(1)
+                continue
+            last = found_add(found, m.group(1), m.group(2), m.group(3), m.group(4), size)
+            continue
+
+        m = SYMBOL.match(line)
+        if m and last is not None and not last[4] and int(m.group(1), 16) == last[0]:
+            last[4] = m.group(2)
+            continue
+
+        if not line.startswith(" "):
+            last = None
+
+    return found
+
+
+def found_add(found, section, addr, length, obj, size):
+    addr = int(addr, 16)
+    length = int(length, 16)
+
+    if length == 0 or addr < IRAM_START or addr >= IRAM_START + size:
+        return None
+
+    entry = [addr, length, section, os.path.basename(obj.strip()), ""]
+    found.append(entry)
+    return entry
+
+
+def demangle(names):
+    try:
+        out = subprocess.run(["c++filt"], input="\n".join(names), capture_output=True, text=True, check=True).stdout
+        return dict(zip(names, out.splitlines()))
+    except (OSError, subprocess.CalledProcessError):
+        return {}
+
+
+def report(found, size, top, out):
+    names = demangle([e[4] for e in found if e[4]])
+    used = sum(e[1] for e in found)
+
+    out.write("IRAM used %d of %d bytes, %d left\n\n" % (used, size, size - used))
+
+    out.write("Functions\n")
+    for addr, length, section, obj, symbol in sorted(found, key=lambda e: -e[1])[:top]:
+        out.write("  %6d  %-24s %s\n" % (length, obj[:24], names.get(symbol, symbol) or section))
+
+    per_object = {}
+    for e in found:
+        per_object[e[3]] = per_object.get(e[3], 0) + e[1]
+
+    out.write("\nObjects\n")
+    for obj, length in sorted(per_object.items(), key=lambda i: -i[1])[:top]:
+        out.write("  %6d  %s\n" % (length, obj))
+
+    return used
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("file", nargs="?", help="linker map, - for stdin")
+    ap.add_argument("--size", type=int, default=32768, help="IRAM bytes for code, 49152 with the 48K MMU option")
+    ap.add_argument("--limit", type=int, help="fail when more than this is used")
+    ap.add_argument("--top", type=int, default=40, help="entries in each list")
+    args = ap.parse_args()
+
+    if args.file and args.file != "-":
+        with open(args.file, encoding="latin-1") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    used = report(parse(lines, args.size), args.size, args.top, sys.stdout)
+
+    if args.limit is not None and used > args.limit:
+        sys.stderr.write("IRAM use %d is over the limit of %d\n" % (used, args.limit))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+"""Prints the hot spots of a ZX48 profile.
+
+Build the emulator with ZX_PROFILER, send 'p' over the serial port and save what comes
+back, or let this script talk to the port:
+
+    zxprof.py profile.txt
+    zxprof.py --port /dev/ttyUSB0      (needs pyserial)
+
+The report lists the hottest 256 byte PC buckets, the most executed opcodes and a
+disassembly of the hottest buckets, with the instructions that start there.
+"""
+
+import argparse
+import sys
+
+R = ["B", "C", "D", "E", "H", "L", "(HL)", "A"]
+RP = ["BC", "DE", "HL", "SP"]
+RP2 = ["BC", "DE", "HL", "AF"]
+CC = ["NZ", "Z", "NC", "C", "PO", "PE", "P", "M"]
+ALU = ["ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP "]
+ROT = ["RLC", "RRC", "RL", "RR", "SLA", "SRA", "SLL", "SRL"]
+IM = ["0", "0", "1", "2", "0", "0", "1", "2"]
+BLI = {
+    (4, 0): "LDI", (4, 1): "CPI", (4, 2): "INI", (4, 3): "OUTI",
+    (5, 0): "LDD", (5, 1): "CPD", (5, 2): "IND", (5, 3): "OUTD",
+    (6, 0): "LDIR", (6, 1): "CPIR", (6, 2): "INIR", (6, 3): "OTIR",
+    (7, 0): "LDDR", (7, 1): "CPDR", (7, 2): "INDR", (7, 3): "OTDR",
+}
+PREFIX_NAMES = {"00": "", "CB": "CB ", "ED": "ED ", "DD": "DD/FD ", "DC": "DD/FD CB "}
+
+
+def disasm(read, pc):
+    """Returns (length, text) of the instruction at pc, read(addr) gives a byte."""
+    start = pc
+    index = None
+
+    def byte():
+        nonlocal pc
+        v = read(pc)
+        pc = (pc + 1) & 0xFFFF
+        return v
+
+    def word():
+        lo = byte()
+        return lo | (byte() << 8)
+
+    def sdisp():
+        d = byte()
+        return d - 256 if d > 127 else d
+
+    op = byte()
+
+    while op in (0xDD, 0xFD):
+        index = "IX" if op == 0xDD else "IY"
+        op = byte()
+
+    def reg(i, d=None):
+        if index is None:
+            return R[i]
+        if i == 6:
+            return "(%s%+d)" % (index, d)
+        if i == 4:
+            return index + "H"
+        if i == 5:
+            return index + "L"
+        return R[i]
+
+    def hl():
+        return index or "HL"
+
+    def rp(p):
+        return hl() if p == 2 else RP[p]
+
+    def rp2(p):
+        return hl() if p == 2 else RP2[p]
+
+    if op == 0xCB:
+        if index:
+            d = sdisp()
+            op = byte()
+            m = "(%s%+d)" % (index, d)
+        else:
+            op = byte()
+            m = R[op & 7]
+        x, y = op >> 6, (op >> 3) & 7
+        if x == 0:
+            text = "%s %s" % (ROT[y], m)
+        else:
+            text = "%s %d,%s" % (["", "BIT", "RES", "SET"][x], y, m)
+        return (pc - start) & 0xFFFF, text
+
+    if op == 0xED:
+        op = byte()
+        x, y, z = op >> 6, (op >> 3) & 7, op & 7
+        p, q = y >> 1, y & 1
+        text = "NOP*"
+        if x == 1:
+            if z == 0:
+                text = "IN (C)" if y == 6 else "IN %s,(C)" % R[y]
+            elif z == 1:
+                text = "OUT (C),0" if y == 6 else "OUT (C),%s" % R[y]
+            elif z == 2:
+                text = "%s HL,%s" % ("ADC" if q else "SBC", RP[p])
+            elif z == 3:
+                nn = word()
+                text = "LD %s,(#%04X)" % (RP[p], nn) if q else "LD (#%04X),%s" % (nn, RP[p])
+            elif z == 4:
+                text = "NEG"
+            elif z == 5:
+                text = "RETI" if y == 1 else "RETN"
+            elif z == 6:
+                text = "IM " + IM[y]
+            else:
+                text = ["LD I,A", "LD R,A", "LD A,I", "LD A,R", "RRD", "RLD", "NOP*", "NOP*"][y]
+        elif x == 2 and (y, z) in BLI:
+            text = BLI[(y, z)]
+        return (pc - start) & 0xFFFF, text
+
+    x, y, z = op >> 6, (op >> 3) & 7, op & 7
+    p, q = y >> 1, y & 1
+
+    if x == 0:
+        if z == 0:
+            if y == 0:
+                text = "NOP"
+            elif y == 1:
+                text = "EX AF,AF'"
+            else:
+                d = sdisp()
+                target = (pc + d) & 0xFFFF
+                text = ["DJNZ", "JR", "JR NZ,", "JR Z,", "JR NC,", "JR C,"][y - 2]
+                text = "%s #%04X" % (text, target) if y < 4 else "%s#%04X" % (text, target)
+        elif z == 1:
+            text = "ADD %s,%s" % (hl(), rp(p)) if q else "LD %s,#%04X" % (rp(p), word())
+        elif z == 2:
+            if p < 2:
+                m = "(%s)" % RP[p]
+                text = "LD A,%s" % m if q else "LD %s,A" % m
+            else:
+                nn = word()
+                r = hl() if p == 2 else "A"
+                text = "LD %s,(#%04X)" % (r, nn) if q else "LD (#%04X),%s" % (nn, r)
+        elif z == 3:
+            text = "%s %s" % ("DEC" if q else "INC", rp(p))
+        elif z in (4, 5):
+            d = sdisp() if index and y == 6 else None
+            text = "%s %s" % ("INC" if z == 4 else "DEC", reg(y, d))
+        elif z == 6:
+            d = sdisp() if index and y == 6 else None
+            text = "LD %s,#%02X" % (reg(y, d), byte())
+        else:
+            text = ["RLCA", "RRCA", "RLA", "RRA", "DAA", "CPL", "SCF", "CCF"][y]
+    elif x == 1:
+        if y == 6 and z == 6:
+            text = "HALT"
+        else:
+            d = sdisp() if index and (y == 6 or z == 6) else None
+            # with (IX+d) the other operand is a plain register
+            if d is not None:
+                text = "LD %s,%s" % (reg(y, d) if y == 6 else R[y], reg(z, d) if z == 6 else R[z])
+            else:
+                text = "LD %s,%s" % (reg(y), reg(z))
+    elif x == 2:
+        d = sdisp() if index and z == 6 else None
+        text = ALU[y] + reg(z, d)
+    else:
+        if z == 0:
+            text = "RET " + CC[y]
+        elif z == 1:
+            if q == 0:
+                text = "POP " + rp2(p)
+            else:
+                text = ["RET", "EXX", "JP (%s)" % hl(), "LD SP,%s" % hl()][p]
+        elif z == 2:
+            text = "JP %s,#%04X" % (CC[y], word())
+        elif z == 3:
+            if y == 0:
+                text = "JP #%04X" % word()
+            elif y == 2:
+                text = "OUT (#%02X),A" % byte()
+            elif y == 3:
+                text = "IN A,(#%02X)" % byte()
+            else:
+                text = ["", "", "", "", "EX (SP),%s" % hl(), "EX DE,HL", "DI", "EI"][y]
+        elif z == 4:
+            text = "CALL %s,#%04X" % (CC[y], word())
+        elif z == 5:
+            text = "PUSH " + rp2(p) if q == 0 else "CALL #%04X" % word()
+        elif z == 6:
+            text = ALU[y] + "#%02X" % byte()
+        else:
+            text = "RST #%02X" % (y * 8)
+
+    return (pc - start) & 0xFFFF, text
+
+
+def parse(lines):
+    prof = {"insn": 0, "pc": {}, "op": {}, "shift": 0, "mem": {}}
+    inside = False
+    for line in lines:
+        f = line.strip().split()
+        if not f:
+            continue
+        if f[0] == "ZXPROF":
+            inside = True
+            prof = {"insn": 0, "pc": {}, "op": {}, "shift": 0, "mem": {}}
+            continue
+        if not inside:
+            continue
+        try:
+            if f[0] == "INSN":
+                prof["insn"] = int(f[1])
+            elif f[0] == "PC":
+                prof["pc"][int(f[1], 16)] = int(f[2])
+            elif f[0] == "OP":
+                prof["op"][(f[1], int(f[2], 16))] = int(f[3])
+            elif f[0] == "SHIFT":
+                prof["shift"] = int(f[1])
+            elif f[0] == "MEM":
+                addr = int(f[1], 16)
+                for i in range(0, len(f[2]), 2):
+                    prof["mem"][addr + i // 2] = int(f[2][i:i + 2], 16)
+            elif f[0] == "END":
+                inside = False
+        except (IndexError, ValueError):
+            pass  # a line mangled by the telemetry packets on the same port
+    return prof
+
+
+def opcode_name(prefix, op):
+    data = {"00": [op, 0, 0, 0], "CB": [0xCB, op, 0, 0], "ED": [0xED, op, 0, 0],
+            "DD": [0xDD, op, 0, 0, 0], "DC": [0xDD, 0xCB, 0, op]}[prefix]
+    return disasm(lambda a: data[a] if a < len(data) else 0, 0)[1]
+
+
+def report(prof, top, out):
+    total = sum(prof["pc"].values()) or 1
+    out.write("%d instructions counted\n\n" % prof["insn"])
+
+    out.write("Hot PC buckets\n")
+    for addr, count in sorted(prof["pc"].items(), key=lambda i: -i[1])[:top]:
+        area = "ROM" if addr < 0x4000 else ("screen" if addr < 0x5B00 else "RAM")
+        out.write("  #%04X-#%04X %6.2f%%  %s\n" % (addr, addr + 255, 100.0 * count / total, area))
+
+    ops = sorted(prof["op"].items(), key=lambda i: -i[1])
+    total = sum(prof["op"].values()) or 1
+    out.write("\nHot opcodes\n")
+    for (prefix, op), count in ops[:top]:
+        out.write("  %s%02X %6.2f%%  %s\n" % (PREFIX_NAMES[prefix], op, 100.0 * count / total,
+                                             opcode_name(prefix, op)))
+
+    mem = prof["mem"]
+    buckets = sorted({a & 0xFF00 for a in mem}, key=lambda a: -prof["pc"].get(a, 0))
+    for base in buckets:
+        out.write("\nBucket #%04X\n" % base)
+        pc = base
+        while pc < base + 256:
+            length, text = disasm(lambda a: mem.get(a, 0), pc)
+            raw = " ".join("%02X" % mem.get(pc + i, 0) for i in range(length))
+            out.write("  #%04X  %-12s %s\n" % (pc, raw, text))
+            pc += length
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("file", nargs="?", help="saved profile, - for stdin")
+    ap.add_argument("--port", help="serial port to request the profile from")
+    ap.add_argument("--top", type=int, default=16, help="entries in each list")
+    args = ap.parse_args()
+
+    if args.port:
+        import serial
+        with serial.Serial(args.port, 115200, timeout=2) as s:
+            s.reset_input_buffer()
+            s.write(b"p")
+            lines = []
+            while True:
+                line = s.readline()
+                if not line:
+                    break
+                lines.append(line.decode("latin-1"))
+                if line.startswith(b"END"):
+                    break
+    elif args.file and args.file != "-":
+        with open(args.file, encoding="latin-1") as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    report(parse(lines), args.top, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
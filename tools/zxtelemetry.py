@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Decodes the ZX48 frame time telemetry packets.
+
+Build the emulator with ZX_TELEMETRY_SERIAL, save what comes over the serial port, or let
+this script read the port:
+
+    zxtelemetry.py capture.bin
+    zxtelemetry.py --port /dev/ttyUSB0      (needs pyserial, Ctrl+C to stop)
+
+Each packet is "ZXT2", the 44 byte ZXTelemetryReport and the 8-bit sum of the report
+bytes, see zxtelemetry.hpp. Packets with a wrong sum are counted and dropped, anything
+else on the port (profile or trace text) is skipped. One line is printed per packet with
+the rendered frames per second, the share of the window spent emulating, rendering,
+scanning the input and in the sound interrupt, then the fields as they were sent, with
+the free heap in bytes.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"ZXT2"
+REPORT = struct.Struct("<9I4H")
+FIELDS = ["window_us", "emulate_us", "render_us", "input_us", "audio_us", "spi_bytes",
+          "dirty_lines", "audio_underruns", "idle_skips", "frames", "skipped", "renders",
+          "heap"]
+PACKET = len(MAGIC) + REPORT.size + 1
+
+
+def decode(buf):
+    """Returns (reports, bad, rest): the reports found in buf as dicts, the number of
+    packets with a wrong sum and the bytes to keep for the next call."""
+    reports = []
+    bad = 0
+    pos = 0
+
+    while True:
+        pos = buf.find(MAGIC, pos)
+        if pos < 0:
+            # keep a tail that may be the start of the magic
+            return reports, bad, buf[-(len(MAGIC) - 1):]
+        if len(buf) - pos < PACKET:
+            return reports, bad, buf[pos:]
+        body = buf[pos + len(MAGIC):pos + PACKET - 1]
+        if sum(body) & 0xFF != buf[pos + PACKET - 1]:
+            bad += 1
+            pos += 1  # a magic inside text or another packet, look again past it
+            continue
+        report = dict(zip(FIELDS, REPORT.unpack(body)))
+        report["heap"] *= 16
+        reports.append(report)
+        pos += PACKET
+
+
+def line(r):
+    window = r["window_us"] or 1
+    busy = r["emulate_us"] + r["render_us"] + r["input_us"] + r["audio_us"]
+    head = "%5.1f fps %3d%% busy (emu %d%% lcd %d%% in %d%% snd %d%%)" % (
+        r["renders"] * 1e6 / window, 100 * busy // window,
+        100 * r["emulate_us"] // window, 100 * r["render_us"] // window,
+        100 * r["input_us"] // window, 100 * r["audio_us"] // window)
+    return head + "  " + " ".join("%s=%d" % (f, r[f]) for f in FIELDS)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("file", nargs="?", help="saved serial capture, - for stdin")
+    ap.add_argument("--port", help="serial port to read the packets from")
+    args = ap.parse_args()
+
+    if args.port:
+        import serial
+        port = serial.Serial(args.port, 115200, timeout=1)
+        read = lambda: port.read(256)
+    elif args.file and args.file != "-":
+        f = open(args.file, "rb")
+        read = lambda: f.read(4096)
+    else:
+        read = lambda: sys.stdin.buffer.read(4096)
+
+    buf = b""
+    total = 0
+    bad = 0
+
+    try:
+        while True:
+            data = read()
+            if not data:
+                if args.port:
+                    continue
+                break
+            reports, n, buf = decode(buf + data)
+            bad += n
+            for r in reports:
+                total += 1
+                print(line(r), flush=True)
+    except KeyboardInterrupt:
+        pass
+
+    sys.stderr.write("%d packets, %d with a wrong sum\n" % (total, bad))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,463 @@
+#pragma once
+
+#ifndef __ZXBANKS_HPP__
+#define __ZXBANKS_HPP__
+
+// 128K RAM bank store
+//
+// The eight 16K banks of the 128K machine do not fit into the ESP8266 heap, so only
+// a few of them are resident in frames at any time. Banks that are paged out are kept
+// packed with the same ED ED nn bb scheme the .z80 format uses, so snapshot pages are
+// stored as they come from the file. A bank that was not written since it was unpacked
+// keeps its packed copy, which makes paging it out again a table update only, so clean
+// banks are paged out before written ones. A written bank is packed again when it is
+// paged out, into the buffer its stale copy left behind when it was written if that is
+// big enough, so a game that keeps switching banks does not go through malloc each time.
+// When the heap runs out the store drops the packed copies of resident clean banks and
+// tries again before giving up.
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+class ZXBankStore
+{
+public:
+	static constexpr uint8_t BANKS = 8;
+	static constexpr size_t BANK_SIZE = 0x4000;
+	static constexpr uint8_t FRAMES_MAX = 4;
+	static constexpr size_t SCREEN_SIZE = 6912;
+	static constexpr uint8_t NONE = 0xff;
+
+	ZXBankStore() : frames(0), own_frames(0), clock(0), dirty(0), raw(0), spare(nullptr), spare_size(0), screen_bank(5), shadow_bank(NONE), shadow(nullptr)
+	{
+		memset(frame, 0, sizeof(frame));
+		memset(packed, 0, sizeof(packed));
+		memset(packed_size, 0, sizeof(packed_size));
+		memset(packed_cap, 0, sizeof(packed_cap));
+		memset(bank_frame, NONE, sizeof(bank_frame));
+		memset(frame_bank, NONE, sizeof(frame_bank));
+	}
+
+	//base is split into base_frames frames, then up to extra frames are allocated while heap allows
+
+	uint8_t begin(uint8_t* base, uint8_t base_frames, uint8_t extra)
+	{
+		uint8_t i;
+
+		end();
+
+		for (i = 0; i < base_frames && frames < FRAMES_MAX; ++i) frame[frames++] = base + i * BANK_SIZE;
+
+		for (i = 0; i < extra && frames < FRAMES_MAX; ++i)
+		{
+			frame[frames] = (uint8_t*)malloc(BANK_SIZE);
+
+			if (!frame[frames]) break;
+
+			++frames;
+			++own_frames;
+		}
+
+		clear();
+
+		return frames;
+	}
+
+	void end()
+	{
+		clear();
+
+		while (own_frames)
+		{
+			--own_frames;
+			--frames;
+			free(frame[frames]);
+		}
+
+		frames = 0;
+
+		free(shadow);
+		shadow = nullptr;
+		shadow_bank = NONE;
+
+		free(spare);
+		spare = nullptr;
+		spare_size = 0;
+	}
+
+	//all banks are zero filled and nothing is resident
+
+	void clear()
+	{
+		uint8_t i;
+
+		for (i = 0; i < BANKS; ++i)
+		{
+			free(packed[i]);
+			packed[i] = nullptr;
+			packed_size[i] = 0;
+			packed_cap[i] = 0;
+			bank_frame[i] = NONE;
+		}
+
+		for (i = 0; i < FRAMES_MAX; ++i)
+		{
+			frame_bank[i] = NONE;
+			frame_age[i] = 0;
+		}
+
+		dirty = 0;
+		raw = 0;
+		shadow_bank = NONE;
+	}
+
+	//makes a bank resident, keep is a bit mask of banks that must not be evicted for it
+	//a free frame is used first, then the least recently used clean bank, then written
+	//banks from the least recently used on until one of them can be packed
+	//returns nullptr when none of them can, there is no heap left even for a packed copy
+
+	uint8_t* acquire(uint8_t bank, uint8_t keep)
+	{
+		uint8_t i, victim, tried, written, victim_written;
+		uint32_t age;
+
+		if (bank_frame[bank] != NONE)
+		{
+			frame_age[bank_frame[bank]] = ++clock;
+			return frame[bank_frame[bank]];
+		}
+
+		tried = 0;
+
+		while (1)
+		{
+			victim = NONE;
+			victim_written = 0;
+			age = 0;
+
+			for (i = 0; i < frames; ++i)
+			{
+				if (frame_bank[i] == NONE)
+				{
+					victim = i;
+					break;
+				}
+
+				if ((keep & (1 << frame_bank[i])) || (tried & (1 << i))) continue;
+
+				//a clean bank beats a written one of any age
+
+				written = (dirty >> frame_bank[i]) & 1;
+
+				if (victim == NONE || written < victim_written || (written == victim_written && clock - frame_age[i] > age))
+				{
+					victim = i;
+					victim_written = written;
+					age = clock - frame_age[i];
+				}
+			}
+
+			if (victim == NONE) return nullptr;
+			if (evict(victim, keep)) break;
+
+			tried |= 1 << victim;
+		}
+
+		unpack(packed[bank], packed_size[bank], (raw >> bank) & 1, frame[victim]);
+
+		frame_bank[victim] = bank;
+		frame_age[victim] = ++clock;
+		bank_frame[bank] = victim;
+
+		if (shadow_bank == bank) shadow_bank = NONE;
+
+		return frame[victim];
+	}
+
+	//resident bank was written, its packed copy is stale now and its buffer is kept as
+	//the spare for the next written bank that is paged out
+
+	void touch(uint8_t bank)
+	{
+		if (dirty & (1 << bank)) return;
+
+		dirty |= (1 << bank);
+
+		keep_spare(packed[bank], packed_cap[bank]);
+
+		packed[bank] = nullptr;
+		packed_size[bank] = 0;
+		packed_cap[bank] = 0;
+		raw &= ~(1 << bank);
+	}
+
+	//returns a buffer for len bytes of bank data, packed, or BANK_SIZE bytes as they are
+	//when is_raw is set; a packed page can be BANK_SIZE bytes long too, so the two are told
+	//apart by the flag and not by the length
+	//used by the snapshot loader, the bank must not be resident
+
+	uint8_t* store(uint8_t bank, size_t len, bool is_raw)
+	{
+		if (shadow_bank == bank) shadow_bank = NONE;
+
+		free(packed[bank]);
+
+		packed[bank] = (uint8_t*)malloc(len);
+		packed_size[bank] = packed[bank] ? len : 0;
+		packed_cap[bank] = packed_size[bank];
+
+		if (is_raw && packed[bank]) raw |= (1 << bank); else raw &= ~(1 << bank);
+
+		return packed[bank];
+	}
+
+	//the screen area of a paged out screen bank is unpacked once into a shadow buffer,
+	//it can't change until the bank is resident again
+
+	void setScreen(uint8_t bank)
+	{
+		screen_bank = bank;
+	}
+
+	const uint8_t* screen()
+	{
+		if (bank_frame[screen_bank] != NONE) return frame[bank_frame[screen_bank]];
+
+		if (shadow_bank != screen_bank)
+		{
+			if (!shadow) shadow = (uint8_t*)malloc(SCREEN_SIZE);
+			if (!shadow) return nullptr;
+
+			unpack(packed[screen_bank], packed_size[screen_bank], (raw >> screen_bank) & 1, shadow, SCREEN_SIZE);
+			shadow_bank = screen_bank;
+		}
+
+		return shadow;
+	}
+
+	uint8_t resident() const { return frames; }
+
+	//.z80 block packing: runs of 5+ bytes, or 2+ 0xED bytes, become ED ED nn bb
+	//a byte that follows a single 0xED is never part of a block
+	//returns the packed size, only the bytes that fit into cap are written to dst, so
+	//dst may be nullptr to get the size only
+
+	static size_t pack(const uint8_t* src, uint8_t* dst, size_t cap = BANK_SIZE * 2)
+	{
+		size_t i, n, run;
+		uint8_t val;
+
+		i = 0;
+		n = 0;
+
+		while (i < BANK_SIZE)
+		{
+			val = src[i];
+			run = 1;
+
+			while (i + run < BANK_SIZE && src[i + run] == val && run < 255) ++run;
+
+			if (run >= 5 || (val == 0xed && run >= 2))
+			{
+				if (dst && n + 4 <= cap)
+				{
+					dst[n + 0] = 0xed;
+					dst[n + 1] = 0xed;
+					dst[n + 2] = run;
+					dst[n + 3] = val;
+				}
+
+				n += 4;
+				i += run;
+			}
+			else
+			{
+				if (dst && n < cap) dst[n] = val;
+
+				++n;
+				++i;
+
+				if (val == 0xed && i < BANK_SIZE)
+				{
+					if (dst && n < cap) dst[n] = src[i];
+
+					++n;
+					++i;
+				}
+			}
+		}
+
+		return n;
+	}
+
+	//raw data is copied, a packed stream is expanded up to sz bytes, the rest is zeroed
+
+	static void unpack(const uint8_t* src, size_t len, bool is_raw, uint8_t* dst, size_t sz = BANK_SIZE)
+	{
+		size_t i, n, ptr;
+
+		if (is_raw)
+		{
+			memcpy(dst, src, sz);
+			return;
+		}
+
+		i = 0;
+		ptr = 0;
+
+		while (i < len && ptr < sz)
+		{
+			if (src[i] == 0xed && i + 3 < len && src[i + 1] == 0xed)
+			{
+				n = src[i + 2];
+
+				if (n > sz - ptr) n = sz - ptr;
+
+				memset(&dst[ptr], src[i + 3], n);
+
+				ptr += n;
+				i += 4;
+			}
+			else
+			{
+				dst[ptr++] = src[i++];
+			}
+		}
+
+		if (ptr < sz) memset(&dst[ptr], 0, sz - ptr);
+	}
+
+private:
+	uint8_t* frame[FRAMES_MAX];
+	uint8_t frame_bank[FRAMES_MAX];
+	uint32_t frame_age[FRAMES_MAX];		//clock at the last acquire, ages are taken modulo 2^32
+	uint8_t frames;
+	uint8_t own_frames;
+	uint32_t clock;		//acquires so far, 8 bits wrapped within seconds of paging
+
+	uint8_t* packed[BANKS];
+	uint16_t packed_size[BANKS]; //0 with no data means zero filled bank
+	uint16_t packed_cap[BANKS]; //bytes allocated for packed, can be more than packed_size
+	uint8_t bank_frame[BANKS];
+	uint8_t dirty; //resident banks without a valid packed copy
+	uint8_t raw; //banks whose packed copy is the BANK_SIZE bytes as they are
+
+	uint8_t* spare; //buffer of the last stale packed copy, reused by evict()
+	uint16_t spare_size;
+
+	uint8_t screen_bank;
+	uint8_t shadow_bank;
+	uint8_t* shadow;
+
+	//only the largest stale buffer is kept, so at most one is held back from the heap
+
+	void keep_spare(uint8_t* buf, uint16_t size)
+	{
+		if (!buf) return;
+
+		if (size > spare_size)
+		{
+			free(spare);
+			spare = buf;
+			spare_size = size;
+		}
+		else
+		{
+			free(buf);
+		}
+	}
+
+	//frees the packed copies of the resident clean banks not in keep, they are packed
+	//again when paged out; returns false if there were none
+
+	bool drop_resident_copies(uint8_t keep)
+	{
+		uint8_t i, bank;
+		bool dropped = false;
+
+		for (i = 0; i < frames; ++i)
+		{
+			bank = frame_bank[i];
+
+			if (bank == NONE || (dirty & (1 << bank)) || (keep & (1 << bank)) || !packed[bank]) continue;
+
+			free(packed[bank]);
+			packed[bank] = nullptr;
+			packed_size[bank] = 0;
+			packed_cap[bank] = 0;
+			raw &= ~(1 << bank);
+			dirty |= (1 << bank);
+			dropped = true;
+		}
+
+		if (spare)
+		{
+			free(spare);
+			spare = nullptr;
+			spare_size = 0;
+			dropped = true;
+		}
+
+		return dropped;
+	}
+
+	//pages a bank out, a written one is packed first; its len is BANK_SIZE or more when
+	//packing does not pay, then the bank is kept raw, flagged in raw
+	//returns 0 and leaves the bank resident when there is no heap for the packed copy
+
+	uint8_t evict(uint8_t fr, uint8_t keep)
+	{
+		uint8_t bank = frame_bank[fr];
+		uint8_t* buf;
+		size_t len, cap;
+		bool is_raw;
+
+		if (bank == NONE) return 1;
+
+		if (dirty & (1 << bank))
+		{
+			//the spare usually fits, then the bank is packed in one pass
+			buf = spare;
+			cap = spare_size;
+			len = pack(frame[fr], buf, cap);
+			is_raw = len >= BANK_SIZE;
+
+			if (is_raw) len = BANK_SIZE;
+
+			if (len > cap)
+			{
+				buf = (uint8_t*)malloc(len);
+
+				if (!buf && drop_resident_copies(keep | (1 << bank))) buf = (uint8_t*)malloc(len);
+				if (!buf) return 0;
+
+				cap = len;
+
+				if (!is_raw) pack(frame[fr], buf, cap);
+			}
+			else
+			{
+				spare = nullptr;
+				spare_size = 0;
+			}
+
+			if (is_raw) memcpy(buf, frame[fr], BANK_SIZE);
+
+			packed[bank] = buf;
+			packed_size[bank] = len;
+			packed_cap[bank] = cap;
+
+			if (is_raw) raw |= (1 << bank); else raw &= ~(1 << bank);
+
+			dirty &= ~(1 << bank);
+		}
+
+		bank_frame[bank] = NONE;
+		frame_bank[fr] = NONE;
+
+		return 1;
+	}
+};
+
+#endif/*__ZXBANKS_HPP__*/
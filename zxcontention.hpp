@@ -0,0 +1,150 @@
+#pragma once
+
+#ifndef __ZXCONTENTION_HPP__
+#define __ZXCONTENTION_HPP__
+
+// ULA memory and I/O contention
+//
+// ZXContention<false> is the plain callback set, the Z80 core only adds raw T-states.
+// ZXContention<true> delays accesses to contended 16K slots while the ULA fetches the
+// 192 active lines, with the 6,5,4,3,2,1,0,0 pattern over the first 128 T-states of each
+// line, and applies the even port / contended high byte I/O rules.
+//
+// The core counts T-states from the start of each Z80_ExecuteTS() call, so the emulator
+// keeps frame_base up to date with the T-state of the frame the call started at.
+
+#include "zymosis.hpp"
+
+struct ZXContentionTiming
+{
+	int32_t start;		//T-state of the first contended cycle after the interrupt
+	uint16_t line;		//T-states per scanline
+	uint32_t line_mul;	//(t * line_mul) >> 24 == t / line for the 192 active lines
+};
+
+constexpr ZXContentionTiming ZX48_CONTENTION = { 14335, 224, 74899 };
+constexpr ZXContentionTiming ZX128_CONTENTION = { 14361, 228, 73585 };
+
+template<bool ENABLED>
+struct ZXContention : public zymosis::Z80CallBacks
+{
+	static constexpr bool enabled = false;
+
+	int32_t frame_base;
+
+	inline void setContention(const ZXContentionTiming& timing, uint8_t slots) {}
+	inline void setContendedSlots(uint8_t slots) {}
+	inline bool contended(uint16_t addr, uint16_t len) const { return false; }
+	inline int32_t contentionEnd() const { return 0; }
+};
+
+template<>
+struct ZXContention<true> : public zymosis::Z80CallBacks
+{
+	static constexpr bool enabled = true;
+
+	int32_t frame_base;
+
+	void setContention(const ZXContentionTiming& timing, uint8_t slots)
+	{
+		uint16_t i;
+
+		cnt_start = timing.start;
+		cnt_line = timing.line;
+		cnt_line_mul = timing.line_mul;
+		cnt_slots = slots;
+
+		static const uint8_t pattern[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+
+		for (i = 0; i < sizeof(cnt_delay); ++i) cnt_delay[i] = (i < 128) ? pattern[i & 7] : 0;
+	}
+
+	//bit mask of 16K slots with contended memory, #4000 always, #c000 on 128K odd banks
+
+	ZYMOSIS_INLINE void setContendedSlots(uint8_t slots)
+	{
+		cnt_slots = slots;
+	}
+
+	//true if any of len bytes from addr is in a contended slot
+
+	ZYMOSIS_INLINE bool contended(uint16_t addr, uint16_t len) const
+	{
+		uint32_t slot;
+
+		for (slot = addr >> 14; slot <= ((uint32_t)addr + len - 1) >> 14; ++slot)
+		{
+			if (cnt_slots & (1 << (slot & 3))) return true;
+		}
+
+		return false;
+	}
+
+	//frame T-state after the last contended cycle
+
+	ZYMOSIS_INLINE int32_t contentionEnd() const
+	{
+		return cnt_start + 192 * cnt_line;
+	}
+
+	ZYMOSIS_INLINE uint8_t ulaDelay()
+	{
+		uint32_t t, ln;
+
+		t = frame_base + tstates - cnt_start;
+
+		if (t >= 192UL * cnt_line) return 0;
+
+		ln = (t * cnt_line_mul) >> 24;
+
+		return cnt_delay[t - ln * cnt_line];
+	}
+
+	ZYMOSIS_INLINE void contentionFn(uint16_t addr, int _tstates, zymosis::Z80MemIOType mio)
+	{
+		if (cnt_slots & (1 << (addr >> 14))) tstates += ulaDelay();
+
+		tstates += _tstates;
+	}
+
+	//in: early 1, then 2 here, the core adds the last one; out: the same around the write
+
+	ZYMOSIS_INLINE void portContentionFn(uint16_t port, int _tstates, zymosis::Z80PIOType pio)
+	{
+		bool high = cnt_slots & (1 << (port >> 14));
+
+		if (pio & zymosis::Z80_PIOFLAG_EARLY)
+		{
+			if (high) tstates += ulaDelay(); //C:1 or N:1
+			++tstates;
+			return;
+		}
+
+		if (!(port & 0x01))
+		{
+			tstates += ulaDelay(); //C:3
+			tstates += 2;
+		}
+		else if (high)
+		{
+			tstates += ulaDelay(); //C:1, C:1, C:1
+			++tstates;
+			tstates += ulaDelay();
+			++tstates;
+			tstates += ulaDelay();
+		}
+		else
+		{
+			tstates += 2; //N:3
+		}
+	}
+
+private:
+	int32_t cnt_start;
+	uint16_t cnt_line;
+	uint32_t cnt_line_mul;
+	uint8_t cnt_slots;
+	uint8_t cnt_delay[228];
+};
+
+#endif/*__ZXCONTENTION_HPP__*/
@@ -0,0 +1,568 @@
+#pragma once
+
+#ifndef __ZXDEBUG_HPP__
+#define __ZXDEBUG_HPP__
+
+// Breakpoints, watchpoints and a GDB remote stub
+//
+// ZXDebugger keeps up to SLOTS execution breakpoints and read/write watchpoints. Each kind
+// has a bitmap with one bit per 256 byte page, so the check made on every instruction or
+// data access is a single bit test, only accesses to a page that holds a breakpoint go on
+// to compare the slots. The whole 64K bitmap would cost 8 KB per kind, which the 48K
+// machine cannot spare.
+//
+// The emulator calls check() from checkBPFn() and watch() from its data accesses, a hit
+// stops the CPU before the next instruction. resume() lets it go again, skipping the
+// breakpoint at the current PC, or for one instruction only.
+//
+// ZXGdbStub speaks the GDB remote serial protocol on top of it: feed() takes the bytes
+// received, replies go to a Print. It only needs the target to provide
+//   uint16_t debugReg(uint8_t n), void debugSetReg(uint8_t n, uint16_t value)
+//   uint8_t debugPeek(uint16_t addr), void debugPoke(uint16_t addr, uint8_t value)
+// with the registers in GDB's z80 order: AF BC DE HL SP PC IX IY AF' BC' DE' HL' IR,
+// so it can be driven from a host build of the core through a pipe as well, see
+// tests/gdbstub.cpp.
+
+#include <arduino.h>
+#include "zymosis.hpp"
+
+class ZXDebugger
+{
+public:
+	static constexpr uint8_t SLOTS = 16;
+
+	enum {
+		EXEC,
+		READ,
+		WRITE,
+		KINDS
+	};
+
+	enum {
+		RUNNING,
+		STEPPING,	//runs one instruction and stops
+		STOPPED
+	};
+
+	enum {
+		STOP_BREAK,
+		STOP_STEP,
+		STOP_WATCH,
+		STOP_INTERRUPT	//stopped by the host
+	};
+
+	ZXDebugger()
+	{
+		clear();
+		state = RUNNING;
+		skip = false;
+		pending = false;
+	}
+
+	void clear()
+	{
+		memset(slots, 0, sizeof(slots));
+		memset(pages, 0, sizeof(pages));
+	}
+
+	bool add(uint8_t kind, uint16_t addr, uint16_t len)
+	{
+		uint8_t i;
+
+		if (!len) len = 1;
+
+		for (i = 0; i < SLOTS; ++i)
+		{
+			if (slots[i].len) continue;
+
+			slots[i].addr = addr;
+			slots[i].len = len;
+			slots[i].kind = kind;
+			mark(slots[i]);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool remove(uint8_t kind, uint16_t addr, uint16_t len)
+	{
+		uint8_t i;
+		bool found;
+
+		if (!len) len = 1;
+
+		found = false;
+
+		for (i = 0; i < SLOTS; ++i)
+		{
+			if (slots[i].len == len && slots[i].addr == addr && slots[i].kind == kind)
+			{
+				slots[i].len = 0;
+				found = true;
+			}
+		}
+
+		//rebuild the page bits from what is left
+		memset(pages, 0, sizeof(pages));
+
+		for (i = 0; i < SLOTS; ++i)
+		{
+			if (slots[i].len) mark(slots[i]);
+		}
+
+		return found;
+	}
+
+	ZYMOSIS_INLINE bool hit(uint8_t kind, uint16_t addr) const
+	{
+		if (!(pages[kind][addr >> 11] & (1 << ((addr >> 8) & 7)))) return false;
+
+		return match(kind, addr);
+	}
+
+	//called before every instruction, returns non-zero to stop the CPU
+
+	ZYMOSIS_INLINE int check(uint16_t pc)
+	{
+		if (state == RUNNING && !skip)
+		{
+			if (!hit(EXEC, pc)) return 0;
+
+			stop(STOP_BREAK, pc);
+			return 1;
+		}
+
+		if (state == STOPPED) return 1;
+
+		//the instruction at the resume address runs even if it has a breakpoint
+		if (skip)
+		{
+			skip = false;
+			return 0;
+		}
+
+		stop(STOP_STEP, pc);
+		return 1;
+	}
+
+	//called on data reads and writes, the CPU stops after the instruction
+
+	ZYMOSIS_INLINE void watch(uint8_t kind, uint16_t addr)
+	{
+		if (hit(kind, addr)) stop(STOP_WATCH, addr, kind);
+	}
+
+	void resume(bool step)
+	{
+		state = step ? STEPPING : RUNNING;
+		skip = true;
+	}
+
+	void halt()
+	{
+		if (state != STOPPED) stop(STOP_INTERRUPT, 0);
+	}
+
+	bool stopped() const { return state == STOPPED; }
+
+	//running with nothing set, the CPU may skip the per-instruction checks
+
+	bool idle() const
+	{
+		uint8_t i;
+
+		if (state != RUNNING || skip) return false;
+
+		for (i = 0; i < SLOTS; ++i)
+		{
+			if (slots[i].len) return false;
+		}
+
+		return true;
+	}
+
+	//true once for every stop, until the host was told about it
+
+	bool report()
+	{
+		if (!pending) return false;
+
+		pending = false;
+		return true;
+	}
+
+	uint8_t stopReason() const { return stop_reason; }
+	uint8_t stopKind() const { return stop_kind; }
+	uint16_t stopAddr() const { return stop_addr; }
+
+private:
+	struct Slot
+	{
+		uint16_t addr;
+		uint16_t len;	//0 for a free slot
+		uint8_t kind;
+	};
+
+	Slot slots[SLOTS];
+	uint8_t pages[KINDS][32];	//one bit per 256 byte page with a slot of the kind
+	uint8_t state;
+	bool skip;
+	bool pending;
+	uint8_t stop_reason;
+	uint8_t stop_kind;
+	uint16_t stop_addr;
+
+	void mark(const Slot& s)
+	{
+		uint32_t page;
+
+		for (page = s.addr >> 8; page <= (uint32_t)(s.addr + s.len - 1) >> 8; ++page)
+		{
+			pages[s.kind][(page >> 3) & 31] |= 1 << (page & 7);
+		}
+	}
+
+	bool match(uint8_t kind, uint16_t addr) const
+	{
+		uint8_t i;
+
+		for (i = 0; i < SLOTS; ++i)
+		{
+			if (slots[i].len && slots[i].kind == kind && (uint16_t)(addr - slots[i].addr) < slots[i].len) return true;
+		}
+
+		return false;
+	}
+
+	void stop(uint8_t reason, uint16_t addr, uint8_t kind = EXEC)
+	{
+		state = STOPPED;
+		skip = false;
+		pending = true;
+		stop_reason = reason;
+		stop_kind = kind;
+		stop_addr = addr;
+	}
+};
+
+template<typename TARGET>
+class ZXGdbStub
+{
+public:
+	static constexpr uint16_t PACKET_SIZE = 256;
+	static constexpr uint8_t REGS = 13;
+
+	ZXGdbStub(TARGET& target, ZXDebugger& debugger) : target(target), debugger(debugger), len(0), state(IDLE)
+	{
+	}
+
+	//returns false for bytes outside of packets, so other serial commands can share the port
+
+	bool feed(uint8_t c, Print& out)
+	{
+		switch (state)
+		{
+		case IDLE:
+			if (c == '$')
+			{
+				len = 0;
+				sum = 0;
+				state = DATA;
+				return true;
+			}
+
+			if (c == 0x03) //Ctrl-C
+			{
+				debugger.halt();
+				return true;
+			}
+
+			return c == '+' || c == '-';
+
+		case DATA:
+			if (c == '#')
+			{
+				state = CHECKSUM1;
+			}
+			else if (len < PACKET_SIZE - 1)
+			{
+				packet[len++] = c;
+				sum += c;
+			}
+			return true;
+
+		case CHECKSUM1:
+			check = hex_value(c) << 4;
+			state = CHECKSUM2;
+			return true;
+
+		default:
+			check |= hex_value(c);
+			state = IDLE;
+
+			if (check != sum)
+			{
+				out.write('-');
+				return true;
+			}
+
+			out.write('+');
+			packet[len] = 0;
+			handle(out);
+			return true;
+		}
+	}
+
+	//sends the stop reply when the CPU stopped on its own
+
+	void poll(Print& out)
+	{
+		if (debugger.report()) sendStop(out);
+	}
+
+private:
+	enum {
+		IDLE,
+		DATA,
+		CHECKSUM1,
+		CHECKSUM2
+	};
+
+	TARGET& target;
+	ZXDebugger& debugger;
+	char packet[PACKET_SIZE];
+	char reply[PACKET_SIZE];
+	uint16_t len;
+	uint8_t state;
+	uint8_t sum;
+	uint8_t check;
+
+	static uint8_t hex_value(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return 0;
+	}
+
+	//parses hex digits up to the first non-hex character
+
+	static uint32_t hex_parse(const char*& ptr)
+	{
+		uint32_t value;
+
+		value = 0;
+
+		while ((*ptr >= '0' && *ptr <= '9') || (*ptr >= 'a' && *ptr <= 'f') || (*ptr >= 'A' && *ptr <= 'F'))
+		{
+			value = (value << 4) | hex_value(*ptr++);
+		}
+
+		return value;
+	}
+
+	void send(Print& out, const char* data)
+	{
+		const char* ptr;
+		uint8_t s;
+		char tail[4];
+
+		s = 0;
+		for (ptr = data; *ptr; ++ptr) s += *ptr;
+
+		snprintf(tail, sizeof(tail), "#%02x", s);
+
+		out.write('$');
+		out.write((const uint8_t*)data, strlen(data));
+		out.write((const uint8_t*)tail, 3);
+	}
+
+	void sendStop(Print& out)
+	{
+		static const char* const watch_names[ZXDebugger::KINDS] = { "", "rwatch", "watch" };
+
+		debugger.report();
+
+		if (debugger.stopReason() == ZXDebugger::STOP_WATCH)
+		{
+			snprintf(reply, sizeof(reply), "T05%s:%04x;", watch_names[debugger.stopKind()], debugger.stopAddr());
+			send(out, reply);
+		}
+		else
+		{
+			send(out, (debugger.stopReason() == ZXDebugger::STOP_INTERRUPT) ? "S02" : "S05");
+		}
+	}
+
+	//register values go over the wire as little-endian hex
+
+	void put_reg(char* ptr, uint16_t value)
+	{
+		snprintf(ptr, 5, "%02x%02x", value & 0xff, value >> 8);
+	}
+
+	uint16_t get_reg(const char*& ptr)
+	{
+		uint16_t value;
+
+		value = hex_value(ptr[0]) << 4 | hex_value(ptr[1]);
+		value |= (hex_value(ptr[2]) << 4 | hex_value(ptr[3])) << 8;
+		ptr += 4;
+
+		return value;
+	}
+
+	//Z type,addr,kind / z type,addr,kind, type 0 and 1 execute, 2 write, 3 read, 4 access
+
+	bool breakpoint(const char* ptr, bool set)
+	{
+		uint8_t type;
+		uint16_t addr, size;
+		bool ok;
+
+		type = hex_parse(ptr);
+		if (*ptr++ != ',') return false;
+		addr = hex_parse(ptr);
+		if (*ptr++ != ',') return false;
+		size = hex_parse(ptr);
+
+		switch (type)
+		{
+		case 0:
+		case 1:
+			return set ? debugger.add(ZXDebugger::EXEC, addr, 1) : debugger.remove(ZXDebugger::EXEC, addr, 1);
+		case 2:
+			return set ? debugger.add(ZXDebugger::WRITE, addr, size) : debugger.remove(ZXDebugger::WRITE, addr, size);
+		case 3:
+			return set ? debugger.add(ZXDebugger::READ, addr, size) : debugger.remove(ZXDebugger::READ, addr, size);
+		case 4:
+			if (!set) return debugger.remove(ZXDebugger::READ, addr, size) | debugger.remove(ZXDebugger::WRITE, addr, size);
+			ok = debugger.add(ZXDebugger::READ, addr, size);
+			if (ok && !debugger.add(ZXDebugger::WRITE, addr, size))
+			{
+				debugger.remove(ZXDebugger::READ, addr, size);
+				ok = false;
+			}
+			return ok;
+		}
+
+		return false;
+	}
+
+	void handle(Print& out)
+	{
+		const char* ptr;
+		uint16_t addr, n, i;
+		uint8_t reg;
+
+		ptr = packet + 1;
+
+		switch (packet[0])
+		{
+		case '?':
+			debugger.halt();
+			sendStop(out);
+			return;
+
+		case 'g':
+			for (reg = 0; reg < REGS; ++reg) put_reg(reply + reg * 4, target.debugReg(reg));
+			send(out, reply);
+			return;
+
+		case 'G':
+			for (reg = 0; reg < REGS && strlen(ptr) >= 4; ++reg) target.debugSetReg(reg, get_reg(ptr));
+			send(out, "OK");
+			return;
+
+		case 'p':
+			reg = hex_parse(ptr);
+			if (reg < REGS) put_reg(reply, target.debugReg(reg)); else strcpy(reply, "E01");
+			send(out, reply);
+			return;
+
+		case 'P':
+			reg = hex_parse(ptr);
+			if (reg >= REGS || *ptr++ != '=' || strlen(ptr) < 4)
+			{
+				send(out, "E01");
+				return;
+			}
+			target.debugSetReg(reg, get_reg(ptr));
+			send(out, "OK");
+			return;
+
+		case 'm':
+			addr = hex_parse(ptr);
+			if (*ptr++ != ',')
+			{
+				send(out, "E01");
+				return;
+			}
+			n = hex_parse(ptr);
+			if (n > (PACKET_SIZE - 1) / 2) n = (PACKET_SIZE - 1) / 2;
+			for (i = 0; i < n; ++i) snprintf(reply + i * 2, 3, "%02x", target.debugPeek(addr + i));
+			reply[n * 2] = 0;
+			send(out, reply);
+			return;
+
+		case 'M':
+			addr = hex_parse(ptr);
+			if (*ptr++ != ',')
+			{
+				send(out, "E01");
+				return;
+			}
+			n = hex_parse(ptr);
+			if (*ptr++ != ':' || strlen(ptr) < n * 2u)
+			{
+				send(out, "E01");
+				return;
+			}
+			for (i = 0; i < n; ++i, ptr += 2) target.debugPoke(addr + i, hex_value(ptr[0]) << 4 | hex_value(ptr[1]));
+			send(out, "OK");
+			return;
+
+		case 'c':
+		case 's':
+			if (*ptr) target.debugSetReg(5, hex_parse(ptr));
+			debugger.resume(packet[0] == 's');
+			return; //the reply is sent when the CPU stops
+
+		case 'Z':
+		case 'z':
+			send(out, breakpoint(ptr, packet[0] == 'Z') ? "OK" : "E01");
+			return;
+
+		case 'D':
+		case 'k':
+			debugger.clear();
+			debugger.resume(false);
+			if (packet[0] == 'D') send(out, "OK");
+			return;
+
+		case 'H':
+			send(out, "OK");
+			return;
+
+		case 'q':
+			if (!strncmp(ptr, "Supported", 9))
+			{
+				snprintf(reply, sizeof(reply), "PacketSize=%x", PACKET_SIZE);
+				send(out, reply);
+				return;
+			}
+			if (!strcmp(ptr, "Attached"))
+			{
+				send(out, "1");
+				return;
+			}
+			break;
+		}
+
+		send(out, ""); //not supported
+	}
+};
+
+#endif/*__ZXDEBUG_HPP__*/
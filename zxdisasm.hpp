@@ -0,0 +1,495 @@
+#pragma once
+
+#ifndef __ZXDISASM_HPP__
+#define __ZXDISASM_HPP__
+
+// Z80 disassembler
+//
+// Every opcode is split into its x (bits 7-6), y (5-3) and z (2-0) fields, the same way
+// for the unprefixed, CB, ED and DD/FD pages, and the mnemonic is put together from the
+// register, condition and operation tables below. Undocumented opcodes are decoded as well:
+// IXH/IXL/IYH/IYL, SLL, OUT (C),0 and the DDCB/FDCB forms, ED holes come out as NOP*.
+// Numbers are hex with a # prefix. Tables live in flash, nothing here allocates.
+
+#include <arduino.h>
+
+static const char zxd_regs[8][5] PROGMEM = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+static const char zxd_pairs[4][3] PROGMEM = { "BC", "DE", "HL", "SP" };
+static const char zxd_conds[8][3] PROGMEM = { "NZ", "Z", "NC", "C", "PO", "PE", "P", "M" };
+static const char zxd_alu_ops[8][7] PROGMEM = { "ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP " };
+static const char zxd_acc_ops[8][5] PROGMEM = { "RLCA", "RRCA", "RLA", "RRA", "DAA", "CPL", "SCF", "CCF" };
+static const char zxd_rel_ops[6][8] PROGMEM = { "DJNZ ", "JR ", "JR NZ,", "JR Z,", "JR NC,", "JR C," };
+static const char zxd_misc_ops[8][9] PROGMEM = { "", "", "", "", "", "EX DE,HL", "DI", "EI" };
+static const char zxd_rot[8][4] PROGMEM = { "RLC", "RRC", "RL", "RR", "SLA", "SRA", "SLL", "SRL" };
+static const char zxd_bit_ops[4][4] PROGMEM = { "", "BIT", "RES", "SET" };
+static const char zxd_ed_misc[8][7] PROGMEM = { "LD I,A", "LD R,A", "LD A,I", "LD A,R", "RRD", "RLD", "NOP*", "NOP*" };
+static const char zxd_block_ops[16][5] PROGMEM = {
+	"LDI", "CPI", "INI", "OUTI", "LDD", "CPD", "IND", "OUTD",
+	"LDIR", "CPIR", "INIR", "OTIR", "LDDR", "CPDR", "INDR", "OTDR"
+};
+static const char zxd_im_modes[8] PROGMEM = { '0', '0', '1', '2', '0', '0', '1', '2' };
+static const char zxd_hex_digits[17] PROGMEM = "0123456789ABCDEF";
+
+class ZXDisasm
+{
+public:
+	ZXDisasm(char* buf, size_t size) : buf(buf), size(size), len(0)
+	{
+		if (size) buf[0] = 0;
+	}
+
+	const char* text() const { return buf; }
+
+	//read(addr) returns the byte at addr, returns the instruction length
+
+	template<typename READ>
+	uint8_t decode(uint16_t pc, READ read)
+	{
+		uint8_t op, x, y, z, p, q;
+		uint16_t start, nn;
+		int8_t d;
+
+		start = pc;
+		index = 0;
+		len = 0;
+		if (size) buf[0] = 0;
+
+		op = read(pc++);
+
+		while (op == 0xdd || op == 0xfd)
+		{
+			index = (op == 0xdd) ? 'X' : 'Y';
+			op = read(pc++);
+		}
+
+		if (op == 0xcb)
+		{
+			if (index)
+			{
+				d = (int8_t)read(pc++);
+				op = read(pc++);
+			}
+			else
+			{
+				d = 0;
+				op = read(pc++);
+			}
+
+			x = op >> 6;
+			y = (op >> 3) & 7;
+			z = op & 7;
+
+			if (x == 0)
+			{
+				put_P(zxd_rot[y]);
+				put(' ');
+			}
+			else
+			{
+				put_P(zxd_bit_ops[x]);
+				put(' ');
+				put('0' + y);
+				put(',');
+			}
+
+			if (index)
+			{
+				mem(d);
+
+				//undocumented forms also copy the result into a register
+				if (z != 6 && x != 1)
+				{
+					put(',');
+					put_P(zxd_regs[z]);
+				}
+			}
+			else
+			{
+				put_P(zxd_regs[z]);
+			}
+
+			return pc - start;
+		}
+
+		if (op == 0xed)
+		{
+			op = read(pc++);
+
+			x = op >> 6;
+			y = (op >> 3) & 7;
+			z = op & 7;
+			p = y >> 1;
+			q = y & 1;
+
+			if (x == 2 && y >= 4 && z < 4)
+			{
+				put_P(zxd_block_ops[(y - 4) * 4 + z]);
+				return pc - start;
+			}
+
+			if (x != 1)
+			{
+				put_P(PSTR("NOP*"));
+				return pc - start;
+			}
+
+			switch (z)
+			{
+			case 0:
+				put_P(PSTR("IN "));
+				if (y != 6)
+				{
+					put_P(zxd_regs[y]);
+					put(',');
+				}
+				put_P(PSTR("(C)"));
+				break;
+
+			case 1:
+				put_P(PSTR("OUT (C),"));
+				if (y != 6) put_P(zxd_regs[y]); else put('0');
+				break;
+
+			case 2:
+				put_P(q ? PSTR("ADC HL,") : PSTR("SBC HL,"));
+				put_P(zxd_pairs[p]);
+				break;
+
+			case 3:
+				nn = read(pc) | (read(pc + 1) << 8);
+				pc += 2;
+				put_P(PSTR("LD "));
+				if (q)
+				{
+					put_P(zxd_pairs[p]);
+					put_P(PSTR(",("));
+					hex(nn, 4);
+					put(')');
+				}
+				else
+				{
+					put('(');
+					hex(nn, 4);
+					put_P(PSTR("),"));
+					put_P(zxd_pairs[p]);
+				}
+				break;
+
+			case 4:
+				put_P(PSTR("NEG"));
+				break;
+
+			case 5:
+				put_P((y == 1) ? PSTR("RETI") : PSTR("RETN"));
+				break;
+
+			case 6:
+				put_P(PSTR("IM "));
+				put(pgm_read_byte(&zxd_im_modes[y]));
+				break;
+
+			default:
+				put_P(zxd_ed_misc[y]);
+				break;
+			}
+
+			return pc - start;
+		}
+
+		x = op >> 6;
+		y = (op >> 3) & 7;
+		z = op & 7;
+		p = y >> 1;
+		q = y & 1;
+
+		switch (x)
+		{
+		case 0:
+			switch (z)
+			{
+			case 0:
+				if (y < 2)
+				{
+					put_P(y ? PSTR("EX AF,AF'") : PSTR("NOP"));
+					break;
+				}
+				d = (int8_t)read(pc++);
+				put_P(zxd_rel_ops[y - 2]);
+				hex(pc + d, 4);
+				break;
+
+			case 1:
+				if (q)
+				{
+					put_P(PSTR("ADD "));
+					pair(2);
+					put(',');
+					pair(p);
+				}
+				else
+				{
+					put_P(PSTR("LD "));
+					pair(p);
+					put(',');
+					hex(read(pc) | (read(pc + 1) << 8), 4);
+					pc += 2;
+				}
+				break;
+
+			case 2:
+				put_P(PSTR("LD "));
+				if (p < 2)
+				{
+					if (q) put_P(PSTR("A,"));
+					put('(');
+					put_P(zxd_pairs[p]);
+					put(')');
+					if (!q) put_P(PSTR(",A"));
+				}
+				else
+				{
+					nn = read(pc) | (read(pc + 1) << 8);
+					pc += 2;
+					if (q)
+					{
+						if (p == 2) pair(2); else put('A');
+						put_P(PSTR(",("));
+						hex(nn, 4);
+						put(')');
+					}
+					else
+					{
+						put('(');
+						hex(nn, 4);
+						put_P(PSTR("),"));
+						if (p == 2) pair(2); else put('A');
+					}
+				}
+				break;
+
+			case 3:
+				put_P(q ? PSTR("DEC ") : PSTR("INC "));
+				pair(p);
+				break;
+
+			case 4:
+			case 5:
+				put_P((z == 4) ? PSTR("INC ") : PSTR("DEC "));
+				if (index && y == 6) mem((int8_t)read(pc++)); else reg(y);
+				break;
+
+			case 6:
+				put_P(PSTR("LD "));
+				if (index && y == 6) mem((int8_t)read(pc++)); else reg(y);
+				put(',');
+				hex(read(pc++), 2);
+				break;
+
+			default:
+				put_P(zxd_acc_ops[y]);
+				break;
+			}
+			break;
+
+		case 1:
+			if (y == 6 && z == 6)
+			{
+				put_P(PSTR("HALT"));
+				break;
+			}
+
+			put_P(PSTR("LD "));
+
+			//with (IX+d) the other operand is a plain register
+			if (index && (y == 6 || z == 6))
+			{
+				d = (int8_t)read(pc++);
+				if (y == 6) mem(d); else put_P(zxd_regs[y]);
+				put(',');
+				if (z == 6) mem(d); else put_P(zxd_regs[z]);
+			}
+			else
+			{
+				reg(y);
+				put(',');
+				reg(z);
+			}
+			break;
+
+		case 2:
+			put_P(zxd_alu_ops[y]);
+			if (index && z == 6) mem((int8_t)read(pc++)); else reg(z);
+			break;
+
+		default:
+			switch (z)
+			{
+			case 0:
+				put_P(PSTR("RET "));
+				put_P(zxd_conds[y]);
+				break;
+
+			case 1:
+				if (!q)
+				{
+					put_P(PSTR("POP "));
+					if (p == 3) put_P(PSTR("AF")); else pair(p);
+				}
+				else if (p == 0)
+				{
+					put_P(PSTR("RET"));
+				}
+				else if (p == 1)
+				{
+					put_P(PSTR("EXX"));
+				}
+				else if (p == 2)
+				{
+					put_P(PSTR("JP ("));
+					pair(2);
+					put(')');
+				}
+				else
+				{
+					put_P(PSTR("LD SP,"));
+					pair(2);
+				}
+				break;
+
+			case 2:
+			case 4:
+				put_P((z == 2) ? PSTR("JP ") : PSTR("CALL "));
+				put_P(zxd_conds[y]);
+				put(',');
+				hex(read(pc) | (read(pc + 1) << 8), 4);
+				pc += 2;
+				break;
+
+			case 3:
+				switch (y)
+				{
+				case 0:
+					put_P(PSTR("JP "));
+					hex(read(pc) | (read(pc + 1) << 8), 4);
+					pc += 2;
+					break;
+
+				case 2:
+					put_P(PSTR("OUT ("));
+					hex(read(pc++), 2);
+					put_P(PSTR("),A"));
+					break;
+
+				case 3:
+					put_P(PSTR("IN A,("));
+					hex(read(pc++), 2);
+					put(')');
+					break;
+
+				case 4:
+					put_P(PSTR("EX (SP),"));
+					pair(2);
+					break;
+
+				default:
+					put_P(zxd_misc_ops[y]);
+					break;
+				}
+				break;
+
+			case 5:
+				if (!q)
+				{
+					put_P(PSTR("PUSH "));
+					if (p == 3) put_P(PSTR("AF")); else pair(p);
+				}
+				else
+				{
+					put_P(PSTR("CALL "));
+					hex(read(pc) | (read(pc + 1) << 8), 4);
+					pc += 2;
+				}
+				break;
+
+			case 6:
+				put_P(zxd_alu_ops[y]);
+				hex(read(pc++), 2);
+				break;
+
+			default:
+				put_P(PSTR("RST "));
+				hex(y * 8, 2);
+				break;
+			}
+			break;
+		}
+
+		return pc - start;
+	}
+
+private:
+	char* buf;
+	size_t size;
+	size_t len;
+	char index;		//X or Y after a DD/FD prefix, 0 otherwise
+
+	void put(char c)
+	{
+		if (len + 1 >= size) return;
+
+		buf[len++] = c;
+		buf[len] = 0;
+	}
+
+	void put_P(PGM_P str)
+	{
+		char c;
+
+		while ((c = pgm_read_byte(str++))) put(c);
+	}
+
+	void hex(uint16_t value, uint8_t digits)
+	{
+		put('#');
+
+		while (digits--) put(pgm_read_byte(&zxd_hex_digits[(value >> (digits * 4)) & 15]));
+	}
+
+	//B C D E H L (HL) A, H and L become the index halves after a prefix
+
+	void reg(uint8_t r)
+	{
+		if (index && (r == 4 || r == 5))
+		{
+			put('I');
+			put(index);
+			put((r == 4) ? 'H' : 'L');
+			return;
+		}
+
+		put_P(zxd_regs[r]);
+	}
+
+	void pair(uint8_t p)
+	{
+		if (index && p == 2)
+		{
+			put('I');
+			put(index);
+			return;
+		}
+
+		put_P(zxd_pairs[p]);
+	}
+
+	void mem(int8_t d)
+	{
+		put('(');
+		pair(2);
+		put((d < 0) ? '-' : '+');
+		hex((d < 0) ? -d : d, 2);
+		put(')');
+	}
+};
+
+#endif/*__ZXDISASM_HPP__*/
@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef __ZXFRAMECHECK_HPP__
+#define __ZXFRAMECHECK_HPP__
+
+// Checksums of what the renderer sent to the LCD
+//
+// The renderer reports every row it pushes, the row keeps a 32-bit FNV-1a hash of its last
+// pixels, so the combined sum describes the whole picture on the panel no matter which rows
+// a frame redrew. Two builds showing the same emulated frame give the same sum, which lets
+// a renderer change be checked against a known good build, and the transaction and byte
+// counts show what the change costs on the SPI bus.
+//
+// dump() writes one text line:
+//   ZXFRAME <sum> <transactions> <bytes>
+// with the transactions and bytes counted since the previous dump.
+
+#include <arduino.h>
+
+template<uint16_t ROWS>
+class ZXFrameCheck
+{
+public:
+	ZXFrameCheck()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		uint16_t i;
+
+		for (i = 0; i < ROWS; ++i) rows[i] = FNV_BASIS;
+
+		transactions = 0;
+		bytes = 0;
+	}
+
+	//pixels pushed to one LCD row
+
+	void line(uint16_t row, const uint16_t* pixels, uint16_t count)
+	{
+		uint32_t h;
+
+		++transactions;
+		bytes += count * 2;
+
+		h = FNV_BASIS;
+		while (count--) h = hash(h, *pixels++);
+
+		if (row < ROWS) rows[row] = h;
+	}
+
+	//rows filled with one colour
+
+	void fill(uint16_t row, uint16_t height, uint16_t width, uint16_t colour)
+	{
+		uint32_t h;
+		uint16_t i;
+
+		h = FNV_BASIS;
+		for (i = 0; i < width; ++i) h = hash(h, colour);
+
+		for (i = row; i < row + height && i < ROWS; ++i) rows[i] = h;
+
+		++transactions;
+		bytes += (uint32_t)width * height * 2;
+	}
+
+	uint32_t sum() const
+	{
+		uint32_t h;
+		uint16_t i;
+
+		h = FNV_BASIS;
+		for (i = 0; i < ROWS; ++i) h = (h ^ rows[i]) * FNV_PRIME;
+
+		return h;
+	}
+
+	void dump(Print& out)
+	{
+		char buf[48];
+
+		snprintf(buf, sizeof(buf), "ZXFRAME %08lx %lu %lu", (unsigned long)sum(), (unsigned long)transactions, (unsigned long)bytes);
+		out.println(buf);
+
+		transactions = 0;
+		bytes = 0;
+	}
+
+private:
+	static constexpr uint32_t FNV_BASIS = 2166136261UL;
+	static constexpr uint32_t FNV_PRIME = 16777619UL;
+
+	uint32_t rows[ROWS];
+	uint32_t transactions;
+	uint32_t bytes;
+
+	static uint32_t hash(uint32_t h, uint16_t pixel)
+	{
+		h = (h ^ (pixel & 0xff)) * FNV_PRIME;
+		return (h ^ (pixel >> 8)) * FNV_PRIME;
+	}
+};
+
+#endif/*__ZXFRAMECHECK_HPP__*/
@@ -0,0 +1,176 @@
+#pragma once
+
+#ifndef __ZXIDLE_HPP__
+#define __ZXIDLE_HPP__
+
+// Idle loop detector
+//
+// Games and the BASIC editor wait for a key or the next frame in short loops such as
+// IN A,(#FE) / AND #1F / JR Z. Inputs only change between frames here, so a loop that
+// writes no memory, does no OUT and comes back to its first instruction with every
+// register but R as it was will spin the same way until the interrupt.
+//
+// step() sees the CPU before every instruction and takes a backward jump of up to SPAN
+// bytes, or a HALT, as the start of a loop. Two passes of the same length and R count
+// with the same registers make the loop idle, and skip() then moves the frame on by
+// whole passes, returning their T-states and adding their R increments.
+
+#include "zymosis.hpp"
+
+class ZXIdleLoop
+{
+public:
+	static constexpr uint16_t SPAN = 64;	//longest loop, in bytes from its start
+
+	bool enabled;	//per game, see zx_load_layout()
+
+	ZXIdleLoop() : enabled(true)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		state = NONE;
+		prev_pc = 0;
+	}
+
+	//memory writes and OUTs change what the loop sees, it has to be confirmed again
+
+	ZYMOSIS_INLINE void touch()
+	{
+		state = NONE;
+	}
+
+	//t is the T-state in the frame
+
+	ZYMOSIS_INLINE void step(const zymosis::Z80Info& z, uint16_t pc, int32_t t)
+	{
+		uint16_t back;
+		int32_t len;
+		uint8_t r;
+
+		back = prev_pc - pc;
+		prev_pc = pc;
+
+		if (state == NONE)
+		{
+			if (back > SPAN) return;
+		}
+		else
+		{
+			//LD A,R reads the one register that differs between passes
+			if ((uint16_t)(pc - head) >= SPAN || z.prev_was_EIDDR < 0)
+			{
+				state = NONE;
+				return;
+			}
+
+			if (back > SPAN) return;
+		}
+
+		if (state == NONE || pc != head || !same(z))
+		{
+			head = pc;
+			take(z, t);
+			state = SEEN;
+			return;
+		}
+
+		len = t - head_t;
+		r = (z.regR - head_r) & 0x7f;
+
+		state = (state != SEEN && len == pass_len && r == pass_r) ? IDLE : PASSED;
+
+		pass_len = len;
+		pass_r = r;
+		head_t = t;
+		head_r = z.regR;
+	}
+
+	//a loop to skip, the caller ends its run there
+
+	ZYMOSIS_INLINE bool idle() const
+	{
+		return state == IDLE && enabled;
+	}
+
+	//T-states of the whole passes that fit in left with one to spare, 0 when not idle
+
+	ZYMOSIS_INLINE uint32_t skip(int32_t left, uint8_t& regR)
+	{
+		uint32_t passes;
+
+		if (state != IDLE || !enabled) return 0;
+
+		state = NONE;
+
+		if (left < 2 * pass_len) return 0;
+
+		passes = left / pass_len - 1;
+		regR = ((regR + passes * pass_r) & 0x7f) | (regR & 0x80);
+
+		return passes * pass_len;
+	}
+
+private:
+	enum {
+		NONE,
+		SEEN,		//at the loop start once
+		PASSED,		//one pass came back to the same registers
+		IDLE		//two passes of the same length
+	};
+
+	uint8_t state;
+	uint16_t prev_pc;
+	uint16_t head;		//first instruction of the loop
+	int32_t head_t;
+	uint8_t head_r;
+	int32_t pass_len;
+	uint8_t pass_r;
+
+	struct Regs
+	{
+		uint16_t af, bc, de, hl, ix, iy, sp, afx, bcx, dex, hlx, memptr;
+		uint8_t i;
+		uint8_t flags;
+	};
+
+	Regs regs;
+
+	static uint8_t pack(const zymosis::Z80Info& z)
+	{
+		return (z.iff1 ? 0x01 : 0) | (z.iff2 ? 0x02 : 0) | (z.halted ? 0x04 : 0) | (z.prev_was_EIDDR ? 0x08 : 0) | (z.im << 4);
+	}
+
+	void take(const zymosis::Z80Info& z, int32_t t)
+	{
+		regs.af = z.af.w;
+		regs.bc = z.bc.w;
+		regs.de = z.de.w;
+		regs.hl = z.hl.w;
+		regs.ix = z.ix.w;
+		regs.iy = z.iy.w;
+		regs.sp = z.sp.w;
+		regs.afx = z.afx.w;
+		regs.bcx = z.bcx.w;
+		regs.dex = z.dex.w;
+		regs.hlx = z.hlx.w;
+		regs.memptr = z.memptr.w;
+		regs.i = z.regI;
+		regs.flags = pack(z);
+
+		head_t = t;
+		head_r = z.regR;
+	}
+
+	ZYMOSIS_INLINE bool same(const zymosis::Z80Info& z) const
+	{
+		return regs.af == z.af.w && regs.bc == z.bc.w && regs.de == z.de.w && regs.hl == z.hl.w &&
+			regs.ix == z.ix.w && regs.iy == z.iy.w && regs.sp == z.sp.w &&
+			regs.afx == z.afx.w && regs.bcx == z.bcx.w && regs.dex == z.dex.w && regs.hlx == z.hlx.w &&
+			regs.memptr == z.memptr.w && regs.i == z.regI && regs.flags == pack(z);
+	}
+};
+
+#endif/*__ZXIDLE_HPP__*/
@@ -0,0 +1,183 @@
+#pragma once
+
+#ifndef __ZXPROFILER_HPP__
+#define __ZXPROFILER_HPP__
+
+// Z80 instruction profiler
+//
+// sample() is called from the core with the address of every instruction. It counts the
+// instruction in a histogram of 256 byte PC buckets and in a per-opcode table for each
+// prefix group. Opcode counters are 16 bit; when one fills up, all of them are halved and
+// the shift is reported, so the ratios stay right.
+//
+// dump() writes a text report, read by tools/zxprof.py:
+//   ZXPROF 1
+//   INSN <instructions counted>
+//   PC <bucket address> <count>           for every non-empty bucket
+//   OP <prefix> <opcode> <count>          prefix 00, CB, ED, DD (DD/FD), DC (DDCB/FDCB)
+//   SHIFT <opcode counter shift>
+//   MEM <address> <32 hex bytes>          contents of the hottest buckets
+//   END
+
+#include <arduino.h>
+#include "zymosis.hpp"
+
+class ZXProfiler
+{
+public:
+	static constexpr uint8_t BUCKET_SHIFT = 8;
+	static constexpr uint16_t BUCKETS = 0x10000 >> BUCKET_SHIFT;
+	static constexpr uint8_t HOT_BUCKETS = 8; //buckets with their contents in the report
+
+	enum {
+		PREFIX_NONE,
+		PREFIX_CB,
+		PREFIX_ED,
+		PREFIX_INDEX,		//DD or FD
+		PREFIX_INDEX_CB,	//DDCB or FDCB, the opcode is after the displacement
+		PREFIXES
+	};
+
+	ZXProfiler()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		memset(pc_count, 0, sizeof(pc_count));
+		memset(op_count, 0, sizeof(op_count));
+		insn = 0;
+		shift = 0;
+	}
+
+	//read(addr) returns the byte at addr without side effects on the emulated machine
+
+	template<typename READ>
+	ZYMOSIS_INLINE void sample(uint16_t pc, READ read)
+	{
+		uint8_t op, group;
+
+		++insn;
+		++pc_count[pc >> BUCKET_SHIFT];
+
+		op = read(pc);
+		group = PREFIX_NONE;
+
+		if (op == 0xcb)
+		{
+			group = PREFIX_CB;
+			op = read(pc + 1);
+		}
+		else if (op == 0xed)
+		{
+			group = PREFIX_ED;
+			op = read(pc + 1);
+		}
+		else if (op == 0xdd || op == 0xfd)
+		{
+			group = PREFIX_INDEX;
+			op = read(pc + 1);
+
+			if (op == 0xcb)
+			{
+				group = PREFIX_INDEX_CB;
+				op = read(pc + 3);
+			}
+		}
+
+		if (!++op_count[group][op]) halve(group, op);
+	}
+
+	template<typename READ>
+	void dump(Print& out, READ read) const
+	{
+		static const char* const names[PREFIXES] = { "00", "CB", "ED", "DD", "DC" };
+		uint16_t hot[HOT_BUCKETS];
+		uint16_t i, j, k;
+		uint32_t addr;
+		char buf[80];
+
+		out.println("ZXPROF 1");
+
+		snprintf(buf, sizeof(buf), "INSN %lu", (unsigned long)insn);
+		out.println(buf);
+
+		for (i = 0; i < BUCKETS; ++i)
+		{
+			if (!pc_count[i]) continue;
+
+			snprintf(buf, sizeof(buf), "PC %04X %lu", i << BUCKET_SHIFT, (unsigned long)pc_count[i]);
+			out.println(buf);
+		}
+
+		for (i = 0; i < PREFIXES; ++i)
+		{
+			for (j = 0; j < 256; ++j)
+			{
+				if (!op_count[i][j]) continue;
+
+				snprintf(buf, sizeof(buf), "OP %s %02X %u", names[i], j, op_count[i][j]);
+				out.println(buf);
+			}
+		}
+
+		snprintf(buf, sizeof(buf), "SHIFT %u", shift);
+		out.println(buf);
+
+		//hottest buckets by insertion into a short sorted list
+
+		for (i = 0; i < HOT_BUCKETS; ++i) hot[i] = BUCKETS;
+
+		for (i = 0; i < BUCKETS; ++i)
+		{
+			if (!pc_count[i]) continue;
+
+			for (j = 0; j < HOT_BUCKETS; ++j)
+			{
+				if (hot[j] == BUCKETS || pc_count[i] > pc_count[hot[j]])
+				{
+					for (k = HOT_BUCKETS - 1; k > j; --k) hot[k] = hot[k - 1];
+					hot[j] = i;
+					break;
+				}
+			}
+		}
+
+		for (i = 0; i < HOT_BUCKETS && hot[i] != BUCKETS; ++i)
+		{
+			for (addr = hot[i] << BUCKET_SHIFT; addr < ((uint32_t)hot[i] + 1) << BUCKET_SHIFT; addr += 32)
+			{
+				k = snprintf(buf, sizeof(buf), "MEM %04X ", (unsigned)addr);
+
+				for (j = 0; j < 32; ++j) k += snprintf(buf + k, sizeof(buf) - k, "%02X", read(addr + j));
+
+				out.println(buf);
+			}
+		}
+
+		out.println("END");
+	}
+
+private:
+	uint32_t pc_count[BUCKETS];
+	uint16_t op_count[PREFIXES][256];
+	uint32_t insn;
+	uint8_t shift;
+
+	void halve(uint8_t group, uint8_t op)
+	{
+		uint16_t i, j;
+
+		op_count[group][op] = 0xffff;
+
+		for (i = 0; i < PREFIXES; ++i)
+		{
+			for (j = 0; j < 256; ++j) op_count[i][j] = (op_count[i][j] + 1) >> 1;
+		}
+
+		++shift;
+	}
+};
+
+#endif/*__ZXPROFILER_HPP__*/
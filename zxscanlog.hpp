@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef __ZXSCANLOG_HPP__
+#define __ZXSCANLOG_HPP__
+
+// Beam-stamped event log for the scanline renderer
+//
+// Only writes that land while the beam is inside the 192 display lines are logged, writes
+// made in the border time look the same on every line, so a frame without mid-frame writes
+// leaves the log empty and the renderer takes its usual path. Attribute events keep the
+// value they replaced; rewind() turns the end of frame attributes back into the start of
+// frame state and swaps the new values into the events, so advance() can replay them.
+// Border events keep the frame line the colour was set on.
+
+#include "zymosis.hpp"
+
+template<uint16_t ATTR_EVENTS, uint8_t BORDER_EVENTS>
+class ZXScanLog
+{
+public:
+	struct AttrEvent
+	{
+		uint16_t addr;	//attribute offset 0..767
+		uint8_t line;	//first display line showing the write
+		uint8_t value;	//old value, new value after rewind()
+	};
+
+	struct BorderEvent
+	{
+		uint16_t line;	//frame line the colour starts at
+		uint8_t colour;
+	};
+
+	void begin(uint8_t border)
+	{
+		attr_count = 0;
+		border_count = 0;
+		border_start = border;
+		pos = 0;
+	}
+
+	ZYMOSIS_INLINE void attr(uint16_t addr, uint8_t line, uint8_t old)
+	{
+		if (attr_count >= ATTR_EVENTS) return;
+
+		attr_log[attr_count].addr = addr;
+		attr_log[attr_count].line = line;
+		attr_log[attr_count].value = old;
+		++attr_count;
+	}
+
+	//colour in effect before the first border event
+
+	void borderStart(uint8_t colour)
+	{
+		border_start = colour;
+	}
+
+	void border(uint16_t line, uint8_t colour)
+	{
+		if (border_count >= BORDER_EVENTS) return;
+
+		border_log[border_count].line = line;
+		border_log[border_count].colour = colour;
+		++border_count;
+	}
+
+	uint16_t attrEvents() const { return attr_count; }
+	uint8_t borderEvents() const { return border_count; }
+
+	//attrs holds the end of frame attributes, it gets the start of frame ones
+
+	void rewind(uint8_t* attrs)
+	{
+		uint16_t i;
+		uint8_t tmp;
+
+		i = attr_count;
+
+		while (i--)
+		{
+			tmp = attrs[attr_log[i].addr];
+			attrs[attr_log[i].addr] = attr_log[i].value;
+			attr_log[i].value = tmp;
+		}
+
+		pos = 0;
+	}
+
+	//applies the events visible on display lines up to line
+
+	ZYMOSIS_INLINE void advance(uint8_t* attrs, uint8_t line)
+	{
+		while (pos < attr_count && attr_log[pos].line <= line)
+		{
+			attrs[attr_log[pos].addr] = attr_log[pos].value;
+			++pos;
+		}
+	}
+
+	uint8_t borderAt(uint16_t line) const
+	{
+		uint8_t i, colour;
+
+		colour = border_start;
+
+		for (i = 0; i < border_count && border_log[i].line <= line; ++i) colour = border_log[i].colour;
+
+		return colour;
+	}
+
+private:
+	AttrEvent attr_log[ATTR_EVENTS];
+	BorderEvent border_log[BORDER_EVENTS];
+	uint16_t attr_count;
+	uint16_t pos;
+	uint8_t border_count;
+	uint8_t border_start;
+};
+
+#endif/*__ZXSCANLOG_HPP__*/
@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef __ZXTELEMETRY_HPP__
+#define __ZXTELEMETRY_HPP__
+
+// Frame-time telemetry
+//
+// Fixed-size counters summed over a 500 ms window. When the window closes they are copied
+// into a report, which the emulator shows in the overlay and can send over the serial port,
+// and the counters start again. Nothing here allocates or prints on its own.
+//
+// Serial packets are the 4 magic bytes "ZXT2", the ZXTelemetryReport in little-endian
+// byte order (44 bytes, no padding) and the 8-bit sum of the report bytes. tools/zxtelemetry.py
+// checks the sum and prints the fields.
+
+#include <arduino.h>
+
+struct ZXTelemetryReport
+{
+	uint32_t window_us;			//length of the window
+	uint32_t emulate_us;		//time spent in emulateFrame()
+	uint32_t render_us;			//time spent in renderFrame() and the overlay
+	uint32_t input_us;			//pad and keyboard scanning
+	uint32_t audio_us;			//time spent in the sound interrupt
+	uint32_t spi_bytes;			//pixel bytes pushed to the LCD
+	uint32_t dirty_lines;		//LCD rows redrawn
+	uint32_t audio_underruns;	//sound interrupts that found no new sample
+	uint32_t idle_skips;		//idle loops run to the interrupt at once, see zxidle.hpp
+	uint16_t frames;			//emulated frames
+	uint16_t skipped;			//emulated frames that were not rendered
+	uint16_t renders;			//rendered frames
+	uint16_t heap;				//free heap at the end of the window, in 16 byte units
+};
+
+static_assert(sizeof(ZXTelemetryReport) == 44, "ZXTelemetryReport layout is part of the serial format");
+
+class ZXTelemetry
+{
+public:
+	static constexpr uint32_t WINDOW_US = 500000;
+
+	uint32_t emulate_us;
+	uint32_t render_us;
+	uint32_t input_us;
+	uint32_t spi_bytes;
+	uint32_t dirty_lines;
+	uint32_t idle_skips;
+	uint16_t frames;
+	uint16_t skipped;
+	uint16_t renders;
+
+	volatile uint32_t audio_cycles;		//updated from the sound interrupt
+	volatile uint32_t audio_underruns;
+
+	ZXTelemetryReport last;				//the last closed window
+
+	ZXTelemetry() : window_start(0)
+	{
+		memset(&last, 0, sizeof(last));
+		clear();
+	}
+
+	//closes the window when it is over, returns true when last was updated
+
+	bool tick(uint32_t now)
+	{
+		uint32_t cycles, underruns;
+
+		if (now - window_start < WINDOW_US) return false;
+
+		noInterrupts();
+		cycles = audio_cycles;
+		underruns = audio_underruns;
+		audio_cycles = 0;
+		audio_underruns = 0;
+		interrupts();
+
+		last.window_us = now - window_start;
+		last.emulate_us = emulate_us;
+		last.render_us = render_us;
+		last.input_us = input_us;
+		last.audio_us = cycles / ESP.getCpuFreqMHz();
+		last.spi_bytes = spi_bytes;
+		last.dirty_lines = dirty_lines;
+		last.audio_underruns = underruns;
+		last.idle_skips = idle_skips;
+		last.frames = frames;
+		last.skipped = skipped;
+		last.renders = renders;
+		last.heap = ESP.getFreeHeap() / 16;
+
+		window_start = now;
+		clear();
+
+		return true;
+	}
+
+	void dump(Print& out) const
+	{
+		const uint8_t* ptr;
+		uint8_t sum;
+		size_t i;
+
+		ptr = (const uint8_t*)&last;
+		sum = 0;
+
+		for (i = 0; i < sizeof(last); ++i) sum += ptr[i];
+
+		out.write((const uint8_t*)"ZXT2", 4);
+		out.write(ptr, sizeof(last));
+		out.write(sum);
+	}
+
+private:
+	uint32_t window_start;
+
+	void clear()
+	{
+		emulate_us = 0;
+		render_us = 0;
+		input_us = 0;
+		spi_bytes = 0;
+		dirty_lines = 0;
+		idle_skips = 0;
+		frames = 0;
+		skipped = 0;
+		renders = 0;
+	}
+};
+
+#endif/*__ZXTELEMETRY_HPP__*/
@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef __ZXTRACE_HPP__
+#define __ZXTRACE_HPP__
+
+// Execution trace ring
+//
+// record() is called from the core before every instruction and keeps the last SIZE of
+// them, 12 bytes each: PC, AF, the T-state in the frame and the first 4 bytes at PC, which
+// covers the longest Z80 instruction. Old entries are overwritten, so the ring always
+// holds what ran just before a game hung.
+//
+// dump() writes them oldest first as text:
+//   ZXTRACE 1
+//   <pc> <af> <t-state> <instruction bytes> <disassembly>
+//   END
+
+#include <arduino.h>
+#include "zymosis.hpp"
+#include "zxdisasm.hpp"
+
+template<uint16_t SIZE>
+class ZXTrace
+{
+public:
+	static_assert(SIZE && !(SIZE & (SIZE - 1)), "ZXTrace size must be a power of two");
+
+	struct Entry
+	{
+		uint16_t pc;
+		uint16_t af;
+		uint32_t tstate;	//T-state in the frame
+		uint8_t op[4];		//bytes at pc
+	};
+
+	ZXTrace()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		head = 0;
+		count = 0;
+	}
+
+	//read(addr) returns the byte at addr without side effects on the emulated machine
+
+	template<typename READ>
+	ZYMOSIS_INLINE void record(uint16_t pc, uint16_t af, uint32_t tstate, READ read)
+	{
+		Entry& e = ring[head];
+
+		e.pc = pc;
+		e.af = af;
+		e.tstate = tstate;
+		e.op[0] = read(pc);
+		e.op[1] = read(pc + 1);
+		e.op[2] = read(pc + 2);
+		e.op[3] = read(pc + 3);
+
+		head = (head + 1) & (SIZE - 1);
+		if (count < SIZE) ++count;
+	}
+
+	uint16_t entries() const { return count; }
+
+	void dump(Print& out) const
+	{
+		uint16_t i, pos;
+		uint8_t j, k, n;
+		char text[24];
+		char buf[64];
+
+		out.println("ZXTRACE 1");
+
+		pos = (head - count) & (SIZE - 1);
+
+		for (i = 0; i < count; ++i)
+		{
+			const Entry& e = ring[pos];
+			ZXDisasm dis(text, sizeof(text));
+
+			n = dis.decode(e.pc, [&e](uint16_t addr) { return e.op[(uint16_t)(addr - e.pc) & 3]; });
+
+			j = snprintf(buf, sizeof(buf), "%04X %04X %5lu ", e.pc, e.af, (unsigned long)e.tstate);
+
+			for (k = 0; k < 4; ++k)
+			{
+				if (k < n) j += snprintf(buf + j, sizeof(buf) - j, "%02X", e.op[k]);
+				else j += snprintf(buf + j, sizeof(buf) - j, "  ");
+			}
+
+			snprintf(buf + j, sizeof(buf) - j, " %s", dis.text());
+			out.println(buf);
+
+			pos = (pos + 1) & (SIZE - 1);
+		}
+
+		out.println("END");
+	}
+
+private:
+	Entry ring[SIZE];
+	uint16_t head;		//next entry to write
+	uint16_t count;
+};
+
+#endif/*__ZXTRACE_HPP__*/
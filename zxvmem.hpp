@@ -0,0 +1,371 @@
+#pragma once
+
+#ifndef __ZXVMEM_HPP__
+#define __ZXVMEM_HPP__
+
+// Flash-backed paged RAM
+//
+// The emulated RAM is split into 1K..4K pages. A fixed pool of frames holds the hot set,
+// the rest of the pages are swapped to raw flash at the top of the free sketch space
+// (the area OTA updates are written to, it is unused while the emulator runs).
+// Pages that were never written back read as zeroes without touching the flash.
+//
+// Replacement is LRU with a coarse clock: the emulator calls tick() once per frame and
+// drops its own page pointer cache, so the first access of a page in a frame refreshes
+// its age through map(). Wired pages (the screen) are never evicted and are kept in
+// contiguous frames, so the renderer can read them directly.
+//
+// Writing a page back needs erased flash, and a sector erase stalls the CPU for tens of
+// milliseconds. The swap area has more 4K sectors than pages (up to SECTORS_MAX of the
+// free space). Dirty pages are written one after another into the SLOTS page slots of
+// the open sector, and when it is full the next sector with no live page in it is
+// erased and opened; the old slot of a page is freed when it is written again. tick()
+// opens the next sector between frames when an erase is due, so the write back that
+// follows does not erase.
+// One erase is allowed every ERASE_FRAMES ticks, while there is none a miss evicts a
+// clean frame even when a dirty one is older; the limit is only broken when every
+// evictable frame is dirty (counted in forced).
+//
+// Wear: the erases go round all S sectors of the swap area and SLOTS pages are written
+// to a sector between two of its erases. Unless they are forced there is at most one
+// erase every ERASE_FRAMES frames, so with 1M of free sketch space (S = 255) and 50 frames
+// a second the rated 100K cycles of the flash last at least 255 * 2 * 100000 / 50 seconds,
+// about 12 days of play. A game that writes a page back every frame with no clean frame
+// left to evict needs an erase every SLOTS frames and forces the ones over the limit:
+// about 6 days with 4K pages, 24 with 1K pages. Games that mostly read their banks last
+// far longer.
+
+#include <arduino.h>
+
+template<uint8_t SHIFT>
+class ZXPagedRAM
+{
+	static_assert(SHIFT >= 10 && SHIFT <= 12, "Page size must be 1K..4K");
+
+public:
+	static constexpr uint32_t PAGE_SIZE = 1 << SHIFT;
+	static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+	static constexpr uint32_t SECTOR_SIZE = 4096;
+	static constexpr uint32_t SPACE_MAX = 0x20000; //128K
+	static constexpr uint16_t PAGES_MAX = SPACE_MAX >> SHIFT;
+	static constexpr uint8_t FRAMES_MAX = 64;
+	static constexpr uint8_t SECTORS_MAX = 255;
+	static constexpr uint8_t SLOTS = SECTOR_SIZE / PAGE_SIZE;	//pages written to a sector between erases
+	static constexpr uint8_t ERASE_FRAMES = 2;	//ticks an erase is allowed in, one erase each
+	static constexpr uint8_t NONE = 0xff;
+	static constexpr uint16_t NO_SLOT = 0xffff;
+
+	static_assert(PAGES_MAX < NONE, "Page numbers must fit the frame map");
+
+	uint32_t hits;			//page lookups served from RAM
+	uint32_t misses;		//page lookups that had to load a page
+	uint32_t evictions;		//frames reused for another page
+	uint32_t writebacks;	//dirty pages written to flash
+	uint32_t erases;		//flash sectors erased
+	uint32_t forced;		//erases over the per frame limit, no clean frame was left
+
+	ZXPagedRAM() : pool(nullptr), frames(0), wired_frames(0), pages(0), sectors(0), cursor(0), fill(SLOTS), budget(0), swap(0), clock(0)
+	{
+		resetStats();
+	}
+
+	//allocates the frame pool, returns the number of frames
+
+	uint8_t begin(uint8_t count)
+	{
+		end();
+
+		if (count > FRAMES_MAX) count = FRAMES_MAX;
+
+		while (count && !pool)
+		{
+			pool = (uint8_t*)malloc(count * PAGE_SIZE);
+
+			if (!pool) --count;
+		}
+
+		frames = count;
+
+		return frames;
+	}
+
+	void end()
+	{
+		free(pool);
+		pool = nullptr;
+		frames = 0;
+		pages = 0;
+	}
+
+	//sets the size of the paged space, all pages become zero and nothing is wired
+	//returns 0 when there is not enough flash for the swap area
+
+	uint8_t clear(uint32_t size)
+	{
+		uint32_t start, space, count;
+		uint16_t i;
+
+		pages = (size + PAGE_MASK) >> SHIFT;
+
+		if (pages > PAGES_MAX) pages = PAGES_MAX;
+
+		start = (ESP.getSketchSize() + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+		space = ESP.getFreeSketchSpace();
+		count = space / SECTOR_SIZE;
+
+		if (count > SECTORS_MAX) count = SECTORS_MAX;
+
+		if (count < (uint32_t)pages + 1) //a page is written to a new sector before its old one is freed
+		{
+			pages = 0;
+			sectors = 0;
+			return 0;
+		}
+
+		sectors = count;
+		swap = start + space - sectors * SECTOR_SIZE;
+
+		for (i = 0; i < PAGES_MAX; ++i)
+		{
+			page_frame[i] = NONE;
+			page_slot[i] = NO_SLOT;
+		}
+		for (i = 0; i < FRAMES_MAX; ++i)
+		{
+			frame_page[i] = 0xffff;
+			frame_dirty[i] = 0;
+		}
+		for (i = 0; i < SECTORS_MAX; ++i) sector_live[i] = 0;
+
+		cursor = 0;
+		fill = SLOTS;
+		budget = 1;
+		wired_frames = 0;
+
+		return 1;
+	}
+
+	//keeps [vaddr, vaddr+size) resident in contiguous frames, must be called right after clear()
+
+	uint8_t* wire(uint32_t vaddr, uint32_t size)
+	{
+		uint16_t page, last;
+		uint8_t* ptr;
+
+		page = vaddr >> SHIFT;
+		last = (vaddr + size - 1) >> SHIFT;
+
+		if (wired_frames + (last - page + 1) > frames) return nullptr;
+
+		ptr = &pool[wired_frames * PAGE_SIZE] + (vaddr & PAGE_MASK);
+
+		for (; page <= last; ++page)
+		{
+			memset(&pool[wired_frames * PAGE_SIZE], 0, PAGE_SIZE);
+
+			page_frame[page] = wired_frames;
+			frame_page[wired_frames] = page;
+			frame_dirty[wired_frames] = 1;
+			++wired_frames;
+		}
+
+		return ptr;
+	}
+
+	//returns the frame holding the page, loads it if needed
+	//write marks the page as dirty, returns nullptr on flash failure
+
+	uint8_t* map(uint16_t page, bool write)
+	{
+		uint8_t fr = page_frame[page];
+
+		if (fr != NONE)
+		{
+			++hits;
+		}
+		else
+		{
+			++misses;
+
+			fr = victim();
+
+			if (fr == NONE) return nullptr;
+			if (!evict(fr)) return nullptr;
+			if (!load(page, fr)) return nullptr;
+		}
+
+		frame_age[fr] = clock;
+
+		if (write) frame_dirty[fr] = 1;
+
+		return &pool[fr * PAGE_SIZE];
+	}
+
+	void poke(uint32_t vaddr, uint8_t value)
+	{
+		uint8_t* ptr = map(vaddr >> SHIFT, true);
+
+		if (ptr) ptr[vaddr & PAGE_MASK] = value;
+	}
+
+	//called between frames: ages the pages and, when the erase is due, opens the sector the
+	//next write backs go to
+
+	void tick()
+	{
+		++clock;
+
+		if (!(clock % ERASE_FRAMES)) budget = 1;
+
+		if (sectors && fill >= SLOTS && budget) open();
+	}
+
+	void resetStats()
+	{
+		hits = 0;
+		misses = 0;
+		evictions = 0;
+		writebacks = 0;
+		erases = 0;
+		forced = 0;
+	}
+
+	uint8_t* frame(uint8_t fr) { return &pool[fr * PAGE_SIZE]; }
+	uint8_t resident() const { return frames; }
+
+private:
+	uint8_t* pool;
+	uint8_t frames;
+	uint8_t wired_frames;		//frames [0, wired_frames) are never evicted
+	uint16_t pages;
+	uint8_t sectors;			//sectors in the swap area
+	uint8_t cursor;				//the open sector, or the last one
+	uint8_t fill;				//slots of the open sector written, SLOTS when none is open
+	uint8_t budget;				//erases left until one is due again
+	uint32_t swap;				//flash address of sector 0
+	uint16_t clock;
+
+	uint8_t page_frame[PAGES_MAX];
+	uint16_t page_slot[PAGES_MAX];		//sector * SLOTS + slot holding the page, NO_SLOT while it reads as zeroes
+	uint8_t sector_live[SECTORS_MAX];	//pages whose copy is in the sector
+	uint16_t frame_page[FRAMES_MAX];
+	uint16_t frame_age[FRAMES_MAX];
+	uint8_t frame_dirty[FRAMES_MAX];
+
+	uint32_t slotAddr(uint16_t slot) const { return swap + (slot / SLOTS) * SECTOR_SIZE + (slot % SLOTS) * PAGE_SIZE; }
+
+	//erases the next sector after the open one without live pages and opens it, there is
+	//always one as sectors > pages; the open one itself is taken last
+
+	uint8_t open()
+	{
+		uint8_t s = cursor;
+
+		do
+		{
+			if (++s >= sectors) s = 0;
+		} while (sector_live[s] && s != cursor);
+
+		if (sector_live[s]) return 0;
+		if (!ESP.flashEraseSector(swap / SECTOR_SIZE + s)) return 0;
+
+		cursor = s;
+		fill = 0;
+		++erases;
+
+		if (budget) --budget; else ++forced;
+
+		return 1;
+	}
+
+	//least recently used frame, a clean one when writing a dirty one back would need
+	//an erase the frame has no budget left for
+
+	uint8_t victim()
+	{
+		uint8_t i, fr, clean;
+		uint16_t age, best, best_clean;
+
+		fr = NONE;
+		clean = NONE;
+		best = 0;
+		best_clean = 0;
+
+		for (i = wired_frames; i < frames; ++i)
+		{
+			if (frame_page[i] == 0xffff) return i;
+
+			age = clock - frame_age[i];
+
+			if (fr == NONE || age > best || (age == best && !frame_dirty[i]))
+			{
+				fr = i;
+				best = age;
+			}
+
+			if (!frame_dirty[i] && (clean == NONE || age > best_clean))
+			{
+				clean = i;
+				best_clean = age;
+			}
+		}
+
+		if (fr != NONE && frame_dirty[fr] && clean != NONE && !budget && fill >= SLOTS) fr = clean;
+
+		return fr;
+	}
+
+	uint8_t evict(uint8_t fr)
+	{
+		uint16_t page = frame_page[fr];
+		uint16_t slot;
+
+		if (page == 0xffff) return 1;
+
+		++evictions;
+
+		if (frame_dirty[fr])
+		{
+			if (fill >= SLOTS && !open()) return 0;
+
+			slot = cursor * SLOTS + fill;
+
+			if (!ESP.flashWrite(slotAddr(slot), (uint32_t*)&pool[fr * PAGE_SIZE], PAGE_SIZE)) return 0;
+
+			++fill;
+
+			if (page_slot[page] != NO_SLOT) --sector_live[page_slot[page] / SLOTS];
+
+			page_slot[page] = slot;
+			++sector_live[cursor];
+
+			++writebacks;
+		}
+
+		page_frame[page] = NONE;
+		frame_page[fr] = 0xffff;
+		frame_dirty[fr] = 0;
+
+		return 1;
+	}
+
+	uint8_t load(uint16_t page, uint8_t fr)
+	{
+		if (page_slot[page] != NO_SLOT)
+		{
+			if (!ESP.flashRead(slotAddr(page_slot[page]), (uint32_t*)&pool[fr * PAGE_SIZE], PAGE_SIZE)) return 0;
+		}
+		else
+		{
+			memset(&pool[fr * PAGE_SIZE], 0, PAGE_SIZE);
+		}
+
+		page_frame[page] = fr;
+		frame_page[fr] = page;
+		frame_dirty[fr] = 0;
+
+		return 1;
+	}
+};
+
+#endif/*__ZXVMEM_HPP__*/
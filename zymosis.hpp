@@ -18,11 +18,22 @@
 #pragma GCC push_options
 
 #include <cstdint>
+#include <type_traits>
+#if defined(ZYMOSIS_FLAGS_IN_STATIC) || defined(ZYMOSIS_FLAGS_IN_TABLES)
+#include <array>
+#endif
 
  /* define either ZYMOSIS_LITTLE_ENDIAN or ZYMOSIS_BIG_ENDIAN */
 
 #if !defined(ZYMOSIS_LITTLE_ENDIAN) && !defined(ZYMOSIS_BIG_ENDIAN)
-	#if BYTE_ORDER == LITTLE_ENDIAN
+	/* BYTE_ORDER comes from the ESP8266 toolchain, host compilers may only have __BYTE_ORDER__ */
+	#if !defined(BYTE_ORDER) && defined(__BYTE_ORDER__)
+		#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			#define ZYMOSIS_LITTLE_ENDIAN
+		#else
+			#define ZYMOSIS_BIG_ENDIAN
+		#endif
+	#elif BYTE_ORDER == LITTLE_ENDIAN
 		#define ZYMOSIS_LITTLE_ENDIAN
 	#else
 		#define ZYMOSIS_BIG_ENDIAN
@@ -50,11 +61,26 @@
 # endif
 #endif
 
+/* ZYMOSIS_HOT goes on Z80_Execute(). Defining ZYMOSIS_COLD moves the ED group and the */
+/* IX/IY instructions into Z80_ExecuteCold(), which it goes on, e.g. to keep the main loop */
+/* in IRAM and the rest in flash on the ESP8266. They run on the Z80Info copies of pc, */
+/* tstates and af, as callbacks do */
+#ifndef ZYMOSIS_HOT
+# define ZYMOSIS_HOT
+#endif
+
+/* host builds without the ESP8266 pgmspace.h read PROGMEM data directly */
 #ifndef PROGMEM
 #define PROGMEM
-#define pgm_read_byte(x) (x)
-#define pgm_read_word(x) (x)
-#define pgm_read_dword(x) (x)
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(x) (*(const uint8_t*)(x))
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(x) (*(const uint16_t*)(x))
+#endif
+#ifndef pgm_read_dword
+#define pgm_read_dword(x) (*(const uint32_t*)(x))
 #endif
 
 namespace zymosis {
@@ -79,7 +105,14 @@ namespace zymosis {
 // 3. Switch-based function generation. (compiler make lookup table).	100.3%
 // 4. Bit ops based function (without loops).							100.5%	<-- Carefully chosed. 
 // 4. Naive function (with loop).										101.6%
+// Define one of ZYMOSIS_FLAGS_IN_STATIC, _ARRAY, _FUNCTION, _FUNCTION2 or _FUNCTION3 to pick it,
+// Z80_SelfCheck() compares the chosen one against the plain definition.
+// ZYMOSIS_FLAGS_IN_TABLES is 2. plus compile-time tables for the INC/DEC flags (256 bytes each,
+// DRAM) and DAA (A, C, H and N to AF, 4K in PROGMEM), in place of the arithmetic in Z80_INC8,
+// Z80_DEC8 and Z80_DAA. The rotates are left alone, their flags are one SZ53PTAB() already.
+#if !defined(ZYMOSIS_FLAGS_IN_STATIC) && !defined(ZYMOSIS_FLAGS_IN_ARRAY) && !defined(ZYMOSIS_FLAGS_IN_FUNCTION) && !defined(ZYMOSIS_FLAGS_IN_FUNCTION2) && !defined(ZYMOSIS_FLAGS_IN_FUNCTION3) && !defined(ZYMOSIS_FLAGS_IN_TABLES)
 #define ZYMOSIS_FLAGS_IN_FUNCTION2
+#endif
 #if defined(ZYMOSIS_FLAGS_IN_STATIC) | defined(ZYMOSIS_FLAGS_IN_FUNCTION)
 	template<uint8_t N>
 	struct FA { constexpr static uint8_t val() { return (4 * (!((((N * 0x0101010101010101ULL) & 0x8040201008040201ULL) % 0x1FF) & 1))) | (N & Z80_FLAG_S35) | (N == 0 ? Z80_FLAG_Z : 0); } };
@@ -87,12 +120,40 @@ namespace zymosis {
 	// enum { TT = FA<255>::val() };
 #endif
 #if defined(ZYMOSIS_FLAGS_IN_STATIC)
-	#include <array>
-
 	template<uint16_t INDEX = 0, uint16_t ...D> struct Helper : Helper<INDEX + 1, D..., FA<INDEX>::val()> { };
 	template<uint16_t ...D> struct Helper<256, D...> { static constexpr std::array<uint8_t, 256> table = { D... };	};
 	constexpr std::array<uint8_t, 256> sz53pTable = Helper<>::table;
 #define SZ53PTAB(x) (sz53pTable[(x)])
+#elif defined(ZYMOSIS_FLAGS_IN_TABLES)
+	/* index packs built by halves, the 2048 DAA entries are too deep for Helper<> */
+	template<uint16_t ...I> struct FSeq { };
+	template<class A, class B> struct FCat;
+	template<uint16_t ...A, uint16_t ...B> struct FCat<FSeq<A...>, FSeq<B...>> { typedef FSeq<A..., (sizeof...(A) + B)...> type; };
+	template<uint16_t N> struct FMakeSeq { typedef typename FCat<typename FMakeSeq<N / 2>::type, typename FMakeSeq<N - N / 2>::type>::type type; };
+	template<> struct FMakeSeq<1> { typedef FSeq<0> type; };
+
+	template<class F, class S> struct FTable;
+	template<class F, uint16_t ...I> struct FTable<F, FSeq<I...>> { static constexpr std::array<typename F::type, sizeof...(I)> table = { { F::val(I)... } }; };
+
+	constexpr uint8_t fSZ53P(uint8_t n) { return (4 * (!((((n * 0x0101010101010101ULL) & 0x8040201008040201ULL) % 0x1FF) & 1))) | (n & Z80_FLAG_S35) | (n == 0 ? Z80_FLAG_Z : 0); }
+	/* DAA pieces, i is A | C << 8 | H << 9 | N << 10 */
+	constexpr uint8_t fDaaI(uint16_t i) { return (((i & 0x200) || (i & 0x0f) > 9) ? 0x06 : 0) | (((i & 0x100) || (i & 0xff) > 0x99) ? 0x60 : 0); }
+	constexpr uint8_t fDaaA(uint16_t i) { return ((i & 0x400) ? (i & 0xff) - fDaaI(i) : (i & 0xff) + fDaaI(i)) & 0xff; }
+
+	struct FSZ53P { typedef uint8_t type; static constexpr uint8_t val(uint16_t n) { return fSZ53P(n); } };
+	/* flags but C of INC and DEC n */
+	struct FInc { typedef uint8_t type; static constexpr uint8_t val(uint16_t n) { return (n == 0x7f ? Z80_FLAG_PV : 0) | ((n + 1) & 0x0f ? 0 : Z80_FLAG_H) | (fSZ53P((n + 1) & 0xff) & ~Z80_FLAG_PV); } };
+	struct FDec { typedef uint8_t type; static constexpr uint8_t val(uint16_t n) { return Z80_FLAG_N | (n == 0x80 ? Z80_FLAG_PV : 0) | (n & 0x0f ? 0 : Z80_FLAG_H) | (fSZ53P((n - 1) & 0xff) & ~Z80_FLAG_PV); } };
+	/* AF after DAA, the same as ADD/SUB of the correction with C and P/V fixed up afterwards */
+	struct FDaa { typedef uint16_t type; static constexpr uint16_t val(uint16_t i) {
+		return (fDaaA(i) << 8) | fSZ53P(fDaaA(i)) | (((i & 0xff) ^ fDaaI(i) ^ fDaaA(i)) & Z80_FLAG_H) | ((i & 0x400) ? Z80_FLAG_N : 0) | (((i & 0x100) || (i & 0xff) > 0x99) ? Z80_FLAG_C : 0);
+	} };
+
+	constexpr std::array<uint8_t, 256> sz53pTable = FTable<FSZ53P, FMakeSeq<256>::type>::table;
+	constexpr std::array<uint8_t, 256> incTable = FTable<FInc, FMakeSeq<256>::type>::table;
+	constexpr std::array<uint8_t, 256> decTable = FTable<FDec, FMakeSeq<256>::type>::table;
+	PROGMEM constexpr std::array<uint16_t, 2048> daaTable = FTable<FDaa, FMakeSeq<2048>::type>::table;
+#define SZ53PTAB(x) (sz53pTable[(x)])
 #elif defined(ZYMOSIS_FLAGS_IN_ARRAY)
 #define SZ53PTAB(x) (sz53pTable[(x)])
 #elif defined(ZYMOSIS_FLAGS_IN_FUNCTION)
@@ -119,7 +180,7 @@ namespace zymosis {
 #define _ZYMOSIS_STAMP(n, x) _ZYMOSIS_STAMP##n(0, x)
 #define SZ53PTAB(x) (fSZ53PTAB(x))
 #define caseSZ53PTAB(n) case n: return FA<n>::val(); break;
-	ZYMOSIS_INLINE uint8_t fSZ53PTAB(uint8_t t)
+	ZYMOSIS_INLINE inline uint8_t fSZ53PTAB(uint8_t t)
 	{
 		switch (t) {
 			_ZYMOSIS_STAMP(256, caseSZ53PTAB);
@@ -128,7 +189,7 @@ namespace zymosis {
 		return 0;
 	}
 #elif defined(ZYMOSIS_FLAGS_IN_FUNCTION2)
-	ZYMOSIS_INLINE uint8_t fSZ53PTAB(uint8_t x)
+	ZYMOSIS_INLINE inline uint8_t fSZ53PTAB(uint8_t x)
 	{
 		uint8_t t = x ^ (x >> 4);
 		t = t ^ (t >> 2);
@@ -136,7 +197,7 @@ namespace zymosis {
 	}
 #define SZ53PTAB(x) (fSZ53PTAB(x))
 #elif defined(ZYMOSIS_FLAGS_IN_FUNCTION3)
-	ZYMOSIS_INLINE uint8_t fSZ53PTAB(uint8_t x)
+	ZYMOSIS_INLINE inline uint8_t fSZ53PTAB(uint8_t x)
 	{
 		uint_fast8_t t = (x & Z80_FLAG_S35) | ((!x) * Z80_FLAG_Z);
 		uint_fast8_t p = 1;
@@ -190,8 +251,8 @@ namespace zymosis {
 		Z80_PIOFLAG_EARLY = 0x20 /* 'early' port contetion, if set */
 	};
 
-#define INC_PC  (this->pc = (this->pc+1)&0xffff)
-#define DEC_PC  (this->pc = ((int32_t)(this->pc)-1)&0xffff)
+#define INC_PC  (rs.pc = (rs.pc+1)&0xffff)
+#define DEC_PC  (rs.pc = ((int32_t)(rs.pc)-1)&0xffff)
 
 #define INC_W(n)  ((n) = ((n)+1)&0xffff)
 #define DEC_W(n)  ((n) = ((int32_t)(n)-1)&0xffff)
@@ -215,7 +276,6 @@ namespace zymosis {
 		Z80WordReg bc, de, hl, af, sp, ix, iy;
 		/* alternate registers */
 		Z80WordReg bcx, dex, hlx, afx;
-		Z80WordReg* dd; /* pointer to current HL/IX/IY (inside this struct) for the current command */
 		Z80WordReg memptr;
 		uint16_t pc; /* program counter */
 		//uint16_t prev_pc; /* first byte of the previous command */
@@ -231,10 +291,46 @@ namespace zymosis {
 							/* Zymosis will reset this flag only if it executed at least one instruction */
 		bool evenM1; /* boolean; emulate 128K/Scorpion M1 contention? */
 		// void* user; /* arbitrary user data */
+#if defined(ZYMOSIS_BLOCK_CACHE)
+		uint16_t code_gen[256]; /* write generation of every 256 byte page, cached blocks remember it */
+		bool code_flush; /* a generation wrapped around, every cached block has to go */
+#endif
+	};
+
+	enum Z80LazyKind : uint8_t {
+		Z80_LAZY_NONE = 0, /* F is up to date */
+		Z80_LAZY_ADD, /* ADD/ADC: a+b(+carry) = r */
+		Z80_LAZY_SUB, /* SUB/SBC: a-b(-carry) = r, r is 16 bit so bit 8 is the borrow */
+		Z80_LAZY_CP, /* CP: as SUB, bits 3 and 5 come from b */
+		Z80_LAZY_INC, /* INC: a+1 = r, b is the carry kept */
+		Z80_LAZY_DEC /* DEC: a-1 = r, b is the carry kept */
+	};
+
+	/* the last flag setting ALU operation when F has not been worked out yet */
+	struct Z80LazyFlags {
+		uint8_t kind; /* Z80LazyKind */
+		uint8_t a, b;
+		uint16_t r;
+	};
+
+	/* the registers the instruction code works on: the Z80Info fields themselves, or locals of */
+	/* Z80_Execute() when the policy makes them resident (see Z80Policy) */
+	struct Z80State {
+		uint16_t& pc;
+		int32_t& tstates;
+		Z80WordReg& af;
+		Z80LazyFlags& lazy;
 	};
 
 	struct Z80CallBacks : public Z80Info
 	{
+		/* with a resident policy pc, tstates and af are only up to date in pagerFn, checkBPFn, */
+		/* profileFn, portInFn, portOutFn, blockCopyFn, blockScanFn, retiFn, retnFn and trapEDFn, */
+		/* and after Z80_Execute() returns; memReadFn and memWriteFn see them as they were before */
+		/* the instruction. trapEDFn is the only callback that may change them. */
+		/* with lazy flags F is worked out for the same callbacks except pagerFn, checkBPFn and */
+		/* profileFn, which see F as the last instruction that needed it left it */
+
 		/* miot: only Z80_MEMIO_xxx, no need in masking */
 		inline uint8_t  memReadFn(uint16_t addr, Z80MemIOType miot) { return 0; }
 		inline void memWriteFn(uint16_t addr, uint8_t value, Z80MemIOType miot) {}
@@ -281,6 +377,39 @@ namespace zymosis {
 		/* emulator can check various breakpoint conditions there */
 		/* and return non-zero to immediately stop executing and return from Z80_Execute[XXX]() */
 
+		inline void profileFn(uint16_t pc) {} /* can be NULL */
+		/* profileFn is called with org_pc of every instruction, before its opcode is fetched */
+
+		inline uint16_t blockCopyFn(uint16_t src, uint16_t dst, uint16_t count, bool backward) { return 0; } /* can be NULL */
+		/* blockCopyFn is called by LDIR/LDDR at org_pc to run up to 'count' more iterations at once */
+		/* it copies bytes from src to dst one by one, stepping both down when backward, and returns */
+		/* how many it copied; 0 makes the core run them one at a time */
+		/* the core counts 21 t-states per iteration, so return 0 if any access of the loop would be */
+		/* contended, or pagerFn, checkBPFn or profileFn have to see every iteration */
+		/* the core never includes an iteration that writes over the LDIR/LDDR opcode at org_pc and */
+		/* org_pc+1, the CPU fetches it again for the next iteration and may run something else; */
+		/* copies that overlap other code are the callback's to handle (codeWritten() and such) */
+
+		inline uint16_t blockScanFn(uint16_t addr, uint16_t count, bool backward, uint8_t value) { return 0; } /* can be NULL */
+		/* blockScanFn is the same for CPIR/CPDR: it returns how many bytes from addr on, at most */
+		/* 'count', differ from value */
+
+#if defined(ZYMOSIS_BLOCK_CACHE)
+		/* memWriteFn must call codeWritten() for every write, and codeInvalidate() is called */
+		/* when memory changes without writes: paging, snapshot loading and so on */
+		ZYMOSIS_INLINE void codeWritten(uint16_t addr) { if (!++code_gen[addr >> 8]) code_flush = true; }
+
+		void codeInvalidate(uint16_t addr, uint32_t len)
+		{
+			uint32_t page;
+			/***/
+			if (!len) return;
+			for (page = addr >> 8; page <= (addr + len - 1) >> 8 && page < 256; ++page) {
+				if (!++code_gen[page]) code_flush = true;
+			}
+		}
+#endif
+
 		inline void reset() {}
 	};
 
@@ -306,7 +435,7 @@ namespace zymosis {
 	} while (0)
 
 #define Z80_EXAFAF()  do { \
-	  uint16_t t = this->af.w; this->af.w = this->afx.w; this->afx.w = t; \
+	  uint16_t t = rs.af.w; rs.af.w = this->afx.w; this->afx.w = t; \
 	} while (0)
 
 
@@ -315,28 +444,72 @@ namespace zymosis {
 	/* (tstates = tstates+contention+1)*cnt */
 	/* (Z80Info *z80, uint16_t addr, int tstates, Z80MemIOType mio) */
 #define Z80_Contention(_addr,_tstates,_mio)  do { \
-	  this->contentionFn((_addr), (_tstates), static_cast<Z80MemIOType>(_mio)); \
+	  if (P::contention) this->contentionFn((_addr), (_tstates), static_cast<Z80MemIOType>(_mio)); \
+	  else rs.tstates += (_tstates); \
 	} while (0)
 
 
 #define Z80_ContentionBy1(_addr,_cnt)  do { \
-		for (int _f = (_cnt); _f-- > 0; this->contentionFn((_addr), 1, static_cast<Z80MemIOType>(Z80_MREQ_NONE | Z80_MEMIO_OTHER))) ; \
+		if (P::contention) { \
+			for (int _f = (_cnt); _f-- > 0; this->contentionFn((_addr), 1, static_cast<Z80MemIOType>(Z80_MREQ_NONE | Z80_MEMIO_OTHER))) ; \
+		} \
+		else rs.tstates += (_cnt); \
 	} while (0)
 
 
 #define Z80_ContentionIRBy1(_cnt)  Z80_ContentionBy1((((uint16_t)this->regI)<<8)|(this->regR), (_cnt))
-#define Z80_ContentionPCBy1(_cnt)  Z80_ContentionBy1(this->pc, (_cnt))
-
-#define Z80_AND_A(_b) (this->af.f = SZ53PTAB(this->af.a&=(_b))|Z80_FLAG_H)
-#define Z80_OR_A(_b)  (this->af.f = SZ53PTAB(this->af.a|=(_b)))
-#define Z80_XOR_A(_b) (this->af.f = SZ53PTAB(this->af.a^=(_b)))
+#define Z80_ContentionPCBy1(_cnt)  Z80_ContentionBy1(rs.pc, (_cnt))
+
+#define Z80_AND_A(_b) (rs.af.f = SZ53PTAB(rs.af.a&=(_b))|Z80_FLAG_H)
+#define Z80_OR_A(_b)  (rs.af.f = SZ53PTAB(rs.af.a|=(_b)))
+#define Z80_XOR_A(_b) (rs.af.f = SZ53PTAB(rs.af.a^=(_b)))
+
+#define INC_R  do { if (P::refresh) this->regR = ((this->regR+1)&0x7f)|(this->regR&0x80); } while (0)
+#define ADD_R(n)  do { if (P::refresh) this->regR = ((this->regR+(n))&0x7f)|(this->regR&0x80); } while (0)
+
+#define Z80_MEMPTR(_value)  do { if (P::memptr) this->memptr.w = (_value); } while (0)
+#define Z80_MEMPTR_LH(_l,_h)  do { if (P::memptr) { this->memptr.l = (_l); this->memptr.h = (_h); } } while (0)
+
+	/* Feature policy */
+	/* The second parameter of Z80Cpu says what the core emulates, a feature that is false is */
+	/* removed at compile time instead of being left to the inliner: */
+	/*   contention: contentionFn and portContentionFn are called, otherwise t-states are added */
+	/*   evenM1: the evenM1 flag is honoured */
+	/*   pager: pagerFn is called before every instruction */
+	/*   breakpoints: checkBPFn is called before every instruction */
+	/*   memptr: MEMPTR is kept, it only shows in bits 3 and 5 of the flags after BIT n,(HL) */
+	/*   refresh: R counts M1 cycles, otherwise it only changes with LD R,A */
+	/*   resident: Z80_Execute() keeps pc, tstates and af in locals, so memory callbacks that */
+	/*     write through pointers do not make the compiler reload them; the Z80Info copies are */
+	/*     written back only around the callbacks listed in Z80CallBacks. Needs no contention, */
+	/*     contentionFn would have to add to the local tstates */
+	/*   lazyFlags: ADD, ADC, SUB, SBC, CP, INC and DEC of the main table only remember their */
+	/*     operands, F is worked out when an instruction or callback needs it */
+	/*   fusion: LD A,(HL)+INC HL, LD (DE),A+INC DE, DEC BC+LD A,B+OR C+JR NZ and DJNZ $ run */
+	/*     as one handler, see Z80_Fused(). pagerFn and profileFn are not called between the */
+	/*     fused instructions and the next opcode is peeked with Z80_MEMIO_OTHER before it is */
+	/*     fetched. Needs no contention and no breakpoints */
+	template<bool CONTENTION, bool EVEN_M1, bool PAGER, bool BREAKPOINTS, bool MEMPTR, bool REFRESH, bool RESIDENT = false, bool LAZY_FLAGS = false, bool FUSION = false>
+	struct Z80Policy {
+		static constexpr bool contention = CONTENTION;
+		static constexpr bool evenM1 = EVEN_M1;
+		static constexpr bool pager = PAGER;
+		static constexpr bool breakpoints = BREAKPOINTS;
+		static constexpr bool memptr = MEMPTR;
+		static constexpr bool refresh = REFRESH;
+		static constexpr bool resident = RESIDENT;
+		static constexpr bool lazyFlags = LAZY_FLAGS;
+		static constexpr bool fusion = FUSION;
+	};
 
-#define INC_R  (this->regR = ((this->regR+1)&0x7f)|(this->regR&0x80))
+	typedef Z80Policy<true, true, true, true, true, true> Z80FullPolicy;
 
-	template<class T = Z80CallBacks>
+	template<class T = Z80CallBacks, class P = Z80FullPolicy>
 	class Z80Cpu : public T
 	{
 		static_assert(std::is_base_of<Z80CallBacks, T>::value, "Type T must be derived from Z80CallBacks");
+		static_assert(!P::resident || !P::contention, "A resident policy cannot call contentionFn");
+		static_assert(!P::fusion || (!P::contention && !P::breakpoints), "Fused instructions are timed without contention and skip checkBPFn");
 
 #if defined(ZYMOSIS_FLAGS_IN_ARRAY)
 		static bool tablesInitialized;
@@ -375,33 +548,124 @@ namespace zymosis {
 			return trueCC;
 		}*/
 
-		ZYMOSIS_INLINE bool SET_TRUE_CC(uint8_t opcode)
+		ZYMOSIS_INLINE Z80State Z80_MemberState(Z80LazyFlags& lazy) {
+			lazy.kind = Z80_LAZY_NONE;
+			return Z80State{ this->pc, this->tstates, this->af, lazy };
+		}
+
+		/* F from a lazy record */
+		static uint8_t Z80_LazyF(const Z80LazyFlags& lz) {
+			uint8_t a = lz.a, b = lz.b, r = lz.r & 0xff;
+			/***/
+			switch (lz.kind) {
+			case Z80_LAZY_ADD:
+				return (SZ53PTAB(r) & ~Z80_FLAG_PV) | (lz.r > 0xff ? Z80_FLAG_C : 0) |
+					((a ^ (~b)) & (a ^ r) & 0x80 ? Z80_FLAG_PV : 0) | ((a ^ b ^ r) & Z80_FLAG_H);
+			case Z80_LAZY_SUB:
+				return Z80_FLAG_N | (SZ53PTAB(r) & ~Z80_FLAG_PV) | (lz.r > 0xff ? Z80_FLAG_C : 0) |
+					((a ^ b) & (a ^ r) & 0x80 ? Z80_FLAG_PV : 0) | ((a ^ b ^ r) & Z80_FLAG_H);
+			case Z80_LAZY_CP:
+				return Z80_FLAG_N | (SZ53PTAB(r) & (Z80_FLAG_S | Z80_FLAG_Z)) | (b & Z80_FLAG_35) | (lz.r > 0xff ? Z80_FLAG_C : 0) |
+					((a ^ b) & (a ^ r) & 0x80 ? Z80_FLAG_PV : 0) | ((a ^ b ^ r) & Z80_FLAG_H);
+#if defined(ZYMOSIS_FLAGS_IN_TABLES)
+			case Z80_LAZY_INC:
+				return b | incTable[a];
+			default:
+				return b | decTable[a];
+#else
+			case Z80_LAZY_INC:
+				return b | (a == 0x7f ? Z80_FLAG_PV : 0) | (r & 0x0f ? 0 : Z80_FLAG_H) | (SZ53PTAB(r) & ~Z80_FLAG_PV);
+			default:
+				return b | Z80_FLAG_N | (a == 0x80 ? Z80_FLAG_PV : 0) | (a & 0x0f ? 0 : Z80_FLAG_H) | (SZ53PTAB(r) & ~Z80_FLAG_PV);
+#endif
+			}
+		}
+
+		/* records ADD, ADC, SUB, SBC or CP (op as in Z80_ALU_A) of a and b, returns the new A */
+		ZYMOSIS_INLINE static uint8_t Z80_LazyALU(Z80LazyFlags& lz, uint8_t op, uint8_t a, uint8_t b, uint8_t carry) {
+			lz.a = a;
+			lz.b = b;
+			if (op < 2) {
+				lz.r = a + b + carry;
+				lz.kind = Z80_LAZY_ADD;
+				return lz.r & 0xff;
+			}
+			lz.r = ((int32_t)a - (int32_t)b - (int32_t)carry) & 0xffff;
+			lz.kind = op == 7 ? Z80_LAZY_CP : Z80_LAZY_SUB;
+			return op == 7 ? a : lz.r & 0xff;
+		}
+
+		/* records INC or DEC of b keeping carry, returns the result */
+		ZYMOSIS_INLINE static uint8_t Z80_LazyIncDec(Z80LazyFlags& lz, bool dec, uint8_t b, uint8_t carry) {
+			lz.a = b;
+			lz.b = carry;
+			lz.r = (((int)b) + (dec ? -1 : 1)) & 0xff;
+			lz.kind = dec ? Z80_LAZY_DEC : Z80_LAZY_INC;
+			return lz.r;
+		}
+
+		/* works out F when the last ALU operation left it lazy */
+		ZYMOSIS_INLINE void Z80_Flags(Z80State& rs) {
+			if (P::lazyFlags && rs.lazy.kind != Z80_LAZY_NONE) {
+				rs.af.f = Z80_LazyF(rs.lazy);
+				rs.lazy.kind = Z80_LAZY_NONE;
+			}
+		}
+
+		/* just the carry, without working out the rest */
+		ZYMOSIS_INLINE uint8_t Z80_Carry(Z80State& rs) {
+			if (!P::lazyFlags || rs.lazy.kind == Z80_LAZY_NONE) return rs.af.f & Z80_FLAG_C;
+			if (rs.lazy.kind >= Z80_LAZY_INC) return rs.lazy.b;
+			return rs.lazy.r > 0xff ? Z80_FLAG_C : 0;
+		}
+
+		/* resident pc, tstates and af to Z80Info before a callback that may look at them, */
+		/* flags is false for the ones that do not get F worked out */
+		ZYMOSIS_INLINE void Z80_SaveState(Z80State& rs, bool flags = true) {
+			if (flags) Z80_Flags(rs);
+			if (P::resident) {
+				this->pc = rs.pc;
+				this->tstates = rs.tstates;
+				this->af.w = rs.af.w;
+			}
+		}
+
+		/* and back after one that may change them */
+		ZYMOSIS_INLINE void Z80_LoadState(Z80State& rs) {
+			if (P::resident) {
+				rs.pc = this->pc;
+				rs.tstates = this->tstates;
+				rs.af.w = this->af.w;
+			}
+		}
+
+		ZYMOSIS_INLINE bool SET_TRUE_CC(Z80State& rs, uint8_t opcode)
 		{
 			uint8_t op = (opcode >> 3) & 0x07;
 			if (op < 4)
 			{
 				if (op < 2)
 				{
-					if (!op)  return (this->af.f & Z80_FLAG_Z) == 0;
-					return (this->af.f & Z80_FLAG_Z) != 0;
+					if (!op)  return (rs.af.f & Z80_FLAG_Z) == 0;
+					return (rs.af.f & Z80_FLAG_Z) != 0;
 				}
 				else
 				{
-					if (op == 2) return (this->af.f & Z80_FLAG_C) == 0;
-					return (this->af.f & Z80_FLAG_C) != 0;
+					if (op == 2) return (rs.af.f & Z80_FLAG_C) == 0;
+					return (rs.af.f & Z80_FLAG_C) != 0;
 				}
 			}
 			else
 			{
 				if (op < 6)
 				{
-					if (op == 4) return (this->af.f & Z80_FLAG_PV) == 0;
-					return (this->af.f & Z80_FLAG_PV) != 0;
+					if (op == 4) return (rs.af.f & Z80_FLAG_PV) == 0;
+					return (rs.af.f & Z80_FLAG_PV) != 0;
 				}
 				else
 				{
-					if (op == 6) return (this->af.f & Z80_FLAG_S) == 0;
-					return (this->af.f & Z80_FLAG_S) != 0;
+					if (op == 6) return (rs.af.f & Z80_FLAG_S) == 0;
+					return (rs.af.f & Z80_FLAG_S) != 0;
 				}
 			}
 			return false;
@@ -409,94 +673,127 @@ namespace zymosis {
 		/* t1: setting /MREQ & /RD */
 		/* t2: memory read */
 		/* t3, t4: decode command, increment R */
-		ZYMOSIS_INLINE void GET_OPCODE(uint8_t& _opc)
+		ZYMOSIS_INLINE void GET_OPCODE(Z80State& rs, uint8_t& _opc)
 		{
 			do {
-				this->contentionFn(this->pc, 4, static_cast<Z80MemIOType>(Z80_MREQ_READ | Z80_MEMIO_OPCODE));
-				if (this->evenM1 && (this->tstates & 0x01))++this->tstates;
-				(_opc) = this->memReadFn(this->pc, Z80_MEMIO_OPCODE);
-				this->pc = (this->pc + 1) & 0xffff;
-				this->regR = ((this->regR + 1) & 0x7f) | (this->regR & 0x80);
+				Z80_Contention(rs.pc, 4, Z80_MREQ_READ | Z80_MEMIO_OPCODE);
+				if (P::evenM1 && this->evenM1 && (rs.tstates & 0x01))++rs.tstates;
+				(_opc) = this->memReadFn(rs.pc, Z80_MEMIO_OPCODE);
+				rs.pc = (rs.pc + 1) & 0xffff;
+				INC_R;
 			} while (0);
 		}
 
-		ZYMOSIS_INLINE void GET_OPCODE_EXT(uint8_t& _opc) {
+		ZYMOSIS_INLINE void GET_OPCODE_EXT(Z80State& rs, uint8_t& _opc) {
 			do {
-				this->contentionFn(this->pc, 4, static_cast<Z80MemIOType>(Z80_MREQ_READ | Z80_MEMIO_OPCEXT));
-				_opc = this->memReadFn(this->pc, Z80_MEMIO_OPCEXT);
-				this->pc = (this->pc + 1) & 0xffff;
-				this->regR = ((this->regR + 1) & 0x7f) | (this->regR & 0x80);
+				Z80_Contention(rs.pc, 4, Z80_MREQ_READ | Z80_MEMIO_OPCEXT);
+				_opc = this->memReadFn(rs.pc, Z80_MEMIO_OPCEXT);
+				rs.pc = (rs.pc + 1) & 0xffff;
+				INC_R;
 			} while (0);
 		}
 
 		/*  t1: setting /MREQ & /RD */
 		/*  t2: memory read */
 		/*#define Z80_PeekB3T(_z80,_addr)  (Z80_Contention(_(_addr), 3, Z80_MREQ_READ|Z80_MEMIO_DATA), Z80_PeekB(_(_addr))) */
-		ZYMOSIS_INLINE uint8_t Z80_PeekB3T(uint16_t addr) {
+		ZYMOSIS_INLINE uint8_t Z80_PeekB3T(Z80State& rs, uint16_t addr) {
 			Z80_Contention(addr, 3, Z80_MREQ_READ | Z80_MEMIO_DATA);
 			return Z80_PeekB(addr);
 		}
 
-		ZYMOSIS_INLINE uint8_t Z80_PeekB3TA(uint16_t addr) {
+		/* how many of 'count' repeats of a 21 t-state block instruction start before next_event_tstate */
+		ZYMOSIS_INLINE int32_t Z80_BlockIterations(Z80State& rs, int32_t count) {
+			int32_t n;
+			/***/
+			if (rs.tstates >= this->next_event_tstate) return 0;
+			n = (this->next_event_tstate - rs.tstates + 20) / 21;
+			return n < count ? n : count;
+		}
+
+		/* how many of 'count' iterations writing from dst on, one byte apart, come before one */
+		/* that writes over the ED xx at org_pc: every iteration fetches it again, so the bulk */
+		/* run has to stop there, and must not start when the iteration just run wrote over it */
+		ZYMOSIS_INLINE int32_t Z80_BlockWriteLimit(uint16_t dst, int32_t count, bool backward) {
+			uint16_t last, d0, d1;
+			/***/
+			last = backward ? dst + 1 : dst - 1;
+			if ((uint16_t)(last - this->org_pc) < 2) return 0;
+			d0 = backward ? dst - this->org_pc : this->org_pc - dst;
+			d1 = backward ? dst - this->org_pc - 1 : this->org_pc + 1 - dst;
+			if (d1 < d0) d0 = d1;
+			return d0 < count ? d0 : count;
+		}
+
+		ZYMOSIS_INLINE uint8_t Z80_PeekB3TA(Z80State& rs, uint16_t addr) {
 			Z80_Contention(addr, 3, Z80_MREQ_READ | Z80_MEMIO_OPCARG);
+#if defined(ZYMOSIS_BLOCK_CACHE)
+			if (this->cache_op) return this->cache_op->arg[(addr - this->org_pc - 1) & 1];
+#endif
 			return Z80_PeekB(addr);
 		}
 
 		/******************************************************************************/
-		ZYMOSIS_INLINE uint8_t Z80_PortIn(uint16_t port) {
+		ZYMOSIS_INLINE void Z80_PortContention(Z80State& rs, uint16_t port, int _tstates, Z80PIOType pio) {
+			if (P::contention) this->portContentionFn(port, _tstates, pio);
+			else rs.tstates += _tstates;
+		}
+
+		ZYMOSIS_INLINE uint8_t Z80_PortIn(Z80State& rs, uint16_t port) {
 			uint8_t value;
-			this->portContentionFn(port, 1, static_cast<Z80PIOType>(Z80_PIOFLAG_IN | Z80_PIOFLAG_EARLY));
-			this->portContentionFn(port, 2, Z80_PIOFLAG_IN);
+			Z80_PortContention(rs, port, 1, static_cast<Z80PIOType>(Z80_PIOFLAG_IN | Z80_PIOFLAG_EARLY));
+			Z80_PortContention(rs, port, 2, Z80_PIOFLAG_IN);
+			Z80_SaveState(rs);
 			value = this->portInFn(port, Z80_PIO_NORMAL);
-			++this->tstates;
+			++rs.tstates;
 			return value;
 		}
 
 
-		ZYMOSIS_INLINE void Z80_PortOut(uint16_t port, uint8_t value) {
-			this->portContentionFn(port, 1, Z80_PIOFLAG_EARLY);
+		ZYMOSIS_INLINE void Z80_PortOut(Z80State& rs, uint16_t port, uint8_t value) {
+			Z80_PortContention(rs, port, 1, Z80_PIOFLAG_EARLY);
+			Z80_SaveState(rs);
 			this->portOutFn(port, value, Z80_PIO_NORMAL);
-			this->portContentionFn(port, 2, Z80_PIO_NORMAL);
-			++this->tstates;
+			Z80_PortContention(rs, port, 2, Z80_PIO_NORMAL);
+			++rs.tstates;
 		}
 
-		ZYMOSIS_INLINE uint16_t Z80_PeekW6T(uint16_t addr) {
-			uint16_t res = Z80_PeekB3T(addr);
-			return res | (((uint16_t)Z80_PeekB3T((addr + 1) & 0xffff)) << 8);
+		ZYMOSIS_INLINE uint16_t Z80_PeekW6T(Z80State& rs, uint16_t addr) {
+			uint16_t res = Z80_PeekB3T(rs, addr);
+			return res | (((uint16_t)Z80_PeekB3T(rs, (addr + 1) & 0xffff)) << 8);
 		}
 
-		ZYMOSIS_INLINE void Z80_PokeW6T(uint16_t addr, uint16_t value) {
+		ZYMOSIS_INLINE void Z80_PokeW6T(Z80State& rs, uint16_t addr, uint16_t value) {
 			Z80_PokeB3T(addr, value & 0xff);
 			Z80_PokeB3T((addr + 1) & 0xffff, (value >> 8) & 0xff);
 		}
 
-		ZYMOSIS_INLINE void Z80_PokeW6TInv(uint16_t addr, uint16_t value) {
+		ZYMOSIS_INLINE void Z80_PokeW6TInv(Z80State& rs, uint16_t addr, uint16_t value) {
 			Z80_PokeB3T((addr + 1) & 0xffff, (value >> 8) & 0xff);
 			Z80_PokeB3T(addr, value & 0xff);
 		}
 
-		ZYMOSIS_INLINE uint16_t Z80_GetWordPC(int wait1) {
-			uint16_t res = Z80_PeekB3TA(this->pc);
+		ZYMOSIS_INLINE uint16_t Z80_GetWordPC(Z80State& rs, int wait1) {
+			uint16_t res = Z80_PeekB3TA(rs, rs.pc);
 			/***/
-			this->pc = (this->pc + 1) & 0xffff;
-			res |= ((uint16_t)Z80_PeekB3TA(this->pc)) << 8;
+			rs.pc = (rs.pc + 1) & 0xffff;
+			res |= ((uint16_t)Z80_PeekB3TA(rs, rs.pc)) << 8;
 			if (wait1) Z80_ContentionPCBy1(wait1);
-			this->pc = (this->pc + 1) & 0xffff;
+			rs.pc = (rs.pc + 1) & 0xffff;
 			return res;
 		}
 
-		ZYMOSIS_INLINE uint16_t Z80_Pop6T() {
-			uint16_t res = Z80_PeekB3T(this->sp.w);
+		ZYMOSIS_INLINE uint16_t Z80_Pop6T(Z80State& rs) {
+			uint16_t res = Z80_PeekB3T(rs, this->sp.w);
 			/***/
 			this->sp.w = (this->sp.w + 1) & 0xffff;
-			res |= ((uint16_t)Z80_PeekB3T(this->sp.w)) << 8;
+			res |= ((uint16_t)Z80_PeekB3T(rs, this->sp.w)) << 8;
 			this->sp.w = (this->sp.w + 1) & 0xffff;
 			return res;
 		}
 
 		/* 3 T states write high byte of PC to the stack and decrement SP */
 		/* 3 T states write the low byte of PC and jump to #0066 */
-		ZYMOSIS_INLINE void Z80_Push6T(uint16_t value) {
+		ZYMOSIS_INLINE void Z80_Push6T(Z80State& rs, uint16_t value) {
 			this->sp.w = (((int32_t)this->sp.w) - 1) & 0xffff;
 			Z80_PokeB3T(this->sp.w, (value >> 8) & 0xff);
 			this->sp.w = (((int32_t)this->sp.w) - 1) & 0xffff;
@@ -505,44 +802,44 @@ namespace zymosis {
 
 
 		/******************************************************************************/
-		ZYMOSIS_INLINE void Z80_ADC_A(uint8_t b) {
-			uint16_t _new, o = this->af.a;
+		ZYMOSIS_INLINE void Z80_ADC_A(Z80State& rs, uint8_t b) {
+			uint16_t _new, o = rs.af.a;
 			/***/
-			this->af.a = (_new = o + b + (this->af.f & Z80_FLAG_C)) & 0xff; /* Z80_FLAG_C is 0x01, so it's safe */
-			this->af.f =
+			rs.af.a = (_new = o + b + (rs.af.f & Z80_FLAG_C)) & 0xff; /* Z80_FLAG_C is 0x01, so it's safe */
+			rs.af.f =
 				(SZ53PTAB(_new & 0xff) & ~Z80_FLAG_PV) |
 				(_new > 0xff ? Z80_FLAG_C : 0) |
 				((o ^ (~b)) & (o ^ _new) & 0x80 ? Z80_FLAG_PV : 0) |
-				((o & 0x0f) + (b & 0x0f) + (this->af.f & Z80_FLAG_C) >= 0x10 ? Z80_FLAG_H : 0);
+				((o & 0x0f) + (b & 0x0f) + (rs.af.f & Z80_FLAG_C) >= 0x10 ? Z80_FLAG_H : 0);
 		}
 
-		ZYMOSIS_INLINE void Z80_SBC_A(uint8_t b) {
-			uint16_t _new, o = this->af.a;
+		ZYMOSIS_INLINE void Z80_SBC_A(Z80State& rs, uint8_t b) {
+			uint16_t _new, o = rs.af.a;
 			/***/
-			this->af.a = (_new = ((int32_t)o - (int32_t)b - (int32_t)(this->af.f & Z80_FLAG_C)) & 0xffff) & 0xff; /* Z80_FLAG_C is 0x01, so it's safe */
-			this->af.f =
+			rs.af.a = (_new = ((int32_t)o - (int32_t)b - (int32_t)(rs.af.f & Z80_FLAG_C)) & 0xffff) & 0xff; /* Z80_FLAG_C is 0x01, so it's safe */
+			rs.af.f =
 				Z80_FLAG_N |
 				(SZ53PTAB(_new & 0xff) & ~Z80_FLAG_PV) |
 				(_new > 0xff ? Z80_FLAG_C : 0) |
 				((o ^ b) & (o ^ _new) & 0x80 ? Z80_FLAG_PV : 0) |
-				((int32_t)(o & 0x0f) - (int32_t)(b & 0x0f) - (int32_t)(this->af.f & Z80_FLAG_C) < 0 ? Z80_FLAG_H : 0);
+				((int32_t)(o & 0x0f) - (int32_t)(b & 0x0f) - (int32_t)(rs.af.f & Z80_FLAG_C) < 0 ? Z80_FLAG_H : 0);
 		}
 
 
-		ZYMOSIS_INLINE void Z80_ADD_A(uint8_t b) {
-			this->af.f &= ~Z80_FLAG_C;
-			Z80_ADC_A(b);
+		ZYMOSIS_INLINE void Z80_ADD_A(Z80State& rs, uint8_t b) {
+			rs.af.f &= ~Z80_FLAG_C;
+			Z80_ADC_A(rs, b);
 		}
 
-		ZYMOSIS_INLINE void Z80_SUB_A(uint8_t b) {
-			this->af.f &= ~Z80_FLAG_C;
-			Z80_SBC_A(b);
+		ZYMOSIS_INLINE void Z80_SUB_A(Z80State& rs, uint8_t b) {
+			rs.af.f &= ~Z80_FLAG_C;
+			Z80_SBC_A(rs, b);
 		}
 
-		ZYMOSIS_INLINE void Z80_CP_A(uint8_t b) {
-			uint8_t o = this->af.a, _new = ((int32_t)o - (int32_t)b) & 0xff;
+		ZYMOSIS_INLINE void Z80_CP_A(Z80State& rs, uint8_t b) {
+			uint8_t o = rs.af.a, _new = ((int32_t)o - (int32_t)b) & 0xff;
 			/***/
-			this->af.f =
+			rs.af.f =
 				Z80_FLAG_N |
 				(_new & Z80_FLAG_S) |
 				(b & Z80_FLAG_35) |
@@ -552,144 +849,176 @@ namespace zymosis {
 				((int32_t)(o & 0x0f) - (int32_t)(b & 0x0f) < 0 ? Z80_FLAG_H : 0);
 		}
 
+		/* ALU A,b of the main table, op is bits 3-5 of the opcode */
+		ZYMOSIS_INLINE void Z80_ALU_A(Z80State& rs, uint8_t op, uint8_t b) {
+			uint8_t o = rs.af.a;
+			/***/
+			if (P::lazyFlags && (op < 4 || op == 7)) {
+				rs.af.a = Z80_LazyALU(rs.lazy, op, o, b, (op == 1 || op == 3) ? Z80_Carry(rs) : 0);
+				return;
+			}
+			/* AND, XOR and OR set all of F */
+			if (P::lazyFlags) rs.lazy.kind = Z80_LAZY_NONE;
+			switch (op) {
+			case 0: Z80_ADD_A(rs, b); break;
+			case 1: Z80_ADC_A(rs, b); break;
+			case 2: Z80_SUB_A(rs, b); break;
+			case 3: Z80_SBC_A(rs, b); break;
+			case 4: Z80_AND_A(b); break;
+			case 5: Z80_XOR_A(b); break;
+			case 6: Z80_OR_A(b); break;
+			case 7: Z80_CP_A(rs, b); break;
+			}
+		}
+
 		/* carry unchanged */
-		ZYMOSIS_INLINE uint8_t Z80_DEC8(uint8_t b) {
-			this->af.f &= Z80_FLAG_C;
-			this->af.f |= Z80_FLAG_N |
+		ZYMOSIS_INLINE uint8_t Z80_DEC8(Z80State& rs, uint8_t b) {
+			if (P::lazyFlags) return Z80_LazyIncDec(rs.lazy, true, b, Z80_Carry(rs));
+#if defined(ZYMOSIS_FLAGS_IN_TABLES)
+			rs.af.f = (rs.af.f & Z80_FLAG_C) | decTable[b];
+#else
+			rs.af.f &= Z80_FLAG_C;
+			rs.af.f |= Z80_FLAG_N |
 				(b == 0x80 ? Z80_FLAG_PV : 0) |
 				(b & 0x0f ? 0 : Z80_FLAG_H) |
 				(SZ53PTAB((((int)b) - 1) & 0xff) & ~Z80_FLAG_PV);
+#endif
 			return (((int)b) - 1) & 0xff;
 		}
 
 		/* carry unchanged */
-		ZYMOSIS_INLINE uint8_t Z80_INC8(uint8_t b) {
-			this->af.f &= Z80_FLAG_C;
-			this->af.f |=
+		ZYMOSIS_INLINE uint8_t Z80_INC8(Z80State& rs, uint8_t b) {
+			if (P::lazyFlags) return Z80_LazyIncDec(rs.lazy, false, b, Z80_Carry(rs));
+#if defined(ZYMOSIS_FLAGS_IN_TABLES)
+			rs.af.f = (rs.af.f & Z80_FLAG_C) | incTable[b];
+#else
+			rs.af.f &= Z80_FLAG_C;
+			rs.af.f |=
 				(b == 0x7f ? Z80_FLAG_PV : 0) |
 				((b + 1) & 0x0f ? 0 : Z80_FLAG_H) |
 				(SZ53PTAB((b + 1) & 0xff) & ~Z80_FLAG_PV);
+#endif
 			return ((b + 1) & 0xff);
 		}
 
 
 		/* cyclic, carry reflects shifted bit */
-		ZYMOSIS_INLINE void Z80_RLCA() {
-			uint8_t c = ((this->af.a >> 7) & 0x01);
+		ZYMOSIS_INLINE void Z80_RLCA(Z80State& rs) {
+			uint8_t c = ((rs.af.a >> 7) & 0x01);
 			/***/
-			this->af.a = (this->af.a << 1) | c;
-			this->af.f = c | (this->af.a & Z80_FLAG_35) | (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
+			rs.af.a = (rs.af.a << 1) | c;
+			rs.af.f = c | (rs.af.a & Z80_FLAG_35) | (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
 		}
 
 		/* cyclic, carry reflects shifted bit */
-		ZYMOSIS_INLINE void Z80_RRCA() {
-			uint8_t c = (this->af.a & 0x01);
+		ZYMOSIS_INLINE void Z80_RRCA(Z80State& rs) {
+			uint8_t c = (rs.af.a & 0x01);
 			/***/
-			this->af.a = (this->af.a >> 1) | (c << 7);
-			this->af.f = c | (this->af.a & Z80_FLAG_35) | (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
+			rs.af.a = (rs.af.a >> 1) | (c << 7);
+			rs.af.f = c | (rs.af.a & Z80_FLAG_35) | (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
 		}
 
 
 		/* cyclic thru carry */
-		ZYMOSIS_INLINE void Z80_RLA() {
-			uint8_t c = ((this->af.a >> 7) & 0x01);
+		ZYMOSIS_INLINE void Z80_RLA(Z80State& rs) {
+			uint8_t c = ((rs.af.a >> 7) & 0x01);
 			/***/
-			this->af.a = (this->af.a << 1) | (this->af.f & Z80_FLAG_C);
-			this->af.f = c | (this->af.a & Z80_FLAG_35) | (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
+			rs.af.a = (rs.af.a << 1) | (rs.af.f & Z80_FLAG_C);
+			rs.af.f = c | (rs.af.a & Z80_FLAG_35) | (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
 		}
 
 		/* cyclic thru carry */
-		ZYMOSIS_INLINE void Z80_RRA() {
-			uint8_t c = (this->af.a & 0x01);
+		ZYMOSIS_INLINE void Z80_RRA(Z80State& rs) {
+			uint8_t c = (rs.af.a & 0x01);
 			/***/
-			this->af.a = (this->af.a >> 1) | ((this->af.f & Z80_FLAG_C) << 7);
-			this->af.f = c | (this->af.a & Z80_FLAG_35) | (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
+			rs.af.a = (rs.af.a >> 1) | ((rs.af.f & Z80_FLAG_C) << 7);
+			rs.af.f = c | (rs.af.a & Z80_FLAG_35) | (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
 		}
 
 		/* cyclic thru carry */
-		ZYMOSIS_INLINE uint8_t Z80_RL(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_RL(Z80State& rs, uint8_t b) {
 			uint8_t c = (b >> 7)& Z80_FLAG_C;
 			/***/
-			this->af.f = SZ53PTAB((b = ((b << 1) & 0xff) | (this->af.f & Z80_FLAG_C))) | c;
+			rs.af.f = SZ53PTAB((b = ((b << 1) & 0xff) | (rs.af.f & Z80_FLAG_C))) | c;
 			return b;
 		}
 
 
-		ZYMOSIS_INLINE uint8_t Z80_RR(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_RR(Z80State& rs, uint8_t b) {
 			uint8_t c = (b & 0x01);
 			/***/
-			this->af.f = SZ53PTAB((b = (b >> 1) | ((this->af.f & Z80_FLAG_C) << 7))) | c;
+			rs.af.f = SZ53PTAB((b = (b >> 1) | ((rs.af.f & Z80_FLAG_C) << 7))) | c;
 			return b;
 		}
 
 		/* cyclic, carry reflects shifted bit */
-		ZYMOSIS_INLINE uint8_t Z80_RLC(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_RLC(Z80State& rs, uint8_t b) {
 			uint8_t c = ((b >> 7)& Z80_FLAG_C);
 			/***/
-			this->af.f = SZ53PTAB((b = ((b << 1) & 0xff) | c)) | c;
+			rs.af.f = SZ53PTAB((b = ((b << 1) & 0xff) | c)) | c;
 			return b;
 		}
 
 		/* cyclic, carry reflects shifted bit */
-		ZYMOSIS_INLINE uint8_t Z80_RRC(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_RRC(Z80State& rs, uint8_t b) {
 			uint8_t c = (b & 0x01);
 			/***/
-			this->af.f = SZ53PTAB((b = (b >> 1) | (c << 7))) | c;
+			rs.af.f = SZ53PTAB((b = (b >> 1) | (c << 7))) | c;
 			return b;
 		}
 
-		ZYMOSIS_INLINE uint8_t Z80_SLA(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_SLA(Z80State& rs, uint8_t b) {
 			uint8_t c = ((b >> 7) & 0x01);
 			/***/
 			b <<= 1;
-			this->af.f = SZ53PTAB(b) | c;
+			rs.af.f = SZ53PTAB(b) | c;
 			return b;
 		}
 
-		ZYMOSIS_INLINE uint8_t Z80_SRA(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_SRA(Z80State& rs, uint8_t b) {
 			uint8_t c = (b & 0x01);
 			/***/
-			this->af.f = SZ53PTAB((b = (b >> 1) | (b & 0x80))) | c;
+			rs.af.f = SZ53PTAB((b = (b >> 1) | (b & 0x80))) | c;
 			return b;
 		}
 
-		ZYMOSIS_INLINE uint8_t Z80_SLL(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_SLL(Z80State& rs, uint8_t b) {
 			uint8_t c = ((b >> 7) & 0x01);
 			/***/
-			this->af.f = SZ53PTAB((b = (b << 1) | 0x01)) | c;
+			rs.af.f = SZ53PTAB((b = (b << 1) | 0x01)) | c;
 			return b;
 		}
 
-		ZYMOSIS_INLINE uint8_t Z80_SLR(uint8_t b) {
+		ZYMOSIS_INLINE uint8_t Z80_SLR(Z80State& rs, uint8_t b) {
 			uint8_t c = (b & 0x01);
 			/***/
-			this->af.f = SZ53PTAB((b >>= 1)) | c;
+			rs.af.f = SZ53PTAB((b >>= 1)) | c;
 			return b;
 		}
 
 
 		/* ddvalue+value */
-		ZYMOSIS_INLINE uint16_t Z80_ADD_DD(uint16_t value, uint16_t ddvalue) {
+		ZYMOSIS_INLINE uint16_t Z80_ADD_DD(Z80State& rs, uint16_t value, uint16_t ddvalue) {
 			//static const uint8_t hct[8] = { 0, Z80_FLAG_H, Z80_FLAG_H, Z80_FLAG_H, 0, 0, 0, Z80_FLAG_H };
 			uint32_t res = (uint32_t)value + (uint32_t)ddvalue;
 			uint8_t b = (((value & 0x0FFF) + (ddvalue & 0x0FFF)) >> 8) & 0x10;
 			/***/
-			this->memptr.w = (ddvalue + 1) & 0xffff;
-			this->af.f =
-				(this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) |
+			Z80_MEMPTR((ddvalue + 1) & 0xffff);
+			rs.af.f =
+				(rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) |
 				(res > 0xffff ? Z80_FLAG_C : 0) |
 				((res >> 8)& Z80_FLAG_35) | b;
 			return res;
 		}
 
 		/* ddvalue+value */
-		ZYMOSIS_INLINE uint16_t Z80_ADC_DD(uint16_t value, uint16_t ddvalue) {
-			uint8_t c = (this->af.f & Z80_FLAG_C);
+		ZYMOSIS_INLINE uint16_t Z80_ADC_DD(Z80State& rs, uint16_t value, uint16_t ddvalue) {
+			uint8_t c = (rs.af.f & Z80_FLAG_C);
 			uint32_t _new = (uint32_t)value + (uint32_t)ddvalue + (uint32_t)c;
 			uint16_t res = (_new & 0xffff);
 			/***/
-			this->memptr.w = (ddvalue + 1) & 0xffff;
-			this->af.f =
+			Z80_MEMPTR((ddvalue + 1) & 0xffff);
+			rs.af.f =
 				((res >> 8)& Z80_FLAG_S35) |
 				(res == 0 ? Z80_FLAG_Z : 0) |
 				(_new > 0xffff ? Z80_FLAG_C : 0) |
@@ -699,885 +1028,1369 @@ namespace zymosis {
 		}
 
 		/* ddvalue-value */
-		ZYMOSIS_INLINE uint16_t Z80_SBC_DD(uint16_t value, uint16_t ddvalue) {
+		ZYMOSIS_INLINE uint16_t Z80_SBC_DD(Z80State& rs, uint16_t value, uint16_t ddvalue) {
 			uint16_t res;
-			uint8_t tmpB = this->af.a;
+			uint8_t tmpB = rs.af.a;
 			/***/
-			this->memptr.w = (ddvalue + 1) & 0xffff;
-			this->af.a = ddvalue & 0xff;
-			Z80_SBC_A(value & 0xff);
-			res = this->af.a;
-			this->af.a = (ddvalue >> 8) & 0xff;
-			Z80_SBC_A((value >> 8) & 0xff);
-			res |= (this->af.a << 8);
-			this->af.a = tmpB;
-			this->af.f = (res ? this->af.f & (~Z80_FLAG_Z) : this->af.f | Z80_FLAG_Z);
+			Z80_MEMPTR((ddvalue + 1) & 0xffff);
+			rs.af.a = ddvalue & 0xff;
+			Z80_SBC_A(rs, value & 0xff);
+			res = rs.af.a;
+			rs.af.a = (ddvalue >> 8) & 0xff;
+			Z80_SBC_A(rs, (value >> 8) & 0xff);
+			res |= (rs.af.a << 8);
+			rs.af.a = tmpB;
+			rs.af.f = (res ? rs.af.f & (~Z80_FLAG_Z) : rs.af.f | Z80_FLAG_Z);
 			return res;
 		}
 
 
-		ZYMOSIS_INLINE void Z80_BIT(uint8_t bit, uint8_t num, int mptr) {
-			this->af.f =
+		ZYMOSIS_INLINE void Z80_BIT(Z80State& rs, uint8_t bit, uint8_t num, int mptr) {
+			rs.af.f =
 				Z80_FLAG_H |
-				(this->af.f & Z80_FLAG_C) |
+				(rs.af.f & Z80_FLAG_C) |
 				(num & Z80_FLAG_35) |
 				(num & (1 << bit) ? 0 : Z80_FLAG_PV | Z80_FLAG_Z) |
 				(bit == 7 ? num & Z80_FLAG_S : 0);
-			if (mptr) this->af.f = (this->af.f & ~Z80_FLAG_35) | (this->memptr.h & Z80_FLAG_35);
+			if (mptr) rs.af.f = (rs.af.f & ~Z80_FLAG_35) | (this->memptr.h & Z80_FLAG_35);
 		}
 
 
-		ZYMOSIS_INLINE void Z80_DAA() {
-			uint8_t tmpI = 0, tmpC = (this->af.f & Z80_FLAG_C), tmpA = this->af.a;
+		ZYMOSIS_INLINE void Z80_DAA(Z80State& rs) {
+#if defined(ZYMOSIS_FLAGS_IN_TABLES)
+			rs.af.w = pgm_read_word(&daaTable[rs.af.a | (rs.af.f & Z80_FLAG_C) << 8 | (rs.af.f & Z80_FLAG_H) << 5 | (rs.af.f & Z80_FLAG_N) << 9]);
+#else
+			Z80_DAAByOps(rs);
+#endif
+		}
+
+		/* DAA as the ADD or SUB of its correction, daaTable is checked against it */
+		ZYMOSIS_INLINE void Z80_DAAByOps(Z80State& rs) {
+			uint8_t tmpI = 0, tmpC = (rs.af.f & Z80_FLAG_C), tmpA = rs.af.a;
 			/***/
-			if ((this->af.f & Z80_FLAG_H) || (tmpA & 0x0f) > 9) tmpI = 6;
+			if ((rs.af.f & Z80_FLAG_H) || (tmpA & 0x0f) > 9) tmpI = 6;
 			if (tmpC != 0 || tmpA > 0x99) tmpI |= 0x60;
 			if (tmpA > 0x99) tmpC = Z80_FLAG_C;
-			if (this->af.f & Z80_FLAG_N) Z80_SUB_A(tmpI); else Z80_ADD_A(tmpI);
-			this->af.f = (this->af.f & ~(Z80_FLAG_C | Z80_FLAG_PV)) | tmpC | (SZ53PTAB(this->af.a) & Z80_FLAG_PV);
+			if (rs.af.f & Z80_FLAG_N) Z80_SUB_A(rs, tmpI); else Z80_ADD_A(rs, tmpI);
+			rs.af.f = (rs.af.f & ~(Z80_FLAG_C | Z80_FLAG_PV)) | tmpC | (SZ53PTAB(rs.af.a) & Z80_FLAG_PV);
 		}
 
 
-		ZYMOSIS_INLINE void Z80_RRD_A() {
-			uint8_t tmpB = Z80_PeekB3T(this->hl.w);
+		ZYMOSIS_INLINE void Z80_RRD_A(Z80State& rs) {
+			uint8_t tmpB = Z80_PeekB3T(rs, this->hl.w);
 			/*IOP(4)*/
-			this->memptr.w = (this->hl.w + 1) & 0xffff;
+			Z80_MEMPTR((this->hl.w + 1) & 0xffff);
 			Z80_ContentionBy1(this->hl.w, 4);
-			Z80_PokeB3T(this->hl.w, (this->af.a << 4) | (tmpB >> 4));
-			this->af.a = (this->af.a & 0xf0) | (tmpB & 0x0f);
-			this->af.f = (this->af.f & Z80_FLAG_C) | SZ53PTAB(this->af.a);
+			Z80_PokeB3T(this->hl.w, (rs.af.a << 4) | (tmpB >> 4));
+			rs.af.a = (rs.af.a & 0xf0) | (tmpB & 0x0f);
+			rs.af.f = (rs.af.f & Z80_FLAG_C) | SZ53PTAB(rs.af.a);
 		}
 
-		ZYMOSIS_INLINE void Z80_RLD_A() {
-			uint8_t tmpB = Z80_PeekB3T(this->hl.w);
+		ZYMOSIS_INLINE void Z80_RLD_A(Z80State& rs) {
+			uint8_t tmpB = Z80_PeekB3T(rs, this->hl.w);
 			/*IOP(4)*/
-			this->memptr.w = (this->hl.w + 1) & 0xffff;
+			Z80_MEMPTR((this->hl.w + 1) & 0xffff);
 			Z80_ContentionBy1(this->hl.w, 4);
-			Z80_PokeB3T(this->hl.w, (tmpB << 4) | (this->af.a & 0x0f));
-			this->af.a = (this->af.a & 0xf0) | (tmpB >> 4);
-			this->af.f = (this->af.f & Z80_FLAG_C) | SZ53PTAB(this->af.a);
+			Z80_PokeB3T(this->hl.w, (tmpB << 4) | (rs.af.a & 0x0f));
+			rs.af.a = (rs.af.a & 0xf0) | (tmpB >> 4);
+			rs.af.f = (rs.af.f & Z80_FLAG_C) | SZ53PTAB(rs.af.a);
 		}
 
 
-		ZYMOSIS_INLINE void Z80_LD_A_IR(uint8_t ir) {
-			this->af.a = ir;
+		ZYMOSIS_INLINE void Z80_LD_A_IR(Z80State& rs, uint8_t ir) {
+			rs.af.a = ir;
 			this->prev_was_EIDDR = -1;
 			Z80_ContentionIRBy1(1);
-			this->af.f = (SZ53PTAB(this->af.a) & ~Z80_FLAG_PV) | (this->af.f & Z80_FLAG_C) | (this->iff2 ? Z80_FLAG_PV : 0);
+			rs.af.f = (SZ53PTAB(rs.af.a) & ~Z80_FLAG_PV) | (rs.af.f & Z80_FLAG_C) | (this->iff2 ? Z80_FLAG_PV : 0);
 		}
 
 
-	public:
-		Z80Cpu()
-		{
-#if defined(ZYMOSIS_FLAGS_IN_ARRAY)
-			Z80_InitTables();
+#if defined(ZYMOSIS_BLOCK_CACHE)
+		/* Decoded block cache */
+		/* Runs of unprefixed instructions are kept decoded, keyed by the PC they start at, so the */
+		/* opcode and operand bytes are not fetched through memReadFn again. A block ends after a */
+		/* jump, call, return or HALT, or before a prefixed instruction, which is interpreted as */
+		/* usual. The opcode still goes through the main switch and every fetch still does its */
+		/* contention, R and evenM1 work, so timing is the same. A block is dropped when the write */
+		/* generation of one of its pages changes, sets of 4 blocks are evicted least recent first. */
+#ifndef ZYMOSIS_BLOCK_CACHE_BLOCKS
+#define ZYMOSIS_BLOCK_CACHE_BLOCKS 64 /* a multiple of 4 and a power of two */
 #endif
+#ifndef ZYMOSIS_BLOCK_CACHE_OPS
+#define ZYMOSIS_BLOCK_CACHE_OPS 16 /* instructions per block */
+#endif
+		static constexpr uint16_t CACHE_WAYS = 4;
+		static constexpr uint16_t CACHE_SETS = ZYMOSIS_BLOCK_CACHE_BLOCKS / CACHE_WAYS;
+		static_assert(CACHE_SETS && !(CACHE_SETS & (CACHE_SETS - 1)), "ZYMOSIS_BLOCK_CACHE_BLOCKS must be 4 times a power of two");
+
+		struct Z80CachedOp {
+			uint8_t opcode;
+			uint8_t arg[2];
+			uint8_t len;
+		};
+
+		struct Z80Block {
+			uint32_t stamp; /* last use, 0 for an empty block */
+			uint16_t pc;
+			uint16_t gen[2]; /* write generations of the first and the last page */
+			uint8_t page[2];
+			uint8_t count; /* 0 when the first instruction is not cacheable */
+			Z80CachedOp op[ZYMOSIS_BLOCK_CACHE_OPS];
+		};
+
+		Z80Block cache[ZYMOSIS_BLOCK_CACHE_BLOCKS];
+		Z80Block* cache_block; /* block being run */
+		const Z80CachedOp* cache_op; /* instruction being run from the cache, nullptr when fetched */
+		uint16_t cache_pc; /* address of the next instruction of cache_block */
+		uint8_t cache_pos;
+		uint32_t cache_clock;
+
+		ZYMOSIS_INLINE static uint8_t Z80_OpLength(uint8_t op)
+		{
+			if ((op & 0xc7) == 0x06 || (op & 0xc7) == 0xc6 || (op & 0xe7) == 0x20 || (op & 0xf7) == 0x10 || op == 0xd3 || op == 0xdb) return 2;
+			if ((op & 0xcf) == 0x01 || (op & 0xe7) == 0x22 || (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || op == 0xc3 || op == 0xcd) return 3;
+			return 1;
 		}
 
-		void Z80_Reset()
+		/* JR, DJNZ, JP, CALL, RET, RST, JP (HL) and HALT */
+		ZYMOSIS_INLINE static bool Z80_OpEndsBlock(uint8_t op)
 		{
-			this->reset();
+			if ((op & 0xe7) == 0x20 || (op & 0xf7) == 0x10 || op == 0x76) return true;
+			if ((op & 0xc0) != 0xc0) return false;
+			return (op & 0x07) == 0x00 || (op & 0x07) == 0x02 || (op & 0x07) == 0x04 || (op & 0x07) == 0x07 || op == 0xc3 || op == 0xc9 || op == 0xcd || op == 0xe9;
+		}
 
-			this->bc.w = this->de.w = this->hl.w = this->af.w = this->sp.w = this->ix.w = this->iy.w = 0;
-			this->bcx.w = this->dex.w = this->hlx.w = this->afx.w = 0;
-			this->pc = /* this->prev_pc =*/ this->org_pc = 0;
-			this->memptr.w = 0;
-			this->regI = this->regR = 0;
-			this->iff1 = this->iff2 = false;
-			this->im = 0;
-			this->halted = false;
-			this->prev_was_EIDDR = 0;
-			this->tstates = 0;
-			this->dd = &this->hl;
+		ZYMOSIS_INLINE bool Z80_CacheValid(const Z80Block* b)
+		{
+			return this->code_gen[b->page[0]] == b->gen[0] && this->code_gen[b->page[1]] == b->gen[1];
+		}
 
-			this->evenM1 = false;
+		void Z80_CacheTranslate(Z80Block* b, uint16_t pc)
+		{
+			uint16_t addr = pc;
+			uint8_t op, len;
+			/***/
+			b->pc = pc;
+			b->count = 0;
+			b->page[0] = b->page[1] = pc >> 8;
+			while (b->count < ZYMOSIS_BLOCK_CACHE_OPS) {
+				op = this->memReadFn(addr, Z80_MEMIO_OTHER);
+				if (op == 0xcb || op == 0xdd || op == 0xed || op == 0xfd) break;
+				len = Z80_OpLength(op);
+				/* two pages at most, so two generations cover the block */
+				if ((uint8_t)(((addr + len - 1) & 0xffff) >> 8) != b->page[0] && (uint8_t)(((addr + len - 1) & 0xffff) >> 8) != (uint8_t)(b->page[0] + 1)) break;
+				b->op[b->count].opcode = op;
+				b->op[b->count].arg[0] = len > 1 ? this->memReadFn((addr + 1) & 0xffff, Z80_MEMIO_OTHER) : 0;
+				b->op[b->count].arg[1] = len > 2 ? this->memReadFn((addr + 2) & 0xffff, Z80_MEMIO_OTHER) : 0;
+				b->op[b->count].len = len;
+				++b->count;
+				b->page[1] = ((addr + len - 1) & 0xffff) >> 8;
+				addr = (addr + len) & 0xffff;
+				if (Z80_OpEndsBlock(op)) break;
+			}
+			b->gen[0] = this->code_gen[b->page[0]];
+			b->gen[1] = this->code_gen[b->page[1]];
+		}
+
+		void Z80_CacheFlush()
+		{
+			uint16_t i;
+			/***/
+			for (i = 0; i < ZYMOSIS_BLOCK_CACHE_BLOCKS; ++i) this->cache[i].stamp = 0;
+			this->cache_block = nullptr;
+			this->cache_op = nullptr;
+			this->cache_clock = 0;
+			this->code_flush = false;
+		}
+
+		/* finds the block starting at pc, translates it when it is missing or stale */
+		Z80Block* Z80_CacheLookup(uint16_t pc)
+		{
+			Z80Block* set = &this->cache[((pc ^ (pc >> 7)) & (CACHE_SETS - 1)) * CACHE_WAYS];
+			Z80Block* victim = set;
+			uint16_t i;
+			/***/
+			if (!++this->cache_clock) { Z80_CacheFlush(); this->cache_clock = 1; }
+			this->cache_pos = 0;
+			for (i = 0; i < CACHE_WAYS; ++i) {
+				if (set[i].stamp && set[i].pc == pc) {
+					set[i].stamp = this->cache_clock;
+					if (!Z80_CacheValid(&set[i])) {
+						++this->cache_stats.invalidations;
+						Z80_CacheTranslate(&set[i], pc);
+					}
+					return &set[i];
+				}
+				if (set[i].stamp < victim->stamp) victim = &set[i];
+			}
+			if (victim->stamp) ++this->cache_stats.evictions;
+			++this->cache_stats.misses;
+			Z80_CacheTranslate(victim, pc);
+			victim->stamp = this->cache_clock;
+			return victim;
 		}
-		void Z80_Execute()
+
+		/* the next instruction from the cache, nullptr when it has to be fetched */
+		ZYMOSIS_INLINE const Z80CachedOp* Z80_CacheFetch(Z80State& rs)
+		{
+			Z80Block* b = this->cache_block;
+			const Z80CachedOp* op;
+			/***/
+			if (this->code_flush) { Z80_CacheFlush(); b = nullptr; }
+			if (!b || rs.pc != this->cache_pc || this->cache_pos >= b->count || !Z80_CacheValid(b)) {
+				b = Z80_CacheLookup(rs.pc);
+			}
+			if (this->cache_pos >= b->count) {
+				++this->cache_stats.bypasses;
+				this->cache_block = nullptr;
+				return nullptr;
+			}
+			op = &b->op[this->cache_pos++];
+			this->cache_block = b;
+			this->cache_pc = (rs.pc + op->len) & 0xffff;
+			++this->cache_stats.hits;
+			return op;
+		}
+
+	public:
+		struct Z80CacheStats {
+			uint32_t hits; /* instructions run from the cache */
+			uint32_t bypasses; /* instructions that could not be cached */
+			uint32_t misses; /* blocks translated */
+			uint32_t evictions; /* blocks dropped for a new one */
+			uint32_t invalidations; /* blocks translated again after a write */
+		};
+
+		Z80CacheStats cache_stats;
+
+		void Z80_CacheReset()
 		{
+			uint16_t i;
+			/***/
+			for (i = 0; i < 256; ++i) this->code_gen[i] = 0;
+			Z80_CacheFlush();
+			this->cache_stats = Z80CacheStats();
+		}
+#endif
+
+		/* fetches the next instruction as the main loop would when it is op and starts before */
+		/* the event, otherwise leaves it to the loop */
+		ZYMOSIS_INLINE bool Z80_FuseNext(Z80State& rs, uint8_t op) {
 			uint8_t opcode;
-			bool gotDD, trueCC; /* booleans */
+			/***/
+			if (rs.tstates >= this->next_event_tstate || Z80_PeekBI(rs.pc) != op) return false;
+			this->org_pc = rs.pc;
+#if defined(ZYMOSIS_BLOCK_CACHE)
+			this->cache_op = nullptr;
+#endif
+			GET_OPCODE(rs, opcode);
+			return true;
+		}
+
+		/* runs opcode, already fetched without prefix, and the instructions that usually follow */
+		/* it; false when opcode does not start a fused sequence */
+		ZYMOSIS_INLINE bool Z80_Fused(Z80State& rs, uint8_t opcode) {
+			int32_t n;
 			int disp;
-			uint8_t tmpB, tmpC, rsrc, rdst;
+			/***/
+			switch (opcode) {
+				/* LD A,(HL) ; INC HL */
+			case 0x7e:
+				rs.af.a = Z80_PeekB3T(rs, this->hl.w);
+				if (!Z80_FuseNext(rs, 0x23)) return true;
+				/*OCR(6)*/
+				Z80_ContentionIRBy1(2);
+				INC_W(this->hl.w);
+				++this->fusion_stats.ldInc;
+				return true;
+				/* LD (DE),A ; INC DE */
+			case 0x12:
+				Z80_PokeB3T(this->de.w, rs.af.a);
+				Z80_MEMPTR_LH((this->de.e + 1) & 0xff, rs.af.a);
+				if (!Z80_FuseNext(rs, 0x13)) return true;
+				/*OCR(6)*/
+				Z80_ContentionIRBy1(2);
+				INC_W(this->de.w);
+				++this->fusion_stats.stInc;
+				return true;
+				/* DEC BC ; LD A,B ; OR C ; JR NZ,d */
+			case 0x0b:
+				/*OCR(6)*/
+				Z80_ContentionIRBy1(2);
+				DEC_W(this->bc.w);
+				if (!Z80_FuseNext(rs, 0x78)) return true;
+				rs.af.a = this->bc.b;
+				if (!Z80_FuseNext(rs, 0xb1)) return true;
+				Z80_ALU_A(rs, 6, this->bc.c);
+				if (!Z80_FuseNext(rs, 0x20)) return true;
+				disp = Z80_PeekB3TA(rs, rs.pc);
+				if (this->bc.w != 0) {
+					/*IOP(5)*/
+					if (disp > 127) disp -= 256;
+					Z80_ContentionPCBy1(5);
+					INC_PC;
+					ZADD_W(rs.pc, disp);
+					Z80_MEMPTR(rs.pc);
+				}
+				else {
+					INC_PC;
+				}
+				++this->fusion_stats.decJr;
+				return true;
+				/* DJNZ d, the taken passes of DJNZ $ that start before the event run at once */
+			case 0x10:
+				/*OCR(5)*/
+				Z80_ContentionIRBy1(1);
+				DEC_B(this->bc.b);
+				disp = Z80_PeekB3TA(rs, rs.pc);
+				if (this->bc.b == 0) { INC_PC; return true; }
+				/*IOP(5)*/
+				if (disp > 127) disp -= 256;
+				Z80_ContentionPCBy1(5);
+				INC_PC;
+				ZADD_W(rs.pc, disp);
+				Z80_MEMPTR(rs.pc);
+				/* the last pass falls through and is left to the main loop */
+				if (rs.pc == this->org_pc && this->bc.b > 1 && rs.tstates < this->next_event_tstate && !(P::evenM1 && this->evenM1)) {
+					n = (this->next_event_tstate - rs.tstates + 12) / 13;
+					if (n > this->bc.b - 1) n = this->bc.b - 1;
+					rs.tstates += n * 13;
+					ADD_R(n);
+					this->bc.b -= n;
+					this->fusion_stats.djnz += n;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		/* HL, IX or IY as picked by Z80_ExecuteOp() */
+		template<uint8_t DD> ZYMOSIS_INLINE Z80WordReg& Z80_IndexReg() {
+			return DD == 0 ? this->hl : (DD == 1 ? this->ix : this->iy);
+		}
+
+		/* everything but ED, unprefixed (DD 0), after DD (1) or after FD (2) with disp read */
+		/* already when the instruction has (IX+d); one copy each so HL does not go through */
+		/* a pointer and the index checks are decided at compile time */
+		template<uint8_t DD> ZYMOSIS_INLINE void Z80_ExecuteOp(Z80State& rs, uint8_t opcode, int disp) {
+			constexpr bool gotDD = DD != 0;
+			Z80WordReg& dd = Z80_IndexReg<DD>();
+			bool trueCC;
+			uint8_t tmpB, rsrc, rdst;
 			uint16_t tmpW = 0; /* shut up the compiler; it's wrong but stubborn */
 			/***/
-			while (this->tstates < this->next_event_tstate) {
-				this->pagerFn();
-				if (this->checkBPFn()) return;
-				//this->prev_pc = this->org_pc; 
-				this->org_pc = this->pc;
+			if (opcode == 0xcb) {
+				/* shifts and bit operations */
 				/* read opcode -- OCR(4) */
-				GET_OPCODE(opcode);
-				this->prev_was_EIDDR = 0;
-				disp = gotDD = 0;
-				this->dd = &this->hl;
-				if (this->halted) { DEC_W(this->pc); continue; }
+				if (!gotDD) {
+					GET_OPCODE_EXT(rs, opcode);
+				}
+				else {
+					Z80_Contention(rs.pc, 3, Z80_MREQ_READ | Z80_MEMIO_OPCEXT);
+					opcode = this->memReadFn(rs.pc, Z80_MEMIO_OPCEXT);
+					Z80_ContentionPCBy1(2);
+					INC_PC;
+				}
+				if (gotDD) {
+					tmpW = ZADD_WX(dd.w, disp);
+					tmpB = Z80_PeekB3T(rs, tmpW);
+					Z80_ContentionBy1(tmpW, 1);
+				}
+				else {
+					switch (opcode & 0x07) {
+					case 0: tmpB = this->bc.b; break;
+					case 1: tmpB = this->bc.c; break;
+					case 2: tmpB = this->de.d; break;
+					case 3: tmpB = this->de.e; break;
+					case 4: tmpB = this->hl.h; break;
+					case 5: tmpB = this->hl.l; break;
+					case 6: tmpB = Z80_PeekB3T(rs, this->hl.w); Z80_Contention(this->hl.w, 1, Z80_MREQ_READ | Z80_MEMIO_DATA); break;
+					case 7: tmpB = rs.af.a; break;
+					}
+				}
+				switch ((opcode >> 3) & 0x1f) {
+				case 0: tmpB = Z80_RLC(rs, tmpB); break;
+				case 1: tmpB = Z80_RRC(rs, tmpB); break;
+				case 2: tmpB = Z80_RL(rs, tmpB); break;
+				case 3: tmpB = Z80_RR(rs, tmpB); break;
+				case 4: tmpB = Z80_SLA(rs, tmpB); break;
+				case 5: tmpB = Z80_SRA(rs, tmpB); break;
+				case 6: tmpB = Z80_SLL(rs, tmpB); break;
+				case 7: tmpB = Z80_SLR(rs, tmpB); break;
+				default:
+					switch ((opcode >> 6) & 0x03) {
+					case 1: Z80_BIT(rs, (opcode >> 3) & 0x07, tmpB, (gotDD || (opcode & 0x07) == 6)); break;
+					case 2: tmpB &= ~(1 << ((opcode >> 3) & 0x07)); break; /* RES */
+					case 3: tmpB |= (1 << ((opcode >> 3) & 0x07)); break; /* SET */
+					}
+					break;
+				}
 				/***/
-				if (opcode == 0xdd || opcode == 0xfd) {
-					static const uint32_t withIndexBmp[8] PROGMEM = { 0x00,0x700000,0x40404040,0x40bf4040,0x40404040,0x40404040,0x0800,0x00 };
-					/* IX/IY prefix */
-					this->dd = (opcode == 0xdd ? &this->ix : &this->iy);
-					/* read opcode -- OCR(4) */
-					GET_OPCODE_EXT(opcode);
-					/* test if this instruction have (HL) */
-					if (pgm_read_dword(&withIndexBmp[opcode >> 5]) & (1 << (opcode & 0x1f))) {
-						/* 3rd byte is always DISP here */
-						disp = Z80_PeekB3TA(this->pc); if (disp > 127) disp -= 256;
-						INC_PC;
-						this->memptr.w = ZADD_WX(this->dd->w, disp);
+				if ((opcode & 0xc0) != 0x40) {
+					/* BITs are not welcome here */
+					if (gotDD) {
+						/* tmpW was set earlier */
+						if ((opcode & 0x07) != 6) Z80_PokeB3T(tmpW, tmpB);
 					}
-					else if (opcode == 0xdd || opcode == 0xfd) {
-						/* double prefix; restart main loop */
-						this->prev_was_EIDDR = 1;
-						continue;
+					switch (opcode & 0x07) {
+					case 0: this->bc.b = tmpB; break;
+					case 1: this->bc.c = tmpB; break;
+					case 2: this->de.d = tmpB; break;
+					case 3: this->de.e = tmpB; break;
+					case 4: this->hl.h = tmpB; break;
+					case 5: this->hl.l = tmpB; break;
+					case 6: Z80_PokeB3T(ZADD_WX(dd.w, disp), tmpB); break;
+					case 7: rs.af.a = tmpB; break;
 					}
-					gotDD = 1;
 				}
-				/* instructions */
-				if (opcode == 0xed) {
-					this->dd = &this->hl;
-					/* read opcode -- OCR(4) */
-					GET_OPCODE_EXT(opcode);
-					switch (opcode) {
-						/* LDI, LDIR, LDD, LDDR */
-					case 0xa0: case 0xb0: case 0xa8: case 0xb8:
-						tmpB = Z80_PeekB3T(this->hl.w);
-						Z80_PokeB3T(this->de.w, tmpB);
-						/*MWR(5)*/
-						Z80_ContentionBy1(this->de.w, 2);
-						DEC_W(this->bc.w);
-						tmpB = (tmpB + this->af.a) & 0xff;
-						/***/
-						this->af.f =
-							(tmpB & Z80_FLAG_3) | (this->af.f & (Z80_FLAG_C | Z80_FLAG_Z | Z80_FLAG_S)) |
-							(this->bc.w != 0 ? Z80_FLAG_PV : 0) |
-							(tmpB & 0x02 ? Z80_FLAG_5 : 0);
-						/***/
-						if (CBX_REPEATED) {
-							if (this->bc.w != 0) {
-								/*IOP(5)*/
-								Z80_ContentionBy1(this->de.w, 5);
-								/* do it again */
-								XSUB_W(this->pc, 2);
-								this->memptr.w = (this->pc + 1) & 0xffff;
+				return;
+			} /* 0xcb done */
+			/* normal things */
+			switch (opcode & 0xc0) {
+				/* 0x00..0x3F */
+			case 0x00:
+				switch (opcode & 0x07) {
+					/* misc,DJNZ,JR,JR cc */
+				case 0:
+					if (opcode & 0x30) {
+						/* branches */
+						if (opcode & 0x20) {
+							/* JR cc */
+							switch ((opcode >> 3) & 0x03) {
+							case 0: trueCC = (rs.af.f & Z80_FLAG_Z) == 0; break;
+							case 1: trueCC = (rs.af.f & Z80_FLAG_Z) != 0; break;
+							case 2: trueCC = (rs.af.f & Z80_FLAG_C) == 0; break;
+							case 3: trueCC = (rs.af.f & Z80_FLAG_C) != 0; break;
+							default: trueCC = 0; break;
 							}
 						}
-						if (!CBX_BACKWARD) { INC_W(this->hl.w); INC_W(this->de.w); }
-						else { DEC_W(this->hl.w); DEC_W(this->de.w); }
-						break;
-						/* CPI, CPIR, CPD, CPDR */
-					case 0xa1: case 0xb1: case 0xa9: case 0xb9:
-						/* MEMPTR */
-						if (CBX_REPEATED && (!(this->bc.w == 1 || Z80_PeekBI(this->hl.w) == this->af.a))) {
-							this->memptr.w = ZADD_WX(this->org_pc, 1);
-						}
 						else {
-							this->memptr.w = ZADD_WX(this->memptr.w, (CBX_BACKWARD ? -1 : 1));
-						}
-						/***/
-						tmpB = Z80_PeekB3T(this->hl.w);
-						/*IOP(5)*/
-						Z80_ContentionBy1(this->hl.w, 5);
-						DEC_W(this->bc.w);
-						/***/
-						this->af.f =
-							Z80_FLAG_N |
-							(this->af.f & Z80_FLAG_C) |
-							(this->bc.w != 0 ? Z80_FLAG_PV : 0) |
-							((int32_t)(this->af.a & 0x0f) - (int32_t)(tmpB & 0x0f) < 0 ? Z80_FLAG_H : 0);
-						/***/
-						tmpB = ((int32_t)this->af.a - (int32_t)tmpB) & 0xff;
-						/***/
-						this->af.f |=
-							(tmpB == 0 ? Z80_FLAG_Z : 0) |
-							(tmpB & Z80_FLAG_S);
-						/***/
-						if (this->af.f & Z80_FLAG_H) tmpB = ((uint16_t)tmpB - 1) & 0xff;
-						this->af.f |= (tmpB & Z80_FLAG_3) | (tmpB & 0x02 ? Z80_FLAG_5 : 0);
-						/***/
-						if (CBX_REPEATED) {
-							/* repeated */
-							if ((this->af.f & (Z80_FLAG_Z | Z80_FLAG_PV)) == Z80_FLAG_PV) {
-								/*IOP(5)*/
-								Z80_ContentionBy1(this->hl.w, 5);
-								/* do it again */
-								XSUB_W(this->pc, 2);
+							/* DJNZ/JR */
+							if ((opcode & 0x08) == 0) {
+								/* DJNZ */
+								/*OCR(5)*/
+								Z80_ContentionIRBy1(1);
+								DEC_B(this->bc.b);
+								trueCC = (this->bc.b != 0);
 							}
-						}
-						if (CBX_BACKWARD) DEC_W(this->hl.w); else INC_W(this->hl.w);
-						break;
-						/* OUTI, OTIR, OUTD, OTDR */
-					case 0xa3: case 0xb3: case 0xab: case 0xbb:
-						DEC_B(this->bc.b);
-						/* fallthru */
-					  /* INI, INIR, IND, INDR */
-					case 0xa2: case 0xb2: case 0xaa: case 0xba:
-						this->memptr.w = ZADD_WX(this->bc.w, (CBX_BACKWARD ? -1 : 1));
-						/*OCR(5)*/
-						Z80_ContentionIRBy1(1);
-						if (opcode & 0x01) {
-							/* OUT* */
-							tmpB = Z80_PeekB3T(this->hl.w);/*MRD(3)*/
-							Z80_PortOut(this->bc.w, tmpB);
-							tmpW = ZADD_WX(this->hl.w, (CBX_BACKWARD ? -1 : 1));
-							tmpC = (tmpB + tmpW) & 0xff;
-						}
-						else {
-							/* IN* */
-							tmpB = Z80_PortIn(this->bc.w);
-							Z80_PokeB3T(this->hl.w, tmpB);/*MWR(3)*/
-							DEC_B(this->bc.b);
-							if (CBX_BACKWARD) tmpC = ((int32_t)tmpB + (int32_t)this->bc.c - 1) & 0xff; else tmpC = (tmpB + this->bc.c + 1) & 0xff;
-						}
-						/***/
-						this->af.f =
-							(tmpB & 0x80 ? Z80_FLAG_N : 0) |
-							(tmpC < tmpB ? Z80_FLAG_H | Z80_FLAG_C : 0) |
-							(SZ53PTAB((tmpC & 0x07) ^ this->bc.b) & Z80_FLAG_PV) |
-							(SZ53PTAB(this->bc.b) & ~Z80_FLAG_PV);
-						/***/
-						if (CBX_REPEATED) {
-							/* repeating commands */
-							if (this->bc.b != 0) {
-								uint16_t a = (opcode & 0x01 ? this->bc.w : this->hl.w);
-								/***/
-								/*IOP(5)*/
-								Z80_ContentionBy1(a, 5);
-								/* do it again */
-								XSUB_W(this->pc, 2);
+							else {
+								/* JR */
+								trueCC = 1;
 							}
 						}
-						if (CBX_BACKWARD) DEC_W(this->hl.w); else INC_W(this->hl.w);
-						break;
-						/* not strings, but some good instructions anyway */
-					default:
-						if ((opcode & 0xc0) == 0x40) {
-							/* 0x40...0x7f */
-							switch (opcode & 0x07) {
-								/* IN r8,(C) */
-							case 0:
-								this->memptr.w = ZADD_WX(this->bc.w, 1);
-								tmpB = Z80_PortIn(this->bc.w);
-								this->af.f = SZ53PTAB(tmpB) | (this->af.f & Z80_FLAG_C);
-								switch ((opcode >> 3) & 0x07) {
-								case 0: this->bc.b = tmpB; break;
-								case 1: this->bc.c = tmpB; break;
-								case 2: this->de.d = tmpB; break;
-								case 3: this->de.e = tmpB; break;
-								case 4: this->hl.h = tmpB; break;
-								case 5: this->hl.l = tmpB; break;
-								case 7: this->af.a = tmpB; break;
-									/* 6 affects only flags */
-								}
-								break;
-								/* OUT (C),r8 */
-							case 1:
-								this->memptr.w = ZADD_WX(this->bc.w, 1);
-								switch ((opcode >> 3) & 0x07) {
-								case 0: tmpB = this->bc.b; break;
-								case 1: tmpB = this->bc.c; break;
-								case 2: tmpB = this->de.d; break;
-								case 3: tmpB = this->de.e; break;
-								case 4: tmpB = this->hl.h; break;
-								case 5: tmpB = this->hl.l; break;
-								case 7: tmpB = this->af.a; break;
-								default: tmpB = 0; break; /*6*/
-								}
-								Z80_PortOut(this->bc.w, tmpB);
-								break;
-								/* SBC HL,rr/ADC HL,rr */
-							case 2:
-								/*IOP(4),IOP(3)*/
-								Z80_ContentionIRBy1(7);
-								switch ((opcode >> 4) & 0x03) {
-								case 0: tmpW = this->bc.w; break;
-								case 1: tmpW = this->de.w; break;
-								case 2: tmpW = this->hl.w; break;
-								default: tmpW = this->sp.w; break;
-								}
-								this->hl.w = (opcode & 0x08 ? Z80_ADC_DD(tmpW, this->hl.w) : Z80_SBC_DD(tmpW, this->hl.w));
-								break;
-								/* LD (nn),rr/LD rr,(nn) */
-							case 3:
-								tmpW = Z80_GetWordPC(0);
-								this->memptr.w = (tmpW + 1) & 0xffff;
-								if (opcode & 0x08) {
-									/* LD rr,(nn) */
-									switch ((opcode >> 4) & 0x03) {
-									case 0: this->bc.w = Z80_PeekW6T(tmpW); break;
-									case 1: this->de.w = Z80_PeekW6T(tmpW); break;
-									case 2: this->hl.w = Z80_PeekW6T(tmpW); break;
-									case 3: this->sp.w = Z80_PeekW6T(tmpW); break;
-									}
-								}
-								else {
-									/* LD (nn),rr */
-									switch ((opcode >> 4) & 0x03) {
-									case 0: Z80_PokeW6T(tmpW, this->bc.w); break;
-									case 1: Z80_PokeW6T(tmpW, this->de.w); break;
-									case 2: Z80_PokeW6T(tmpW, this->hl.w); break;
-									case 3: Z80_PokeW6T(tmpW, this->sp.w); break;
-									}
-								}
-								break;
-								/* NEG */
-							case 4:
-								tmpB = this->af.a;
-								this->af.a = 0;
-								Z80_SUB_A(tmpB);
-								break;
-								/* RETI/RETN */
-							case 5:
-								/*RETI: 0x4d, 0x5d, 0x6d, 0x7d*/
-								/*RETN: 0x45, 0x55, 0x65, 0x75*/
-								this->iff1 = this->iff2;
-								this->memptr.w = this->pc = Z80_Pop6T();
-								if (opcode & 0x08) {
-									/* RETI */
-									if (this->retiFn(opcode)) return;
-								}
-								else {
-									/* RETN */
-									if (this->retnFn(opcode)) return;
-								}
-								break;
-								/* IM n */
-							case 6:
-								switch (opcode) {
-								case 0x56: case 0x76: this->im = 1; break;
-								case 0x5e: case 0x7e: this->im = 2; break;
-								default: this->im = 0; break;
-								}
-								break;
-								/* specials */
-							case 7:
-								switch (opcode) {
-									/* LD I,A */
-								case 0x47:
-									/*OCR(5)*/
-									Z80_ContentionIRBy1(1);
-									this->regI = this->af.a;
-									break;
-									/* LD R,A */
-								case 0x4f:
-									/*OCR(5)*/
-									Z80_ContentionIRBy1(1);
-									this->regR = this->af.a;
-									break;
-									/* LD A,I */
-								case 0x57: Z80_LD_A_IR(this->regI); break;
-									/* LD A,R */
-								case 0x5f: Z80_LD_A_IR(this->regR); break;
-									/* RRD */
-								case 0x67: Z80_RRD_A(); break;
-									/* RLD */
-								case 0x6F: Z80_RLD_A(); break;
-								}
-							}
+						/***/
+						disp = Z80_PeekB3TA(rs, rs.pc);
+						if (trueCC) {
+							/* execute branch (relative) */
+							/*IOP(5)*/
+							if (disp > 127) disp -= 256;
+							Z80_ContentionPCBy1(5);
+							INC_PC;
+							ZADD_W(rs.pc, disp);
+							Z80_MEMPTR(rs.pc);
 						}
 						else {
-							/* slt and other traps */
-							if (this->trapEDFn(opcode)) return;
+							INC_PC;
 						}
-						break;
-					}
-					continue;
-				} /* 0xed done */
-				/***/
-				if (opcode == 0xcb) {
-					/* shifts and bit operations */
-					/* read opcode -- OCR(4) */
-					if (!gotDD) {
-						GET_OPCODE_EXT(opcode);
 					}
 					else {
-						Z80_Contention(this->pc, 3, Z80_MREQ_READ | Z80_MEMIO_OPCEXT);
-						opcode = this->memReadFn(this->pc, Z80_MEMIO_OPCEXT);
-						Z80_ContentionPCBy1(2);
-						INC_PC;
+						/* EX AF,AF' or NOP */
+						if (opcode != 0) Z80_EXAFAF();
 					}
-					if (gotDD) {
-						tmpW = ZADD_WX(this->dd->w, disp);
-						tmpB = Z80_PeekB3T(tmpW);
-						Z80_ContentionBy1(tmpW, 1);
+					break;
+					/* LD rr,nn/ADD HL,rr */
+				case 1:
+					if (opcode & 0x08) {
+						/* ADD HL,rr */
+						/*IOP(4),IOP(3)*/
+						Z80_ContentionIRBy1(7);
+						switch ((opcode >> 4) & 0x03) {
+						case 0: dd.w = Z80_ADD_DD(rs, this->bc.w, dd.w); break;
+						case 1: dd.w = Z80_ADD_DD(rs, this->de.w, dd.w); break;
+						case 2: dd.w = Z80_ADD_DD(rs, dd.w, dd.w); break;
+						case 3: dd.w = Z80_ADD_DD(rs, this->sp.w, dd.w); break;
+						}
 					}
 					else {
-						switch (opcode & 0x07) {
-						case 0: tmpB = this->bc.b; break;
-						case 1: tmpB = this->bc.c; break;
-						case 2: tmpB = this->de.d; break;
-						case 3: tmpB = this->de.e; break;
-						case 4: tmpB = this->hl.h; break;
-						case 5: tmpB = this->hl.l; break;
-						case 6: tmpB = Z80_PeekB3T(this->hl.w); Z80_Contention(this->hl.w, 1, Z80_MREQ_READ | Z80_MEMIO_DATA); break;
-						case 7: tmpB = this->af.a; break;
+						/* LD rr,nn */
+						tmpW = Z80_GetWordPC(rs, 0);
+						switch ((opcode >> 4) & 0x03) {
+						case 0: this->bc.w = tmpW; break;
+						case 1: this->de.w = tmpW; break;
+						case 2: dd.w = tmpW; break;
+						case 3: this->sp.w = tmpW; break;
 						}
 					}
-					switch ((opcode >> 3) & 0x1f) {
-					case 0: tmpB = Z80_RLC(tmpB); break;
-					case 1: tmpB = Z80_RRC(tmpB); break;
-					case 2: tmpB = Z80_RL(tmpB); break;
-					case 3: tmpB = Z80_RR(tmpB); break;
-					case 4: tmpB = Z80_SLA(tmpB); break;
-					case 5: tmpB = Z80_SRA(tmpB); break;
-					case 6: tmpB = Z80_SLL(tmpB); break;
-					case 7: tmpB = Z80_SLR(tmpB); break;
-					default:
-						switch ((opcode >> 6) & 0x03) {
-						case 1: Z80_BIT((opcode >> 3) & 0x07, tmpB, (gotDD || (opcode & 0x07) == 6)); break;
-						case 2: tmpB &= ~(1 << ((opcode >> 3) & 0x07)); break; /* RES */
-						case 3: tmpB |= (1 << ((opcode >> 3) & 0x07)); break; /* SET */
-						}
+					break;
+					/* LD xxx,xxx */
+				case 2:
+					switch ((opcode >> 3) & 0x07) {
+						/* LD (BC),A */
+					case 0: Z80_PokeB3T(this->bc.w, rs.af.a); Z80_MEMPTR_LH((this->bc.c + 1) & 0xff, rs.af.a); break;
+						/* LD A,(BC) */
+					case 1: rs.af.a = Z80_PeekB3T(rs, this->bc.w); Z80_MEMPTR((this->bc.w + 1) & 0xffff); break;
+						/* LD (DE),A */
+					case 2: Z80_PokeB3T(this->de.w, rs.af.a); Z80_MEMPTR_LH((this->de.e + 1) & 0xff, rs.af.a); break;
+						/* LD A,(DE) */
+					case 3: rs.af.a = Z80_PeekB3T(rs, this->de.w); Z80_MEMPTR((this->de.w + 1) & 0xffff); break;
+						/* LD (nn),HL */
+					case 4:
+						tmpW = Z80_GetWordPC(rs, 0);
+						Z80_MEMPTR((tmpW + 1) & 0xffff);
+						Z80_PokeW6T(rs, tmpW, dd.w);
+						break;
+						/* LD HL,(nn) */
+					case 5:
+						tmpW = Z80_GetWordPC(rs, 0);
+						Z80_MEMPTR((tmpW + 1) & 0xffff);
+						dd.w = Z80_PeekW6T(rs, tmpW);
+						break;
+						/* LD (nn),A */
+					case 6:
+						tmpW = Z80_GetWordPC(rs, 0);
+						Z80_MEMPTR_LH((tmpW + 1) & 0xff, rs.af.a);
+						Z80_PokeB3T(tmpW, rs.af.a);
+						break;
+						/* LD A,(nn) */
+					case 7:
+						tmpW = Z80_GetWordPC(rs, 0);
+						Z80_MEMPTR((tmpW + 1) & 0xffff);
+						rs.af.a = Z80_PeekB3T(rs, tmpW);
 						break;
 					}
-					/***/
-					if ((opcode & 0xc0) != 0x40) {
-						/* BITs are not welcome here */
-						if (gotDD) {
-							/* tmpW was set earlier */
-							if ((opcode & 0x07) != 6) Z80_PokeB3T(tmpW, tmpB);
-						}
-						switch (opcode & 0x07) {
-						case 0: this->bc.b = tmpB; break;
-						case 1: this->bc.c = tmpB; break;
-						case 2: this->de.d = tmpB; break;
-						case 3: this->de.e = tmpB; break;
-						case 4: this->hl.h = tmpB; break;
-						case 5: this->hl.l = tmpB; break;
-						case 6: Z80_PokeB3T(ZADD_WX(this->dd->w, disp), tmpB); break;
-						case 7: this->af.a = tmpB; break;
+					break;
+					/* INC rr/DEC rr */
+				case 3:
+					/*OCR(6)*/
+					Z80_ContentionIRBy1(2);
+					if (opcode & 0x08) {
+						/*DEC*/
+						switch ((opcode >> 4) & 0x03) {
+						case 0: DEC_W(this->bc.w); break;
+						case 1: DEC_W(this->de.w); break;
+						case 2: DEC_W(dd.w); break;
+						case 3: DEC_W(this->sp.w); break;
 						}
 					}
-					continue;
-				} /* 0xcb done */
-				/* normal things */
-				switch (opcode & 0xc0) {
-					/* 0x00..0x3F */
-				case 0x00:
-					switch (opcode & 0x07) {
-						/* misc,DJNZ,JR,JR cc */
-					case 0:
-						if (opcode & 0x30) {
-							/* branches */
-							if (opcode & 0x20) {
-								/* JR cc */
-								switch ((opcode >> 3) & 0x03) {
-								case 0: trueCC = (this->af.f & Z80_FLAG_Z) == 0; break;
-								case 1: trueCC = (this->af.f & Z80_FLAG_Z) != 0; break;
-								case 2: trueCC = (this->af.f & Z80_FLAG_C) == 0; break;
-								case 3: trueCC = (this->af.f & Z80_FLAG_C) != 0; break;
-								default: trueCC = 0; break;
-								}
-							}
-							else {
-								/* DJNZ/JR */
-								if ((opcode & 0x08) == 0) {
-									/* DJNZ */
-									/*OCR(5)*/
-									Z80_ContentionIRBy1(1);
-									DEC_B(this->bc.b);
-									trueCC = (this->bc.b != 0);
-								}
-								else {
-									/* JR */
-									trueCC = 1;
-								}
-							}
-							/***/
-							disp = Z80_PeekB3TA(this->pc);
-							if (trueCC) {
-								/* execute branch (relative) */
-								/*IOP(5)*/
-								if (disp > 127) disp -= 256;
-								Z80_ContentionPCBy1(5);
-								INC_PC;
-								ZADD_W(this->pc, disp);
-								this->memptr.w = this->pc;
-							}
-							else {
-								INC_PC;
-							}
-						}
-						else {
-							/* EX AF,AF' or NOP */
-							if (opcode != 0) Z80_EXAFAF();
+					else {
+						/*INC*/
+						switch ((opcode >> 4) & 0x03) {
+						case 0: INC_W(this->bc.w); break;
+						case 1: INC_W(this->de.w); break;
+						case 2: INC_W(dd.w); break;
+						case 3: INC_W(this->sp.w); break;
 						}
-						break;
-						/* LD rr,nn/ADD HL,rr */
-					case 1:
-						if (opcode & 0x08) {
-							/* ADD HL,rr */
-							/*IOP(4),IOP(3)*/
-							Z80_ContentionIRBy1(7);
-							switch ((opcode >> 4) & 0x03) {
-							case 0: this->dd->w = Z80_ADD_DD(this->bc.w, this->dd->w); break;
-							case 1: this->dd->w = Z80_ADD_DD(this->de.w, this->dd->w); break;
-							case 2: this->dd->w = Z80_ADD_DD(this->dd->w, this->dd->w); break;
-							case 3: this->dd->w = Z80_ADD_DD(this->sp.w, this->dd->w); break;
-							}
-						}
-						else {
-							/* LD rr,nn */
-							tmpW = Z80_GetWordPC(0);
-							switch ((opcode >> 4) & 0x03) {
-							case 0: this->bc.w = tmpW; break;
-							case 1: this->de.w = tmpW; break;
-							case 2: this->dd->w = tmpW; break;
-							case 3: this->sp.w = tmpW; break;
-							}
-						}
-						break;
-						/* LD xxx,xxx */
-					case 2:
-						switch ((opcode >> 3) & 0x07) {
-							/* LD (BC),A */
-						case 0: Z80_PokeB3T(this->bc.w, this->af.a); this->memptr.l = (this->bc.c + 1) & 0xff; this->memptr.h = this->af.a; break;
-							/* LD A,(BC) */
-						case 1: this->af.a = Z80_PeekB3T(this->bc.w); this->memptr.w = (this->bc.w + 1) & 0xffff; break;
-							/* LD (DE),A */
-						case 2: Z80_PokeB3T(this->de.w, this->af.a); this->memptr.l = (this->de.e + 1) & 0xff; this->memptr.h = this->af.a; break;
-							/* LD A,(DE) */
-						case 3: this->af.a = Z80_PeekB3T(this->de.w); this->memptr.w = (this->de.w + 1) & 0xffff; break;
-							/* LD (nn),HL */
-						case 4:
-							tmpW = Z80_GetWordPC(0);
-							this->memptr.w = (tmpW + 1) & 0xffff;
-							Z80_PokeW6T(tmpW, this->dd->w);
-							break;
-							/* LD HL,(nn) */
-						case 5:
-							tmpW = Z80_GetWordPC(0);
-							this->memptr.w = (tmpW + 1) & 0xffff;
-							this->dd->w = Z80_PeekW6T(tmpW);
-							break;
-							/* LD (nn),A */
-						case 6:
-							tmpW = Z80_GetWordPC(0);
-							this->memptr.l = (tmpW + 1) & 0xff;
-							this->memptr.h = this->af.a;
-							Z80_PokeB3T(tmpW, this->af.a);
-							break;
-							/* LD A,(nn) */
-						case 7:
-							tmpW = Z80_GetWordPC(0);
-							this->memptr.w = (tmpW + 1) & 0xffff;
-							this->af.a = Z80_PeekB3T(tmpW);
-							break;
-						}
-						break;
-						/* INC rr/DEC rr */
-					case 3:
-						/*OCR(6)*/
-						Z80_ContentionIRBy1(2);
-						if (opcode & 0x08) {
-							/*DEC*/
-							switch ((opcode >> 4) & 0x03) {
-							case 0: DEC_W(this->bc.w); break;
-							case 1: DEC_W(this->de.w); break;
-							case 2: DEC_W(this->dd->w); break;
-							case 3: DEC_W(this->sp.w); break;
-							}
-						}
-						else {
-							/*INC*/
-							switch ((opcode >> 4) & 0x03) {
-							case 0: INC_W(this->bc.w); break;
-							case 1: INC_W(this->de.w); break;
-							case 2: INC_W(this->dd->w); break;
-							case 3: INC_W(this->sp.w); break;
-							}
-						}
-						break;
-						/* INC r8 */
-					case 4:
-						switch ((opcode >> 3) & 0x07) {
-						case 0: this->bc.b = Z80_INC8(this->bc.b); break;
-						case 1: this->bc.c = Z80_INC8(this->bc.c); break;
-						case 2: this->de.d = Z80_INC8(this->de.d); break;
-						case 3: this->de.e = Z80_INC8(this->de.e); break;
-						case 4: this->dd->h = Z80_INC8(this->dd->h); break;
-						case 5: this->dd->l = Z80_INC8(this->dd->l); break;
-						case 6:
-							if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
-							tmpW = ZADD_WX(this->dd->w, disp);
-							tmpB = Z80_PeekB3T(tmpW);
-							Z80_ContentionBy1(tmpW, 1);
-							tmpB = Z80_INC8(tmpB);
-							Z80_PokeB3T(tmpW, tmpB);
-							break;
-						case 7: this->af.a = Z80_INC8(this->af.a); break;
-						}
-						break;
-						/* DEC r8 */
-					case 5:
-						switch ((opcode >> 3) & 0x07) {
-						case 0: this->bc.b = Z80_DEC8(this->bc.b); break;
-						case 1: this->bc.c = Z80_DEC8(this->bc.c); break;
-						case 2: this->de.d = Z80_DEC8(this->de.d); break;
-						case 3: this->de.e = Z80_DEC8(this->de.e); break;
-						case 4: this->dd->h = Z80_DEC8(this->dd->h); break;
-						case 5: this->dd->l = Z80_DEC8(this->dd->l); break;
-						case 6:
-							if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
-							tmpW = ZADD_WX(this->dd->w, disp);
-							tmpB = Z80_PeekB3T(tmpW);
-							Z80_ContentionBy1(tmpW, 1);
-							tmpB = Z80_DEC8(tmpB);
-							Z80_PokeB3T(tmpW, tmpB);
-							break;
-						case 7: this->af.a = Z80_DEC8(this->af.a); break;
-						}
-						break;
-						/* LD r8,n */
+					}
+					break;
+					/* INC r8 */
+				case 4:
+					switch ((opcode >> 3) & 0x07) {
+					case 0: this->bc.b = Z80_INC8(rs, this->bc.b); break;
+					case 1: this->bc.c = Z80_INC8(rs, this->bc.c); break;
+					case 2: this->de.d = Z80_INC8(rs, this->de.d); break;
+					case 3: this->de.e = Z80_INC8(rs, this->de.e); break;
+					case 4: dd.h = Z80_INC8(rs, dd.h); break;
+					case 5: dd.l = Z80_INC8(rs, dd.l); break;
 					case 6:
-						tmpB = Z80_PeekB3TA(this->pc);
-						INC_PC;
-						switch ((opcode >> 3) & 0x07) {
-						case 0: this->bc.b = tmpB; break;
-						case 1: this->bc.c = tmpB; break;
-						case 2: this->de.d = tmpB; break;
-						case 3: this->de.e = tmpB; break;
-						case 4: this->dd->h = tmpB; break;
-						case 5: this->dd->l = tmpB; break;
-						case 6:
-							if (gotDD) { DEC_PC; Z80_ContentionPCBy1(2); INC_PC; }
-							tmpW = ZADD_WX(this->dd->w, disp);
-							Z80_PokeB3T(tmpW, tmpB);
-							break;
-						case 7: this->af.a = tmpB; break;
-						}
-						break;
-						/* swim-swim-hungry */
-					case 7:
-						switch ((opcode >> 3) & 0x07) {
-						case 0: Z80_RLCA(); break;
-						case 1: Z80_RRCA(); break;
-						case 2: Z80_RLA(); break;
-						case 3: Z80_RRA(); break;
-						case 4: Z80_DAA(); break;
-						case 5: /* CPL */
-							this->af.a ^= 0xff;
-							this->af.f = (this->af.a & Z80_FLAG_35) | (Z80_FLAG_N | Z80_FLAG_H) | (this->af.f & (Z80_FLAG_C | Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
-							break;
-						case 6: /* SCF */
-							this->af.f = (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) | (this->af.a & Z80_FLAG_35) | Z80_FLAG_C;
-							break;
-						case 7: /* CCF */
-							tmpB = this->af.f & Z80_FLAG_C;
-							this->af.f = (this->af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) | (this->af.a & Z80_FLAG_35);
-							this->af.f |= tmpB ? Z80_FLAG_H : Z80_FLAG_C;
-							break;
-						}
+						if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
+						tmpW = ZADD_WX(dd.w, disp);
+						tmpB = Z80_PeekB3T(rs, tmpW);
+						Z80_ContentionBy1(tmpW, 1);
+						tmpB = Z80_INC8(rs, tmpB);
+						Z80_PokeB3T(tmpW, tmpB);
 						break;
+					case 7: rs.af.a = Z80_INC8(rs, rs.af.a); break;
 					}
 					break;
-					/* 0x40..0x7F (LD r8,r8) */
-				case 0x40:
-					if (opcode == 0x76) { this->halted = true; DEC_W(this->pc); continue; } /* HALT */
-					rsrc = (opcode & 0x07);
-					rdst = ((opcode >> 3) & 0x07);
-					switch (rsrc) {
-					case 0: tmpB = this->bc.b; break;
-					case 1: tmpB = this->bc.c; break;
-					case 2: tmpB = this->de.d; break;
-					case 3: tmpB = this->de.e; break;
-					case 4: tmpB = (gotDD && rdst == 6 ? this->hl.h : this->dd->h); break;
-					case 5: tmpB = (gotDD && rdst == 6 ? this->hl.l : this->dd->l); break;
+					/* DEC r8 */
+				case 5:
+					switch ((opcode >> 3) & 0x07) {
+					case 0: this->bc.b = Z80_DEC8(rs, this->bc.b); break;
+					case 1: this->bc.c = Z80_DEC8(rs, this->bc.c); break;
+					case 2: this->de.d = Z80_DEC8(rs, this->de.d); break;
+					case 3: this->de.e = Z80_DEC8(rs, this->de.e); break;
+					case 4: dd.h = Z80_DEC8(rs, dd.h); break;
+					case 5: dd.l = Z80_DEC8(rs, dd.l); break;
 					case 6:
 						if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
-						tmpW = ZADD_WX(this->dd->w, disp);
-						tmpB = Z80_PeekB3T(tmpW);
+						tmpW = ZADD_WX(dd.w, disp);
+						tmpB = Z80_PeekB3T(rs, tmpW);
+						Z80_ContentionBy1(tmpW, 1);
+						tmpB = Z80_DEC8(rs, tmpB);
+						Z80_PokeB3T(tmpW, tmpB);
 						break;
-					case 7: tmpB = this->af.a; break;
+					case 7: rs.af.a = Z80_DEC8(rs, rs.af.a); break;
 					}
-					switch (rdst) {
+					break;
+					/* LD r8,n */
+				case 6:
+					tmpB = Z80_PeekB3TA(rs, rs.pc);
+					INC_PC;
+					switch ((opcode >> 3) & 0x07) {
 					case 0: this->bc.b = tmpB; break;
 					case 1: this->bc.c = tmpB; break;
 					case 2: this->de.d = tmpB; break;
 					case 3: this->de.e = tmpB; break;
-					case 4: if (gotDD && rsrc == 6) this->hl.h = tmpB; else this->dd->h = tmpB; break;
-					case 5: if (gotDD && rsrc == 6) this->hl.l = tmpB; else this->dd->l = tmpB; break;
+					case 4: dd.h = tmpB; break;
+					case 5: dd.l = tmpB; break;
 					case 6:
-						if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
-						tmpW = ZADD_WX(this->dd->w, disp);
+						if (gotDD) { DEC_PC; Z80_ContentionPCBy1(2); INC_PC; }
+						tmpW = ZADD_WX(dd.w, disp);
 						Z80_PokeB3T(tmpW, tmpB);
 						break;
-					case 7: this->af.a = tmpB; break;
+					case 7: rs.af.a = tmpB; break;
 					}
 					break;
-					/* 0x80..0xBF (ALU A,r8) */
-				case 0x80:
-					switch (opcode & 0x07) {
-					case 0: tmpB = this->bc.b; break;
-					case 1: tmpB = this->bc.c; break;
-					case 2: tmpB = this->de.d; break;
-					case 3: tmpB = this->de.e; break;
-					case 4: tmpB = this->dd->h; break;
-					case 5: tmpB = this->dd->l; break;
-					case 6:
-						if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
-						tmpW = ZADD_WX(this->dd->w, disp);
-						tmpB = Z80_PeekB3T(tmpW);
+					/* swim-swim-hungry */
+				case 7:
+					switch ((opcode >> 3) & 0x07) {
+					case 0: Z80_RLCA(rs); break;
+					case 1: Z80_RRCA(rs); break;
+					case 2: Z80_RLA(rs); break;
+					case 3: Z80_RRA(rs); break;
+					case 4: Z80_DAA(rs); break;
+					case 5: /* CPL */
+						rs.af.a ^= 0xff;
+						rs.af.f = (rs.af.a & Z80_FLAG_35) | (Z80_FLAG_N | Z80_FLAG_H) | (rs.af.f & (Z80_FLAG_C | Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S));
+						break;
+					case 6: /* SCF */
+						rs.af.f = (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) | (rs.af.a & Z80_FLAG_35) | Z80_FLAG_C;
+						break;
+					case 7: /* CCF */
+						tmpB = rs.af.f & Z80_FLAG_C;
+						rs.af.f = (rs.af.f & (Z80_FLAG_PV | Z80_FLAG_Z | Z80_FLAG_S)) | (rs.af.a & Z80_FLAG_35);
+						rs.af.f |= tmpB ? Z80_FLAG_H : Z80_FLAG_C;
 						break;
-					case 7: tmpB = this->af.a; break;
 					}
+					break;
+				}
+				break;
+				/* 0x40..0x7F (LD r8,r8) */
+			case 0x40:
+				if (opcode == 0x76) { this->halted = true; DEC_W(rs.pc); return; } /* HALT */
+				rsrc = (opcode & 0x07);
+				rdst = ((opcode >> 3) & 0x07);
+				switch (rsrc) {
+				case 0: tmpB = this->bc.b; break;
+				case 1: tmpB = this->bc.c; break;
+				case 2: tmpB = this->de.d; break;
+				case 3: tmpB = this->de.e; break;
+				case 4: tmpB = (gotDD && rdst == 6 ? this->hl.h : dd.h); break;
+				case 5: tmpB = (gotDD && rdst == 6 ? this->hl.l : dd.l); break;
+				case 6:
+					if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
+					tmpW = ZADD_WX(dd.w, disp);
+					tmpB = Z80_PeekB3T(rs, tmpW);
+					break;
+				case 7: tmpB = rs.af.a; break;
+				}
+				switch (rdst) {
+				case 0: this->bc.b = tmpB; break;
+				case 1: this->bc.c = tmpB; break;
+				case 2: this->de.d = tmpB; break;
+				case 3: this->de.e = tmpB; break;
+				case 4: if (gotDD && rsrc == 6) this->hl.h = tmpB; else dd.h = tmpB; break;
+				case 5: if (gotDD && rsrc == 6) this->hl.l = tmpB; else dd.l = tmpB; break;
+				case 6:
+					if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
+					tmpW = ZADD_WX(dd.w, disp);
+					Z80_PokeB3T(tmpW, tmpB);
+					break;
+				case 7: rs.af.a = tmpB; break;
+				}
+				break;
+				/* 0x80..0xBF (ALU A,r8) */
+			case 0x80:
+				switch (opcode & 0x07) {
+				case 0: tmpB = this->bc.b; break;
+				case 1: tmpB = this->bc.c; break;
+				case 2: tmpB = this->de.d; break;
+				case 3: tmpB = this->de.e; break;
+				case 4: tmpB = dd.h; break;
+				case 5: tmpB = dd.l; break;
+				case 6:
+					if (gotDD) { DEC_PC; Z80_ContentionPCBy1(5); INC_PC; }
+					tmpW = ZADD_WX(dd.w, disp);
+					tmpB = Z80_PeekB3T(rs, tmpW);
+					break;
+				case 7: tmpB = rs.af.a; break;
+				}
+				Z80_ALU_A(rs, (opcode >> 3) & 0x07, tmpB);
+				break;
+				/* 0xC0..0xFF */
+			case 0xC0:
+				switch (opcode & 0x07) {
+					/* RET cc */
+				case 0:
+					Z80_ContentionIRBy1(1);
+					trueCC = SET_TRUE_CC(rs, opcode);
+					if (trueCC) { rs.pc = Z80_Pop6T(rs); Z80_MEMPTR(rs.pc); }
+					break;
+					/* POP rr/special0 */
+				case 1:
+					if (opcode & 0x08) {
+						/* special 0 */
+						switch ((opcode >> 4) & 0x03) {
+							/* RET */
+						case 0: rs.pc = Z80_Pop6T(rs); Z80_MEMPTR(rs.pc); break;
+							/* EXX */
+						case 1: Z80_EXX(); break;
+							/* JP (HL) */
+						case 2: rs.pc = dd.w; break;
+							/* LD SP,HL */
+						case 3:
+							/*OCR(6)*/
+							Z80_ContentionIRBy1(2);
+							this->sp.w = dd.w;
+							break;
+						}
+					}
+					else {
+						/* POP rr */
+						tmpW = Z80_Pop6T(rs);
+						switch ((opcode >> 4) & 0x03) {
+						case 0: this->bc.w = tmpW; break;
+						case 1: this->de.w = tmpW; break;
+						case 2: dd.w = tmpW; break;
+						case 3: rs.af.w = tmpW; break;
+						}
+					}
+					break;
+					/* JP cc,nn */
+				case 2:
+					trueCC = SET_TRUE_CC(rs, opcode);
+					tmpW = Z80_GetWordPC(rs, 0);
+					Z80_MEMPTR(tmpW);
+					if (trueCC) rs.pc = tmpW;
+					break;
+					/* special1/special3 */
+				case 3:
 					switch ((opcode >> 3) & 0x07) {
-					case 0: Z80_ADD_A(tmpB); break;
-					case 1: Z80_ADC_A(tmpB); break;
-					case 2: Z80_SUB_A(tmpB); break;
-					case 3: Z80_SBC_A(tmpB); break;
-					case 4: Z80_AND_A(tmpB); break;
-					case 5: Z80_XOR_A(tmpB); break;
-					case 6: Z80_OR_A(tmpB); break;
-					case 7: Z80_CP_A(tmpB); break;
+						/* JP nn */
+					case 0: rs.pc = Z80_GetWordPC(rs, 0); Z80_MEMPTR(rs.pc); break;
+						/* OUT (n),A */
+					case 2:
+						tmpW = Z80_PeekB3TA(rs, rs.pc);
+						INC_PC;
+						Z80_MEMPTR_LH((tmpW + 1) & 0xff, rs.af.a);
+						tmpW |= (((uint16_t)(rs.af.a)) << 8);
+						Z80_PortOut(rs, tmpW, rs.af.a);
+						break;
+						/* IN A,(n) */
+					case 3:
+						tmpW = (((uint16_t)(rs.af.a)) << 8) | Z80_PeekB3TA(rs, rs.pc);
+						INC_PC;
+						Z80_MEMPTR((tmpW + 1) & 0xffff);
+						rs.af.a = Z80_PortIn(rs, tmpW);
+						break;
+						/* EX (SP),HL */
+					case 4:
+						/*SRL(3),SRH(4)*/
+						tmpW = Z80_PeekW6T(rs, this->sp.w);
+						Z80_ContentionBy1((this->sp.w + 1) & 0xffff, 1);
+						/*SWL(3),SWH(5)*/
+						Z80_PokeW6TInv(rs, this->sp.w, dd.w);
+						Z80_ContentionBy1(this->sp.w, 2);
+						dd.w = tmpW;
+						Z80_MEMPTR(tmpW);
+						break;
+						/* EX DE,HL */
+					case 5:
+						tmpW = this->de.w;
+						this->de.w = this->hl.w;
+						this->hl.w = tmpW;
+						break;
+						/* DI */
+					case 6: this->iff1 = this->iff2 = false; break;
+						/* EI */
+					case 7: this->iff1 = this->iff2 = true; this->prev_was_EIDDR = 1; break;
 					}
 					break;
-					/* 0xC0..0xFF */
-				case 0xC0:
+					/* CALL cc,nn */
+				case 4:
+					trueCC = SET_TRUE_CC(rs, opcode);
+					tmpW = Z80_GetWordPC(rs, trueCC);
+					Z80_MEMPTR(tmpW);
+					if (trueCC) {
+						Z80_Push6T(rs, rs.pc);
+						rs.pc = tmpW;
+					}
+					break;
+					/* PUSH rr/special2 */
+				case 5:
+					if (opcode & 0x08) {
+						if (((opcode >> 4) & 0x03) == 0) {
+							/* CALL */
+							tmpW = Z80_GetWordPC(rs, 1);
+							Z80_MEMPTR(tmpW);
+							Z80_Push6T(rs, rs.pc);
+							rs.pc = tmpW;
+						}
+					}
+					else {
+						/* PUSH rr */
+						/*OCR(5)*/
+						Z80_ContentionIRBy1(1);
+						switch ((opcode >> 4) & 0x03) {
+						case 0: tmpW = this->bc.w; break;
+						case 1: tmpW = this->de.w; break;
+						case 2: tmpW = dd.w; break;
+						default: tmpW = rs.af.w; break;
+						}
+						Z80_Push6T(rs, tmpW);
+					}
+					break;
+					/* ALU A,n */
+				case 6:
+					tmpB = Z80_PeekB3TA(rs, rs.pc);
+					INC_PC;
+					Z80_ALU_A(rs, (opcode >> 3) & 0x07, tmpB);
+					break;
+					/* RST nnn */
+				case 7:
+					/*OCR(5)*/
+					Z80_ContentionIRBy1(1);
+					Z80_Push6T(rs, rs.pc);
+					rs.pc = opcode & 0x38;
+					Z80_MEMPTR(rs.pc);
+					break;
+				}
+				break;
+			} /* end switch */
+		}
+
+		/* the ED group, reads its opcode; true when a callback asked Z80_Execute() to return */
+		ZYMOSIS_INLINE bool Z80_ExecuteED(Z80State& rs) {
+			uint8_t opcode, tmpB, tmpC;
+			uint16_t tmpW;
+			bool trueCC;
+			/***/
+			/* read opcode -- OCR(4) */
+			GET_OPCODE_EXT(rs, opcode);
+			switch (opcode) {
+				/* LDI, LDIR, LDD, LDDR */
+			case 0xa0: case 0xb0: case 0xa8: case 0xb8:
+				tmpB = Z80_PeekB3T(rs, this->hl.w);
+				Z80_PokeB3T(this->de.w, tmpB);
+				/*MWR(5)*/
+				Z80_ContentionBy1(this->de.w, 2);
+				DEC_W(this->bc.w);
+				tmpB = (tmpB + rs.af.a) & 0xff;
+				/***/
+				rs.af.f =
+					(tmpB & Z80_FLAG_3) | (rs.af.f & (Z80_FLAG_C | Z80_FLAG_Z | Z80_FLAG_S)) |
+					(this->bc.w != 0 ? Z80_FLAG_PV : 0) |
+					(tmpB & 0x02 ? Z80_FLAG_5 : 0);
+				/***/
+				if (CBX_REPEATED) {
+					if (this->bc.w != 0) {
+						/*IOP(5)*/
+						Z80_ContentionBy1(this->de.w, 5);
+						/* do it again */
+						XSUB_W(rs.pc, 2);
+						Z80_MEMPTR((rs.pc + 1) & 0xffff);
+					}
+				}
+				if (!CBX_BACKWARD) { INC_W(this->hl.w); INC_W(this->de.w); }
+				else { DEC_W(this->hl.w); DEC_W(this->de.w); }
+				/* the iterations that still repeat and start before the event run in bulk, */
+				/* the last one is left to the loop above, it sets the final flags */
+				if (CBX_REPEATED && this->bc.w > 1 && !(P::evenM1 && this->evenM1)) {
+					int32_t n = Z80_BlockWriteLimit(this->de.w, Z80_BlockIterations(rs, this->bc.w - 1), CBX_BACKWARD);
+					/***/
+					if (n > 0) {
+						Z80_SaveState(rs);
+						n = this->blockCopyFn(this->hl.w, this->de.w, n, CBX_BACKWARD);
+					}
+					if (n > 0) {
+						this->block_stats.copies += n;
+						rs.tstates += n * 21;
+						ADD_R(n * 2);
+						XSUB_W(this->bc.w, n);
+						if (!CBX_BACKWARD) { this->hl.w = ZADD_WX(this->hl.w, n); this->de.w = ZADD_WX(this->de.w, n); }
+						else { this->hl.w = ZADD_WX(this->hl.w, -n); this->de.w = ZADD_WX(this->de.w, -n); }
+						tmpB = (Z80_PeekBI(ZADD_WX(this->de.w, (CBX_BACKWARD ? 1 : -1))) + rs.af.a) & 0xff;
+						rs.af.f =
+							(tmpB & Z80_FLAG_3) | (rs.af.f & (Z80_FLAG_C | Z80_FLAG_Z | Z80_FLAG_S)) |
+							Z80_FLAG_PV | (tmpB & 0x02 ? Z80_FLAG_5 : 0);
+					}
+				}
+				break;
+				/* CPI, CPIR, CPD, CPDR */
+			case 0xa1: case 0xb1: case 0xa9: case 0xb9:
+				/* MEMPTR */
+				if (CBX_REPEATED && (!(this->bc.w == 1 || Z80_PeekBI(this->hl.w) == rs.af.a))) {
+					Z80_MEMPTR(ZADD_WX(this->org_pc, 1));
+				}
+				else {
+					Z80_MEMPTR(ZADD_WX(this->memptr.w, (CBX_BACKWARD ? -1 : 1)));
+				}
+				/***/
+				tmpB = Z80_PeekB3T(rs, this->hl.w);
+				/*IOP(5)*/
+				Z80_ContentionBy1(this->hl.w, 5);
+				DEC_W(this->bc.w);
+				/***/
+				rs.af.f =
+					Z80_FLAG_N |
+					(rs.af.f & Z80_FLAG_C) |
+					(this->bc.w != 0 ? Z80_FLAG_PV : 0) |
+					((int32_t)(rs.af.a & 0x0f) - (int32_t)(tmpB & 0x0f) < 0 ? Z80_FLAG_H : 0);
+				/***/
+				tmpB = ((int32_t)rs.af.a - (int32_t)tmpB) & 0xff;
+				/***/
+				rs.af.f |=
+					(tmpB == 0 ? Z80_FLAG_Z : 0) |
+					(tmpB & Z80_FLAG_S);
+				/***/
+				if (rs.af.f & Z80_FLAG_H) tmpB = ((uint16_t)tmpB - 1) & 0xff;
+				rs.af.f |= (tmpB & Z80_FLAG_3) | (tmpB & 0x02 ? Z80_FLAG_5 : 0);
+				/***/
+				if (CBX_REPEATED) {
+					/* repeated */
+					if ((rs.af.f & (Z80_FLAG_Z | Z80_FLAG_PV)) == Z80_FLAG_PV) {
+						/*IOP(5)*/
+						Z80_ContentionBy1(this->hl.w, 5);
+						/* do it again */
+						XSUB_W(rs.pc, 2);
+					}
+				}
+				if (CBX_BACKWARD) DEC_W(this->hl.w); else INC_W(this->hl.w);
+				/* bulk run of the iterations that miss and repeat, as for LDIR */
+				if (CBX_REPEATED && rs.pc == this->org_pc && this->bc.w > 1 && !(P::evenM1 && this->evenM1)) {
+					int32_t n = Z80_BlockIterations(rs, this->bc.w - 1);
+					/***/
+					if (n > 0) {
+						Z80_SaveState(rs);
+						n = this->blockScanFn(this->hl.w, n, CBX_BACKWARD, rs.af.a);
+					}
+					if (n > 0) {
+						this->block_stats.scans += n;
+						rs.tstates += n * 21;
+						ADD_R(n * 2);
+						XSUB_W(this->bc.w, n);
+						this->hl.w = ZADD_WX(this->hl.w, (CBX_BACKWARD ? -n : n));
+						/* MEMPTR is org_pc+1 after every repeating iteration and already is */
+						tmpB = Z80_PeekBI(ZADD_WX(this->hl.w, (CBX_BACKWARD ? 1 : -1)));
+						rs.af.f =
+							Z80_FLAG_N |
+							(rs.af.f & Z80_FLAG_C) |
+							Z80_FLAG_PV |
+							((int32_t)(rs.af.a & 0x0f) - (int32_t)(tmpB & 0x0f) < 0 ? Z80_FLAG_H : 0);
+						tmpB = ((int32_t)rs.af.a - (int32_t)tmpB) & 0xff;
+						rs.af.f |= (tmpB & Z80_FLAG_S);
+						if (rs.af.f & Z80_FLAG_H) tmpB = ((uint16_t)tmpB - 1) & 0xff;
+						rs.af.f |= (tmpB & Z80_FLAG_3) | (tmpB & 0x02 ? Z80_FLAG_5 : 0);
+					}
+				}
+				break;
+				/* OUTI, OTIR, OUTD, OTDR */
+			case 0xa3: case 0xb3: case 0xab: case 0xbb:
+				DEC_B(this->bc.b);
+				/* fallthru */
+			  /* INI, INIR, IND, INDR */
+			case 0xa2: case 0xb2: case 0xaa: case 0xba:
+				Z80_MEMPTR(ZADD_WX(this->bc.w, (CBX_BACKWARD ? -1 : 1)));
+				/*OCR(5)*/
+				Z80_ContentionIRBy1(1);
+				if (opcode & 0x01) {
+					/* OUT* */
+					tmpB = Z80_PeekB3T(rs, this->hl.w);/*MRD(3)*/
+					Z80_PortOut(rs, this->bc.w, tmpB);
+					tmpW = ZADD_WX(this->hl.w, (CBX_BACKWARD ? -1 : 1));
+					tmpC = (tmpB + tmpW) & 0xff;
+				}
+				else {
+					/* IN* */
+					tmpB = Z80_PortIn(rs, this->bc.w);
+					Z80_PokeB3T(this->hl.w, tmpB);/*MWR(3)*/
+					DEC_B(this->bc.b);
+					if (CBX_BACKWARD) tmpC = ((int32_t)tmpB + (int32_t)this->bc.c - 1) & 0xff; else tmpC = (tmpB + this->bc.c + 1) & 0xff;
+				}
+				/***/
+				rs.af.f =
+					(tmpB & 0x80 ? Z80_FLAG_N : 0) |
+					(tmpC < tmpB ? Z80_FLAG_H | Z80_FLAG_C : 0) |
+					(SZ53PTAB((tmpC & 0x07) ^ this->bc.b) & Z80_FLAG_PV) |
+					(SZ53PTAB(this->bc.b) & ~Z80_FLAG_PV);
+				/***/
+				if (CBX_REPEATED) {
+					/* repeating commands */
+					if (this->bc.b != 0) {
+						uint16_t a = (opcode & 0x01 ? this->bc.w : this->hl.w);
+						/***/
+						/*IOP(5)*/
+						Z80_ContentionBy1(a, 5);
+						/* do it again */
+						XSUB_W(rs.pc, 2);
+					}
+				}
+				if (CBX_BACKWARD) DEC_W(this->hl.w); else INC_W(this->hl.w);
+				break;
+				/* not strings, but some good instructions anyway */
+			default:
+				if ((opcode & 0xc0) == 0x40) {
+					/* 0x40...0x7f */
 					switch (opcode & 0x07) {
-						/* RET cc */
+						/* IN r8,(C) */
 					case 0:
-						Z80_ContentionIRBy1(1);
-						trueCC = SET_TRUE_CC(opcode);
-						if (trueCC) this->memptr.w = this->pc = Z80_Pop6T();
+						Z80_MEMPTR(ZADD_WX(this->bc.w, 1));
+						tmpB = Z80_PortIn(rs, this->bc.w);
+						rs.af.f = SZ53PTAB(tmpB) | (rs.af.f & Z80_FLAG_C);
+						switch ((opcode >> 3) & 0x07) {
+						case 0: this->bc.b = tmpB; break;
+						case 1: this->bc.c = tmpB; break;
+						case 2: this->de.d = tmpB; break;
+						case 3: this->de.e = tmpB; break;
+						case 4: this->hl.h = tmpB; break;
+						case 5: this->hl.l = tmpB; break;
+						case 7: rs.af.a = tmpB; break;
+							/* 6 affects only flags */
+						}
 						break;
-						/* POP rr/special0 */
+						/* OUT (C),r8 */
 					case 1:
+						Z80_MEMPTR(ZADD_WX(this->bc.w, 1));
+						switch ((opcode >> 3) & 0x07) {
+						case 0: tmpB = this->bc.b; break;
+						case 1: tmpB = this->bc.c; break;
+						case 2: tmpB = this->de.d; break;
+						case 3: tmpB = this->de.e; break;
+						case 4: tmpB = this->hl.h; break;
+						case 5: tmpB = this->hl.l; break;
+						case 7: tmpB = rs.af.a; break;
+						default: tmpB = 0; break; /*6*/
+						}
+						Z80_PortOut(rs, this->bc.w, tmpB);
+						break;
+						/* SBC HL,rr/ADC HL,rr */
+					case 2:
+						/*IOP(4),IOP(3)*/
+						Z80_ContentionIRBy1(7);
+						switch ((opcode >> 4) & 0x03) {
+						case 0: tmpW = this->bc.w; break;
+						case 1: tmpW = this->de.w; break;
+						case 2: tmpW = this->hl.w; break;
+						default: tmpW = this->sp.w; break;
+						}
+						this->hl.w = (opcode & 0x08 ? Z80_ADC_DD(rs, tmpW, this->hl.w) : Z80_SBC_DD(rs, tmpW, this->hl.w));
+						break;
+						/* LD (nn),rr/LD rr,(nn) */
+					case 3:
+						tmpW = Z80_GetWordPC(rs, 0);
+						Z80_MEMPTR((tmpW + 1) & 0xffff);
 						if (opcode & 0x08) {
-							/* special 0 */
+							/* LD rr,(nn) */
 							switch ((opcode >> 4) & 0x03) {
-								/* RET */
-							case 0: this->memptr.w = this->pc = Z80_Pop6T(); break;
-								/* EXX */
-							case 1: Z80_EXX(); break;
-								/* JP (HL) */
-							case 2: this->pc = this->dd->w; break;
-								/* LD SP,HL */
-							case 3:
-								/*OCR(6)*/
-								Z80_ContentionIRBy1(2);
-								this->sp.w = this->dd->w;
-								break;
+							case 0: this->bc.w = Z80_PeekW6T(rs, tmpW); break;
+							case 1: this->de.w = Z80_PeekW6T(rs, tmpW); break;
+							case 2: this->hl.w = Z80_PeekW6T(rs, tmpW); break;
+							case 3: this->sp.w = Z80_PeekW6T(rs, tmpW); break;
 							}
 						}
 						else {
-							/* POP rr */
-							tmpW = Z80_Pop6T();
+							/* LD (nn),rr */
 							switch ((opcode >> 4) & 0x03) {
-							case 0: this->bc.w = tmpW; break;
-							case 1: this->de.w = tmpW; break;
-							case 2: this->dd->w = tmpW; break;
-							case 3: this->af.w = tmpW; break;
+							case 0: Z80_PokeW6T(rs, tmpW, this->bc.w); break;
+							case 1: Z80_PokeW6T(rs, tmpW, this->de.w); break;
+							case 2: Z80_PokeW6T(rs, tmpW, this->hl.w); break;
+							case 3: Z80_PokeW6T(rs, tmpW, this->sp.w); break;
 							}
 						}
 						break;
-						/* JP cc,nn */
-					case 2:
-						trueCC = SET_TRUE_CC(opcode);
-						this->memptr.w = Z80_GetWordPC(0);
-						if (trueCC) this->pc = this->memptr.w;
-						break;
-						/* special1/special3 */
-					case 3:
-						switch ((opcode >> 3) & 0x07) {
-							/* JP nn */
-						case 0: this->memptr.w = this->pc = Z80_GetWordPC(0); break;
-							/* OUT (n),A */
-						case 2:
-							tmpW = Z80_PeekB3TA(this->pc);
-							INC_PC;
-							this->memptr.l = (tmpW + 1) & 0xff;
-							this->memptr.h = this->af.a;
-							tmpW |= (((uint16_t)(this->af.a)) << 8);
-							Z80_PortOut(tmpW, this->af.a);
-							break;
-							/* IN A,(n) */
-						case 3:
-							tmpW = (((uint16_t)(this->af.a)) << 8) | Z80_PeekB3TA(this->pc);
-							INC_PC;
-							this->memptr.w = (tmpW + 1) & 0xffff;
-							this->af.a = Z80_PortIn(tmpW);
-							break;
-							/* EX (SP),HL */
-						case 4:
-							/*SRL(3),SRH(4)*/
-							tmpW = Z80_PeekW6T(this->sp.w);
-							Z80_ContentionBy1((this->sp.w + 1) & 0xffff, 1);
-							/*SWL(3),SWH(5)*/
-							Z80_PokeW6TInv(this->sp.w, this->dd->w);
-							Z80_ContentionBy1(this->sp.w, 2);
-							this->memptr.w = this->dd->w = tmpW;
-							break;
-							/* EX DE,HL */
-						case 5:
-							tmpW = this->de.w;
-							this->de.w = this->hl.w;
-							this->hl.w = tmpW;
-							break;
-							/* DI */
-						case 6: this->iff1 = this->iff2 = false; break;
-							/* EI */
-						case 7: this->iff1 = this->iff2 = true; this->prev_was_EIDDR = 1; break;
-						}
-						break;
-						/* CALL cc,nn */
+						/* NEG */
 					case 4:
-						trueCC = SET_TRUE_CC(opcode);
-						this->memptr.w = Z80_GetWordPC(trueCC);
-						if (trueCC) {
-							Z80_Push6T(this->pc);
-							this->pc = this->memptr.w;
-						}
+						tmpB = rs.af.a;
+						rs.af.a = 0;
+						Z80_SUB_A(rs, tmpB);
 						break;
-						/* PUSH rr/special2 */
+						/* RETI/RETN */
 					case 5:
+						/*RETI: 0x4d, 0x5d, 0x6d, 0x7d*/
+						/*RETN: 0x45, 0x55, 0x65, 0x75*/
+						this->iff1 = this->iff2;
+						rs.pc = Z80_Pop6T(rs);
+						Z80_MEMPTR(rs.pc);
 						if (opcode & 0x08) {
-							if (((opcode >> 4) & 0x03) == 0) {
-								/* CALL */
-								this->memptr.w = tmpW = Z80_GetWordPC(1);
-								Z80_Push6T(this->pc);
-								this->pc = tmpW;
-							}
+							/* RETI */
+							Z80_SaveState(rs);
+							if (this->retiFn(opcode)) return true;
 						}
 						else {
-							/* PUSH rr */
-							/*OCR(5)*/
-							Z80_ContentionIRBy1(1);
-							switch ((opcode >> 4) & 0x03) {
-							case 0: tmpW = this->bc.w; break;
-							case 1: tmpW = this->de.w; break;
-							case 2: tmpW = this->dd->w; break;
-							default: tmpW = this->af.w; break;
-							}
-							Z80_Push6T(tmpW);
+							/* RETN */
+							Z80_SaveState(rs);
+							if (this->retnFn(opcode)) return true;
 						}
 						break;
-						/* ALU A,n */
+						/* IM n */
 					case 6:
-						tmpB = Z80_PeekB3TA(this->pc);
-						INC_PC;
-						switch ((opcode >> 3) & 0x07) {
-						case 0: Z80_ADD_A(tmpB); break;
-						case 1: Z80_ADC_A(tmpB); break;
-						case 2: Z80_SUB_A(tmpB); break;
-						case 3: Z80_SBC_A(tmpB); break;
-						case 4: Z80_AND_A(tmpB); break;
-						case 5: Z80_XOR_A(tmpB); break;
-						case 6: Z80_OR_A(tmpB); break;
-						case 7: Z80_CP_A(tmpB); break;
+						switch (opcode) {
+						case 0x56: case 0x76: this->im = 1; break;
+						case 0x5e: case 0x7e: this->im = 2; break;
+						default: this->im = 0; break;
 						}
 						break;
-						/* RST nnn */
+						/* specials */
 					case 7:
-						/*OCR(5)*/
-						Z80_ContentionIRBy1(1);
-						Z80_Push6T(this->pc);
-						this->memptr.w = this->pc = opcode & 0x38;
-						break;
+						switch (opcode) {
+							/* LD I,A */
+						case 0x47:
+							/*OCR(5)*/
+							Z80_ContentionIRBy1(1);
+							this->regI = rs.af.a;
+							break;
+							/* LD R,A */
+						case 0x4f:
+							/*OCR(5)*/
+							Z80_ContentionIRBy1(1);
+							this->regR = rs.af.a;
+							break;
+							/* LD A,I */
+						case 0x57: Z80_LD_A_IR(rs, this->regI); break;
+							/* LD A,R */
+						case 0x5f: Z80_LD_A_IR(rs, this->regR); break;
+							/* RRD */
+						case 0x67: Z80_RRD_A(rs); break;
+							/* RLD */
+						case 0x6F: Z80_RLD_A(rs); break;
+						}
 					}
-					break;
-				} /* end switch */
+				}
+				else {
+					/* slt and other traps */
+					Z80_SaveState(rs);
+					trueCC = this->trapEDFn(opcode) != 0;
+					Z80_LoadState(rs);
+					if (trueCC) return true;
+				}
+				break;
+			}
+			return false;
+		}
+
+#if defined(ZYMOSIS_COLD)
+		/* ED and IX/IY instructions out of Z80_Execute(), on the Z80Info copies of pc, tstates */
+		/* and af, with F worked out before and after */
+		ZYMOSIS_COLD bool Z80_ExecuteCold(uint8_t opcode, uint8_t idx, int disp) {
+			Z80LazyFlags lazy;
+			Z80State rs = Z80_MemberState(lazy);
+			/***/
+			if (opcode == 0xed) return Z80_ExecuteED(rs);
+			if (idx == 1) Z80_ExecuteOp<1>(rs, opcode, disp); else Z80_ExecuteOp<2>(rs, opcode, disp);
+			Z80_Flags(rs);
+			return false;
+		}
+#endif
+
+	public:
+		Z80Cpu()
+		{
+#if defined(ZYMOSIS_FLAGS_IN_ARRAY)
+			Z80_InitTables();
+#endif
+#if defined(ZYMOSIS_BLOCK_CACHE)
+			Z80_CacheReset();
+#endif
+			this->fusion_stats = Z80FusionStats();
+			this->block_stats = Z80BlockStats();
+		}
+
+		/* what the fusion policy ran, counted since construction */
+		struct Z80FusionStats {
+			uint32_t ldInc; /* LD A,(HL) with its INC HL */
+			uint32_t stInc; /* LD (DE),A with its INC DE */
+			uint32_t decJr; /* DEC BC, LD A,B, OR C and JR NZ together */
+			uint32_t djnz; /* DJNZ $ passes run at once */
+		};
+
+		Z80FusionStats fusion_stats;
+
+		/* iterations of the block repeats run in bulk by the callbacks, counted since construction */
+		struct Z80BlockStats {
+			uint32_t copies; /* LDIR and LDDR through blockCopyFn() */
+			uint32_t scans; /* CPIR and CPDR through blockScanFn() */
+		};
+
+		Z80BlockStats block_stats;
+
+		/* compares the flag table and condition code variants compiled in against the plain */
+		/* definitions, lazy flags against the ALU helpers for every operand and carry and */
+		/* with ZYMOSIS_FLAGS_IN_TABLES the DAA table against Z80_DAAByOps(), */
+		/* returns false when a speed experiment broke them; registers are kept */
+		bool Z80_SelfCheck()
+		{
+			uint8_t x, n, p, ref, c, op, res;
+			uint16_t af;
+			bool ok = true;
+			Z80LazyFlags lazy, lz;
+			Z80State rs = Z80_MemberState(lazy);
+
+			af = this->af.w;
+
+			x = 0;
+			do {
+				for (n = x, p = 0; n != 0; n >>= 1) p ^= n & 0x01;
+				ref = (x & Z80_FLAG_S35) | (p ? 0 : Z80_FLAG_PV) | (x ? 0 : Z80_FLAG_Z);
+				if (SZ53PTAB(x) != ref) ok = false;
+
+				/* cc is NZ Z NC C PO PE P M, each pair tests one flag */
+				this->af.f = x;
+				for (n = 0; n < 8; ++n) {
+					static const uint8_t ccflag[4] = { Z80_FLAG_Z, Z80_FLAG_C, Z80_FLAG_PV, Z80_FLAG_S };
+					if (SET_TRUE_CC(rs, n << 3) != (((x & ccflag[n >> 1]) != 0) == (n & 1))) ok = false;
+				}
+			} while (++x);
+
+			x = 0;
+			do {
+				n = 0;
+				do {
+					for (c = 0; c < 2; ++c) {
+						for (op = 0; op < 8; ++op) {
+							if (op >= 4 && op < 7) continue; /* AND, XOR and OR are never lazy */
+							rs.af.a = x;
+							rs.af.f = c;
+							switch (op) {
+							case 0: Z80_ADD_A(rs, n); break;
+							case 1: Z80_ADC_A(rs, n); break;
+							case 2: Z80_SUB_A(rs, n); break;
+							case 3: Z80_SBC_A(rs, n); break;
+							case 7: Z80_CP_A(rs, n); break;
+							}
+							res = Z80_LazyALU(lz, op, x, n, (op == 1 || op == 3) ? c : 0);
+							if (res != rs.af.a || Z80_LazyF(lz) != rs.af.f) ok = false;
+						}
+						if (n < 2) {
+							/* INC and DEC are ADD and SUB of 1 that keep the carry */
+							rs.af.a = x;
+							rs.af.f = 0;
+							if (n) Z80_SUB_A(rs, 1); else Z80_ADD_A(rs, 1);
+							res = Z80_LazyIncDec(lz, n != 0, x, c);
+							if (res != rs.af.a || Z80_LazyF(lz) != ((rs.af.f & ~Z80_FLAG_C) | c)) ok = false;
+						}
+					}
+				} while (++n);
+			} while (++x);
+
+#if defined(ZYMOSIS_FLAGS_IN_TABLES)
+			for (c = 0; c < 8; ++c) {
+				x = 0;
+				do {
+					/* c is C, H and N, the other flags do not change DAA */
+					rs.af.a = x;
+					rs.af.f = (c & 1 ? Z80_FLAG_C : 0) | (c & 2 ? Z80_FLAG_H : 0) | (c & 4 ? Z80_FLAG_N : 0);
+					Z80_DAAByOps(rs);
+					if (pgm_read_word(&daaTable[x | c << 8]) != rs.af.w) ok = false;
+				} while (++x);
 			}
+#endif
+
+			this->af.w = af;
+			return ok;
+		}
+
+		void Z80_Reset()
+		{
+			this->reset();
+
+			this->bc.w = this->de.w = this->hl.w = this->af.w = this->sp.w = this->ix.w = this->iy.w = 0;
+			this->bcx.w = this->dex.w = this->hlx.w = this->afx.w = 0;
+			this->pc = /* this->prev_pc =*/ this->org_pc = 0;
+			this->memptr.w = 0;
+			this->regI = this->regR = 0;
+			this->iff1 = this->iff2 = false;
+			this->im = 0;
+			this->halted = false;
+			this->prev_was_EIDDR = 0;
+			this->tstates = 0;
+
+			this->evenM1 = false;
+#if defined(ZYMOSIS_BLOCK_CACHE)
+			Z80_CacheFlush();
+#endif
+		}
+		ZYMOSIS_HOT void Z80_Execute()
+		{
+			uint8_t opcode, idx;
+#if defined(ZYMOSIS_COLD)
+			bool stop;
+#endif
+			int disp;
+			uint16_t res_pc = this->pc;
+			int32_t res_tstates = this->tstates;
+			Z80WordReg res_af = this->af;
+			Z80LazyFlags lazy = { Z80_LAZY_NONE, 0, 0, 0 };
+			Z80State rs = P::resident ? Z80State{ res_pc, res_tstates, res_af, lazy } : Z80_MemberState(lazy);
+			/***/
+			while (rs.tstates < this->next_event_tstate) {
+				Z80_SaveState(rs, false);
+				if (P::pager) this->pagerFn();
+				if (P::breakpoints && this->checkBPFn()) { Z80_SaveState(rs); return; }
+				//this->prev_pc = this->org_pc; 
+				this->org_pc = rs.pc;
+				this->profileFn(this->org_pc);
+				/* read opcode -- OCR(4) */
+#if defined(ZYMOSIS_BLOCK_CACHE)
+				if ((this->cache_op = Z80_CacheFetch(rs))) {
+					Z80_Contention(rs.pc, 4, Z80_MREQ_READ | Z80_MEMIO_OPCODE);
+					if (P::evenM1 && this->evenM1 && (rs.tstates & 0x01))++rs.tstates;
+					opcode = this->cache_op->opcode;
+					rs.pc = (rs.pc + 1) & 0xffff;
+					INC_R;
+				}
+				else
+#endif
+				GET_OPCODE(rs, opcode);
+				this->prev_was_EIDDR = 0;
+				disp = idx = 0;
+				if (this->halted) { DEC_W(rs.pc); continue; }
+				if (P::lazyFlags && rs.lazy.kind != Z80_LAZY_NONE) {
+					/* instructions that neither read F nor write it other than through Z80_ALU_A, INC and DEC */
+					static const uint32_t lazyFreeBmp[8] PROGMEM = { 0x7d7f7c7f,0x7c7e7c7e,0xffffffff,0xffffffff,0xffffffff,0xffffffff,0xcaeae2ea,0xcac8caea };
+					if (!(pgm_read_dword(&lazyFreeBmp[opcode >> 5]) & (1 << (opcode & 0x1f)))) Z80_Flags(rs);
+				}
+				if (P::fusion && Z80_Fused(rs, opcode)) continue;
+				/***/
+				if (opcode == 0xdd || opcode == 0xfd) {
+					static const uint32_t withIndexBmp[8] PROGMEM = { 0x00,0x700000,0x40404040,0x40bf4040,0x40404040,0x40404040,0x0800,0x00 };
+					/* IX/IY prefix */
+					idx = (opcode == 0xdd ? 1 : 2);
+					/* read opcode -- OCR(4) */
+					GET_OPCODE_EXT(rs, opcode);
+					/* test if this instruction have (HL) */
+					if (pgm_read_dword(&withIndexBmp[opcode >> 5]) & (1 << (opcode & 0x1f))) {
+						/* 3rd byte is always DISP here */
+						disp = Z80_PeekB3TA(rs, rs.pc); if (disp > 127) disp -= 256;
+						INC_PC;
+						Z80_MEMPTR(ZADD_WX((idx == 1 ? this->ix.w : this->iy.w), disp));
+					}
+					else if (opcode == 0xdd || opcode == 0xfd) {
+						/* double prefix; restart main loop */
+						this->prev_was_EIDDR = 1;
+						continue;
+					}
+				}
+				/* instructions */
+#if defined(ZYMOSIS_COLD)
+				if (opcode == 0xed || idx != 0) {
+					Z80_SaveState(rs);
+					stop = Z80_ExecuteCold(opcode, idx, disp);
+					Z80_LoadState(rs);
+					if (stop) return;
+					continue;
+				}
+#else
+				if (opcode == 0xed) {
+					if (Z80_ExecuteED(rs)) return;
+					continue;
+				}
+				if (idx == 1) { Z80_ExecuteOp<1>(rs, opcode, disp); continue; }
+				if (idx == 2) { Z80_ExecuteOp<2>(rs, opcode, disp); continue; }
+#endif
+				/***/
+				Z80_ExecuteOp<0>(rs, opcode, 0);
+			}
+			Z80_SaveState(rs);
 		}
 		int32_t Z80_ExecuteStep() /* returns number of executed ticks */
 		{
@@ -1591,9 +2404,11 @@ namespace zymosis {
 		int Z80_Interrupt() /* !0: interrupt was accepted (returns # of t-states eaten); changes tstates if interrupt occurs */
 		{
 			uint16_t a;
-			int ots = this->tstates;
+			Z80LazyFlags lazy;
+			Z80State rs = Z80_MemberState(lazy);
+			int ots = rs.tstates;
 			/***/
-			if (this->prev_was_EIDDR < 0) { this->prev_was_EIDDR = 0; this->af.f &= ~Z80_FLAG_PV; } /* Z80 bug */
+			if (this->prev_was_EIDDR < 0) { this->prev_was_EIDDR = 0; rs.af.f &= ~Z80_FLAG_PV; } /* Z80 bug */
 			if (this->prev_was_EIDDR || !this->iff1) return 0; /* not accepted */
 			if (this->halted) { this->halted = false; INC_PC; }
 			this->iff1 = this->iff2 = false; /* disable interrupts */
@@ -1607,46 +2422,51 @@ namespace zymosis {
 			  /* M3 cycle: 3 T to read high byte of 'nnnn' and decrement SP */
 			  /* M4 cycle: 3 T to write high byte of PC to the stack and decrement SP */
 			  /* M5 cycle: 3 T to write low byte of PC and jump to 'nnnn' */
-				this->tstates += 6;
+				rs.tstates += 6;
 			case 1: /* just do RST #38 */
 				INC_R;
-				this->tstates += 7; /* M1 cycle: 7 T to acknowledge interrupt and decrement SP */
+				rs.tstates += 7; /* M1 cycle: 7 T to acknowledge interrupt and decrement SP */
 				/* M2 cycle: 3 T states write high byte of PC to the stack and decrement SP */
 				/* M3 cycle: 3 T states write the low byte of PC and jump to #0038 */
-				Z80_Push6T(this->pc);
-				this->memptr.w = this->pc = 0x38;
+				Z80_Push6T(rs, rs.pc);
+				rs.pc = 0x38;
+				Z80_MEMPTR(rs.pc);
 				break;
 			case 2:
 				INC_R;
-				this->tstates += 7; /* M1 cycle: 7 T to acknowledge interrupt and decrement SP */
+				rs.tstates += 7; /* M1 cycle: 7 T to acknowledge interrupt and decrement SP */
 				/* M2 cycle: 3 T states write high byte of PC to the stack and decrement SP */
 				/* M3 cycle: 3 T states write the low byte of PC */
-				Z80_Push6T(this->pc);
+				Z80_Push6T(rs, rs.pc);
 				/* M4 cycle: 3 T to read high byte from the interrupt vector */
 				/* M5 cycle: 3 T to read low byte from bus and jump to interrupt routine */
 				a = (((uint16_t)this->regI) << 8) | 0xff;
-				this->memptr.w = this->pc = Z80_PeekW6T(a);
+				rs.pc = Z80_PeekW6T(rs, a);
+				Z80_MEMPTR(rs.pc);
 				break;
 			}
-			return this->tstates - ots; /* accepted */
+			return rs.tstates - ots; /* accepted */
 		}
 		int Z80_NMI() /* !0: interrupt was accepted (returns # of t-states eaten); changes tstates if interrupt occurs */
 		{
-			int ots = this->tstates;
+			Z80LazyFlags lazy;
+			Z80State rs = Z80_MemberState(lazy);
+			int ots = rs.tstates;
 			/***/
 			/* emulate Z80 bug with interrupted LD A,I/R */
-			/*if (this->prev_was_EIDDR < 0) { this->prev_was_EIDDR = 0; this->af.f &= ~Z80_FLAG_PV; }*/
+			/*if (this->prev_was_EIDDR < 0) { this->prev_was_EIDDR = 0; rs.af.f &= ~Z80_FLAG_PV; }*/
 			/*if (this->prev_was_EIDDR) return 0;*/
 			this->prev_was_EIDDR = 0; /* don't care */
 			if (this->halted) { this->halted = false; INC_PC; }
 			INC_R;
 			this->iff1 = true; /* IFF2 is not changed */
-			this->tstates += 5; /* M1 cycle: 5 T states to do an opcode read and decrement SP */
+			rs.tstates += 5; /* M1 cycle: 5 T states to do an opcode read and decrement SP */
 			/* M2 cycle: 3 T states write high byte of PC to the stack and decrement SP */
 			/* M3 cycle: 3 T states write the low byte of PC and jump to #0066 */
-			Z80_Push6T(this->pc);
-			this->memptr.w = this->pc = 0x66;
-			return this->tstates - ots;
+			Z80_Push6T(rs, rs.pc);
+			rs.pc = 0x66;
+			Z80_MEMPTR(rs.pc);
+			return rs.tstates - ots;
 		}
 
 		/* without contention, using Z80_MEMIO_OTHER */
@@ -1683,11 +2503,11 @@ namespace zymosis {
 	};
 
 #if defined(ZYMOSIS_FLAGS_IN_ARRAY)
-	template <class T>
-	bool Z80Cpu<T>::tablesInitialized = false;
+	template <class T, class P>
+	bool Z80Cpu<T, P>::tablesInitialized = false;
 
-	template <class T>
-	uint8_t Z80Cpu<T>::sz53pTable[256]; /* bits 3, 5 and 7 of result, Z and P flags */
+	template <class T, class P>
+	uint8_t Z80Cpu<T, P>::sz53pTable[256]; /* bits 3, 5 and 7 of result, Z and P flags */
 #endif
 
 }; // zymosis namespace